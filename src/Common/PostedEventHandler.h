@@ -0,0 +1,55 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TROJITA_POSTEDEVENTHANDLER_H
+#define TROJITA_POSTEDEVENTHANDLER_H
+
+#include <functional>
+#include <QObject>
+
+namespace Common
+{
+
+/** @short Run a handler in the thread of this object each time it gets scheduled
+
+This is a lightweight way of waking up a worker thread, or of getting back to the thread which owns some other object,
+without the need for a signal and a queued connection for each of them. Multiple calls to schedule() which happen before
+the event loop gets to them lead to multiple invocations of the handler, so the callers typically remember whether they
+have scheduled something already.
+*/
+class PostedEventHandler : public QObject
+{
+public:
+    explicit PostedEventHandler(const std::function<void()> &handler);
+
+    /** @short Make sure that the handler gets called from the event loop of this object's thread */
+    void schedule();
+
+protected:
+    virtual void customEvent(QEvent *event);
+
+private:
+    std::function<void()> m_handler;
+};
+
+}
+
+#endif // TROJITA_POSTEDEVENTHANDLER_H
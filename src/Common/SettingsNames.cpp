@@ -83,6 +83,7 @@ const QString SettingsNames::cacheOfflineNone = QStringLiteral("memory");
 const QString SettingsNames::cacheOfflineXDays = QStringLiteral("days");
 const QString SettingsNames::cacheOfflineAll = QStringLiteral("all");
 const QString SettingsNames::cacheOfflineNumberDaysKey = QStringLiteral("offline.cache.numDays");
+const QString SettingsNames::cacheOfflinePartBudgetKey = QStringLiteral("offline.cache.partsBudgetMiB");
 const QString SettingsNames::watchedFoldersKey = QStringLiteral("watchFolders");
 const QString SettingsNames::watchOnlyInbox = QStringLiteral("INBOX");
 const QString SettingsNames::watchSubscribed = QStringLiteral("subscribed");
@@ -115,6 +116,8 @@ const QString SettingsNames::addressbookPlugin = QStringLiteral("plugin/addressb
 const QString SettingsNames::passwordPlugin = QStringLiteral("plugin/password");
 const QString SettingsNames::spellcheckerPlugin = QStringLiteral("plugin/spellchecker");
 const QString SettingsNames::imapIdleRenewal = QStringLiteral("imapIdleRenewal");
+const QString SettingsNames::imapUnloadIdleMailboxesAfter = QStringLiteral("imap.memory.unloadIdleMailboxesAfter");
+const QString SettingsNames::imapResidentMessagesLimit = QStringLiteral("imap.memory.residentMessagesLimit");
 const QString SettingsNames::autoMarkReadEnabled = QStringLiteral("autoMarkRead/enabled");
 const QString SettingsNames::autoMarkReadSeconds = QStringLiteral("autoMarkRead/seconds");
 const QString SettingsNames::interopRevealVersions = QStringLiteral("interoperability/revealVersions");
@@ -41,7 +41,8 @@ struct SettingsNames {
            imapAccountIcon, imapArchiveFolderName, imapDefaultArchiveFolderName;
     static const QString composerSaveToImapKey, composerImapSentKey, smtpUseBurlKey;
     static const QString cacheMetadataKey, cacheMetadataMemory,
-           cacheOfflineKey, cacheOfflineNone, cacheOfflineXDays, cacheOfflineAll, cacheOfflineNumberDaysKey;
+           cacheOfflineKey, cacheOfflineNone, cacheOfflineXDays, cacheOfflineAll, cacheOfflineNumberDaysKey,
+           cacheOfflinePartBudgetKey;
     static const QString watchedFoldersKey, watchOnlyInbox, watchSubscribed, watchAll;
     static const QString xtConnectCacheDirectory, xtSyncMailboxList, xtDbHost, xtDbPort,
            xtDbDbName, xtDbUser;
@@ -58,6 +59,7 @@ struct SettingsNames {
     static const QString knownEmailsKey;
     static const QString addressbookPlugin, passwordPlugin, spellcheckerPlugin;
     static const QString imapIdleRenewal;
+    static const QString imapUnloadIdleMailboxesAfter, imapResidentMessagesLimit;
     static const QString autoMarkReadEnabled, autoMarkReadSeconds;
     static const QString interopRevealVersions;
     static const QString completeMessageWidgetGeometry;
@@ -0,0 +1,197 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <new>
+#include <QtGlobal>
+#include "SlabAllocator.h"
+
+namespace {
+
+/** @short Size of one slab, including its header */
+const std::size_t SlabSize = 64 * 1024;
+
+/** @short Alignment which is good enough for any object */
+const std::size_t ChunkAlignment = 16;
+
+std::size_t alignUp(const std::size_t size)
+{
+    return (size + ChunkAlignment - 1) & ~(ChunkAlignment - 1);
+}
+
+}
+
+namespace Common
+{
+
+/** @short A chunk which is not in use is a member of its slab's free list */
+struct SlabAllocator::FreeChunk
+{
+    FreeChunk *next;
+};
+
+/** @short Header of a slab, its chunks follow right after it */
+struct SlabAllocator::Slab
+{
+    Slab *prev;
+    Slab *next;
+    /** @short Chunks which were used once and released again */
+    FreeChunk *freeList;
+    /** @short Number of chunks which are in use */
+    int used;
+    /** @short Number of chunks which have been handed out at least once; the rest of them has never been touched */
+    int touched;
+
+    char *chunks()
+    {
+        return reinterpret_cast<char *>(this) + alignUp(sizeof(Slab));
+    }
+};
+
+SlabAllocator::SlabAllocator(const std::size_t chunkSize)
+    : m_chunkSize(chunkSize)
+    , m_stride(alignUp(qMax(chunkSize, sizeof(FreeChunk))))
+    , m_chunksPerSlab(static_cast<int>((SlabSize - alignUp(sizeof(Slab))) / m_stride))
+    , m_available(0)
+{
+    Q_ASSERT(m_chunksPerSlab > 1);
+}
+
+SlabAllocator::~SlabAllocator()
+{
+    // All objects should be gone by now
+    Q_FOREACH(Slab *slab, m_slabs) {
+        ::operator delete(slab);
+    }
+}
+
+int SlabAllocator::slabCount() const
+{
+    return m_slabs.size();
+}
+
+int SlabAllocator::chunksPerSlab() const
+{
+    return m_chunksPerSlab;
+}
+
+void *SlabAllocator::allocate(const std::size_t size)
+{
+    if (size != m_chunkSize)
+        return ::operator new(size);
+
+    Slab *slab = m_available ? m_available : createSlab();
+    void *ptr;
+    if (slab->freeList) {
+        ptr = slab->freeList;
+        slab->freeList = slab->freeList->next;
+    } else {
+        Q_ASSERT(slab->touched < m_chunksPerSlab);
+        ptr = slab->chunks() + slab->touched * m_stride;
+        ++slab->touched;
+    }
+    ++slab->used;
+    if (slab->used == m_chunksPerSlab)
+        unlinkAvailable(slab);
+    return ptr;
+}
+
+void SlabAllocator::deallocate(void *ptr, const std::size_t size)
+{
+    if (!ptr)
+        return;
+    if (size != m_chunkSize) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    Slab *slab = slabOf(ptr);
+    Q_ASSERT(slab);
+    if (slab->used == m_chunksPerSlab)
+        linkAvailable(slab);
+    FreeChunk *chunk = static_cast<FreeChunk *>(ptr);
+    chunk->next = slab->freeList;
+    slab->freeList = chunk;
+    --slab->used;
+
+    // Keep the last slab around so that a single item which keeps getting created and destroyed does not hit the heap
+    if (!slab->used && m_slabs.size() > 1)
+        releaseSlab(slab);
+}
+
+SlabAllocator::Slab *SlabAllocator::createSlab()
+{
+    Slab *slab = static_cast<Slab *>(::operator new(SlabSize));
+    slab->prev = 0;
+    slab->next = 0;
+    slab->freeList = 0;
+    slab->used = 0;
+    slab->touched = 0;
+    m_slabs.insert(std::upper_bound(m_slabs.begin(), m_slabs.end(), slab), slab);
+    linkAvailable(slab);
+    return slab;
+}
+
+void SlabAllocator::releaseSlab(Slab *slab)
+{
+    unlinkAvailable(slab);
+    m_slabs.erase(std::lower_bound(m_slabs.begin(), m_slabs.end(), slab));
+    ::operator delete(slab);
+}
+
+/** @short Find the slab which contains the chunk at @arg ptr */
+SlabAllocator::Slab *SlabAllocator::slabOf(void *ptr) const
+{
+    Slab *candidate = static_cast<Slab *>(ptr);
+    auto it = std::upper_bound(m_slabs.constBegin(), m_slabs.constEnd(), candidate);
+    if (it == m_slabs.constBegin())
+        return 0;
+    --it;
+    if (static_cast<char *>(ptr) >= reinterpret_cast<char *>(*it) + SlabSize)
+        return 0;
+    return *it;
+}
+
+/** @short Put the @arg slab to the list of slabs which can serve allocations */
+void SlabAllocator::linkAvailable(Slab *slab)
+{
+    Q_ASSERT(!slab->prev && !slab->next && m_available != slab);
+    slab->next = m_available;
+    if (m_available)
+        m_available->prev = slab;
+    m_available = slab;
+}
+
+/** @short Remove the @arg slab from the list of slabs which can serve allocations */
+void SlabAllocator::unlinkAvailable(Slab *slab)
+{
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else if (m_available == slab)
+        m_available = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+    slab->prev = 0;
+    slab->next = 0;
+}
+
+}
@@ -0,0 +1,82 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TROJITA_SLABALLOCATOR_H
+#define TROJITA_SLABALLOCATOR_H
+
+#include <cstddef>
+#include <QVector>
+
+namespace Common
+{
+
+/** @short Allocator which hands out memory chunks of a fixed size carved out of big slabs
+
+The items of the mailbox tree are allocated in huge numbers -- a big mailbox has hundreds of thousands of messages, and each
+of them used to be a separate trip to the general-purpose heap with its own bookkeeping overhead. This allocator serves them
+from big blocks of memory ("slabs") instead, so that the items which are created together live next to each other. A slab
+is given back as soon as all of its chunks have been released, which means that tearing down a big mailbox returns the
+memory in bulk.
+
+Requests for any other size than the one this allocator has been set up for, e.g. from a derived class, are passed to the
+global operator new. The allocator is not thread-safe.
+*/
+class SlabAllocator
+{
+public:
+    explicit SlabAllocator(const std::size_t chunkSize);
+    ~SlabAllocator();
+
+    void *allocate(const std::size_t size);
+    void deallocate(void *ptr, const std::size_t size);
+
+    /** @short Number of slabs which are currently allocated */
+    int slabCount() const;
+    /** @short Number of chunks which fit into a single slab */
+    int chunksPerSlab() const;
+
+private:
+    struct FreeChunk;
+    struct Slab;
+
+    Slab *createSlab();
+    void releaseSlab(Slab *slab);
+    Slab *slabOf(void *ptr) const;
+    void linkAvailable(Slab *slab);
+    void unlinkAvailable(Slab *slab);
+
+    /** @short Size of the objects which are served by this allocator */
+    std::size_t m_chunkSize;
+    /** @short Distance between two consecutive chunks, i.e. the chunk size rounded up for proper alignment */
+    std::size_t m_stride;
+    int m_chunksPerSlab;
+    /** @short All slabs, sorted by their address */
+    QVector<Slab *> m_slabs;
+    /** @short Linked list of slabs which have at least one free chunk */
+    Slab *m_available;
+
+    SlabAllocator(const SlabAllocator &); // don't implement
+    SlabAllocator &operator=(const SlabAllocator &); // don't implement
+};
+
+}
+
+#endif // TROJITA_SLABALLOCATOR_H
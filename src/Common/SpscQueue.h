@@ -0,0 +1,105 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TROJITA_SPSCQUEUE_H
+#define TROJITA_SPSCQUEUE_H
+
+#include <atomic>
+#include <QtGlobal>
+
+namespace Common
+{
+
+/** @short Unbounded lock-free queue for passing items from one thread to another
+
+Exactly one thread may call push() and exactly one (other) thread may call pop() and isEmpty(). Under these rules, no
+locking is needed at all -- the producer only ever touches the last node of the internal linked list and the consumer
+only the first one, and the handover happens through an atomic pointer.
+
+The queue does not wake up its consumer; the caller is responsible for scheduling it somehow.
+*/
+template<typename T>
+class SpscQueue
+{
+public:
+    SpscQueue(): m_back(new Node()), m_front(m_back)
+    {
+    }
+
+    ~SpscQueue()
+    {
+        while (m_front) {
+            Node *next = m_front->next.load(std::memory_order_relaxed);
+            delete m_front;
+            m_front = next;
+        }
+    }
+
+    /** @short Append an item to the end of the queue; producer only */
+    void push(const T &item)
+    {
+        Node *node = new Node(item);
+        m_back->next.store(node, std::memory_order_release);
+        m_back = node;
+    }
+
+    /** @short Remove the oldest item from the queue and store it into @arg item; consumer only
+
+    Returns false if the queue was empty, in which case the @arg item is left untouched.
+    */
+    bool pop(T &item)
+    {
+        Node *next = m_front->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+        item = next->value;
+        // The node becomes the new sentinel, so make sure that it doesn't keep the item alive any longer
+        next->value = T();
+        delete m_front;
+        m_front = next;
+        return true;
+    }
+
+    /** @short Check whether there's anything to pop(); consumer only */
+    bool isEmpty() const
+    {
+        return !m_front->next.load(std::memory_order_acquire);
+    }
+
+private:
+    Q_DISABLE_COPY(SpscQueue)
+
+    struct Node {
+        Node(): next(nullptr) {}
+        explicit Node(const T &value): value(value), next(nullptr) {}
+        T value;
+        std::atomic<Node *> next;
+    };
+
+    /** @short The most recently pushed node, owned by the producer */
+    Node *m_back;
+    /** @short The sentinel whose successor is the oldest item, owned by the consumer */
+    Node *m_front;
+};
+
+}
+
+#endif // TROJITA_SPSCQUEUE_H
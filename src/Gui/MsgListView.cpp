@@ -31,6 +31,7 @@
 #include <QPainter>
 #include <QSignalMapper>
 #include <QTimer>
+#include <QScrollBar>
 #include "MsgItemDelegate.h"
 #include "Imap/Model/MsgListModel.h"
 #include "Imap/Model/PrettyMsgListModel.h"
@@ -66,6 +67,16 @@ MsgListView::MsgListView(QWidget *parent, Imap::Mailbox::FavoriteTagsModel *m_fa
     m_naviActivationTimer = new QTimer(this);
     m_naviActivationTimer->setSingleShot(true);
     connect(m_naviActivationTimer, &QTimer::timeout, this, &MsgListView::slotCurrentActivated);
+
+    // Scrolling produces a storm of valueChanged() signals; only the final position is interesting
+    m_viewportReportTimer = new QTimer(this);
+    m_viewportReportTimer->setSingleShot(true);
+    m_viewportReportTimer->setInterval(50);
+    connect(m_viewportReportTimer, &QTimer::timeout, this, &MsgListView::slotReportVisibleMessages);
+    connect(verticalScrollBar(), &QAbstractSlider::valueChanged,
+            m_viewportReportTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
+    connect(verticalScrollBar(), &QAbstractSlider::rangeChanged,
+            m_viewportReportTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
 }
 
 // left might collapse a thread, question is whether ending there (on closing the thread) should be
@@ -119,6 +130,21 @@ void MsgListView::slotCurrentActivated()
     }
 }
 
+void MsgListView::slotReportVisibleMessages()
+{
+    QModelIndex index = indexAt(QPoint(0, 0));
+    if (!index.isValid())
+        return;
+
+    QModelIndexList visible;
+    const int viewportHeight = viewport()->height();
+    while (index.isValid() && visualRect(index).top() < viewportHeight) {
+        visible << index;
+        index = indexBelow(index);
+    }
+    emit visibleMessagesChanged(visible);
+}
+
 int MsgListView::sizeHintForColumn(int column) const
 {
     QFont boldFont = font();
@@ -426,6 +452,7 @@ void MsgListView::setModel(QAbstractItemModel *model)
                 &QAbstractItemModel::rowsAboutToBeRemoved,
                 this, &MsgListView::slotMsgListModelRowsAboutToBeRemoved);
     }
+    m_viewportReportTimer->start();
 }
 
 /** @short Get ThreadingMsgListModel index and call the next handler */
@@ -53,6 +53,9 @@ public:
     void updateActionsAfterRestoredState();
     virtual int sizeHintForColumn(int column) const;
     QHeaderView::ResizeMode resizeModeForColumn(const int column) const;
+signals:
+    /** @short The user can see these messages now */
+    void visibleMessagesChanged(const QModelIndexList &messages);
 protected:
     void keyPressEvent(QKeyEvent *ke);
     void keyReleaseEvent(QKeyEvent *ke);
@@ -77,6 +80,8 @@ private slots:
     /** @short conditionally emits activated(currentIndex()) for keyboard events */
     void slotCurrentActivated();
     void slotHandleNewColumns(int oldCount, int newCount);
+    /** @short Announce which messages are currently on screen */
+    void slotReportVisibleMessages();
 private:
     /** @short Try to move the cursor to next message */
     void setCurrentIndexToNextValid(const QModelIndex &current);
@@ -84,6 +89,7 @@ private:
 
     QSignalMapper *headerFieldsMapper;
     QTimer *m_naviActivationTimer;
+    QTimer *m_viewportReportTimer;
     bool m_autoActivateAfterKeyNavigation;
     bool m_autoResizeSections;
 
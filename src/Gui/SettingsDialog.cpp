@@ -974,6 +974,7 @@ CachePage::CachePage(QWidget *parent, QSettings &s): QScrollArea(parent), Ui_Cac
     }
 
     offlineNumberOfDays->setValue(s.value(SettingsNames::cacheOfflineNumberDaysKey, QVariant(30)).toInt());
+    offlinePartBudget->setValue(s.value(SettingsNames::cacheOfflinePartBudgetKey, QVariant(0)).toInt());
 
     val = s.value(SettingsNames::watchedFoldersKey).toString();
     if (val == Common::SettingsNames::watchAll) {
@@ -994,6 +995,8 @@ CachePage::CachePage(QWidget *parent, QSettings &s): QScrollArea(parent), Ui_Cac
 void CachePage::updateWidgets()
 {
     offlineNumberOfDays->setEnabled(offlineXDays->isChecked());
+    offlinePartBudget->setEnabled(!offlineNope->isChecked());
+    offlinePartBudgetLabel->setEnabled(!offlineNope->isChecked());
     emit widgetsUpdated();
 }
 
@@ -1009,6 +1012,7 @@ void CachePage::save(QSettings &s)
         s.setValue(SettingsNames::cacheOfflineKey, SettingsNames::cacheOfflineNone);
 
     s.setValue(SettingsNames::cacheOfflineNumberDaysKey, offlineNumberOfDays->value());
+    s.setValue(SettingsNames::cacheOfflinePartBudgetKey, offlinePartBudget->value());
 
     if (watchAll->isChecked()) {
         s.setValue(SettingsNames::watchedFoldersKey, SettingsNames::watchAll);
@@ -106,6 +106,7 @@
 #include "ui_ImapInfoDialog.h"
 
 #include "Imap/Model/ModelTest/modeltest.h"
+#include "UiUtils/Formatting.h"
 #include "UiUtils/IconLoader.h"
 #include "UiUtils/QaimDfsIterator.h"
 
@@ -933,6 +934,9 @@ void MainWindow::setupModels()
     connect(imapModel(), &Imap::Mailbox::Model::mailboxCreationFailed, this, &MainWindow::slotMailboxCreateFailed);
     connect(imapModel(), &Imap::Mailbox::Model::mailboxSyncFailed, this, &MainWindow::slotMailboxSyncFailed);
 
+    // The message list only tells which messages are on screen; it's up to the IMAP model what it does about that
+    connect(msgListWidget->tree, &MsgListView::visibleMessagesChanged, imapModel(), &Imap::Mailbox::Model::setVisibleMessages);
+
     connect(imapModel(), &Imap::Mailbox::Model::logged, protocolLogger, &ProtocolLoggerWidget::log);
     connect(imapModel(), &Imap::Mailbox::Model::connectionStateChanged, protocolLogger, &ProtocolLoggerWidget::onConnectionClosed);
 
@@ -2466,16 +2470,10 @@ void MainWindow::slotCapabilitiesUpdated(const QStringList &capabilities)
                                                Common::SettingsNames::guiMailboxListShowOnlySubscribed, false).toBool());
     m_actionSubscribeMailbox->setEnabled(m_actionShowOnlySubscribed->isEnabled());
 
-    const QStringList supportedCapabilities = Imap::Mailbox::ThreadingMsgListModel::supportedCapabilities();
-    Q_FOREACH(const QString &capability, capabilities) {
-        if (supportedCapabilities.contains(capability)) {
-            actionThreadMsgList->setEnabled(true);
-            if (actionThreadMsgList->isChecked())
-                slotThreadMsgList();
-            return;
-        }
-    }
-    actionThreadMsgList->setEnabled(false);
+    // When the server cannot do the threading, the ThreadingMsgListModel does that on its own
+    actionThreadMsgList->setEnabled(true);
+    if (actionThreadMsgList->isChecked())
+        slotThreadMsgList();
 }
 
 void MainWindow::slotShowImapInfo()
@@ -2540,6 +2538,21 @@ void MainWindow::slotShowImapInfo()
                            "<p>The following capabilities are currently advertised:</p>").arg(idString));
     ui.capabilities->setText(tr("<ul>\n%1</ul>").arg(caps));
 
+    const QVariantMap cacheStats = m_imapAccess->cacheStatistics();
+    if (cacheStats.isEmpty()) {
+        ui.cacheStatistics->hide();
+    } else {
+        const qint64 budget = cacheStats[QStringLiteral("partBudget")].toLongLong();
+        ui.cacheStatistics->setText(
+                    tr("<p>Cached message parts: %1 of %2, %3 % of the requests served from the cache, %n part(s) evicted</p>",
+                       0, cacheStats[QStringLiteral("partEvictions")].toInt())
+                    .arg(UiUtils::Formatting::prettySize(cacheStats[QStringLiteral("partBytes")].toLongLong()),
+                         budget ? UiUtils::Formatting::prettySize(budget) : tr("unlimited"),
+                         QString::number(qRound(cacheStats[QStringLiteral("hitRate")].toDouble() * 100)))
+                    + tr("<p>Memory reclaimed by unloading idle mailboxes: %1</p>")
+                    .arg(UiUtils::Formatting::prettySize(cacheStats[QStringLiteral("reclaimedMemory")].toULongLong())));
+    }
+
     dialog->exec();
 }
 
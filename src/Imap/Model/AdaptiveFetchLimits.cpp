@@ -0,0 +1,164 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AdaptiveFetchLimits.h"
+
+namespace {
+
+const uint minBytesPerGroup = 64 * 1024;
+const uint maxBytesPerGroup = 16 * 1024 * 1024;
+const uint bytesPerGroupStep = 128 * 1024;
+
+const int minMessagesPerGroup = 10;
+const int maxMessagesPerGroup = 2000;
+const int messagesPerGroupStep = 25;
+
+const int maxParallelTasks = 20;
+/** @short Add another parallel FETCH after this many of them have finished in time */
+const int parallelTasksStepInterval = 4;
+
+/** @short Responses smaller than this are dominated by the latency and say nothing about the throughput */
+const quint64 minBytesForThroughput = 16 * 1024;
+
+/** @short Smoothing of the averages, the same as TCP uses for its RTT estimate */
+template<typename T>
+T movingAverage(const T average, const T sample)
+{
+    return (7 * average + sample) / 8;
+}
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+AdaptiveFetchLimits::AdaptiveFetchLimits():
+    m_seeded(false), m_targetLatency(1000), m_bytesPerGroup(1024 * 1024), m_messagesPerGroup(300), m_parallelTasks(10),
+    m_successesInRow(0), m_smoothedRtt(-1), m_minimalRtt(-1), m_throughput(0), m_samples(0)
+{
+}
+
+void AdaptiveFetchLimits::seed(const uint bytesPerGroup, const int messagesPerGroup, const int parallelTasks)
+{
+    if (m_seeded)
+        return;
+    m_seeded = true;
+    m_bytesPerGroup = bytesPerGroup;
+    m_messagesPerGroup = messagesPerGroup;
+    m_parallelTasks = parallelTasks;
+}
+
+bool AdaptiveFetchLimits::isSeeded() const
+{
+    return m_seeded;
+}
+
+void AdaptiveFetchLimits::setTargetLatency(const int msecs)
+{
+    m_targetLatency = qMax(1, msecs);
+}
+
+int AdaptiveFetchLimits::targetLatency() const
+{
+    return m_targetLatency;
+}
+
+bool AdaptiveFetchLimits::addSample(const qint64 elapsed, const quint64 bytes, const bool isFetch)
+{
+    ++m_samples;
+    m_smoothedRtt = m_smoothedRtt < 0 ? elapsed : movingAverage(m_smoothedRtt, elapsed);
+    m_minimalRtt = m_minimalRtt < 0 ? elapsed : qMin(m_minimalRtt, elapsed);
+    if (bytes >= minBytesForThroughput && elapsed > 0) {
+        const quint64 rate = bytes * 1000 / elapsed;
+        m_throughput = m_throughput ? movingAverage(m_throughput, rate) : rate;
+    }
+
+    if (!isFetch)
+        return false;
+
+    const uint oldBytes = m_bytesPerGroup;
+    const int oldMessages = m_messagesPerGroup;
+    const int oldParallel = m_parallelTasks;
+
+    if (elapsed > m_targetLatency) {
+        // Multiplicative decrease
+        m_successesInRow = 0;
+        m_bytesPerGroup = qMax(minBytesPerGroup, m_bytesPerGroup / 2);
+        m_messagesPerGroup = qMax(minMessagesPerGroup, m_messagesPerGroup / 2);
+        m_parallelTasks = qMax(1, m_parallelTasks / 2);
+    } else {
+        // Additive increase
+        ++m_successesInRow;
+        m_bytesPerGroup = qBound(minBytesPerGroup, m_bytesPerGroup + bytesPerGroupStep, maxBytesPerGroup);
+        m_messagesPerGroup = qBound(minMessagesPerGroup, m_messagesPerGroup + messagesPerGroupStep, maxMessagesPerGroup);
+        if (m_successesInRow % parallelTasksStepInterval == 0)
+            m_parallelTasks = qMin(maxParallelTasks, m_parallelTasks + 1);
+    }
+
+    if (m_throughput) {
+        // No point in asking for more than what can arrive within the target latency
+        const quint64 deliverable = m_throughput * m_targetLatency / 1000;
+        m_bytesPerGroup = qMin<quint64>(m_bytesPerGroup, qMax<quint64>(minBytesPerGroup, deliverable));
+    }
+
+    return m_bytesPerGroup != oldBytes || m_messagesPerGroup != oldMessages || m_parallelTasks != oldParallel;
+}
+
+uint AdaptiveFetchLimits::bytesPerGroup() const
+{
+    return m_bytesPerGroup;
+}
+
+int AdaptiveFetchLimits::messagesPerGroup() const
+{
+    return m_messagesPerGroup;
+}
+
+int AdaptiveFetchLimits::parallelTasks() const
+{
+    return m_parallelTasks;
+}
+
+int AdaptiveFetchLimits::smoothedRtt() const
+{
+    return m_smoothedRtt;
+}
+
+int AdaptiveFetchLimits::minimalRtt() const
+{
+    return m_minimalRtt;
+}
+
+quint64 AdaptiveFetchLimits::throughput() const
+{
+    return m_throughput;
+}
+
+int AdaptiveFetchLimits::samples() const
+{
+    return m_samples;
+}
+
+}
+}
@@ -0,0 +1,94 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef IMAP_MODEL_ADAPTIVEFETCHLIMITS_H
+#define IMAP_MODEL_ADAPTIVEFETCHLIMITS_H
+
+#include <QtGlobal>
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short Tune the size and the number of concurrent FETCH commands to the measured properties of the link
+
+Every connection has its own instance. Each completed command is fed in as a sample of the round-trip time and of the
+amount of data which has been received in the meanwhile. The limits follow the AIMD scheme which is known from TCP's
+congestion control: as long as the FETCHes finish within the target latency, the limits are raised by a constant step,
+and as soon as one of them takes longer than that, they are cut in half. The size of a group is also capped by the
+amount of data which the link can deliver within the target latency.
+*/
+class AdaptiveFetchLimits
+{
+public:
+    AdaptiveFetchLimits();
+
+    /** @short Start from the given limits unless there is some history already */
+    void seed(const uint bytesPerGroup, const int messagesPerGroup, const int parallelTasks);
+    bool isSeeded() const;
+
+    /** @short How long should a single FETCH take at most, in milliseconds */
+    void setTargetLatency(const int msecs);
+    int targetLatency() const;
+
+    /** @short Record a completed command
+
+    The @arg elapsed is the time in milliseconds between sending the command and receiving its tagged response, and the
+    @arg bytes is the amount of data which has been received meanwhile. Only the FETCH commands (@arg isFetch) are used
+    for adjusting the limits, the other ones just contribute to the measurements.
+
+    Returns true if any of the limits has changed.
+    */
+    bool addSample(const qint64 elapsed, const quint64 bytes, const bool isFetch);
+
+    uint bytesPerGroup() const;
+    int messagesPerGroup() const;
+    int parallelTasks() const;
+
+    /** @short Exponentially weighted moving average of the round-trip time in milliseconds, or -1 if unknown */
+    int smoothedRtt() const;
+    /** @short The shortest round-trip time seen so far in milliseconds, or -1 if unknown */
+    int minimalRtt() const;
+    /** @short Moving average of the throughput in bytes per second, or 0 if unknown */
+    quint64 throughput() const;
+    /** @short Number of commands which have been measured */
+    int samples() const;
+
+private:
+    bool m_seeded;
+    int m_targetLatency;
+    uint m_bytesPerGroup;
+    int m_messagesPerGroup;
+    int m_parallelTasks;
+    /** @short Number of consecutive FETCHes which finished in time */
+    int m_successesInRow;
+
+    qint64 m_smoothedRtt;
+    qint64 m_minimalRtt;
+    quint64 m_throughput;
+    int m_samples;
+};
+
+}
+}
+
+#endif /* IMAP_MODEL_ADAPTIVEFETCHLIMITS_H */
@@ -0,0 +1,109 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BlobStore.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+BlobStore::BlobStore(const QString &storeDir)
+    : m_storeDir(storeDir)
+{
+    if (!m_storeDir.endsWith(QLatin1Char('/')))
+        m_storeDir.append(QLatin1Char('/'));
+}
+
+QByteArray BlobStore::hashOf(const QByteArray &data)
+{
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+}
+
+bool BlobStore::store(const QByteArray &hash, const QByteArray &data)
+{
+    const QString fileName = fileForBlob(hash);
+    if (QFile::exists(fileName)) {
+        // The same content is already there, so there's nothing to do
+        return true;
+    }
+
+    QDir().mkpath(QFileInfo(fileName).path());
+    // Write into a temporary file which gets renamed only when complete so that no partial blob is ever visible
+    QSaveFile buf(fileName);
+    if (!buf.open(QIODevice::WriteOnly) || buf.write(data) != data.size() || !buf.commit()) {
+        m_errorHandler(QObject::tr("Couldn't save blob %1 into file %2: %3").arg(
+                           QString::fromUtf8(hash), fileName, buf.errorString()));
+        return false;
+    }
+    return true;
+}
+
+QByteArray BlobStore::load(const QByteArray &hash) const
+{
+    QFile buf(fileForBlob(hash));
+    if (!buf.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return buf.readAll();
+}
+
+void BlobStore::remove(const QByteArray &hash)
+{
+    QFile buf(fileForBlob(hash));
+    if (buf.exists() && !buf.remove()) {
+        m_errorHandler(QObject::tr("Couldn't remove blob %1: %2").arg(QString::fromUtf8(hash), buf.errorString()));
+    }
+}
+
+void BlobStore::removeOrphans(const QSet<QByteArray> &known)
+{
+    // This also catches the temporary files of the writes which have never finished
+    QDirIterator it(m_storeDir, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QFile buf(it.next());
+        if (known.contains(it.fileName().toUtf8()))
+            continue;
+        if (!buf.remove()) {
+            m_errorHandler(QObject::tr("Couldn't remove orphaned blob file %1: %2").arg(buf.fileName(), buf.errorString()));
+        }
+    }
+}
+
+QString BlobStore::fileForBlob(const QByteArray &hash) const
+{
+    // Fan the files out into subdirectories so that none of them grows too big
+    return m_storeDir + QString::fromUtf8(hash.left(2)) + QLatin1Char('/') + QString::fromUtf8(hash);
+}
+
+void BlobStore::setErrorHandler(const std::function<void(const QString &)> &handler)
+{
+    m_errorHandler = handler;
+}
+
+}
+}
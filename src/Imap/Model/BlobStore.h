@@ -0,0 +1,82 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_BLOBSTORE_H
+#define IMAP_MODEL_BLOBSTORE_H
+
+#include <functional>
+#include <QSet>
+#include <QString>
+
+namespace Imap
+{
+
+namespace Mailbox
+{
+
+/** @short Content-addressed storage for big message parts
+
+Each blob is stored in a file which is named after the SHA-256 of its content, so the same attachment which is present
+in several messages or mailboxes occupies the disk space just once. The store itself does not know who uses a blob; the
+references are tracked by the SQLCache and the CombinedCache removes blobs which are no longer referenced.
+
+A blob file only becomes visible once it has been written completely. The CombinedCache makes sure that the SQL rows which
+refer to a blob are committed only after its file is in place, and that the file is deleted only after the removal of
+these rows has been committed. A crash in between can therefore leave behind just a file which nobody refers to; these
+get cleaned up by removeOrphans().
+*/
+class BlobStore
+{
+public:
+    /** @short Create the store occupying the @arg storeDir directory */
+    explicit BlobStore(const QString &storeDir);
+
+    /** @short Compute the key under which the @arg data would be stored */
+    static QByteArray hashOf(const QByteArray &data);
+
+    /** @short Save the @arg data under the @arg hash unless a blob with that hash exists already */
+    bool store(const QByteArray &hash, const QByteArray &data);
+    /** @short Return the whole blob, or a null QByteArray if it isn't present */
+    QByteArray load(const QByteArray &hash) const;
+    /** @short Delete the blob */
+    void remove(const QByteArray &hash);
+    /** @short Delete all files in the store which are not among the @arg known blobs */
+    void removeOrphans(const QSet<QByteArray> &known);
+
+    /** @short Inform about runtime failures */
+    void setErrorHandler(const std::function<void(const QString &)> &handler);
+
+private:
+    QString fileForBlob(const QByteArray &hash) const;
+
+    /** @short The root directory of the store */
+    QString m_storeDir;
+
+protected:
+    std::function<void(const QString&)> m_errorHandler;
+};
+
+}
+
+}
+
+#endif /* IMAP_MODEL_BLOBSTORE_H */
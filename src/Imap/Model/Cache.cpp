@@ -20,21 +20,73 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <functional>
 #include "Cache.h"
+#include "Imap/Encoders.h"
+#include "Imap/Parser/LiteralSink.h"
 
 namespace Imap {
 namespace Mailbox {
 
+AbstractCache::Statistics::Statistics()
+    : partHits(0)
+    , partMisses(0)
+    , partEvictions(0)
+    , partBytes(0)
+    , partBudget(0)
+{
+}
+
 AbstractCache::~AbstractCache()
 {
 }
 
+void AbstractCache::clearMessages(const QString &mailbox, const Imap::Uids &uids)
+{
+    for (const uint uid : uids) {
+        clearMessage(mailbox, uid);
+    }
+}
+
+void AbstractCache::loadMessageMetadata(const QString &mailbox, const uint uid,
+                                        const std::function<void(const MessageDataBundle &)> &callback) const
+{
+    callback(messageMetadata(mailbox, uid));
+}
+
+void AbstractCache::loadMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &rawPartId,
+                                    const std::function<void(const QByteArray &, const QByteArray &)> &callback) const
+{
+    const QByteArray data = messagePart(mailbox, uid, partId);
+    callback(data, data.isNull() && !rawPartId.isEmpty() ? messagePart(mailbox, uid, rawPartId) : QByteArray());
+}
+
+void AbstractCache::setSpooledMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId,
+                                      const QSharedPointer<LiteralSink> &data, const QByteArray &transferEncoding)
+{
+    QByteArray decoded;
+    decodeContentTransferEncoding(data->readAll(), transferEncoding, &decoded);
+    setMsgPart(mailbox, uid, partId, decoded);
+}
+
 void AbstractCache::setErrorHandler(const std::function<void(const QString &)> &handler)
 {
     m_errorHandler = handler;
 }
 
+void AbstractCache::applyUidMappingUpdate(Imap::Uids &mapping, const Imap::Uids &removed, const Imap::Uids &added)
+{
+    if (!removed.isEmpty()) {
+        Imap::Uids sortedRemoved = removed;
+        std::sort(sortedRemoved.begin(), sortedRemoved.end());
+        mapping.erase(std::remove_if(mapping.begin(), mapping.end(), [&sortedRemoved](const uint uid) {
+            return std::binary_search(sortedRemoved.constBegin(), sortedRemoved.constEnd(), uid);
+        }), mapping.end());
+    }
+    mapping += added;
+}
+
 AbstractCache::MessageDataBundle::MessageDataBundle(
         const uint uid, const Message::Envelope &envelope, const QDateTime &internalDate, const quint64 size,
         const QByteArray &serializedBodyStructure, const QList<QByteArray> &hdrReferences,
@@ -24,6 +24,8 @@
 #define IMAP_MODEL_CACHE_H
 
 #include <functional>
+#include <QHash>
+#include <QSharedPointer>
 #include <QUrl>
 #include "MailboxMetadata.h"
 #include "Imap/Parser/Message.h"
@@ -34,6 +36,8 @@
 namespace Imap
 {
 
+class LiteralSink;
+
 /** @short Classes for handling of mailboxes and connections */
 namespace Mailbox
 {
@@ -56,9 +60,11 @@ public:
         /** @short Serialized form of BODYSTRUCTURE
 
         Due to the complex nature of BODYSTRUCTURE and the way we use, simly
-        archiving the resulting object is far from trivial. The simplest way is
-        offered by Imap::Message::AbstractMessage::fromList. Therefore, this item
-        contains a QVariantList as serialized by QDataStream.
+        archiving the resulting object is far from trivial. This item therefore
+        contains the compact binary form produced by
+        Imap::Message::AbstractMessage::serialize(). Entries stored by older
+        versions contain a QVariantList as serialized by QDataStream; both
+        variants are understood by Imap::Message::AbstractMessage::fromSerialized().
         */
         QByteArray serializedBodyStructure;
 
@@ -84,6 +90,22 @@ public:
         }
     };
 
+    /** @short Usage statistics of the cached message parts */
+    struct Statistics {
+        /** @short Number of requests for a message part which were satisfied from the cache */
+        quint64 partHits;
+        /** @short Number of requests for a message part which were not found in the cache */
+        quint64 partMisses;
+        /** @short Number of message parts which were dropped in order to stay within the budget */
+        quint64 partEvictions;
+        /** @short Total size of all stored message parts in bytes */
+        qint64 partBytes;
+        /** @short The configured budget in bytes, zero means unlimited */
+        qint64 partBudget;
+
+        Statistics();
+    };
+
     virtual ~AbstractCache();
 
     /** @short Return a list of all known child mailboxes */
@@ -100,6 +122,13 @@ public:
 
     /** @short Store the mapping of sequence numbers to UIDs */
     virtual void setUidMapping(const QString &mailbox, const Imap::Uids &seqToUid) = 0;
+    /** @short Update the stored mapping of sequence numbers to UIDs incrementally
+
+    The UIDs listed in @arg removed are dropped from the mapping and the @arg added ones are appended to its end. All of
+    the added UIDs have to be higher than any UID which is already present. This is much cheaper than a full
+    setUidMapping() when just a few messages have arrived or got expunged in a huge mailbox.
+    */
+    virtual void updateUidMapping(const QString &mailbox, const Imap::Uids &removed, const Imap::Uids &added) = 0;
     /** @short Forget the cached seq->UID mapping for given mailbox */
     virtual void clearUidMapping(const QString &mailbox) = 0;
     /** @short Retrieve sequence to UID mapping */
@@ -109,20 +138,54 @@ public:
     virtual void clearAllMessages(const QString &mailbox) = 0;
     /** @short Remove all info for given message in the mailbox from cache */
     virtual void clearMessage(const QString mailbox, const uint uid) = 0;
+    /** @short Remove all info for all of the given messages in the mailbox from cache
+
+    The default implementation simply calls clearMessage() for each of them.
+    */
+    virtual void clearMessages(const QString &mailbox, const Imap::Uids &uids);
 
     /** @short Returns all known data for a message in the given mailbox (except real parts data) */
     virtual MessageDataBundle messageMetadata(const QString &mailbox, uint uid) const = 0;
+    /** @short Look up the data of a message just like messageMetadata() and pass them to the @arg callback
+
+    The default implementation invokes the @arg callback before returning; caches which perform their I/O elsewhere might
+    call it later from the event loop instead.
+    */
+    virtual void loadMessageMetadata(const QString &mailbox, const uint uid,
+                                     const std::function<void(const MessageDataBundle &)> &callback) const;
     virtual void setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata) = 0;
 
     /** @short Retrieve flags for one message in a mailbox */
     virtual QStringList msgFlags(const QString &mailbox, const uint uid) const = 0;
     /** @short Save flags for one message in mailbox */
     virtual void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags) = 0;
+    /** @short Retrieve flags of all messages in a mailbox at once, indexed by UID
+
+    This is much faster than calling msgFlags() for each and every message when populating a big mailbox. Messages
+    without any cached flags might be missing from the result.
+    */
+    virtual QHash<uint, QStringList> msgFlagsForMailbox(const QString &mailbox) const = 0;
 
     /** @short Return part data or a null QByteArray if none available */
     virtual QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const = 0;
+    /** @short Look up the data of a message part and pass them to the @arg callback
+
+    When there are no data for @arg partId and the @arg rawPartId is not empty, the data stored under @arg rawPartId are
+    passed as the second argument. The default implementation invokes the @arg callback before returning; caches which
+    perform their I/O elsewhere might call it later from the event loop instead.
+    */
+    virtual void loadMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &rawPartId,
+                                 const std::function<void(const QByteArray &, const QByteArray &)> &callback) const;
     /** @short Save data for one message part */
     virtual void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data) = 0;
+    /** @short Save data for one message part whose payload was spooled by the Parser
+
+    The payload is read back from the @arg data, the @arg transferEncoding is undone and the result is passed to
+    setMsgPart(). The ThreadedCache does all that in its worker thread, so that the caller does not have to bring the whole
+    part into memory.
+    */
+    virtual void setSpooledMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId,
+                                   const QSharedPointer<LiteralSink> &data, const QByteArray &transferEncoding);
     /** @short Drop the data for a message part which is no longer needed */
     virtual void forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) = 0;
 
@@ -134,10 +197,21 @@ public:
     /** @short How many days is it OK not to mark entries as accessed? */
     virtual void setRenewalThreshold(const int days) = 0;
 
+    /** @short Limit the total size of the cached message parts to @arg bytes
+
+    When the limit is exceeded, the least recently used parts are evicted. Zero means no limit.
+    */
+    virtual void setPartCacheBudget(const qint64 bytes) = 0;
+    /** @short Return the usage statistics of this cache */
+    virtual Statistics statistics() const = 0;
+
     /** @short Inform about runtime failures */
     void setErrorHandler(const std::function<void(const QString &)> &handler);
 
 protected:
+    /** @short Apply the changes passed to updateUidMapping() to an in-memory copy of the UID mapping */
+    static void applyUidMappingUpdate(Imap::Uids &mapping, const Imap::Uids &removed, const Imap::Uids &added);
+
     std::function<void(const QString&)> m_errorHandler;
 };
 
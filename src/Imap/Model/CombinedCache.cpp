@@ -21,6 +21,7 @@
 */
 
 #include "CombinedCache.h"
+#include "BlobStore.h"
 #include "DiskPartCache.h"
 #include "SQLCache.h"
 
@@ -34,18 +35,38 @@ CombinedCache::CombinedCache(const QString &name, const QString &cacheDir)
     , cacheDir(cacheDir)
     , sqlCache(new SQLCache())
     , diskPartCache(new DiskPartCache(cacheDir))
+    , blobStore(new BlobStore(cacheDir + QLatin1String("/blobs")))
+    , m_partHits(0)
+    , m_partMisses(0)
 {
     sqlCache->setErrorHandler([this](const QString &e) { this->m_errorHandler(e); });
     diskPartCache->setErrorHandler([this](const QString &e) { this->m_errorHandler(e); });
+    blobStore->setErrorHandler([this](const QString &e) { this->m_errorHandler(e); });
+    sqlCache->setCommitHandler([this](const bool ok) { this->transactionCommitted(ok); });
+    sqlCache->setPartsEvictedHandler([this]() { this->removeUnreferencedBlobs(); });
 }
 
 CombinedCache::~CombinedCache()
 {
+    // The final commit happens in the SQLCache's destructor, and it might still have to delete some blobs
+    sqlCache.reset();
 }
 
 bool CombinedCache::open()
 {
-    return sqlCache->open(name, cacheDir + QLatin1String("/imap.cache.sqlite"));
+    if (!sqlCache->open(name, cacheDir + QLatin1String("/imap.cache.sqlite")))
+        return false;
+
+    // Files of the blobs which were being added or removed when we got killed might still be lying around
+    QSet<QByteArray> knownBlobs;
+    if (sqlCache->knownBlobs(knownBlobs))
+        blobStore->removeOrphans(knownBlobs);
+    return true;
+}
+
+void CombinedCache::commit()
+{
+    sqlCache->commit();
 }
 
 QList<MailboxMetadata> CombinedCache::childMailboxes(const QString &mailbox) const
@@ -83,6 +104,11 @@ void CombinedCache::setUidMapping(const QString &mailbox, const Imap::Uids &seqT
     sqlCache->setUidMapping(mailbox, seqToUid);
 }
 
+void CombinedCache::updateUidMapping(const QString &mailbox, const Imap::Uids &removed, const Imap::Uids &added)
+{
+    sqlCache->updateUidMapping(mailbox, removed, added);
+}
+
 void CombinedCache::clearUidMapping(const QString &mailbox)
 {
     sqlCache->clearUidMapping(mailbox);
@@ -92,12 +118,23 @@ void CombinedCache::clearAllMessages(const QString &mailbox)
 {
     sqlCache->clearAllMessages(mailbox);
     diskPartCache->clearAllMessages(mailbox);
+    removeUnreferencedBlobs();
 }
 
 void CombinedCache::clearMessage(const QString mailbox, const uint uid)
 {
     sqlCache->clearMessage(mailbox, uid);
     diskPartCache->clearMessage(mailbox, uid);
+    removeUnreferencedBlobs();
+}
+
+void CombinedCache::clearMessages(const QString &mailbox, const Imap::Uids &uids)
+{
+    for (const uint uid : uids) {
+        sqlCache->clearMessage(mailbox, uid);
+        diskPartCache->clearMessage(mailbox, uid);
+    }
+    removeUnreferencedBlobs();
 }
 
 QStringList CombinedCache::msgFlags(const QString &mailbox, const uint uid) const
@@ -110,6 +147,11 @@ void CombinedCache::setMsgFlags(const QString &mailbox, const uint uid, const QS
     sqlCache->setMsgFlags(mailbox, uid, flags);
 }
 
+QHash<uint, QStringList> CombinedCache::msgFlagsForMailbox(const QString &mailbox) const
+{
+    return sqlCache->msgFlagsForMailbox(mailbox);
+}
+
 AbstractCache::MessageDataBundle CombinedCache::messageMetadata(const QString &mailbox, const uint uid) const
 {
     return sqlCache->messageMetadata(mailbox, uid);
@@ -124,8 +166,19 @@ QByteArray CombinedCache::messagePart(const QString &mailbox, const uint uid, co
 {
     QByteArray res = sqlCache->messagePart(mailbox, uid, partId);
     if (res.isEmpty()) {
+        QByteArray hash = sqlCache->messagePartBlob(mailbox, uid, partId);
+        if (!hash.isEmpty()) {
+            res = blobStore->load(hash);
+        }
+    }
+    if (res.isEmpty()) {
+        // Older versions used to store each big part in a file of its own
         res = diskPartCache->messagePart(mailbox, uid, partId);
     }
+    if (res.isEmpty())
+        ++m_partMisses;
+    else
+        ++m_partHits;
     return res;
 }
 
@@ -134,14 +187,42 @@ void CombinedCache::setMsgPart(const QString &mailbox, const uint uid, const QBy
     if (data.size() < 1024 * 1024) {
         sqlCache->setMsgPart(mailbox, uid, partId, data);
     } else {
-        diskPartCache->setMsgPart(mailbox, uid, partId, data);
+        QByteArray hash = BlobStore::hashOf(data);
+        // The blob might have been forgotten in the current transaction; its file is still there and it's needed again
+        m_blobsToRemove.remove(hash);
+        if (blobStore->store(hash, data)) {
+            sqlCache->setMessagePartBlob(mailbox, uid, partId, hash, data.size());
+        }
     }
+    // An older blob might have been replaced
+    removeUnreferencedBlobs();
 }
 
 void CombinedCache::forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
 {
     sqlCache->forgetMessagePart(mailbox, uid, partId);
     diskPartCache->forgetMessagePart(mailbox, uid, partId);
+    removeUnreferencedBlobs();
+}
+
+void CombinedCache::removeUnreferencedBlobs()
+{
+    Q_FOREACH(const QByteArray &hash, sqlCache->unreferencedBlobs()) {
+        sqlCache->forgetBlob(hash);
+        m_blobsToRemove.insert(hash);
+    }
+}
+
+void CombinedCache::transactionCommitted(const bool ok)
+{
+    if (ok) {
+        Q_FOREACH(const QByteArray &hash, m_blobsToRemove) {
+            blobStore->remove(hash);
+        }
+    }
+    // Upon a failure, the SQL rows might still be around, so the files have to stay; the leftovers will be removed
+    // upon the next open()
+    m_blobsToRemove.clear();
 }
 
 QVector<Imap::Responses::ThreadingNode> CombinedCache::messageThreading(const QString &mailbox)
@@ -159,5 +240,19 @@ void CombinedCache::setRenewalThreshold(const int days)
     sqlCache->setRenewalThreshold(days);
 }
 
+void CombinedCache::setPartCacheBudget(const qint64 bytes)
+{
+    sqlCache->setPartCacheBudget(bytes);
+}
+
+AbstractCache::Statistics CombinedCache::statistics() const
+{
+    // The SQL cache only sees the inline parts, so it cannot tell the hits from the misses
+    Statistics res = sqlCache->statistics();
+    res.partHits = m_partHits;
+    res.partMisses = m_partMisses;
+    return res;
+}
+
 }
 }
@@ -24,6 +24,7 @@
 #define IMAP_MODEL_COMBINEDCACHE_H
 
 #include <memory>
+#include <QSet>
 #include "Cache.h"
 
 namespace Imap
@@ -32,6 +33,7 @@ namespace Imap
 namespace Mailbox
 {
 
+class BlobStore;
 class SQLCache;
 class DiskPartCache;
 
@@ -41,6 +43,8 @@ class DiskPartCache;
 This cache servers as a thin wrapper around the SQLCache. It uses
 the SQL facilities for most of the actual caching, but changes to
 a file-based cache when items are bigger than a certain threshold.
+These big items are stored in a BlobStore, so identical parts are
+kept on the disk just once.
 
 In future, this should be extended with an in-memory cache (but
 only after the MemoryCache rework) which should only speed-up certain
@@ -68,17 +72,20 @@ public:
     virtual void setMailboxSyncState(const QString &mailbox, const SyncState &state);
 
     virtual void setUidMapping(const QString &mailbox, const Imap::Uids &seqToUid);
+    virtual void updateUidMapping(const QString &mailbox, const Imap::Uids &removed, const Imap::Uids &added);
     virtual void clearUidMapping(const QString &mailbox);
     virtual Imap::Uids uidMapping(const QString &mailbox) const;
 
     virtual void clearAllMessages(const QString &mailbox);
     virtual void clearMessage(const QString mailbox, const uint uid);
+    virtual void clearMessages(const QString &mailbox, const Imap::Uids &uids);
 
     virtual MessageDataBundle messageMetadata(const QString &mailbox, const uint uid) const;
     virtual void setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata);
 
     virtual QStringList msgFlags(const QString &mailbox, const uint uid) const;
     virtual void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags);
+    virtual QHash<uint, QStringList> msgFlagsForMailbox(const QString &mailbox) const;
 
     virtual QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
     virtual void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data);
@@ -89,18 +96,35 @@ public:
 
     virtual void setRenewalThreshold(const int days);
 
+    virtual void setPartCacheBudget(const qint64 bytes);
+    virtual Statistics statistics() const;
+
     /** @short Open a connection to the cache */
     bool open();
+    /** @short Commit the pending changes right away, including the deletion of the blobs which are no longer used */
+    void commit();
 
 private:
+    /** @short Forget the blobs which no message part refers to; their files go away after the next commit */
+    void removeUnreferencedBlobs();
+    /** @short The SQL transaction has finished, so the files of the forgotten blobs can be deleted if it succeeded */
+    void transactionCommitted(const bool ok);
+
     /** @short Name of the DB connection */
     QString name;
     /** @short Directory to serve as a cache root */
     QString cacheDir;
     /** @short The SQL-based cache */
     std::unique_ptr<SQLCache> sqlCache;
-    /** @short Cache for bigger message parts */
+    /** @short Big message parts as stored by older versions, kept just for reading and removal */
     std::unique_ptr<DiskPartCache> diskPartCache;
+    /** @short Deduplicated storage of big message parts */
+    std::unique_ptr<BlobStore> blobStore;
+    /** @short Blobs whose files shall be deleted once the removal of their SQL rows has been committed */
+    QSet<QByteArray> m_blobsToRemove;
+    /** @short Lookups of message parts, counted across all storage backends */
+    mutable quint64 m_partHits;
+    mutable quint64 m_partMisses;
 };
 
 }
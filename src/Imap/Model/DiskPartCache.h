@@ -37,6 +37,9 @@ namespace Mailbox
 The API is designed to be "similar" to the AbstractCache, but because certain
 operations do not really make much sense (like working with a list of mailboxes),
 we do not inherit from that abstract base class.
+
+New parts are stored in the BlobStore; this class is only used for accessing and
+removing the files which were created by older versions.
 */
 class DiskPartCache
 {
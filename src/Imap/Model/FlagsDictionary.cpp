@@ -0,0 +1,91 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FlagsDictionary.h"
+#include "SpecialFlagNames.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+FlagsDictionary::FlagsDictionary()
+{
+    // Keep this in sync with the WellKnownFlag enum.  The FlagNames are used directly so that the decoded lists share
+    // their data with whatever the Model::normalizeFlags() produces.
+    m_atoms.reserve(WELL_KNOWN_FLAGS_COUNT);
+    m_atoms << FlagNames::seen << FlagNames::answered << FlagNames::deleted << FlagNames::forwarded << FlagNames::recent
+            << FlagNames::flagged << FlagNames::junk << FlagNames::notjunk << FlagNames::mdnsent << FlagNames::submitted
+            << FlagNames::submitpending;
+    Q_ASSERT(m_atoms.size() == WELL_KNOWN_FLAGS_COUNT);
+    for (int i = 0; i < m_atoms.size(); ++i)
+        m_index[m_atoms[i]] = i;
+}
+
+FlagsDictionary::Bits FlagsDictionary::encode(const QStringList &flags, QStringList &overflow)
+{
+    Bits res = 0;
+    overflow.clear();
+    for (QStringList::const_iterator flag = flags.constBegin(); flag != flags.constEnd(); ++flag) {
+        QHash<QString, int>::const_iterator known = m_index.constFind(*flag);
+        int atom;
+        if (known != m_index.constEnd()) {
+            atom = *known;
+        } else if (m_atoms.size() < capacity) {
+            atom = m_atoms.size();
+            m_atoms << *flag;
+            m_index[*flag] = atom;
+        } else {
+            overflow << *flag;
+            continue;
+        }
+        res |= Bits(1) << atom;
+    }
+    return res;
+}
+
+QStringList FlagsDictionary::decode(const Bits bits, const QStringList &overflow) const
+{
+    if (!overflow.isEmpty())
+        return decodeUncached(bits, overflow);
+
+    QHash<Bits, QStringList>::const_iterator cached = m_decoded.constFind(bits);
+    if (cached != m_decoded.constEnd())
+        return *cached;
+    QStringList res = decodeUncached(bits, overflow);
+    m_decoded.insert(bits, res);
+    return res;
+}
+
+QStringList FlagsDictionary::decodeUncached(const Bits bits, const QStringList &overflow) const
+{
+    QStringList res = overflow;
+    for (int atom = 0; atom < m_atoms.size() && (bits >> atom); ++atom) {
+        if (bits & (Bits(1) << atom))
+            res << m_atoms[atom];
+    }
+    res.sort();
+    return res;
+}
+
+}
+}
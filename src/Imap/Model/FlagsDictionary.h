@@ -0,0 +1,98 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_FLAGSDICTIONARY_H
+#define IMAP_MODEL_FLAGSDICTIONARY_H
+
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+namespace Imap
+{
+
+namespace Mailbox
+{
+
+/** @short Interned IMAP flags of all messages in a single mailbox
+
+Each distinct flag which is seen in a mailbox gets assigned an "atom", i.e. a bit in the per-message bitmap.  The
+well-known system flags are registered upfront at fixed positions, so checking whether a message is, say, unread is
+a single bit test which does not need the dictionary at all.  When a mailbox uses more keywords than what fits into
+the bitmap, the rest of them is kept in a per-message list of overflowing flags.
+
+The dictionary only ever grows; the number of distinct flags in a mailbox is tiny compared to the number of messages.
+*/
+class FlagsDictionary
+{
+public:
+    typedef quint64 Bits;
+
+    /** @short Atoms which are always present in the dictionary */
+    enum WellKnownFlag {
+        FLAG_SEEN,
+        FLAG_ANSWERED,
+        FLAG_DELETED,
+        FLAG_FORWARDED,
+        FLAG_RECENT,
+        FLAG_FLAGGED,
+        FLAG_JUNK,
+        FLAG_NOTJUNK,
+        FLAG_MDNSENT,
+        FLAG_SUBMITTED,
+        FLAG_SUBMITPENDING,
+        WELL_KNOWN_FLAGS_COUNT
+    };
+
+    /** @short How many distinct flags can be represented in the bitmap */
+    static const int capacity = sizeof(Bits) * 8;
+
+    static Bits bit(const WellKnownFlag flag)
+    {
+        return Bits(1) << flag;
+    }
+
+    FlagsDictionary();
+
+    /** @short Convert a list of flags into the bitmap, putting the flags which do not fit into @arg overflow */
+    Bits encode(const QStringList &flags, QStringList &overflow);
+    /** @short Reconstruct the sorted list of flags
+
+    The result is cached for each distinct bitmap without any overflowing flags, so that repeated calls, e.g. when
+    painting the message list, do not have to build and sort a new list each time.
+    */
+    QStringList decode(const Bits bits, const QStringList &overflow) const;
+
+private:
+    QStringList decodeUncached(const Bits bits, const QStringList &overflow) const;
+
+    QVector<QString> m_atoms;
+    QHash<QString, int> m_index;
+    /** @short Already decoded bitmaps; an atom never changes its meaning, so these remain valid forever */
+    mutable QHash<Bits, QStringList> m_decoded;
+};
+
+}
+
+}
+
+#endif /* IMAP_MODEL_FLAGSDICTIONARY_H */
@@ -25,6 +25,7 @@
 #include <QFileInfo>
 #include <QSslKey>
 #include <QSettings>
+#include "Common/InvokeMethod.h"
 #include "Common/MetaTypes.h"
 #include "Common/Paths.h"
 #include "Common/PortNumbers.h"
@@ -39,6 +40,7 @@
 #include "Imap/Model/OneMessageModel.h"
 #include "Imap/Model/SubtreeModel.h"
 #include "Imap/Model/SystemNetworkWatcher.h"
+#include "Imap/Model/ThreadedCache.h"
 #include "Imap/Model/ThreadingMsgListModel.h"
 #include "Imap/Model/Utils.h"
 #include "Imap/Model/VisibleTasksModel.h"
@@ -335,10 +337,16 @@ void ImapAccess::doConnect()
     if (!shouldUsePersistentCache) {
         cache.reset(new Imap::Mailbox::MemoryCache());
     } else {
-        cache.reset(new Imap::Mailbox::CombinedCache(QStringLiteral("trojita-imap-cache"), m_cacheDir));
-        cache->setErrorHandler([this](const QString &e) { this->onCacheError(e); });
-        if (! static_cast<Imap::Mailbox::CombinedCache *>(cache.get())->open()) {
-            // Error message was already shown by the cacheError() slot
+        // All the I/O happens in a dedicated thread so that the GUI is not blocked by the SQL commits
+        auto threadedCache = new Imap::Mailbox::ThreadedCache(std::unique_ptr<Imap::Mailbox::AbstractCache>(
+                    new Imap::Mailbox::CombinedCache(QStringLiteral("trojita-imap-cache"), m_cacheDir)));
+        cache.reset(threadedCache);
+        // The onCacheError() replaces the cache, so it cannot run while the cache is still busy reporting the error
+        cache->setErrorHandler([this](const QString &e) { CALL_LATER(this, onCacheError, Q_ARG(QString, e)); });
+        if (!threadedCache->initialize([](Imap::Mailbox::AbstractCache *backend) {
+                                           return static_cast<Imap::Mailbox::CombinedCache *>(backend)->open();
+                                       })) {
+            // Error message is shown by the cacheError() slot
             cache.reset(new Imap::Mailbox::MemoryCache());
         } else {
             if (m_settings->value(Common::SettingsNames::cacheOfflineKey).toString() == Common::SettingsNames::cacheOfflineAll) {
@@ -351,6 +359,10 @@ void ImapAccess::doConnect()
                     num = defaultCacheLifetime;
                 cache->setRenewalThreshold(num);
             }
+            // Zero, the default, means that the cached message parts are not limited in size
+            const qint64 partBudgetMiB = m_settings->value(Common::SettingsNames::cacheOfflinePartBudgetKey, 0).toLongLong();
+            if (partBudgetMiB > 0)
+                cache->setPartCacheBudget(partBudgetMiB * 1024 * 1024);
         }
     }
 
@@ -360,6 +372,16 @@ void ImapAccess::doConnect()
     m_imapModel->setProperty("trojita-imap-id-no-versions", !m_settings->value(Common::SettingsNames::interopRevealVersions, true).toBool());
     m_imapModel->setProperty("trojita-imap-idle-renewal", m_settings->value(Common::SettingsNames::imapIdleRenewal).toUInt() * 60 * 1000);
     m_imapModel->setNumberRefreshInterval(numberRefreshInterval());
+    m_imapModel->setProperty("trojita-imap-parse-in-thread", true);
+    m_imapModel->setProperty("trojita-imap-adaptive-fetch-limits", true);
+    m_imapModel->setProperty("trojita-imap-pipelined-select", true);
+    m_imapModel->setProperty("trojita-imap-pipelined-login", true);
+    m_imapModel->setProperty("trojita-imap-spare-connections", 1);
+    // Unloading of idle mailboxes is opt-in for now
+    m_imapModel->setProperty("trojita-imap-unload-idle-mailboxes-after",
+                             m_settings->value(Common::SettingsNames::imapUnloadIdleMailboxesAfter, 0).toInt());
+    m_imapModel->setProperty("trojita-imap-resident-messages-limit",
+                             m_settings->value(Common::SettingsNames::imapResidentMessagesLimit, 0).toInt());
     connect(m_imapModel, &Mailbox::Model::alertReceived, this, &ImapAccess::alertReceived);
     connect(m_imapModel, &Mailbox::Model::imapError, this, &ImapAccess::imapError);
     connect(m_imapModel, &Mailbox::Model::networkError, this, &ImapAccess::networkError);
@@ -564,6 +586,23 @@ void ImapAccess::nukeCache()
     Imap::removeRecursively(m_cacheDir);
 }
 
+QVariantMap ImapAccess::cacheStatistics() const
+{
+    QVariantMap res;
+    if (!m_imapModel || !m_imapModel->cache())
+        return res;
+    const Imap::Mailbox::AbstractCache::Statistics stats = m_imapModel->cache()->statistics();
+    const quint64 lookups = stats.partHits + stats.partMisses;
+    res[QStringLiteral("partHits")] = stats.partHits;
+    res[QStringLiteral("partMisses")] = stats.partMisses;
+    res[QStringLiteral("hitRate")] = lookups ? static_cast<double>(stats.partHits) / lookups : 0.0;
+    res[QStringLiteral("partEvictions")] = stats.partEvictions;
+    res[QStringLiteral("partBytes")] = stats.partBytes;
+    res[QStringLiteral("partBudget")] = stats.partBudget;
+    res[QStringLiteral("reclaimedMemory")] = m_imapModel->reclaimedMemory();
+    return res;
+}
+
 QModelIndex ImapAccess::deproxifiedIndex(const QModelIndex index)
 {
     return Imap::deproxifiedIndex(index);
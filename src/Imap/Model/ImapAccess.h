@@ -25,6 +25,7 @@
 
 #include <QObject>
 #include <QSslError>
+#include <QVariant>
 
 #include "Common/ConnectionMethod.h"
 #include "Common/Logging.h"
@@ -127,6 +128,8 @@ public:
     Q_INVOKABLE void forgetSslCertificate();
 
     Q_INVOKABLE void nukeCache();
+    /** @short Usage statistics of the cached message parts (their hit rate, size and budget) and of the unloaded mailboxes */
+    Q_INVOKABLE QVariantMap cacheStatistics() const;
 
     Q_INVOKABLE QString mailboxListShortMailboxName() const;
     Q_INVOKABLE QString mailboxListMailboxName() const;
@@ -0,0 +1,316 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <QTimer>
+#include "LocalThreading.h"
+
+namespace Imap
+{
+
+namespace Mailbox
+{
+
+struct LocalThreading::Container {
+    /** @short UID of the message, or zero if this message is not present in the mailbox */
+    uint uid;
+    QDateTime date;
+    /** @short Key of this container in the Message-Id table, empty for the anonymous ones */
+    QByteArray messageId;
+    Container *parent;
+    QVector<Container *> children;
+    Container(): uid(0), parent(0) {}
+};
+
+namespace {
+
+/** @short A subtree of the result along with the key by which it shall be sorted among its siblings */
+struct SortableNode {
+    QDateTime date;
+    uint uid;
+    Responses::ThreadingNode node;
+};
+
+bool sortableNodeLessThan(const SortableNode &a, const SortableNode &b)
+{
+    if (a.date != b.date)
+        return a.date < b.date;
+    return a.uid < b.uid;
+}
+
+/** @short Convert the subtree rooted at the @arg container into nodes which represent it at the level of its parent
+
+This is where the pruning of the empty containers happens. An empty container is dropped, with its children promoted to
+its level. The only exception are the empty containers at the root level which have more than one child; these are kept as
+a zero node so that the siblings are still shown as one thread.
+*/
+QVector<SortableNode> convertContainer(const LocalThreading::Container *container, const bool isRoot)
+{
+    QVector<SortableNode> children;
+    Q_FOREACH(const LocalThreading::Container *child, container->children) {
+        children += convertContainer(child, false);
+    }
+    std::sort(children.begin(), children.end(), sortableNodeLessThan);
+
+    if (!container->uid && (children.isEmpty() || !isRoot || children.size() == 1))
+        return children;
+
+    SortableNode res;
+    res.uid = container->uid;
+    if (container->uid) {
+        res.date = container->date;
+    } else {
+        // An empty container is sorted by its first child
+        res.date = children.front().date;
+    }
+    res.node.num = container->uid;
+    res.node.children.reserve(children.size());
+    Q_FOREACH(const SortableNode &child, children) {
+        res.node.children << child.node;
+    }
+    return QVector<SortableNode>() << res;
+}
+
+}
+
+LocalThreading::LocalThreading()
+{
+}
+
+LocalThreading::~LocalThreading()
+{
+    qDeleteAll(m_idTable);
+    qDeleteAll(m_anonymous);
+}
+
+LocalThreading::Container *LocalThreading::containerFor(const QByteArray &messageId)
+{
+    Container *&container = m_idTable[messageId];
+    if (!container) {
+        container = new Container();
+        container->messageId = messageId;
+    }
+    return container;
+}
+
+/** @short Is the @arg ancestor somewhere on the path from the @arg node to the root? */
+bool LocalThreading::isAncestorOrSelf(const Container *ancestor, const Container *node)
+{
+    for (; node; node = node->parent) {
+        if (node == ancestor)
+            return true;
+    }
+    return false;
+}
+
+void LocalThreading::setParent(Container *child, Container *parent)
+{
+    if (child->parent == parent)
+        return;
+    if (child->parent) {
+        auto &siblings = child->parent->children;
+        siblings.erase(std::find(siblings.begin(), siblings.end(), child));
+        m_pruneCandidates.insert(child->parent);
+    }
+    child->parent = parent;
+    if (parent)
+        parent->children << child;
+}
+
+void LocalThreading::addMessages(const QVector<Message> &messages)
+{
+    Q_FOREACH(const Message &message, messages) {
+        addMessage(message);
+    }
+    pruneEmptyContainers();
+}
+
+void LocalThreading::addMessage(const Message &message)
+{
+    Q_ASSERT(message.uid);
+
+    // Forget what we knew about this message before; its container stays in place as an empty one until the next pruning
+    if (Container *previous = m_uidTable.take(message.uid)) {
+        previous->uid = 0;
+        previous->date = QDateTime();
+        m_pruneCandidates.insert(previous);
+    }
+
+    Container *container = 0;
+    if (!message.messageId.isEmpty()) {
+        container = containerFor(message.messageId);
+        if (container->uid) {
+            // Duplicate Message-Id; the JWZ says that it's better to treat this one as if it had none
+            container = 0;
+        }
+    }
+    if (!container) {
+        container = new Container();
+        m_anonymous.insert(container);
+    }
+    container->uid = message.uid;
+    container->date = message.date;
+    m_uidTable[message.uid] = container;
+
+    // Link the referenced messages together, but never break any link which was already established
+    Container *previous = 0;
+    Q_FOREACH(const QByteArray &reference, message.references) {
+        if (reference.isEmpty())
+            continue;
+        Container *current = containerFor(reference);
+        // The link might get refused, in which case nothing else keeps this container alive
+        m_pruneCandidates.insert(current);
+        if (previous && !current->parent && !isAncestorOrSelf(current, previous)) {
+            setParent(current, previous);
+        }
+        previous = current;
+    }
+
+    // The message's own idea about its parent takes precedence over what the other messages have said
+    if (previous && isAncestorOrSelf(container, previous))
+        previous = 0;
+    setParent(container, previous);
+}
+
+void LocalThreading::removeMessages(const Imap::Uids &uids)
+{
+    Q_FOREACH(const uint uid, uids) {
+        if (Container *container = m_uidTable.take(uid)) {
+            container->uid = 0;
+            container->date = QDateTime();
+            m_pruneCandidates.insert(container);
+        }
+    }
+    pruneEmptyContainers();
+}
+
+/** @short Free the containers which hold no message and have no children
+
+Such containers do not show up in the result at all. Removing one of them might leave its parent childless, so the pruning
+continues upwards.
+*/
+void LocalThreading::pruneEmptyContainers()
+{
+    while (!m_pruneCandidates.isEmpty()) {
+        auto it = m_pruneCandidates.begin();
+        Container *container = *it;
+        m_pruneCandidates.erase(it);
+        while (container && !container->uid && container->children.isEmpty()) {
+            Container *parent = container->parent;
+            if (parent) {
+                auto &siblings = parent->children;
+                siblings.erase(std::find(siblings.begin(), siblings.end(), container));
+            }
+            if (container->messageId.isEmpty()) {
+                m_anonymous.remove(container);
+            } else {
+                m_idTable.remove(container->messageId);
+            }
+            m_pruneCandidates.remove(container);
+            delete container;
+            container = parent;
+        }
+    }
+}
+
+int LocalThreading::containerCount() const
+{
+    return m_idTable.size() + m_anonymous.size();
+}
+
+QVector<Responses::ThreadingNode> LocalThreading::threads() const
+{
+    QVector<SortableNode> roots;
+    for (auto it = m_idTable.constBegin(); it != m_idTable.constEnd(); ++it) {
+        if (!(*it)->parent)
+            roots += convertContainer(*it, true);
+    }
+    Q_FOREACH(const Container *container, m_anonymous) {
+        if (!container->parent)
+            roots += convertContainer(container, true);
+    }
+    std::sort(roots.begin(), roots.end(), sortableNodeLessThan);
+
+    QVector<Responses::ThreadingNode> res;
+    res.reserve(roots.size());
+    Q_FOREACH(const SortableNode &root, roots) {
+        res << root.node;
+    }
+    return res;
+}
+
+
+LocalThreadingRunner::LocalThreadingRunner(QObject *parent)
+    : QObject(parent)
+    , m_worker(new LocalThreadingWorker())
+{
+    qRegisterMetaType<QVector<Imap::Mailbox::LocalThreading::Message>>("QVector<Imap::Mailbox::LocalThreading::Message>");
+    qRegisterMetaType<Imap::Uids>("Imap::Uids");
+    qRegisterMetaType<QVector<Imap::Responses::ThreadingNode>>("QVector<Imap::Responses::ThreadingNode>");
+    connect(m_worker, &LocalThreadingWorker::threadingComputed, this, &LocalThreadingRunner::threadingComputed);
+    m_thread.setObjectName(QStringLiteral("LocalThreading"));
+    m_worker->moveToThread(&m_thread);
+    m_thread.start();
+}
+
+LocalThreadingRunner::~LocalThreadingRunner()
+{
+    m_thread.quit();
+    m_thread.wait();
+    delete m_worker;
+}
+
+void LocalThreadingRunner::update(const QVector<LocalThreading::Message> &added, const Imap::Uids &removed)
+{
+    bool ok = QMetaObject::invokeMethod(m_worker, "update", Qt::QueuedConnection,
+                                        Q_ARG(QVector<Imap::Mailbox::LocalThreading::Message>, added),
+                                        Q_ARG(Imap::Uids, removed));
+    Q_ASSERT(ok);
+    Q_UNUSED(ok);
+}
+
+
+LocalThreadingWorker::LocalThreadingWorker()
+    : m_threading(new LocalThreading())
+    , m_computeScheduled(false)
+{
+}
+
+void LocalThreadingWorker::update(const QVector<LocalThreading::Message> &added, const Imap::Uids &removed)
+{
+    m_threading->removeMessages(removed);
+    m_threading->addMessages(added);
+    if (!m_computeScheduled) {
+        // Any updates which have been queued in the meanwhile will be processed before the compute() gets called
+        m_computeScheduled = true;
+        QTimer::singleShot(0, this, SLOT(compute()));
+    }
+}
+
+void LocalThreadingWorker::compute()
+{
+    m_computeScheduled = false;
+    emit threadingComputed(m_threading->threads());
+}
+
+}
+}
@@ -0,0 +1,154 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_LOCALTHREADING_H
+#define IMAP_MODEL_LOCALTHREADING_H
+
+#include <memory>
+#include <QDateTime>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QThread>
+#include <QVector>
+#include "Imap/Parser/ThreadingNode.h"
+#include "Imap/Parser/Uids.h"
+
+namespace Imap
+{
+
+namespace Mailbox
+{
+
+/** @short Client-side threading of messages for servers which do not support the THREAD extension
+
+This is the algorithm by Jamie Zawinski (http://www.jwz.org/doc/threading.html) which also forms the base of the
+REFERENCES and REFS algorithms from RFC 5256. Just like the REFS, the messages are not grouped by their subjects, so
+the threads are based solely on the Message-Id, References and In-Reply-To headers. The result has the very same format as
+a THREAD response, including the zero nodes for messages which are referenced, but which are not present in the mailbox.
+
+The Message-Id table is kept between the calls, so adding a few new arrivals only has to link these new messages. Only
+the final walk over the tree which produces the THREAD-like result has to visit all messages. The containers which no
+longer hold any message and which have no children are freed at the end of each update, so the tables do not keep growing
+as messages come and go.
+*/
+class LocalThreading
+{
+public:
+    /** @short Metadata of one message which are relevant for threading */
+    struct Message {
+        uint uid;
+        QByteArray messageId;
+        /** @short Content of the References header followed by the In-Reply-To */
+        QList<QByteArray> references;
+        QDateTime date;
+        Message(): uid(0) {}
+    };
+
+    /** @short Node of the threading tree; an implementation detail */
+    struct Container;
+
+    LocalThreading();
+    ~LocalThreading();
+
+    /** @short Add these messages, replacing any previous data about the same UIDs */
+    void addMessages(const QVector<Message> &messages);
+    /** @short The messages with these UIDs are gone from the mailbox */
+    void removeMessages(const Imap::Uids &uids);
+    /** @short Return the threading in the same form as if it came from a THREAD response */
+    QVector<Responses::ThreadingNode> threads() const;
+    /** @short Number of nodes of the threading tree which are currently allocated */
+    int containerCount() const;
+
+private:
+    Container *containerFor(const QByteArray &messageId);
+    void addMessage(const Message &message);
+    static bool isAncestorOrSelf(const Container *ancestor, const Container *node);
+    void setParent(Container *child, Container *parent);
+    void pruneEmptyContainers();
+
+    Q_DISABLE_COPY(LocalThreading)
+
+    /** @short All containers which have a Message-Id */
+    QHash<QByteArray, Container *> m_idTable;
+    /** @short Containers of messages whose Message-Id is either unknown, or duplicate */
+    QSet<Container *> m_anonymous;
+    /** @short Mapping of UIDs to their containers */
+    QHash<uint, Container *> m_uidTable;
+    /** @short Containers which might have become empty and childless since the last pruning */
+    QSet<Container *> m_pruneCandidates;
+};
+
+class LocalThreadingWorker;
+
+/** @short Run the LocalThreading in a background thread
+
+Each ThreadingMsgListModel which needs it has its own LocalThreadingRunner; the runner owns its LocalThreading which
+is only ever accessed from the worker thread. Updates which are submitted while the worker is busy are merged together,
+and only one result is produced for them.
+*/
+class LocalThreadingRunner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LocalThreadingRunner(QObject *parent = 0);
+    virtual ~LocalThreadingRunner();
+
+    /** @short Update the threading and compute it once again; the result is reported via threadingComputed() */
+    void update(const QVector<LocalThreading::Message> &added, const Imap::Uids &removed);
+
+signals:
+    void threadingComputed(const QVector<Imap::Responses::ThreadingNode> &mapping);
+
+private:
+    QThread m_thread;
+    LocalThreadingWorker *m_worker;
+};
+
+/** @short Helper of the LocalThreadingRunner which lives in the worker thread */
+class LocalThreadingWorker : public QObject
+{
+    Q_OBJECT
+public:
+    LocalThreadingWorker();
+
+public slots:
+    void update(const QVector<Imap::Mailbox::LocalThreading::Message> &added, const Imap::Uids &removed);
+
+signals:
+    void threadingComputed(const QVector<Imap::Responses::ThreadingNode> &mapping);
+
+private slots:
+    void compute();
+
+private:
+    std::unique_ptr<LocalThreading> m_threading;
+    bool m_computeScheduled;
+};
+
+}
+
+}
+
+Q_DECLARE_METATYPE(Imap::Mailbox::LocalThreading::Message)
+
+#endif // IMAP_MODEL_LOCALTHREADING_H
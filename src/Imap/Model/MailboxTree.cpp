@@ -21,11 +21,14 @@
 */
 
 #include <algorithm>
+#include <iterator>
 #include <QTextStream>
 #include "Common/FindWithUnknown.h"
 #include "Common/InvokeMethod.h"
 #include "Common/MetaTypes.h"
+#include "Common/SlabAllocator.h"
 #include "Imap/Encoders.h"
+#include "Imap/Parser/LiteralSink.h"
 #include "Imap/Parser/Rfc5322HeaderParser.h"
 #include "Imap/Tasks/KeepMailboxOpenTask.h"
 #include "UiUtils/Formatting.h"
@@ -41,6 +44,164 @@ namespace Imap
 namespace Mailbox
 {
 
+namespace {
+
+bool uidComparator(const TreeItem *const item, const uint uid)
+{
+    const TreeItemMessage *const message = static_cast<const TreeItemMessage *const>(item);
+    uint messageUid = message->uid();
+    Q_ASSERT(messageUid);
+    return messageUid < uid;
+}
+
+bool messageHasUidZero(const TreeItem *const item)
+{
+    const TreeItemMessage *const message = static_cast<const TreeItemMessage *const>(item);
+    return message->uid() == 0;
+}
+
+/** @short Keep track of which rows of a list are still alive while a batch of removals is being prepared
+
+This is a Fenwick tree over the original rows, so that both the removal and the lookup of the N-th surviving row
+are logarithmic. Without this, applying N expunges to a mailbox with M messages would be O(N * M).
+*/
+class SurvivingRows
+{
+public:
+    explicit SurvivingRows(const int size)
+        : m_tree(size + 1, 0)
+        , m_remaining(size)
+        , m_topBit(1)
+    {
+        for (int i = 1; i <= size; ++i) {
+            m_tree[i] = i & -i;
+        }
+        while (m_topBit * 2 <= size) {
+            m_topBit *= 2;
+        }
+    }
+
+    /** @short Number of rows which have not been removed yet */
+    int size() const
+    {
+        return m_remaining;
+    }
+
+    /** @short Map an offset into the surviving rows to the original row */
+    int originalRow(const int survivingOffset) const
+    {
+        Q_ASSERT(survivingOffset >= 0 && survivingOffset < m_remaining);
+        int position = 0;
+        int remaining = survivingOffset + 1;
+        for (int step = m_topBit; step; step >>= 1) {
+            if (position + step < m_tree.size() && m_tree[position + step] < remaining) {
+                position += step;
+                remaining -= m_tree[position];
+            }
+        }
+        return position;
+    }
+
+    /** @short Mark the original row as removed */
+    void remove(const int originalRow)
+    {
+        for (int i = originalRow + 1; i < m_tree.size(); i += i & -i) {
+            --m_tree[i];
+        }
+        --m_remaining;
+    }
+
+private:
+    QVector<int> m_tree;
+    int m_remaining;
+    int m_topBit;
+};
+
+/** @short Random access iterator over those messages which are still present according to SurvivingRows */
+class SurvivingMessageIterator
+{
+public:
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef TreeItem *value_type;
+    typedef int difference_type;
+    typedef TreeItem *const *pointer;
+    typedef TreeItem *const &reference;
+
+    SurvivingMessageIterator()
+        : m_children(nullptr)
+        , m_rows(nullptr)
+        , m_offset(0)
+    {
+    }
+
+    SurvivingMessageIterator(const TreeItemChildrenList *children, const SurvivingRows *rows, const int offset)
+        : m_children(children)
+        , m_rows(rows)
+        , m_offset(offset)
+    {
+    }
+
+    reference operator*() const
+    {
+        return (*m_children)[row()];
+    }
+
+    /** @short Row of the current message in the original list */
+    int row() const
+    {
+        return m_rows->originalRow(m_offset);
+    }
+
+    SurvivingMessageIterator &operator++()
+    {
+        ++m_offset;
+        return *this;
+    }
+
+    SurvivingMessageIterator &operator--()
+    {
+        --m_offset;
+        return *this;
+    }
+
+    SurvivingMessageIterator operator+(const int n) const
+    {
+        return SurvivingMessageIterator(m_children, m_rows, m_offset + n);
+    }
+
+    SurvivingMessageIterator operator-(const int n) const
+    {
+        return SurvivingMessageIterator(m_children, m_rows, m_offset - n);
+    }
+
+    int operator-(const SurvivingMessageIterator &other) const
+    {
+        return m_offset - other.m_offset;
+    }
+
+    bool operator==(const SurvivingMessageIterator &other) const
+    {
+        return m_offset == other.m_offset;
+    }
+
+    bool operator!=(const SurvivingMessageIterator &other) const
+    {
+        return m_offset != other.m_offset;
+    }
+
+    bool operator<(const SurvivingMessageIterator &other) const
+    {
+        return m_offset < other.m_offset;
+    }
+
+private:
+    const TreeItemChildrenList *m_children;
+    const SurvivingRows *m_rows;
+    int m_offset;
+};
+
+}
+
 TreeItem::TreeItem(TreeItem *parent): m_parent(parent)
 {
     // These just have to be present in the context of TreeItem, otherwise they couldn't access the protected members
@@ -333,6 +494,9 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
                                       QString::number(list->m_children.size())).toUtf8().constData(), response);
 
     TreeItemMessage *message = static_cast<TreeItemMessage *>(list->child(number, model));
+    // The metadata are only worth saving when this very response has completed them; when they were complete already,
+    // they have either been saved before or have been loaded from the cache
+    const bool wasComplete = message->m_data && message->m_data->isComplete();
 
     // At first, have a look at the response and check the UID of the message
     if (uidRecord != response.data.constEnd()) {
@@ -393,8 +557,11 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
         } else if (it.key() == "FLAGS") {
             // Only emit signals when the flags have actually changed
             QStringList newFlags = model->normalizeFlags(static_cast<const Responses::RespData<QStringList>&>(*(it.value())).data);
-            bool forceChange = !message->m_flagsHandled || (message->m_flags != newFlags);
+            bool wasHandled = message->m_flagsHandled;
+            FlagsDictionary::Bits oldBits = message->m_flagBits;
+            QStringList oldOverflow = message->m_flagOverflow;
             message->setFlags(list, newFlags);
+            bool forceChange = !wasHandled || oldBits != message->m_flagBits || oldOverflow != message->m_flagOverflow;
             if (forceChange) {
                 updatedFlags = true;
                 changedMessage = message;
@@ -449,7 +616,7 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
             message->data()->setSize(static_cast<const Responses::RespData<quint64>&>(*(it.value())).data);
         } else if (it.key().startsWith("BODY[HEADER.FIELDS (")) {
             // Process any headers found in any such response bit
-            const QByteArray &rawHeaders = static_cast<const Responses::RespData<QByteArray>&>(*(it.value())).data;
+            const QByteArray rawHeaders = Responses::Fetch::payload(*(it.value()));
             message->processAdditionalHeaders(model, rawHeaders);
             changedMessage = message;
         } else if (it.key().startsWith("BODY[") || it.key().startsWith("BINARY[")) {
@@ -458,19 +625,28 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
             TreeItemPart *part = partIdToPtr(model, message, it.key());
             if (! part)
                 throw UnknownMessageIndex("Got BODY[]/BINARY[] fetch that did not resolve to any known part", response);
-            const QByteArray &data = static_cast<const Responses::RespData<QByteArray>&>(*(it.value())).data;
+            // A huge payload stays in the Parser's spool until somebody actually asks for the data; the part and the cache
+            // both read it from there on their own
+            const QSharedPointer<LiteralSink> spooled = Responses::Fetch::spooledPayload(*(it.value()));
+            const QByteArray data = spooled ? QByteArray() : Responses::Fetch::payload(*(it.value()));
             if (it.key().startsWith("BODY[")) {
 
                 // Check whether we are supposed to be loading the raw, undecoded part as well.
                 // The check has to be done via a direct pointer access to m_partRaw to make sure that it does not
                 // get instantiated when not actually needed.
                 if (part->m_partRaw && part->m_partRaw->loading()) {
-                    part->m_partRaw->m_data = data;
+                    if (spooled)
+                        part->m_partRaw->setSpooledData(spooled, QByteArray());
+                    else
+                        part->m_partRaw->m_data = data;
                     part->m_partRaw->setFetchStatus(DONE);
                     changedParts.append(part->m_partRaw);
                     if (message->uid()) {
                         model->cache()->forgetMessagePart(mailbox(), message->uid(), part->partId());
-                        model->cache()->setMsgPart(mailbox(), message->uid(), part->partId() + ".X-RAW", data);
+                        if (spooled)
+                            model->cache()->setSpooledMsgPart(mailbox(), message->uid(), part->partId() + ".X-RAW", spooled, QByteArray());
+                        else
+                            model->cache()->setMsgPart(mailbox(), message->uid(), part->partId() + ".X-RAW", data);
                     }
                 }
 
@@ -479,23 +655,35 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
                 // we were in fact asked to only fetch the raw data and the user is not itnerested in the processed data at all.
                 if (part->loading()) {
                     // got to decode the part data by hand
-                    Imap::decodeContentTransferEncoding(data, part->transferEncoding(), part->dataPtr());
+                    if (spooled)
+                        part->setSpooledData(spooled, part->transferEncoding());
+                    else
+                        Imap::decodeContentTransferEncoding(data, part->transferEncoding(), part->dataPtr());
                     part->setFetchStatus(DONE);
                     changedParts.append(part);
                     if (message->uid()
                             && model->cache()->messagePart(mailbox(), message->uid(), part->partId() + ".X-RAW").isNull()) {
                         // Do not store the data into cache if the raw data are already there
-                        model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
+                        if (spooled)
+                            model->cache()->setSpooledMsgPart(mailbox(), message->uid(), part->partId(), spooled, part->transferEncoding());
+                        else
+                            model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
                     }
                 }
 
             } else {
                 // A BINARY FETCH item is already decoded for us, yay
-                part->m_data = data;
+                if (spooled)
+                    part->setSpooledData(spooled, QByteArray());
+                else
+                    part->m_data = data;
                 part->setFetchStatus(DONE);
                 changedParts.append(part);
                 if (message->uid()) {
-                    model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
+                    if (spooled)
+                        model->cache()->setSpooledMsgPart(mailbox(), message->uid(), part->partId(), spooled, QByteArray());
+                    else
+                        model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
                 }
             }
         } else if (it.key() == "INTERNALDATE") {
@@ -505,7 +693,7 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
         }
     }
     if (message->uid()) {
-        if (message->data()->isComplete() && model->cache()->messageMetadata(mailbox(), message->uid()).uid == 0) {
+        if (!wasComplete && message->data()->isComplete()) {
              model->cache()->setMessageMetadata(
                          mailbox(), message->uid(),
                          Imap::Mailbox::AbstractCache::MessageDataBundle(
@@ -521,7 +709,7 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
              message->setFetchStatus(DONE);
         }
         if (updatedFlags) {
-            model->cache()->setMsgFlags(mailbox(), message->uid(), message->m_flags);
+            model->cache()->setMsgFlags(mailbox(), message->uid(), message->flags());
         }
     }
 }
@@ -555,46 +743,144 @@ void TreeItemMailbox::saveSyncStateAndUids(Model * model)
 void TreeItemMailbox::handleExpunge(Model *const model, const Responses::NumberResponse &resp)
 {
     Q_ASSERT(resp.kind == Responses::EXPUNGE);
+    handleExpunges(model, QVector<uint>() << resp.number);
+}
+
+/** @short Process a burst of consecutive EXPUNGE responses at once
+
+The sequence numbers are interpreted just like the server sent them, i.e. each of them refers to the state of the mailbox
+after all of the preceding ones have been applied. The messages are nonetheless removed in one go, with a single
+rowsRemoved() per contiguous range of messages and with a single renumbering pass.
+*/
+void TreeItemMailbox::handleExpunges(Model *const model, const QVector<uint> &sequenceNumbers)
+{
     TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(m_children[ 0 ]);
     Q_ASSERT(list);
-    if (resp.number > static_cast<uint>(list->m_children.size()) || resp.number == 0) {
-        throw UnknownMessageIndex("EXPUNGE references message number which is out-of-bounds");
-    }
-    uint offset = resp.number - 1;
 
-    model->beginRemoveRows(list->toIndex(model), offset, offset);
-    auto it = list->m_children.begin() + offset;
-    TreeItemMessage *message = static_cast<TreeItemMessage *>(*it);
-    list->m_children.erase(it);
-    model->cache()->clearMessage(static_cast<TreeItemMailbox *>(list->parent())->mailbox(), message->uid());
-    for (int i = offset; i < list->m_children.size(); ++i) {
-        --static_cast<TreeItemMessage *>(list->m_children[i])->m_offset;
+    // Translate the sequence numbers into the current row numbers before touching anything
+    SurvivingRows surviving(list->m_children.size());
+    QVector<int> rows;
+    rows.reserve(sequenceNumbers.size());
+    Imap::Uids uids;
+    uids.reserve(sequenceNumbers.size());
+    for (const uint number : sequenceNumbers) {
+        if (number > static_cast<uint>(surviving.size()) || number == 0) {
+            throw UnknownMessageIndex("EXPUNGE references message number which is out-of-bounds");
+        }
+        int row = surviving.originalRow(number - 1);
+        surviving.remove(row);
+        rows << row;
+        uids << static_cast<TreeItemMessage *>(list->m_children[row])->uid();
     }
-    model->endRemoveRows();
 
-    --list->m_totalMessageCount;
-    list->recalcVariousMessageCountsOnExpunge(const_cast<Model *>(model), message);
+    if (rows.isEmpty())
+        return;
+
+    auto expunged = removeMessages(model, rows, uids);
+
+    list->m_totalMessageCount -= expunged.size();
+    list->recalcVariousMessageCountsOnExpunge(const_cast<Model *>(model), expunged);
 
-    delete message;
+    qDeleteAll(expunged);
 
     // The UID map is not synced at this time, though, and we defer a decision on when to do this to the context
     // of the task which invoked this method. The idea is that this task has a better insight for potentially
-    // batching these changes to prevent useless hammering of the saveUidMap() etc.
+    // batching these changes to prevent useless hammering of the saveUidMap() etc. The forgetSavedUid() in
+    // removeMessages() makes sure that the saveUidMap() will be able to write just the difference.
     // Previously, the code would simetimes do this twice in a row, which is kinda suboptimal...
 }
 
+/** @short Detach messages at the specified rows from the list of messages
+
+The caller is responsible for updating the message counts and for deleting the returned messages. The \a cachedUids
+are forgotten in the cache.
+*/
+TreeItemChildrenList TreeItemMailbox::removeMessages(Model *const model, const QVector<int> &rows, const Imap::Uids &cachedUids)
+{
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(m_children[ 0 ]);
+    Q_ASSERT(list);
+
+    TreeItemChildrenList removed;
+    if (rows.isEmpty())
+        return removed;
+
+    auto sortedRows = rows;
+    qSort(sortedRows);
+    Q_ASSERT(std::adjacent_find(sortedRows.constBegin(), sortedRows.constEnd()) == sortedRows.constEnd());
+
+    QModelIndex listIndex = list->toIndex(model);
+    removed.reserve(sortedRows.size());
+
+    // The m_offset of the messages is fixed at the very end, in a single pass. Until then, the row() has to be
+    // looked up the slow way because the views are free to ask about the surviving messages.
+    list->m_messageOffsetsStale = true;
+
+    // Going from the end ensures that the row numbers of the ranges which have not been removed yet stay valid
+    int end = sortedRows.size();
+    while (end > 0) {
+        int begin = end - 1;
+        while (begin > 0 && sortedRows[begin - 1] == sortedRows[begin] - 1)
+            --begin;
+        const int firstRow = sortedRows[begin];
+        const int lastRow = sortedRows[end - 1];
+        model->beginRemoveRows(listIndex, firstRow, lastRow);
+        auto first = list->m_children.begin() + firstRow;
+        auto last = list->m_children.begin() + lastRow + 1;
+        for (auto it = first; it != last; ++it) {
+            removed << *it;
+        }
+        list->m_children.erase(first, last);
+        model->endRemoveRows();
+        end = begin;
+    }
+
+    for (int i = sortedRows.front(); i < list->m_children.size(); ++i) {
+        static_cast<TreeItemMessage *>(list->m_children[i])->m_offset = i;
+    }
+    list->m_messageOffsetsStale = false;
+
+    for (TreeItem *item : removed) {
+        list->forgetSavedUid(static_cast<TreeItemMessage *>(item)->uid());
+    }
+    model->cache()->clearMessages(mailbox(), cachedUids);
+    return removed;
+}
+
 void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanished &resp)
 {
     TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(m_children[ 0 ]);
     Q_ASSERT(list);
     QModelIndex listIndex = list->toIndex(model);
 
-    auto uids = resp.uids;
-    qSort(uids);
-    // Remove duplicates -- even that garbage can be present in a perfectly valid VANISHED :(
-    uids.erase(std::unique(uids.begin(), uids.end()), uids.end());
+    QVector<int> rows;
+    Imap::Uids cachedUids;
+    // Sorted and without duplicates -- even that garbage can be present in a perfectly valid VANISHED :(
+    Imap::Uids uids;
+
+    if (resp.earlier == Responses::Vanished::EARLIER && resp.uids.size() > static_cast<quint64>(list->m_children.size())) {
+        // The VANISHED (EARLIER) only removes the messages whose UIDs are known, but the ranges which it covers are free
+        // to include any number of UIDs which we have never seen. Checking each message is cheaper than looking them up.
+        if (resp.uids.contains(0)) {
+            model->logTrace(listIndex.parent(), Common::LOG_MAILBOX_SYNC, QStringLiteral("TreeItemMailbox::handleVanished"),
+                            QStringLiteral("VANISHED contains UID zero for increased fun"));
+        }
+        for (int row = 0; row < list->m_children.size(); ++row) {
+            const uint uid = static_cast<TreeItemMessage *>(list->m_children[row])->uid();
+            if (uid == 0 || !resp.uids.contains(uid))
+                continue;
+            rows << row;
+            cachedUids << uid;
+            if (syncState.uidNext() <= uid)
+                syncState.setUidNext(uid + 1);
+        }
+    } else {
+        uids = resp.uids.toVector();
+    }
+
+    // The messages are only marked for removal at first; the lookups work on the list of messages which survived so far
+    SurvivingRows surviving(list->m_children.size());
+    const SurvivingMessageIterator survivingBegin(&list->m_children, &surviving, 0);
 
-    auto it = list->m_children.end();
     while (!uids.isEmpty()) {
         // We have to process each UID separately because the UIDs in the mailbox are not necessarily present
         // in a continuous range; zeros might be present
@@ -608,7 +894,7 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
             break;
         }
 
-        if (list->m_children.isEmpty()) {
+        if (surviving.size() == 0) {
             // Well, it'd be cool to throw an exception here but VANISHED is free to contain references to UIDs which are not here
             // at all...
             qDebug() << "VANISHED attempted to remove too many messages";
@@ -619,15 +905,16 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
 
         // Find a highest message with UID zero such as no message with non-zero UID higher than the current UID exists
         // at a position after the target message
-        it = model->findMessageOrNextOneByUid(list, uid);
+        const SurvivingMessageIterator survivingEnd = survivingBegin + surviving.size();
+        auto it = Common::lowerBoundWithUnknownElements(survivingBegin, survivingEnd, uid, messageHasUidZero, uidComparator);
 
-        if (it == list->m_children.end()) {
+        if (it == survivingEnd) {
             // this is a legitimate situation, the UID of the last message in the mailbox which is getting expunged right now
             // could very well be not know at this point
             --it;
         }
         // there's a special case above guarding against an empty list
-        Q_ASSERT(it >= list->m_children.begin());
+        Q_ASSERT(!(it < survivingBegin));
 
         TreeItemMessage *msgCandidate = static_cast<TreeItemMessage*>(*it);
         if (msgCandidate->uid() == uid) {
@@ -638,7 +925,7 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
         } else if (msgCandidate->uid() == 0) {
             // will be deleted
         } else {
-            if (it != list->m_children.begin()) {
+            if (it != survivingBegin) {
                 --it;
                 msgCandidate = static_cast<TreeItemMessage*>(*it);
                 if (msgCandidate->uid() == 0) {
@@ -649,7 +936,7 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
                     QTextStream ss(&str);
                     ss << "VANISHED refers to UID " << uid << " which wasn't found in the mailbox (found adjacent UIDs " <<
                           msgCandidate->uid() << " and " << static_cast<TreeItemMessage*>(*(it + 1))->uid() << " with " <<
-                          static_cast<TreeItemMessage*>(*(list->m_children.end() - 1))->uid() << " at the end)";
+                          static_cast<TreeItemMessage*>(*(survivingEnd - 1))->uid() << " at the end)";
                     ss.flush();
                     qDebug() << str.toUtf8().constData();
                     model->logTrace(listIndex.parent(), Common::LOG_MAILBOX_SYNC, QStringLiteral("TreeItemMailbox::handleVanished"), str);
@@ -660,7 +947,7 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
                 QString str;
                 QTextStream ss(&str);
                 ss << "VANISHED refers to UID " << uid << " which is too low (lowest UID is " <<
-                      static_cast<TreeItemMessage*>(list->m_children.front())->uid() << ")";
+                      static_cast<TreeItemMessage*>(*survivingBegin)->uid() << ")";
                 ss.flush();
                 qDebug() << str.toUtf8().constData();
                 model->logTrace(listIndex.parent(), Common::LOG_MAILBOX_SYNC, QStringLiteral("TreeItemMailbox::handleVanished"), str);
@@ -668,24 +955,21 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
             }
         }
 
-        int row = msgCandidate->row();
-        Q_ASSERT(row == it - list->m_children.begin());
-        model->beginRemoveRows(listIndex, row, row);
-        it = list->m_children.erase(it);
-        for (auto furtherMessage = it; furtherMessage != list->m_children.end(); ++furtherMessage) {
-            --static_cast<TreeItemMessage *>(*furtherMessage)->m_offset;
-        }
-        model->endRemoveRows();
+        int row = it.row();
+        Q_ASSERT(list->m_children[row] == msgCandidate);
+        surviving.remove(row);
+        rows << row;
+        cachedUids << uid;
 
         if (syncState.uidNext() <= uid) {
             // We're informed about a message being deleted; this means that that UID must have been in the mailbox for some
             // (possibly tiny) time and we can therefore use it to get an idea about the UIDNEXT
             syncState.setUidNext(uid + 1);
         }
-        model->cache()->clearMessage(mailbox(), uid);
-        delete msgCandidate;
     }
 
+    qDeleteAll(removeMessages(model, rows, cachedUids));
+
     if (resp.earlier == Responses::Vanished::EARLIER && static_cast<uint>(list->m_children.size()) < syncState.exists()) {
         // Okay, there were some new arrivals which we failed to take into account because we had processed EXISTS
         // before VANISHED (EARLIER). That means that we have to add some of that messages back right now.
@@ -814,7 +1098,8 @@ bool TreeItemMailbox::isSelectable() const
 
 TreeItemMsgList::TreeItemMsgList(TreeItem *parent):
     TreeItem(parent), m_numberFetchingStatus(NONE), m_totalMessageCount(-1),
-    m_unreadMessageCount(-1), m_recentMessageCount(-1)
+    m_unreadMessageCount(-1), m_recentMessageCount(-1), m_savedUidsValid(false), m_savedUidCount(0), m_savedHighestUid(0),
+    m_messageOffsetsStale(false), m_lastUseSweep(0)
 {
     if (!parent->parent())
         setFetchStatus(DONE);
@@ -822,6 +1107,7 @@ TreeItemMsgList::TreeItemMsgList(TreeItem *parent):
 
 void TreeItemMsgList::fetch(Model *const model)
 {
+    markAsUsed(model);
     if (fetched() || isUnavailable())
         return;
 
@@ -922,7 +1208,7 @@ void TreeItemMsgList::recalcVariousMessageCounts(Model *model)
     model->emitMessageCountChanged(static_cast<TreeItemMailbox *>(parent()));
 }
 
-void TreeItemMsgList::recalcVariousMessageCountsOnExpunge(Model *model, TreeItemMessage *expungedMessage)
+void TreeItemMsgList::recalcVariousMessageCountsOnExpunge(Model *model, const TreeItemChildrenList &expungedMessages)
 {
     if (m_numberFetchingStatus != DONE) {
         // In case the counts weren't synced before, we cannot really rely on them now -> go to the slow path
@@ -930,13 +1216,16 @@ void TreeItemMsgList::recalcVariousMessageCountsOnExpunge(Model *model, TreeItem
         return;
     }
 
-    bool isRead, isRecent;
-    expungedMessage->checkFlagsReadRecent(isRead, isRecent);
-    if (expungedMessage->m_flagsHandled) {
-        if (!isRead)
-            --m_unreadMessageCount;
-        if (isRecent)
-            --m_recentMessageCount;
+    for (TreeItem *item : expungedMessages) {
+        TreeItemMessage *expungedMessage = static_cast<TreeItemMessage *>(item);
+        bool isRead, isRecent;
+        expungedMessage->checkFlagsReadRecent(isRead, isRecent);
+        if (expungedMessage->m_flagsHandled) {
+            if (!isRead)
+                --m_unreadMessageCount;
+            if (isRecent)
+                --m_recentMessageCount;
+        }
     }
     model->emitMessageCountChanged(static_cast<TreeItemMailbox *>(parent()));
 }
@@ -954,6 +1243,33 @@ bool TreeItemMsgList::numbersFetched() const
     return m_numberFetchingStatus == DONE;
 }
 
+void TreeItemMsgList::setSavedUids(const Imap::Uids &uids)
+{
+    // The saved UID mapping is never supposed to contain zeros, but let's not build upon it if it does
+    m_savedUidsValid = !uids.contains(0);
+    m_savedUidCount = uids.size();
+    m_savedHighestUid = uids.isEmpty() ? 0 : uids.last();
+    m_savedUidsRemoved.clear();
+}
+
+void TreeItemMsgList::invalidateSavedUids()
+{
+    m_savedUidsValid = false;
+    m_savedUidsRemoved.clear();
+}
+
+void TreeItemMsgList::forgetSavedUid(const uint uid)
+{
+    // New arrivals always have higher UIDs than anything which has been saved before
+    if (m_savedUidsValid && uid != 0 && uid <= m_savedHighestUid)
+        m_savedUidsRemoved.append(uid);
+}
+
+void TreeItemMsgList::markAsUsed(Model *const model)
+{
+    m_lastUseSweep = model->m_unloadSweep;
+}
+
 
 
 MessageDataPayload::MessageDataPayload()
@@ -1104,7 +1420,7 @@ void MessageDataPayload::setPartText(std::unique_ptr<TreeItemPart> part)
 
 
 TreeItemMessage::TreeItemMessage(TreeItem *parent):
-    TreeItem(parent), m_offset(-1), m_uid(0), m_data(0), m_flagsHandled(false), m_wasUnread(false)
+    TreeItem(parent), m_offset(-1), m_uid(0), m_data(0), m_flagBits(0), m_flagsHandled(false), m_wasUnread(false)
 {
 }
 
@@ -1113,6 +1429,27 @@ TreeItemMessage::~TreeItemMessage()
     delete m_data;
 }
 
+void *TreeItemMessage::operator new(std::size_t size)
+{
+    return allocator().allocate(size);
+}
+
+void TreeItemMessage::operator delete(void *ptr, std::size_t size)
+{
+    allocator().deallocate(ptr, size);
+}
+
+/** @short The allocator which is shared by all messages
+
+A big mailbox consists of hundreds of thousands of messages which are created in a few batches and usually destroyed
+together, too, which is what the SlabAllocator is good for.
+*/
+Common::SlabAllocator &TreeItemMessage::allocator()
+{
+    static Common::SlabAllocator slabs(sizeof(TreeItemMessage));
+    return slabs;
+}
+
 void TreeItemMessage::fetch(Model *const model)
 {
     if (fetched() || loading() || isUnavailable())
@@ -1190,6 +1527,10 @@ TreeItem *TreeItemMessage::specialColumnPtr(int row, int column) const
 int TreeItemMessage::row() const
 {
     Q_ASSERT(m_offset != -1);
+    if (static_cast<const TreeItemMsgList *>(parent())->m_messageOffsetsStale) {
+        // TreeItemMailbox::removeMessages() is just in the middle of removing a batch of messages
+        return TreeItem::row();
+    }
     return m_offset;
 }
 
@@ -1198,6 +1539,8 @@ QVariant TreeItemMessage::data(Model *const model, int role)
     if (!parent())
         return QVariant();
 
+    static_cast<TreeItemMsgList *>(parent())->markAsUsed(model);
+
     // Special item roles which should not trigger fetching of message metadata
     switch (role) {
     case RoleMessageUid:
@@ -1207,8 +1550,7 @@ QVariant TreeItemMessage::data(Model *const model, int role)
     case RoleIsUnavailable:
         return isUnavailable();
     case RoleMessageFlags:
-        // The flags are already sorted by Model::normalizeFlags()
-        return m_flags;
+        return flags();
     case RoleMessageIsMarkedDeleted:
         return isMarkedAsDeleted();
     case RoleMessageIsMarkedRead:
@@ -1358,76 +1700,60 @@ QVariantList TreeItemMessage::addresListToQVariant(const QList<Imap::Message::Ma
 }
 
 
-namespace {
-
-/** @short Find a string based on d-ptr equality
-
-This works because our flags always use implicit sharing. If they didn't use that, this method wouldn't work.
-*/
-bool containsStringByDPtr(const QStringList &haystack, const QString &needle)
-{
-    const auto sentinel = const_cast<QString&>(needle).data_ptr();
-    Q_FOREACH(const auto &item, haystack) {
-        if (const_cast<QString&>(item).data_ptr() == sentinel)
-            return true;
-    }
-    return false;
-}
-
-}
-
 bool TreeItemMessage::isMarkedAsDeleted() const
 {
-    return containsStringByDPtr(m_flags, FlagNames::deleted);
+    return m_flagBits & FlagsDictionary::bit(FlagsDictionary::FLAG_DELETED);
 }
 
 bool TreeItemMessage::isMarkedAsRead() const
 {
-    return containsStringByDPtr(m_flags, FlagNames::seen);
+    return m_flagBits & FlagsDictionary::bit(FlagsDictionary::FLAG_SEEN);
 }
 
 bool TreeItemMessage::isMarkedAsReplied() const
 {
-    return containsStringByDPtr(m_flags, FlagNames::answered);
+    return m_flagBits & FlagsDictionary::bit(FlagsDictionary::FLAG_ANSWERED);
 }
 
 bool TreeItemMessage::isMarkedAsForwarded() const
 {
-    return containsStringByDPtr(m_flags, FlagNames::forwarded);
+    return m_flagBits & FlagsDictionary::bit(FlagsDictionary::FLAG_FORWARDED);
 }
 
 bool TreeItemMessage::isMarkedAsRecent() const
 {
-    return containsStringByDPtr(m_flags, FlagNames::recent);
+    return m_flagBits & FlagsDictionary::bit(FlagsDictionary::FLAG_RECENT);
 }
 
 bool TreeItemMessage::isMarkedAsFlagged() const
 {
-    return containsStringByDPtr(m_flags, FlagNames::flagged);
+    return m_flagBits & FlagsDictionary::bit(FlagsDictionary::FLAG_FLAGGED);
 }
 
 bool TreeItemMessage::isMarkedAsJunk() const
 {
-    return containsStringByDPtr(m_flags, FlagNames::junk);
+    return m_flagBits & FlagsDictionary::bit(FlagsDictionary::FLAG_JUNK);
 }
 
 bool TreeItemMessage::isMarkedAsNotJunk() const
 {
-    return containsStringByDPtr(m_flags, FlagNames::notjunk);
+    return m_flagBits & FlagsDictionary::bit(FlagsDictionary::FLAG_NOTJUNK);
 }
 
 void TreeItemMessage::checkFlagsReadRecent(bool &isRead, bool &isRecent) const
 {
-    const auto dRead = const_cast<QString&>(FlagNames::seen).data_ptr();
-    const auto dRecent = const_cast<QString&>(FlagNames::recent).data_ptr();
-    auto end = m_flags.end();
-    auto it = m_flags.begin();
-    isRead = isRecent = false;
-    while (it != end && !(isRead && isRecent)) {
-        isRead |= const_cast<QString&>(*it).data_ptr() == dRead;
-        isRecent |= const_cast<QString&>(*it).data_ptr() == dRecent;
-        ++it;
-    }
+    isRead = isMarkedAsRead();
+    isRecent = isMarkedAsRecent();
+}
+
+const FlagsDictionary &TreeItemMessage::flagsDictionary() const
+{
+    return static_cast<TreeItemMsgList *>(parent())->m_flagsDictionary;
+}
+
+QStringList TreeItemMessage::flags() const
+{
+    return flagsDictionary().decode(m_flagBits, m_flagOverflow);
 }
 
 uint TreeItemMessage::uid() const
@@ -1457,7 +1783,7 @@ void TreeItemMessage::setFlags(TreeItemMsgList *list, const QStringList &flags)
 {
     // wasSeen is used to determine if the message was marked as read before this operation
     bool wasSeen = isMarkedAsRead();
-    m_flags = flags;
+    storeFlags(list, flags);
     if (list->m_numberFetchingStatus == DONE) {
         bool isSeen = isMarkedAsRead();
         if (m_flagsHandled) {
@@ -1480,6 +1806,12 @@ void TreeItemMessage::setFlags(TreeItemMsgList *list, const QStringList &flags)
     }
 }
 
+void TreeItemMessage::storeFlags(TreeItemMsgList *list, const QStringList &flags)
+{
+    Q_ASSERT(list == parent());
+    m_flagBits = list->m_flagsDictionary.encode(flags, m_flagOverflow);
+}
+
 /** @short Process the data found in the headers passed along and file in auxiliary metadata
 
 This function accepts a snippet containing some RFC5322 headers of a message, no matter what headers are actually
@@ -1590,6 +1922,22 @@ TreeItemPart::~TreeItemPart()
     delete m_partRaw;
 }
 
+void *TreeItemPart::operator new(std::size_t size)
+{
+    return allocator().allocate(size);
+}
+
+void TreeItemPart::operator delete(void *ptr, std::size_t size)
+{
+    allocator().deallocate(ptr, size);
+}
+
+Common::SlabAllocator &TreeItemPart::allocator()
+{
+    static Common::SlabAllocator slabs(sizeof(TreeItemPart));
+    return slabs;
+}
+
 unsigned int TreeItemPart::childrenCount(Model *const model)
 {
     Q_UNUSED(model);
@@ -1728,11 +2076,14 @@ QVariant TreeItemPart::data(Model *const model, int role)
                QString::fromUtf8(m_mimeType) :
                QStringLiteral("%1: %2").arg(QString::fromUtf8(partId()), QString::fromUtf8(m_mimeType));
     case Qt::ToolTipRole:
+        loadSpooledData();
         return QStringLiteral("%1 bytes of data").arg(m_data.size());
     case RolePartData:
+        loadSpooledData();
         return m_data;
     case RolePartUnicodeText:
         if (m_mimeType.startsWith("text/")) {
+            loadSpooledData();
             return decodeByteArray(m_data, m_charset);
         } else {
             return QVariant();
@@ -1817,9 +2168,26 @@ TreeItemMessage *TreeItemPart::message() const
 
 QByteArray *TreeItemPart::dataPtr()
 {
+    loadSpooledData();
     return &m_data;
 }
 
+void TreeItemPart::setSpooledData(const QSharedPointer<LiteralSink> &data, const QByteArray &transferEncoding)
+{
+    m_data.clear();
+    m_spooledData = data;
+    m_spooledEncoding = transferEncoding;
+}
+
+void TreeItemPart::loadSpooledData()
+{
+    if (!m_spooledData)
+        return;
+    Imap::decodeContentTransferEncoding(m_spooledData->readAll(), m_spooledEncoding, &m_data);
+    m_spooledData.clear();
+    m_spooledEncoding.clear();
+}
+
 unsigned int TreeItemPart::columnCount()
 {
     if (isTopLevelMultiPart()) {
@@ -1869,6 +2237,8 @@ void TreeItemPart::silentlyReleaseMemoryRecursive()
         m_partRaw = 0;
     }
     m_data.clear();
+    m_spooledData.clear();
+    m_spooledEncoding.clear();
     setFetchStatus(NONE);
     qDeleteAll(m_children);
     m_children.clear();
@@ -27,11 +27,17 @@
 #include <QList>
 #include <QModelIndex>
 #include <QPointer>
+#include <QSet>
 #include <QString>
 #include "../Parser/Response.h"
 #include "../Parser/Message.h"
+#include "FlagsDictionary.h"
 #include "MailboxMetadata.h"
 
+namespace Common {
+class SlabAllocator;
+}
+
 namespace Imap
 {
 
@@ -188,6 +194,7 @@ public:
                              bool usingQresync);
     void rescanForChildMailboxes(Model *const model);
     void handleExpunge(Model *const model, const Responses::NumberResponse &resp);
+    void handleExpunges(Model *const model, const QVector<uint> &sequenceNumbers);
     void handleExists(Model *const model, const Responses::NumberResponse &resp);
     void handleVanished(Model *const model, const Responses::Vanished &resp);
     bool isSelectable() const;
@@ -196,6 +203,7 @@ public:
 
 private:
     TreeItemPart *partIdToPtr(Model *model, TreeItemMessage *message, const QByteArray &msgId);
+    TreeItemChildrenList removeMessages(Model *const model, const QVector<int> &rows, const Imap::Uids &cachedUids);
 
     /** @short ImapTask which is currently responsible for well-being of this mailbox */
     QPointer<KeepMailboxOpenTask> maintainingTask;
@@ -213,6 +221,21 @@ class TreeItemMsgList: public TreeItem
     int m_totalMessageCount;
     int m_unreadMessageCount;
     int m_recentMessageCount;
+    FlagsDictionary m_flagsDictionary;
+    /** @short Do the m_saved* members describe the UID mapping which is stored in the cache? */
+    bool m_savedUidsValid;
+    /** @short Number of UIDs in the cached UID mapping */
+    int m_savedUidCount;
+    /** @short The highest UID in the cached UID mapping */
+    uint m_savedHighestUid;
+    /** @short UIDs of messages which are gone from this list, but which are still present in the cached UID mapping */
+    Imap::Uids m_savedUidsRemoved;
+    /** @short Are the TreeItemMessage::m_offset values out of date because a batch of messages is being removed? */
+    bool m_messageOffsetsStale;
+    /** @short Value of Model::m_unloadSweep when the messages were accessed for the last time */
+    uint m_lastUseSweep;
+    /** @short UIDs of the messages which the user can see right now; empty if not known */
+    QSet<uint> m_visibleUids;
 public:
     explicit TreeItemMsgList(TreeItem *parent);
 
@@ -226,9 +249,17 @@ public:
     int recentMessageCount(Model *const model);
     void fetchNumbers(Model *const model);
     void recalcVariousMessageCounts(Model *model);
-    void recalcVariousMessageCountsOnExpunge(Model *model, TreeItemMessage *expungedMessage);
+    void recalcVariousMessageCountsOnExpunge(Model *model, const TreeItemChildrenList &expungedMessages);
     void resetWasUnreadState();
     bool numbersFetched() const;
+    /** @short The cache now contains exactly these UIDs, see Model::saveUidMap() */
+    void setSavedUids(const Imap::Uids &uids);
+    /** @short This list has changed in a way which cannot be tracked incrementally */
+    void invalidateSavedUids();
+    /** @short Remember that a message with this UID has been removed from the list */
+    void forgetSavedUid(const uint uid);
+    /** @short The messages are in use right now, so Model::unloadIdleMailboxes() shall keep them for a while */
+    void markAsUsed(Model *const model);
 };
 
 class MessageDataPayload
@@ -292,17 +323,25 @@ class TreeItemMessage: public TreeItem
     friend class Model;
     friend class ObtainSynchronizedMailboxTask; // needs access to m_offset
     friend class KeepMailboxOpenTask; // needs access to m_offset
-    friend class ThreadingMsgListModel; // needs access to m_flags
-    friend class UpdateFlagsTask; // needs access to m_flags
-    friend class UpdateFlagsOfAllMessagesTask; // needs access to m_flags
+    friend class ThreadingMsgListModel; // needs access to m_flagBits
+    friend class UpdateFlagsTask; // needs access to flags()
+    friend class UpdateFlagsOfAllMessagesTask; // needs access to flags()
     int m_offset;
     uint m_uid;
     mutable MessageDataPayload *m_data;
-    QStringList m_flags;
+    /** @short Flags of this message as atoms of the parent TreeItemMsgList's FlagsDictionary */
+    FlagsDictionary::Bits m_flagBits;
+    /** @short Flags which did not fit into the m_flagBits; usually empty */
+    QStringList m_flagOverflow;
     bool m_flagsHandled;
     bool m_wasUnread;
     /** @short Set FLAGS and maintain the unread message counter */
     void setFlags(TreeItemMsgList *list, const QStringList &flags);
+    /** @short Set FLAGS without touching any counters */
+    void storeFlags(TreeItemMsgList *list, const QStringList &flags);
+    /** @short Return the sorted list of flags */
+    QStringList flags() const;
+    const FlagsDictionary &flagsDictionary() const;
     void processAdditionalHeaders(Model *model, const QByteArray &rawHeaders);
     static bool hasNestedAttachments(Model *const model, TreeItemPart *part);
 
@@ -315,6 +354,11 @@ public:
     explicit TreeItemMessage(TreeItem *parent);
     ~TreeItemMessage();
 
+    /** @short Messages are allocated from a Common::SlabAllocator, see allocator() */
+    static void *operator new(std::size_t size);
+    static void operator delete(void *ptr, std::size_t size);
+    static Common::SlabAllocator &allocator();
+
     virtual int row() const;
     virtual void fetch(Model *const model);
     virtual unsigned int rowCount(Model *const model);
@@ -353,6 +397,10 @@ class TreeItemPart: public TreeItem
     QByteArray m_delSp;
     QByteArray m_transferEncoding;
     QByteArray m_data;
+    /** @short Payload which the Parser has spooled; it is moved into m_data only when somebody asks for it */
+    QSharedPointer<LiteralSink> m_spooledData;
+    /** @short The Content-Transfer-Encoding which has to be undone when loading the m_spooledData */
+    QByteArray m_spooledEncoding;
     QByteArray m_bodyFldId;
     QByteArray m_bodyDisposition;
     QString m_fileName;
@@ -366,6 +414,11 @@ public:
     TreeItemPart(TreeItem *parent, const QByteArray &mimeType);
     ~TreeItemPart();
 
+    /** @short Parts are allocated from a Common::SlabAllocator; the derived classes use the global heap */
+    static void *operator new(std::size_t size);
+    static void operator delete(void *ptr, std::size_t size);
+    static Common::SlabAllocator &allocator();
+
     virtual unsigned int childrenCount(Model *const model);
     virtual TreeItem *child(const int offset, Model *const model);
     virtual TreeItemChildrenList setChildren(const TreeItemChildrenList &items);
@@ -399,6 +452,8 @@ public:
         Imap::Network::MsgPartNetworkReply.
      */
     QByteArray *dataPtr();
+    /** @short Use a spooled literal as the data of this part, undoing the @arg transferEncoding once it gets accessed */
+    void setSpooledData(const QSharedPointer<LiteralSink> &data, const QByteArray &transferEncoding);
     QByteArray mimeType() const { return m_mimeType; }
     QByteArray charset() const { return m_charset; }
     void setCharset(const QByteArray &ch) { m_charset = ch; }
@@ -425,6 +480,8 @@ public:
     virtual void silentlyReleaseMemoryRecursive();
 protected:
     TreeItemPart(TreeItem *parent);
+private:
+    void loadSpooledData();
 };
 
 /** @short A message part with a modifier
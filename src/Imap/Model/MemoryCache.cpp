@@ -31,6 +31,32 @@ namespace Imap
 namespace Mailbox
 {
 
+MemoryCache::PartKey::PartKey(const QString &mailbox, const uint uid, const QByteArray &partId)
+    : mailbox(mailbox)
+    , uid(uid)
+    , partId(partId)
+{
+}
+
+bool MemoryCache::PartKey::operator<(const PartKey &other) const
+{
+    if (mailbox != other.mailbox)
+        return mailbox < other.mailbox;
+    if (uid != other.uid)
+        return uid < other.uid;
+    return partId < other.partId;
+}
+
+MemoryCache::MemoryCache()
+    : m_partBudget(0)
+    , m_partBytes(0)
+    , m_partUseCounter(0)
+    , m_partEvictions(0)
+    , m_partHits(0)
+    , m_partMisses(0)
+{
+}
+
 QList<MailboxMetadata> MemoryCache::childMailboxes(const QString &mailbox) const
 {
     return mailboxes[ mailbox ];
@@ -70,6 +96,14 @@ void MemoryCache::setUidMapping(const QString &mailbox, const Imap::Uids &mappin
     seqToUid[mailbox] = mapping;
 }
 
+void MemoryCache::updateUidMapping(const QString &mailbox, const Imap::Uids &removed, const Imap::Uids &added)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "updating UID mapping for" << mailbox << "removed" << removed << "added" << added;
+#endif
+    applyUidMappingUpdate(seqToUid[mailbox], removed, added);
+}
+
 void MemoryCache::clearUidMapping(const QString &mailbox)
 {
 #ifdef CACHE_DEBUG
@@ -85,7 +119,15 @@ void MemoryCache::clearAllMessages(const QString &mailbox)
 #endif
     flags.remove(mailbox);
     msgMetadata.remove(mailbox);
-    parts.remove(mailbox);
+    auto mailboxParts = parts.find(mailbox);
+    if (mailboxParts != parts.end()) {
+        for (auto messageIt = mailboxParts->constBegin(); messageIt != mailboxParts->constEnd(); ++messageIt) {
+            for (auto partIt = messageIt->constBegin(); partIt != messageIt->constEnd(); ++partIt) {
+                untrackPart(PartKey(mailbox, messageIt.key(), partIt.key()), partIt->size());
+            }
+        }
+        parts.erase(mailboxParts);
+    }
     threads.remove(mailbox);
 }
 
@@ -98,8 +140,16 @@ void MemoryCache::clearMessage(const QString mailbox, const uint uid)
         flags[mailbox].remove(uid);
     if (msgMetadata.contains(mailbox))
         msgMetadata[mailbox].remove(uid);
-    if (parts.contains(mailbox))
-        parts[mailbox].remove(uid);
+    auto mailboxParts = parts.find(mailbox);
+    if (mailboxParts != parts.end()) {
+        auto messageParts = mailboxParts->find(uid);
+        if (messageParts != mailboxParts->end()) {
+            for (auto partIt = messageParts->constBegin(); partIt != messageParts->constEnd(); ++partIt) {
+                untrackPart(PartKey(mailbox, uid, partIt.key()), partIt->size());
+            }
+            mailboxParts->erase(messageParts);
+        }
+    }
 }
 
 void MemoryCache::setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data)
@@ -107,7 +157,11 @@ void MemoryCache::setMsgPart(const QString &mailbox, const uint uid, const QByte
 #ifdef CACHE_DEBUG
     qDebug() << "set message part" << mailbox << uid << partId << data.size();
 #endif
-    parts[mailbox][uid][partId] = data;
+    QByteArray &stored = parts[mailbox][uid][partId];
+    m_partBytes += data.size() - stored.size();
+    stored = data;
+    touchPart(PartKey(mailbox, uid, partId));
+    enforcePartCacheBudget();
 }
 
 void MemoryCache::forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
@@ -115,8 +169,48 @@ void MemoryCache::forgetMessagePart(const QString &mailbox, const uint uid, cons
 #ifdef CACHE_DEBUG
     qDebug() << "forget message part" << mailbox << uid << partId;
 #endif
-    parts[mailbox][uid].remove(partId);
+    auto mailboxParts = parts.find(mailbox);
+    if (mailboxParts == parts.end())
+        return;
+    auto messageParts = mailboxParts->find(uid);
+    if (messageParts == mailboxParts->end())
+        return;
+    auto part = messageParts->find(partId);
+    if (part == messageParts->end())
+        return;
+    untrackPart(PartKey(mailbox, uid, partId), part->size());
+    messageParts->erase(part);
+}
 
+void MemoryCache::touchPart(const PartKey &key) const
+{
+    auto lastUse = m_partLastUse.find(key);
+    if (lastUse != m_partLastUse.end()) {
+        m_partLru.remove(*lastUse);
+        *lastUse = ++m_partUseCounter;
+    } else {
+        m_partLastUse.insert(key, ++m_partUseCounter);
+    }
+    m_partLru.insert(m_partUseCounter, key);
+}
+
+void MemoryCache::untrackPart(const PartKey &key, const qint64 size)
+{
+    m_partBytes -= size;
+    auto lastUse = m_partLastUse.find(key);
+    if (lastUse != m_partLastUse.end()) {
+        m_partLru.remove(*lastUse);
+        m_partLastUse.erase(lastUse);
+    }
+}
+
+void MemoryCache::enforcePartCacheBudget()
+{
+    while (m_partBudget && m_partBytes > m_partBudget && !m_partLru.isEmpty()) {
+        const PartKey victim = m_partLru.first();
+        forgetMessagePart(victim.mailbox, victim.uid, victim.partId);
+        ++m_partEvictions;
+    }
 }
 
 void MemoryCache::setMsgFlags(const QString &mailbox, uint uid, const QStringList &newFlags)
@@ -132,6 +226,18 @@ QStringList MemoryCache::msgFlags(const QString &mailbox, const uint uid) const
     return flags[mailbox][uid];
 }
 
+QHash<uint, QStringList> MemoryCache::msgFlagsForMailbox(const QString &mailbox) const
+{
+    QHash<uint, QStringList> res;
+    auto mailboxFlags = flags.constFind(mailbox);
+    if (mailboxFlags == flags.constEnd())
+        return res;
+    res.reserve(mailboxFlags->size());
+    for (auto it = mailboxFlags->constBegin(); it != mailboxFlags->constEnd(); ++it)
+        res.insert(it.key(), it.value());
+    return res;
+}
+
 Imap::Uids MemoryCache::uidMapping(const QString &mailbox) const
 {
     return seqToUid[mailbox];
@@ -154,14 +260,22 @@ MemoryCache::MessageDataBundle MemoryCache::messageMetadata(const QString &mailb
 
 QByteArray MemoryCache::messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
 {
-    if (! parts.contains(mailbox))
+    if (! parts.contains(mailbox)) {
+        ++m_partMisses;
         return QByteArray();
+    }
     const auto & mailboxParts = parts[mailbox];
-    if (! mailboxParts.contains(uid))
+    if (! mailboxParts.contains(uid)) {
+        ++m_partMisses;
         return QByteArray();
+    }
     const auto & messageParts = mailboxParts[uid];
-    if (! messageParts.contains(partId))
+    if (! messageParts.contains(partId)) {
+        ++m_partMisses;
         return QByteArray();
+    }
+    ++m_partHits;
+    touchPart(PartKey(mailbox, uid, partId));
     return messageParts[ partId ];
 }
 
@@ -180,5 +294,22 @@ void MemoryCache::setRenewalThreshold(const int days)
     Q_UNUSED(days);
 }
 
+void MemoryCache::setPartCacheBudget(const qint64 bytes)
+{
+    // The eviction itself happens upon the next insertion
+    m_partBudget = bytes;
+}
+
+AbstractCache::Statistics MemoryCache::statistics() const
+{
+    Statistics res;
+    res.partHits = m_partHits;
+    res.partMisses = m_partMisses;
+    res.partEvictions = m_partEvictions;
+    res.partBytes = m_partBytes;
+    res.partBudget = m_partBudget;
+    return res;
+}
+
 }
 }
@@ -38,10 +38,15 @@ namespace Mailbox
 
     It also has an optional feature to dump the data to a local file and read
     it back in. Is isn't suitable for real production use, but it's a good start.
+
+    When a part cache budget is set, the least recently used message parts are evicted as soon as a new part would
+    not fit into it.
  */
 class MemoryCache : public AbstractCache
 {
 public:
+    MemoryCache();
+
     virtual QList<MailboxMetadata> childMailboxes(const QString &mailbox) const;
     virtual bool childMailboxesFresh(const QString &mailbox) const;
     virtual void setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data);
@@ -50,6 +55,7 @@ public:
     virtual void setMailboxSyncState(const QString &mailbox, const SyncState &state);
 
     virtual void setUidMapping(const QString &mailbox, const Imap::Uids &mapping);
+    virtual void updateUidMapping(const QString &mailbox, const Imap::Uids &removed, const Imap::Uids &added);
     virtual void clearUidMapping(const QString &mailbox);
     virtual Imap::Uids uidMapping(const QString &mailbox) const;
 
@@ -61,6 +67,7 @@ public:
 
     virtual QStringList msgFlags(const QString &mailbox, const uint uid) const;
     virtual void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &newFlags);
+    virtual QHash<uint, QStringList> msgFlagsForMailbox(const QString &mailbox) const;
 
     virtual QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
     virtual void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data);
@@ -71,7 +78,27 @@ public:
 
     virtual void setRenewalThreshold(const int days);
 
+    virtual void setPartCacheBudget(const qint64 bytes);
+    virtual Statistics statistics() const;
+
 private:
+    /** @short Identification of a single message part for the LRU bookkeeping */
+    struct PartKey {
+        QString mailbox;
+        uint uid;
+        QByteArray partId;
+
+        PartKey(const QString &mailbox, const uint uid, const QByteArray &partId);
+        bool operator<(const PartKey &other) const;
+    };
+
+    /** @short Mark the part as the most recently used one */
+    void touchPart(const PartKey &key) const;
+    /** @short Stop tracking a part of @arg size bytes which has been removed */
+    void untrackPart(const PartKey &key, const qint64 size);
+    /** @short Evict the least recently used parts until the rest fits into the budget */
+    void enforcePartCacheBudget();
+
     QMap<QString, QList<MailboxMetadata> > mailboxes;
     QMap<QString, SyncState> syncState;
     QMap<QString, Imap::Uids> seqToUid;
@@ -79,6 +106,18 @@ private:
     QMap<QString, QMap<uint, MessageDataBundle> > msgMetadata;
     QMap<QString, QMap<uint, QMap<QByteArray, QByteArray> > > parts;
     QMap<QString, QVector<Imap::Responses::ThreadingNode> > threads;
+    qint64 m_partBudget;
+    /** @short Total size of all parts */
+    qint64 m_partBytes;
+    /** @short Parts ordered by the time of their last use, oldest first */
+    mutable QMap<quint64, PartKey> m_partLru;
+    /** @short Position of each part in the m_partLru */
+    mutable QMap<PartKey, quint64> m_partLastUse;
+    /** @short Source of the keys of the m_partLru */
+    mutable quint64 m_partUseCounter;
+    quint64 m_partEvictions;
+    mutable quint64 m_partHits;
+    mutable quint64 m_partMisses;
 };
 
 }
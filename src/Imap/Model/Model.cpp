@@ -25,6 +25,7 @@
 #include <QAuthenticator>
 #include <QCoreApplication>
 #include <QDebug>
+#include <QSet>
 #include <QtAlgorithms>
 #include "Model.h"
 #include "Common/FindWithUnknown.h"
@@ -37,9 +38,12 @@
 #include "Imap/Model/Utils.h"
 #include "Imap/Tasks/AppendTask.h"
 #include "Imap/Tasks/CreateMailboxTask.h"
+#include "Imap/Tasks/FetchMsgMetadataTask.h"
+#include "Imap/Tasks/FetchMsgPartTask.h"
 #include "Imap/Tasks/GetAnyConnectionTask.h"
 #include "Imap/Tasks/KeepMailboxOpenTask.h"
 #include "Imap/Tasks/OpenConnectionTask.h"
+#include "Imap/Tasks/RefreshMessageCountsTask.h"
 #include "Imap/Tasks/UpdateFlagsTask.h"
 #include "Imap/Tasks/CopyMoveMessagesTask.h"
 #include "Streams/SocketFactory.h"
@@ -96,6 +100,16 @@ bool messageHasUidZero(const TreeItem *const item)
     return message->uid() == 0;
 }
 
+/** @short Is this a response which the KeepMailboxOpenTask queues for KeepMailboxOpenTask::applyPendingExpunges()? */
+bool isQueuedExpunge(const Responses::AbstractResponse *const resp)
+{
+    if (const Responses::NumberResponse *const number = dynamic_cast<const Responses::NumberResponse *>(resp))
+        return number->kind == Responses::EXPUNGE;
+    if (const Responses::Vanished *const vanished = dynamic_cast<const Responses::Vanished *>(resp))
+        return vanished->earlier == Responses::Vanished::NOT_EARLIER;
+    return false;
+}
+
 }
 
 namespace Imap
@@ -113,6 +127,8 @@ Model::Model(QObject *parent, std::shared_ptr<AbstractCache> cache, SocketFactor
     , m_netPolicy(NETWORK_OFFLINE)
     , m_taskModel(nullptr)
     , m_hasImapPassword(PasswordAvailability::NOT_REQUESTED)
+    , m_unloadSweep(0), m_reclaimedMemory(0)
+    , m_pendingChangesFlushScheduled(false), m_responseBatchDepth(0)
 {
     m_startTls = m_socketFactory->startTlsRequired();
 
@@ -136,7 +152,20 @@ Model::Model(QObject *parent, std::shared_ptr<AbstractCache> cache, SocketFactor
     m_periodicMailboxNumbersRefresh = new QTimer(this);
     // polling every five minutes
     m_periodicMailboxNumbersRefresh->setInterval(5 * 60 * 1000);
-    connect(m_periodicMailboxNumbersRefresh, &QTimer::timeout, this, &Model::invalidateAllMessageCounts);
+    connect(m_periodicMailboxNumbersRefresh, &QTimer::timeout, this, &Model::refreshAllMessageCounts);
+
+    m_idleMailboxesUnloader = new QTimer(this);
+    m_idleMailboxesUnloader->setInterval(60 * 1000);
+    connect(m_idleMailboxesUnloader, &QTimer::timeout, this, &Model::unloadIdleMailboxes);
+    m_idleMailboxesUnloader->start();
+
+    m_commandClock.start();
+
+    // The pending updates refer to the items by pointers and rows, so they have to be delivered before these change
+    connect(this, &QAbstractItemModel::rowsAboutToBeRemoved, this, &Model::flushPendingChanges);
+    connect(this, &QAbstractItemModel::rowsAboutToBeMoved, this, &Model::flushPendingChanges);
+    connect(this, &QAbstractItemModel::layoutAboutToBeChanged, this, &Model::flushPendingChanges);
+    connect(this, &QAbstractItemModel::modelAboutToBeReset, this, &Model::flushPendingChanges);
 }
 
 Model::~Model()
@@ -168,21 +197,25 @@ void Model::responseReceived(const QMap<Parser *,ParserState>::iterator it)
 {
     Q_ASSERT(it->parser);
 
+    // Changes to the items are reported in one go once this batch of responses has been processed
+    ++m_responseBatchDepth;
+
     int counter = 0;
     while (it->parser && it->parser->hasResponse()) {
         QSharedPointer<Imap::Responses::AbstractResponse> resp = it->parser->getResponse();
         Q_ASSERT(resp);
         // Always log BAD responses from a central place. They're bad enough to warant an extra treatment.
         // FIXME: is it worth an UI popup?
-        if (Responses::State *stateResponse = dynamic_cast<Responses::State *>(resp.data())) {
-            if (stateResponse->kind == Responses::BAD) {
-                QString buf;
-                QTextStream s(&buf);
-                s << *stateResponse;
-                logTrace(it->parser->parserId(), Common::LOG_OTHER, QStringLiteral("Model"), QStringLiteral("BAD response: %1").arg(buf));
-                qDebug() << buf;
-            }
+        const Responses::State *const stateResponse = dynamic_cast<const Responses::State *>(resp.data());
+        if (stateResponse && stateResponse->kind == Responses::BAD) {
+            QString buf;
+            QTextStream s(&buf);
+            s << *stateResponse;
+            logTrace(it->parser->parserId(), Common::LOG_OTHER, QStringLiteral("Model"), QStringLiteral("BAD response: %1").arg(buf));
+            qDebug() << buf;
         }
+        const bool isFetch = !stateResponse && dynamic_cast<const Responses::Fetch *>(resp.data());
+        const bool queuedExpunge = isQueuedExpunge(resp.data());
         try {
             /* At this point, we want to iterate over all active tasks and try them
             for processing the server's responses (the plug() method). However, this
@@ -193,24 +226,54 @@ void Model::responseReceived(const QMap<Parser *,ParserState>::iterator it)
             cause a realloc to happen, happily invalidating our iterators, and that
             kind of sucks.
 
-            So, we have to iterate over a copy of the original list and instead of
-            deleting Tasks, we store them into a temporary list. When we're done with
-            processing, we walk the original list once again and simply remove all
-            "deleted" items for real.
+            So, we have to iterate over a copy of the original list and leave the
+            finished Tasks alone. When we're done with processing, runReadyTasks()
+            walks the original list once again and removes them for real.
 
             This took me 3+ hours to track it down to what the hell was happening here,
             even though the underlying reason is simple -- QList::append() could invalidate
             existing iterators.
             */
 
+            // The EXPUNGEs which were queued so far have to be applied before anything else can see the mailbox
+            if (!queuedExpunge && it->maintainingTask) {
+                it->maintainingTask->applyPendingExpunges();
+            }
+
             bool handled = false;
             QList<ImapTask *> taskSnapshot = it->activeTasks;
-            QList<ImapTask *> deletedTasks;
             QList<ImapTask *>::const_iterator taskEnd = taskSnapshot.constEnd();
+            ImapTask *handledBy = 0;
+
+            /* Offering each response to all tasks in turn gets expensive when there are many of them, e.g. during a burst
+            of FETCHes for message parts. A tagged response belongs to the task which has sent the command, and an untagged
+            FETCH goes to the same task as the previous one as long as no other task has been activated since, so these are
+            tried first. The usual order still applies when that guess is not available or when the task rejects the
+            response. Only the active tasks send commands and they stay active until they finish, so neither guess needs a
+            lookup in the activeTasks. */
+            ImapTask *preferredTask = 0;
+            if (stateResponse && !stateResponse->tag.isEmpty()) {
+                recordCommandCompletion(*it, stateResponse->tag);
+                ImapTask *owner = it->commandOwners.take(stateResponse->tag);
+                if (owner && !owner->isFinished())
+                    preferredTask = owner;
+            } else if (isFetch && it->fetchHandler && !it->fetchHandler->isFinished() &&
+                       it->fetchHandlerGeneration == it->activeTasksGeneration) {
+                preferredTask = it->fetchHandler;
+            }
+            ++it->routedResponses;
+            if (preferredTask) {
+                TaskSendingCommands sender(this, preferredTask);
+                ++it->plugProbes;
+                if (resp->plug(preferredTask)) {
+                    handled = true;
+                    handledBy = preferredTask;
+                }
+            }
 
-            // Try various tasks, perhaps it's their response. Also check if they're already finished and remove them.
-            for (QList<ImapTask *>::const_iterator taskIt = taskSnapshot.constBegin(); taskIt != taskEnd; ++taskIt) {
-                if (! handled) {
+            // Try various tasks, perhaps it's their response. The finished ones are removed by runReadyTasks() below.
+            for (QList<ImapTask *>::const_iterator taskIt = taskSnapshot.constBegin(); !handled && taskIt != taskEnd; ++taskIt) {
+                if (*taskIt != preferredTask) {
 
 #ifdef DEBUG_TASK_ROUTING
                     try {
@@ -218,7 +281,13 @@ void Model::responseReceived(const QMap<Parser *,ParserState>::iterator it)
                                  QString::fromAscii("Routing to %1 %2").arg(QString::fromAscii((*taskIt)->metaObject()->className()),
                                                                             (*taskIt)->debugIdentification()));
 #endif
-                    handled = resp->plug(*taskIt);
+                    {
+                        TaskSendingCommands sender(this, *taskIt);
+                        ++it->plugProbes;
+                        handled = resp->plug(*taskIt);
+                    }
+                    if (handled)
+                        handledBy = *taskIt;
 #ifdef DEBUG_TASK_ROUTING
                         if (handled) {
                             logTrace(it->parser->parserId(), Common::LOG_TASKS, (*taskIt)->debugIdentification(), QLatin1String("Handled"));
@@ -229,13 +298,12 @@ void Model::responseReceived(const QMap<Parser *,ParserState>::iterator it)
                     }
 #endif
                 }
-
-                if ((*taskIt)->isFinished()) {
-                    deletedTasks << *taskIt;
-                }
             }
 
-            removeDeletedTasks(deletedTasks, it->activeTasks);
+            if (isFetch) {
+                it->fetchHandler = handledBy && !handledBy->isFinished() ? handledBy : 0;
+                it->fetchHandlerGeneration = it->activeTasksGeneration;
+            }
 
             runReadyTasks();
 
@@ -256,14 +324,30 @@ void Model::responseReceived(const QMap<Parser *,ParserState>::iterator it)
             break;
         }
 
-        // Return to the event loop every 100 messages to handle GUI events
-        ++counter;
+        // Return to the event loop every 100 messages to handle GUI events. Queueing an EXPUNGE is cheap, though, and
+        // a burst of them should better be applied at once.
+        if (!queuedExpunge)
+            ++counter;
         if (counter == 100) {
             QTimer::singleShot(0, this, SLOT(responseReceived()));
             break;
         }
     }
 
+    if (it->parser && it->maintainingTask) {
+        try {
+            it->maintainingTask->applyPendingExpunges();
+        } catch (Imap::ImapException &e) {
+            uint parserId = it->parser->parserId();
+            killParser(it->parser, PARSER_KILL_HARD);
+            broadcastParseError(parserId, QString::fromStdString(e.exceptionClass()), QString::fromUtf8(e.what()), e.line(), e.offset());
+        }
+    }
+
+    --m_responseBatchDepth;
+    if (!m_responseBatchDepth)
+        flushPendingChanges();
+
     if (!it->parser) {
         // He's dead, Jim
         m_taskModel->beginResetModel();
@@ -295,7 +379,12 @@ void Model::handleState(Imap::Parser *ptr, const Imap::Responses::State *const r
         // FIXME: we should probably just eat them and don't bother, as untagged OK/NO could be rather common...
         switch (resp->kind) {
         case BYE:
-            if (accessParser(ptr).logoutCmd.isEmpty()) {
+            if (accessParser(ptr).isSpare) {
+                // Nobody is using this connection, so there's no reason to go offline
+                logTrace(ptr->parserId(), Common::LOG_OTHER, QStringLiteral("Model"),
+                         QStringLiteral("Spare connection closed by the server: %1").arg(resp->message));
+                changeConnectionState(ptr, CONN_STATE_LOGOUT);
+            } else if (accessParser(ptr).logoutCmd.isEmpty()) {
                 // The connection got closed but we haven't really requested that -- we better treat that as error, including
                 // going offline...
                 // ... but before that, expect that the connection will get closed soon
@@ -503,6 +592,62 @@ void Model::emitMessageCountChanged(TreeItemMailbox *const mailbox)
     emit messageCountPossiblyChanged(mailboxIndex);
 }
 
+/** @short Remember that the data of the @arg item has changed
+
+The dataChanged() signal is emitted later on by flushPendingChanges(), once per item no matter how many times it changed.
+*/
+void Model::scheduleDataChanged(TreeItem *const item)
+{
+    m_pendingDataChanges.append(item);
+    scheduleFlushOfPendingChanges();
+}
+
+/** @short Like emitMessageCountChanged(), but deferred and coalesced with other changes of the same @arg mailbox */
+void Model::scheduleMessageCountChanged(TreeItemMailbox *const mailbox)
+{
+    m_pendingMessageCountChanges.append(mailbox);
+    scheduleFlushOfPendingChanges();
+}
+
+void Model::scheduleFlushOfPendingChanges()
+{
+    // The responseReceived() will flush everything when it's done, no need to return to the event loop for that
+    if (m_responseBatchDepth || m_pendingChangesFlushScheduled)
+        return;
+    m_pendingChangesFlushScheduled = true;
+    CALL_LATER_NOARG(this, flushPendingChanges);
+}
+
+void Model::flushPendingChanges()
+{
+    m_pendingChangesFlushScheduled = false;
+    if (m_pendingDataChanges.isEmpty() && m_pendingMessageCountChanges.isEmpty())
+        return;
+
+    QVector<TreeItem *> items;
+    items.swap(m_pendingDataChanges);
+    QVector<TreeItemMailbox *> mailboxes;
+    mailboxes.swap(m_pendingMessageCountChanges);
+
+    // The consumers of this model expect dataChanged() to cover just a single index, so the signals cannot be merged
+    // into ranges. An item which got updated several times is reported just once, though.
+    QSet<TreeItem *> seen;
+    Q_FOREACH(TreeItem *item, items) {
+        if (seen.contains(item))
+            continue;
+        seen.insert(item);
+        QModelIndex index = item->toIndex(this);
+        if (index.isValid())
+            emit dataChanged(index, index);
+    }
+
+    std::sort(mailboxes.begin(), mailboxes.end());
+    mailboxes.erase(std::unique(mailboxes.begin(), mailboxes.end()), mailboxes.end());
+    Q_FOREACH(TreeItemMailbox *mailbox, mailboxes) {
+        emitMessageCountChanged(mailbox);
+    }
+}
+
 void Model::handleCapability(Imap::Parser *ptr, const Imap::Responses::Capability *const resp)
 {
     updateCapabilities(ptr, resp->capabilities);
@@ -548,29 +693,36 @@ void Model::handleStatus(Imap::Parser *ptr, const Imap::Responses::Status *const
     if (accessParser(ptr).connState == CONN_STATE_LOGOUT)
         return;
     Q_UNUSED(ptr);
-    TreeItemMailbox *mailbox = findMailboxByName(resp->mailbox);
+    TreeItemMailbox *mailbox = applyStatus(*resp);
+    if (mailbox)
+        emitMessageCountChanged(mailbox);
+}
+
+/** @short Update the message counts of a mailbox based on a STATUS response, return the mailbox or nullptr if it isn't known */
+TreeItemMailbox *Model::applyStatus(const Imap::Responses::Status &resp)
+{
+    TreeItemMailbox *mailbox = findMailboxByName(resp.mailbox);
     if (! mailbox) {
-        qDebug() << "Couldn't find out which mailbox is" << resp->mailbox << "when parsing a STATUS reply";
-        return;
+        qDebug() << "Couldn't find out which mailbox is" << resp.mailbox << "when parsing a STATUS reply";
+        return nullptr;
     }
     TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
     Q_ASSERT(list);
     bool updateCache = false;
-    Imap::Responses::Status::stateDataType::const_iterator it = resp->states.constEnd();
-    if ((it = resp->states.constFind(Imap::Responses::Status::MESSAGES)) != resp->states.constEnd()) {
+    Imap::Responses::Status::stateDataType::const_iterator it = resp.states.constEnd();
+    if ((it = resp.states.constFind(Imap::Responses::Status::MESSAGES)) != resp.states.constEnd()) {
         updateCache |= list->m_totalMessageCount != static_cast<const int>(it.value());
         list->m_totalMessageCount = it.value();
     }
-    if ((it = resp->states.constFind(Imap::Responses::Status::UNSEEN)) != resp->states.constEnd()) {
+    if ((it = resp.states.constFind(Imap::Responses::Status::UNSEEN)) != resp.states.constEnd()) {
         updateCache |= list->m_unreadMessageCount != static_cast<const int>(it.value());
         list->m_unreadMessageCount = it.value();
     }
-    if ((it = resp->states.constFind(Imap::Responses::Status::RECENT)) != resp->states.constEnd()) {
+    if ((it = resp.states.constFind(Imap::Responses::Status::RECENT)) != resp.states.constEnd()) {
         updateCache |= list->m_recentMessageCount != static_cast<const int>(it.value());
         list->m_recentMessageCount = it.value();
     }
     list->m_numberFetchingStatus = TreeItem::DONE;
-    emitMessageCountChanged(mailbox);
 
     if (updateCache) {
         // We have to be very careful to only touch the bits which are *not* used by the mailbox syncing code.
@@ -587,6 +739,21 @@ void Model::handleStatus(Imap::Parser *ptr, const Imap::Responses::Status *const
         }
         cache()->setMailboxSyncState(mailbox->mailbox(), state);
     }
+    return mailbox;
+}
+
+/** @short Apply a whole batch of STATUS responses, notifying about the aggregate change just once */
+void Model::applyMessageCounts(const QList<Imap::Responses::Status> &responses)
+{
+    for (auto it = responses.constBegin(); it != responses.constEnd(); ++it) {
+        TreeItemMailbox *mailbox = applyStatus(*it);
+        if (!mailbox)
+            continue;
+        scheduleDataChanged(mailbox->m_children[0]);
+        scheduleDataChanged(mailbox);
+    }
+    if (!responses.isEmpty())
+        emit messageCountPossiblyChanged(QModelIndex());
 }
 
 void Model::handleFetch(Imap::Parser *ptr, const Imap::Responses::Fetch *const resp)
@@ -840,19 +1007,34 @@ void Model::askForMessagesInMailbox(TreeItemMsgList *item)
         Q_ASSERT(item->accessFetchStatus() == TreeItem::LOADING);
         QModelIndex listIndex = item->toIndex(this);
         if (uidMapping.size()) {
+            // Fetch all flags in one go and normalize and intern each distinct set of them just once; IMAP flags cannot
+            // contain spaces, so joining them is enough to obtain a unique key
+            const QHash<uint, QStringList> cachedFlags = cache()->msgFlagsForMailbox(mailbox);
+            QHash<QString, TreeItemMessage *> sameFlags;
             beginInsertRows(listIndex, 0, uidMapping.size() - 1);
+            item->m_children.reserve(uidMapping.size());
             for (uint seq = 0; seq < static_cast<uint>(uidMapping.size()); ++seq) {
                 TreeItemMessage *message = new TreeItemMessage(item);
                 message->m_offset = seq;
                 message->m_uid = uidMapping[seq];
                 item->m_children << message;
-                QStringList flags = cache()->msgFlags(mailbox, message->m_uid);
-                flags.removeOne(QStringLiteral("\\Recent"));
-                message->m_flags = normalizeFlags(flags);
+                const QStringList flags = cachedFlags.value(message->m_uid);
+                const QString key = flags.join(QLatin1Char(' '));
+                auto same = sameFlags.constFind(key);
+                if (same == sameFlags.constEnd()) {
+                    QStringList withoutRecent = flags;
+                    withoutRecent.removeOne(QStringLiteral("\\Recent"));
+                    message->storeFlags(item, normalizeFlags(withoutRecent));
+                    sameFlags.insert(key, message);
+                } else {
+                    message->m_flagBits = (*same)->m_flagBits;
+                    message->m_flagOverflow = (*same)->m_flagOverflow;
+                }
             }
             endInsertRows();
         }
         mailboxPtr->syncState = oldSyncState;
+        item->setSavedUids(uidMapping);
         item->setFetchStatus(TreeItem::DONE); // required for FETCH processing later on
         // The list of messages was satisfied from cache. Do the same for the message counts, if applicable
         item->recalcVariousMessageCounts(this);
@@ -895,21 +1077,45 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
     TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(list->parent());
     Q_ASSERT(mailboxPtr);
 
+    // The cache might only deliver the data once we have returned to the event loop. The item might be gone by then, or
+    // the server might have provided the data in the meanwhile.
+    if (!item->loading())
+        item->setFetchStatus(TreeItem::LOADING);
+    QPersistentModelIndex index = item->toIndex(this);
+    auto synchronous = std::make_shared<bool>(true);
+    cache()->loadMessageMetadata(mailboxPtr->mailbox(), item->uid(),
+                                 [this, item, index, preloadMode, synchronous](const AbstractCache::MessageDataBundle &data) {
+        if (*synchronous) {
+            finalizeAskForMsgMetadata(item, data, preloadMode);
+            return;
+        }
+        if (!index.isValid())
+            return;
+        TreeItemMessage *message = static_cast<TreeItemMessage *>(index.internalPointer());
+        if (!message->loading())
+            return;
+        finalizeAskForMsgMetadata(message, data, preloadMode);
+    });
+    *synchronous = false;
+}
+
+/** @short Use the @arg data of the @arg item which were found in the cache, or ask the server for them */
+void Model::finalizeAskForMsgMetadata(TreeItemMessage *item, const AbstractCache::MessageDataBundle &data,
+                                      const PreloadingMode preloadMode)
+{
+    TreeItemMsgList *list = static_cast<TreeItemMsgList *>(item->parent());
+    TreeItemMailbox *mailboxPtr = static_cast<TreeItemMailbox *>(list->parent());
+
     if (item->uid()) {
-        AbstractCache::MessageDataBundle data = cache()->messageMetadata(mailboxPtr->mailbox(), item->uid());
         if (data.uid == item->uid()) {
             item->data()->setEnvelope(data.envelope);
             item->data()->setSize(data.size);
             item->data()->setHdrReferences(data.hdrReferences);
             item->data()->setHdrListPost(data.hdrListPost);
             item->data()->setHdrListPostNo(data.hdrListPostNo);
-            QDataStream stream(&data.serializedBodyStructure, QIODevice::ReadOnly);
-            stream.setVersion(QDataStream::Qt_4_6);
-            QVariantList unserialized;
-            stream >> unserialized;
             QSharedPointer<Message::AbstractMessage> abstractMessage;
             try {
-                abstractMessage = Message::AbstractMessage::fromList(unserialized, QByteArray(), 0);
+                abstractMessage = Message::AbstractMessage::fromSerialized(data.serializedBodyStructure);
             } catch (Imap::ParserException &e) {
                 qDebug() << "Error when parsing cached BODYSTRUCTURE" << e.what();
             }
@@ -971,7 +1177,7 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
     }
     break;
     }
-    EMIT_LATER(this, dataChanged, Q_ARG(QModelIndex, item->toIndex(this)), Q_ARG(QModelIndex, item->toIndex(this)));
+    scheduleDataChanged(item);
 }
 
 void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
@@ -996,10 +1202,40 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
         Q_ASSERT(itemForFetchOperation);
     }
 
-    const QByteArray &data = cache()->messagePart(mailboxPtr->mailbox(), uid,
-                                                  isSpecialRawPart ?
-                                                      itemForFetchOperation->partId() + ".X-RAW"
-                                                    : item->partId());
+    // The cache might only deliver the data once we have returned to the event loop. The item might be gone by then,
+    // so it has to be looked up again, and whoever asked for it has to be told about the result.
+    QPersistentModelIndex index = item->toIndex(this);
+    auto synchronous = std::make_shared<bool>(true);
+    cache()->loadMessagePart(mailboxPtr->mailbox(), uid,
+                             isSpecialRawPart ? itemForFetchOperation->partId() + ".X-RAW" : item->partId(),
+                             isSpecialRawPart ? QByteArray() : itemForFetchOperation->partId() + ".X-RAW",
+                             [this, item, index, onlyFromCache, synchronous](const QByteArray &data, const QByteArray &rawData) {
+        if (*synchronous) {
+            finalizeAskForMsgPart(item, data, rawData, onlyFromCache);
+            return;
+        }
+        if (!index.isValid())
+            return;
+        TreeItemPart *part = static_cast<TreeItemPart *>(index.internalPointer());
+        if (part->fetched() || part->isUnavailable())
+            return;
+        finalizeAskForMsgPart(part, data, rawData, onlyFromCache);
+        emit dataChanged(index, index);
+    });
+    *synchronous = false;
+}
+
+/** @short Use the @arg data or the @arg rawData of the @arg item which were found in the cache, or ask the server for them */
+void Model::finalizeAskForMsgPart(TreeItemPart *item, const QByteArray &data, const QByteArray &rawData, bool onlyFromCache)
+{
+    TreeItemPart *itemForFetchOperation = item;
+    TreeItemModifiedPart *modifiedPart = dynamic_cast<TreeItemModifiedPart*>(item);
+    bool isSpecialRawPart = modifiedPart && modifiedPart->kind() == TreeItem::OFFSET_RAW_CONTENTS;
+    if (isSpecialRawPart) {
+        itemForFetchOperation = dynamic_cast<TreeItemPart*>(item->parent());
+        Q_ASSERT(itemForFetchOperation);
+    }
+
     if (! data.isNull()) {
         item->m_data = data;
         item->setFetchStatus(TreeItem::DONE);
@@ -1007,11 +1243,8 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
     }
 
     if (!isSpecialRawPart) {
-        const QByteArray &data = cache()->messagePart(mailboxPtr->mailbox(), uid,
-                                                      itemForFetchOperation->partId() + ".X-RAW");
-
-        if (!data.isNull()) {
-            Imap::decodeContentTransferEncoding(data, item->transferEncoding(), item->dataPtr());
+        if (!rawData.isNull()) {
+            Imap::decodeContentTransferEncoding(rawData, item->transferEncoding(), item->dataPtr());
             item->setFetchStatus(TreeItem::DONE);
             return;
         }
@@ -1027,6 +1260,7 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
         if (item->accessFetchStatus() != TreeItem::DONE)
             item->setFetchStatus(TreeItem::UNAVAILABLE);
     } else if (! onlyFromCache) {
+        TreeItemMailbox *mailboxPtr = static_cast<TreeItemMailbox *>(item->message()->parent()->parent());
         KeepMailboxOpenTask *keepTask = findTaskResponsibleFor(mailboxPtr);
         TreeItemPart::PartFetchingMode fetchingMode = TreeItemPart::FETCH_PART_IMAP;
         if (!isSpecialRawPart && keepTask->parser && accessParser(keepTask->parser).capabilitiesFresh &&
@@ -1111,6 +1345,11 @@ void Model::handleSocketDisconnectedResponse(Parser *ptr, const Responses::Socke
 
         // But we still absolutely want to clean up and kill the connection/Parser anyway
         killParser(ptr, PARSER_KILL_EXPECTED);
+    } else if (accessParser(ptr).isSpare) {
+        // Losing a connection which nobody has asked for yet is not an error
+        logTrace(ptr->parserId(), Common::LOG_PARSE_ERROR, QString(), resp->message);
+        changeConnectionState(ptr, CONN_STATE_LOGOUT);
+        killParser(ptr, PARSER_KILL_EXPECTED);
     } else {
         logTrace(ptr->parserId(), Common::LOG_PARSE_ERROR, QString(), resp->message);
         changeConnectionState(ptr, CONN_STATE_LOGOUT);
@@ -1164,6 +1403,11 @@ void Model::switchToMailbox(const QModelIndex &mbox)
     if (! mbox.isValid())
         return;
 
+    if (TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mbox.internalPointer()))) {
+        static_cast<TreeItemMsgList *>(mailbox->m_children[0])->markAsUsed(this);
+        m_currentMailbox = mbox;
+    }
+
     if (m_netPolicy == NETWORK_OFFLINE)
         return;
 
@@ -1410,13 +1654,43 @@ void Model::unsubscribeMailbox(const QString &name)
     m_taskFactory->createSubscribeUnsubscribeTask(this, name, UNSUBSCRIBE);
 }
 
+/** @short Store the UID mapping of a mailbox in the cache
+
+When the list knows what the cache already contains, only the expunged messages and the new arrivals are passed to the
+cache. Because the new arrivals always have higher UIDs than any other message, they are found at the very end of the
+list, which means that the cost is proportional to the size of the change, not to the size of the mailbox.
+*/
 void Model::saveUidMap(TreeItemMsgList *list)
 {
-    Imap::Uids seqToUid(list->m_children.size(), 0);
-    std::transform(list->m_children.constBegin(), list->m_children.cend(), seqToUid.begin(), [](TreeItem *item) {
+    auto uidOf = [](TreeItem *item) {
         return static_cast<TreeItemMessage *>(item)->uid();
-    });
-    cache()->setUidMapping(static_cast<TreeItemMailbox *>(list->parent())->mailbox(), seqToUid);
+    };
+    const QString mailbox = static_cast<TreeItemMailbox *>(list->parent())->mailbox();
+
+    if (list->m_savedUidsValid) {
+        int firstNew = list->m_children.size();
+        while (firstNew > 0 && uidOf(list->m_children[firstNew - 1]) > list->m_savedHighestUid)
+            --firstNew;
+        if (firstNew == list->m_savedUidCount - list->m_savedUidsRemoved.size()
+                && (firstNew == 0 || uidOf(list->m_children[firstNew - 1]) != 0)) {
+            Imap::Uids added(list->m_children.size() - firstNew);
+            std::transform(list->m_children.constBegin() + firstNew, list->m_children.cend(), added.begin(), uidOf);
+            if (!added.isEmpty() || !list->m_savedUidsRemoved.isEmpty()) {
+                cache()->updateUidMapping(mailbox, list->m_savedUidsRemoved, added);
+            }
+            list->m_savedUidCount = list->m_children.size();
+            if (!added.isEmpty())
+                list->m_savedHighestUid = added.last();
+            list->m_savedUidsRemoved.clear();
+            return;
+        }
+        // The list doesn't match our idea of what the cache contains, so let's better overwrite everything
+    }
+
+    Imap::Uids seqToUid(list->m_children.size(), 0);
+    std::transform(list->m_children.constBegin(), list->m_children.cend(), seqToUid.begin(), uidOf);
+    cache()->setUidMapping(mailbox, seqToUid);
+    list->setSavedUids(seqToUid);
 }
 
 
@@ -1437,6 +1711,77 @@ void Model::changeConnectionState(Parser *parser, ConnectionState state)
     accessParser(parser).connState = state;
     logTrace(parser->parserId(), Common::LOG_TASKS, QStringLiteral("conn"), connectionStateToString(state));
     emit connectionStateChanged(parser->parserId(), state);
+    if (state == CONN_STATE_AUTHENTICATED && property("trojita-imap-spare-connections").toInt() > 0) {
+        QTimer::singleShot(0, this, SLOT(openSpareConnections()));
+    }
+}
+
+/** @short Keep some authenticated connections around, so that opening another mailbox doesn't have to wait for them
+
+The spare connections are only opened after a regular connection has logged in, which ensures that the credentials are known
+and that the user will not be prompted for anything just because of them. Together with the m_maxParsers, the
+trojita-imap-spare-connections property limits how many of them are kept. A spare connection which fails or which gets
+closed by the server is silently dropped; a new one is only opened once another connection logs in. A spare which gets
+used is replaced by one of the existing connections, see replenishSpareConnection().
+*/
+void Model::openSpareConnections()
+{
+    const int wanted = property("trojita-imap-spare-connections").toInt();
+    if (wanted <= 0 || m_netPolicy != NETWORK_ONLINE)
+        return;
+
+    int usable = 0;
+    int spares = 0;
+    bool loggedIn = false;
+    for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
+        if (!it->parser || it->connState == CONN_STATE_LOGOUT)
+            continue;
+        ++usable;
+        if (it->isSpare)
+            ++spares;
+        else if (it->connState >= CONN_STATE_AUTHENTICATED)
+            loggedIn = true;
+    }
+    if (!loggedIn)
+        return;
+
+    while (spares < wanted && usable < m_maxParsers) {
+        OpenConnectionTask *conn = m_taskFactory->createOpenConnectionTask(this);
+        Q_ASSERT(conn->parser);
+        accessParser(conn->parser).isSpare = true;
+        logTrace(conn->parser->parserId(), Common::LOG_OTHER, QStringLiteral("Model"), QStringLiteral("Opening a spare connection"));
+        ++spares;
+        ++usable;
+    }
+}
+
+/** @short Turn one of the other connections into a spare one after the @arg adopted spare got used for a mailbox
+
+Without the spare, the new mailbox would have been opened on one of the existing connections, which would have closed the
+mailbox that was there before. Closing that mailbox now keeps the number of connections at bay; opening yet another spare
+connection instead would only leave more and more of them idling in mailboxes which nobody looks at.
+*/
+void Model::replenishSpareConnection(Parser *adopted)
+{
+    for (QMap<Parser *,ParserState>::iterator it = m_parsers.begin(); it != m_parsers.end(); ++it) {
+        if (it.key() == adopted || it->isSpare || it->connState == CONN_STATE_LOGOUT)
+            continue;
+        if (!it->maintainingTask && it->connState == CONN_STATE_AUTHENTICATED) {
+            // Not in any mailbox, so it can become a spare right away
+            it->isSpare = true;
+            return;
+        }
+    }
+    for (QMap<Parser *,ParserState>::iterator it = m_parsers.begin(); it != m_parsers.end(); ++it) {
+        if (it.key() == adopted || it->isSpare || it->connState == CONN_STATE_LOGOUT)
+            continue;
+        if (it->maintainingTask && it->maintainingTask->releaseConnection()) {
+            logTrace(it.key()->parserId(), Common::LOG_OTHER, QStringLiteral("Model"),
+                     QStringLiteral("Closing the mailbox to keep this connection as a spare one"));
+            it->isSpare = true;
+            return;
+        }
+    }
 }
 
 void Model::handleSocketStateChanged(Parser *parser, Imap::ConnectionState state)
@@ -1483,6 +1828,16 @@ void Model::killParser(Parser *parser, ParserKillingMethod method)
 void Model::slotParserLineReceived(Parser *parser, const QByteArray &line)
 {
     logTrace(parser->parserId(), Common::LOG_IO_READ, QString(), QString::fromUtf8(line));
+    QMap<Parser *,ParserState>::iterator it = m_parsers.find(parser);
+    if (it != m_parsers.end())
+        it->receivedBytes += line.size();
+}
+
+void Model::slotParserSpooledLiteralReceived(Parser *parser, const qint64 size)
+{
+    QMap<Parser *,ParserState>::iterator it = m_parsers.find(parser);
+    if (it != m_parsers.end())
+        it->receivedBytes += size;
 }
 
 void Model::slotParserLineSent(Parser *parser, const QByteArray &line)
@@ -1490,6 +1845,41 @@ void Model::slotParserLineSent(Parser *parser, const QByteArray &line)
     logTrace(parser->parserId(), Common::LOG_IO_WRITTEN, QString(), QString::fromUtf8(line));
 }
 
+void Model::slotParserCommandQueued(Parser *parser, const CommandHandle &tag)
+{
+    // Commands which are queued outside of any TaskSendingCommands scope, like the IDLE or the periodic NOOP, can take
+    // arbitrarily long and are therefore not measured
+    if (!m_taskSendingCommands || m_taskSendingCommands->parser != parser)
+        return;
+    QMap<Parser *,ParserState>::iterator it = m_parsers.find(parser);
+    if (it == m_parsers.end())
+        return;
+    it->commandOwners[tag] = m_taskSendingCommands.data();
+    const bool isFetch = qobject_cast<FetchMsgPartTask *>(m_taskSendingCommands.data()) ||
+            qobject_cast<FetchMsgMetadataTask *>(m_taskSendingCommands.data());
+    it->commandTimings[tag] = CommandTiming(m_commandClock.elapsed(), it->receivedBytes, isFetch);
+}
+
+void Model::recordCommandCompletion(ParserState &parserState, const CommandHandle &tag)
+{
+    QHash<CommandHandle, CommandTiming>::iterator timing = parserState.commandTimings.find(tag);
+    if (timing == parserState.commandTimings.end())
+        return;
+    const qint64 elapsed = m_commandClock.elapsed() - timing->queuedAt;
+    const quint64 bytes = parserState.receivedBytes - timing->receivedBytes;
+    const bool isFetch = timing->isFetch;
+    parserState.commandTimings.erase(timing);
+
+    AdaptiveFetchLimits &limits = parserState.fetchLimits;
+    if (limits.addSample(elapsed, bytes, isFetch) && limits.isSeeded()) {
+        logTrace(parserState.parser->parserId(), Common::LOG_OTHER, QStringLiteral("Model"),
+                 QStringLiteral("FETCH limits: %1 messages, %2 bytes, %3 in parallel (RTT %4 ms, min %5 ms, %6 B/s)")
+                 .arg(QString::number(limits.messagesPerGroup()), QString::number(limits.bytesPerGroup()),
+                      QString::number(limits.parallelTasks()), QString::number(limits.smoothedRtt()),
+                      QString::number(limits.minimalRtt()), QString::number(limits.throughput())));
+    }
+}
+
 void Model::setCache(std::shared_ptr<AbstractCache> cache)
 {
     m_cache = cache;
@@ -1509,6 +1899,7 @@ void Model::runReadyTasks()
             for (QList<ImapTask *>::const_iterator taskIt = origList.constBegin(); taskIt != taskEnd; ++taskIt) {
                 ImapTask *task = *taskIt;
                 if (task->isReadyToRun()) {
+                    TaskSendingCommands sender(this, task);
                     task->perform();
                     runSomething = true;
                 }
@@ -1562,6 +1953,17 @@ KeepMailboxOpenTask *Model::findTaskResponsibleFor(TreeItemMailbox *mailboxPtr)
         // The mailbox is not being maintained, but we can create a new connection
         return m_taskFactory->createKeepMailboxOpenTask(this, mailboxPtr->toIndex(this), 0);
     } else {
+        // A spare connection has been opened precisely for this purpose
+        for (QMap<Parser *,ParserState>::iterator it = m_parsers.begin(); it != m_parsers.end(); ++it) {
+            if (!it->isSpare || it->connState == CONN_STATE_LOGOUT || it->maintainingTask)
+                continue;
+            it->isSpare = false;
+            Parser *spare = it.key();
+            KeepMailboxOpenTask *keepTask = m_taskFactory->createKeepMailboxOpenTask(this, mailboxPtr->toIndex(this), spare);
+            replenishSpareConnection(spare);
+            return keepTask;
+        }
+
         // Too bad, we have to re-use an existing parser. That will probably lead to
         // stealing it from some mailbox, but there's no other way.
         Q_ASSERT(!m_parsers.isEmpty());
@@ -1584,16 +1986,12 @@ void Model::genericHandleFetch(TreeItemMailbox *mailbox, const Imap::Responses::
     QList<TreeItemPart *> changedParts;
     TreeItemMessage *changedMessage = 0;
     mailbox->handleFetchResponse(this, *resp, changedParts, changedMessage, false);
-    if (! changedParts.isEmpty()) {
-        Q_FOREACH(TreeItemPart* part, changedParts) {
-            QModelIndex index = part->toIndex(this);
-            emit dataChanged(index, index);
-        }
+    Q_FOREACH(TreeItemPart* part, changedParts) {
+        scheduleDataChanged(part);
     }
     if (changedMessage) {
-        QModelIndex index = changedMessage->toIndex(this);
-        emit dataChanged(index, index);
-        emitMessageCountChanged(mailbox);
+        scheduleDataChanged(changedMessage);
+        scheduleMessageCountChanged(mailbox);
     }
 }
 
@@ -1666,6 +2064,141 @@ ParserState &Model::accessParser(Parser *parser)
     return m_parsers[ parser ];
 }
 
+quint64 Model::reclaimedMemory() const
+{
+    return m_reclaimedMemory;
+}
+
+QMap<uint, AdaptiveFetchLimits> Model::fetchLimits() const
+{
+    QMap<uint, AdaptiveFetchLimits> res;
+    for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
+        if (it->parser)
+            res[it->parser->parserId()] = it->fetchLimits;
+    }
+    return res;
+}
+
+void Model::unloadIdleMailboxes()
+{
+    ++m_unloadSweep;
+
+    bool ok;
+    const int idleMinutes = property("trojita-imap-unload-idle-mailboxes-after").toInt(&ok);
+    const uint idleSweeps = ok && idleMinutes > 0 ? idleMinutes : 0;
+    const int residentLimit = property("trojita-imap-resident-messages-limit").toInt(&ok);
+    const int messageLimit = ok && residentLimit > 0 ? residentLimit : 0;
+    if (!idleSweeps && !messageLimit)
+        return;
+
+    // The lists which are on screen, or whose messages somebody still refers to, have to stay
+    QSet<TreeItem *> pinned;
+    if (m_currentMailbox.isValid())
+        pinned.insert(static_cast<TreeItem *>(m_currentMailbox.internalPointer())->m_children[0]);
+    Q_FOREACH(const QModelIndex &index, persistentIndexList()) {
+        for (TreeItem *item = static_cast<TreeItem *>(index.internalPointer()); item; item = item->parent()) {
+            if (dynamic_cast<TreeItemMsgList *>(item)) {
+                pinned.insert(item);
+                break;
+            } else if (dynamic_cast<TreeItemMailbox *>(item)) {
+                break;
+            }
+        }
+    }
+
+    // Find all lists of messages which are loaded, along with the total number of messages in memory
+    QList<TreeItemMsgList *> candidates;
+    int residentMessages = 0;
+    QList<TreeItemMailbox *> queue;
+    queue << m_mailboxes;
+    while (!queue.isEmpty()) {
+        TreeItemMailbox *mailbox = queue.takeLast();
+        for (int i = 1; i < mailbox->m_children.size(); ++i) {
+            queue << static_cast<TreeItemMailbox *>(mailbox->m_children[i]);
+        }
+        TreeItemMsgList *list = static_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+        if (list->m_children.isEmpty())
+            continue;
+        residentMessages += list->m_children.size();
+        if (!list->fetched() || mailbox->maintainingTask || pinned.contains(list))
+            continue;
+        // Reloading from the cache must result in the very same list, otherwise the network would have to be asked
+        if (!list->m_savedUidsValid || !list->m_savedUidsRemoved.isEmpty() || list->m_savedUidCount != list->m_children.size())
+            continue;
+        candidates << list;
+    }
+
+    // The least recently used ones go first
+    std::sort(candidates.begin(), candidates.end(), [](const TreeItemMsgList *a, const TreeItemMsgList *b) {
+        return a->m_lastUseSweep < b->m_lastUseSweep;
+    });
+
+    Q_FOREACH(TreeItemMsgList *list, candidates) {
+        const bool idle = idleSweeps && m_unloadSweep - list->m_lastUseSweep >= idleSweeps;
+        const bool overLimit = messageLimit && residentMessages > messageLimit;
+        if (!idle && !overLimit)
+            break;
+        if (!cache()->mailboxSyncState(static_cast<TreeItemMailbox *>(list->parent())->mailbox()).isUsableForSyncing())
+            continue;
+        residentMessages -= list->m_children.size();
+        m_reclaimedMemory += unloadMessageList(list);
+    }
+}
+
+/** @short Release all messages of the @arg list, returning the approximate amount of freed memory
+
+The list gets reloaded from the cache once somebody asks for its content again.
+*/
+quint64 Model::unloadMessageList(TreeItemMsgList *list)
+{
+    TreeItemMailbox *mailbox = static_cast<TreeItemMailbox *>(list->parent());
+    quint64 bytes = 0;
+    Q_FOREACH(TreeItem *message, list->m_children) {
+        bytes += approximateMemoryUsage(message);
+    }
+
+    const QModelIndex listIndex = list->toIndex(this);
+    beginRemoveRows(listIndex, 0, list->m_children.size() - 1);
+    TreeItemChildrenList messages;
+    messages.swap(list->m_children);
+    list->setFetchStatus(TreeItem::NONE);
+    list->invalidateSavedUids();
+    endRemoveRows();
+    qDeleteAll(messages);
+    emit dataChanged(listIndex, listIndex);
+
+    logTrace(listIndex, Common::LOG_OTHER, QStringLiteral("Model"),
+             QStringLiteral("Unloaded %1 messages of mailbox %2 (about %3 bytes)").arg(
+                 QString::number(messages.size()), mailbox->mailbox(), QString::number(bytes)));
+    return bytes;
+}
+
+/** @short Estimate how much memory the @arg item and its children occupy */
+quint64 Model::approximateMemoryUsage(TreeItem *item)
+{
+    quint64 bytes = 0;
+    if (TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(item)) {
+        bytes += sizeof(TreeItemMessage);
+        if (message->m_data) {
+            bytes += sizeof(MessageDataPayload) + message->m_data->rememberedBodyStructure().size();
+            if (message->m_data->partHeader())
+                bytes += approximateMemoryUsage(message->m_data->partHeader());
+            if (message->m_data->partText())
+                bytes += approximateMemoryUsage(message->m_data->partText());
+        }
+    } else if (TreeItemPart *part = dynamic_cast<TreeItemPart *>(item)) {
+        bytes += sizeof(TreeItemPart) + part->m_data.size();
+        if (part->m_partMime)
+            bytes += approximateMemoryUsage(part->m_partMime);
+        if (part->m_partRaw)
+            bytes += approximateMemoryUsage(part->m_partRaw);
+    }
+    Q_FOREACH(TreeItem *child, item->m_children) {
+        bytes += approximateMemoryUsage(child);
+    }
+    return bytes;
+}
+
 void Model::releaseMessageData(const QModelIndex &message)
 {
     if (! message.isValid())
@@ -1708,6 +2241,30 @@ void Model::releaseMessageData(const QModelIndex &message)
 #endif
 }
 
+void Model::setVisibleMessages(const QModelIndexList &messages)
+{
+    // The rows in a sorted or threaded view have nothing to do with the order of messages in the mailbox, so only the
+    // actual messages are remembered
+    TreeItemMsgList *list = 0;
+    QSet<uint> uids;
+    Q_FOREACH(const QModelIndex &index, messages) {
+        const QModelIndex message = Imap::deproxifiedIndex(index);
+        if (message.model() != this)
+            continue;
+        TreeItemMessage *item = dynamic_cast<TreeItemMessage *>(static_cast<TreeItem *>(message.internalPointer()));
+        if (!item || !item->uid())
+            continue;
+        TreeItemMsgList *parentList = static_cast<TreeItemMsgList *>(item->parent());
+        if (list && parentList != list)
+            continue;
+        list = parentList;
+        uids.insert(item->uid());
+    }
+    if (!list)
+        return;
+    list->m_visibleUids = uids;
+}
+
 QStringList Model::capabilities() const
 {
     if (m_parsers.isEmpty())
@@ -1909,6 +2466,7 @@ QModelIndex Model::messageIndexByUid(const QString &mailboxName, const uint uid)
         return QModelIndex();
     } else {
         Q_ASSERT(messages.size() == 1);
+        static_cast<TreeItemMsgList *>(mailbox->m_children[0])->markAsUsed(this);
         return messages.front()->toIndex(this);
     }
 }
@@ -1935,6 +2493,37 @@ void Model::invalidateAllMessageCounts()
     }
 }
 
+/** @short Update the numbers of all mailboxes which have been asked for in one batch
+
+Unlike invalidateAllMessageCounts(), the old numbers remain visible till the new ones arrive, and the whole update is
+performed by a single task instead of one STATUS task per mailbox.
+*/
+void Model::refreshAllMessageCounts()
+{
+    if (networkPolicy() == NETWORK_OFFLINE || m_messageCountsRefresh)
+        return;
+
+    QStringList mailboxes;
+    QList<TreeItemMailbox*> queue;
+    queue.append(m_mailboxes);
+    while (!queue.isEmpty()) {
+        TreeItemMailbox *head = queue.takeFirst();
+        // ignore first child, the TreeItemMsgList
+        for (auto it = head->m_children.constBegin() + 1; it != head->m_children.constEnd(); ++it) {
+            queue.append(static_cast<TreeItemMailbox*>(*it));
+        }
+        TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(head->m_children[0]);
+
+        // Just like in invalidateAllMessageCounts(), a mailbox which is kept open is up-to-date already
+        if (list->m_numberFetchingStatus == TreeItem::DONE && !head->maintainingTask && !head->mailbox().isEmpty()) {
+            mailboxes << head->mailbox();
+        }
+    }
+
+    if (!mailboxes.isEmpty())
+        m_messageCountsRefresh = m_taskFactory->createRefreshMessageCountsTask(this, mailboxes);
+}
+
 AppendTask *Model::appendIntoMailbox(const QString &mailbox, const QByteArray &rawMessageData, const QStringList &flags,
                                      const QDateTime &timestamp)
 {
@@ -2046,5 +2635,15 @@ void Model::setNumberRefreshInterval(const int interval)
     m_periodicMailboxNumbersRefresh->start(interval * 1000);
 }
 
+TaskSendingCommands::TaskSendingCommands(Model *model, ImapTask *task): m_model(model), m_previous(model->m_taskSendingCommands)
+{
+    m_model->m_taskSendingCommands = task;
+}
+
+TaskSendingCommands::~TaskSendingCommands()
+{
+    m_model->m_taskSendingCommands = m_previous;
+}
+
 }
 }
@@ -26,8 +26,10 @@
 #define IMAP_MODEL_H
 
 #include <QAbstractItemModel>
+#include <QElapsedTimer>
 #include <QPointer>
 #include <QTimer>
+#include <QVector>
 #include "Cache.h"
 #include "../ConnectionState.h"
 #include "../Parser/Parser.h"
@@ -245,6 +247,13 @@ public:
     */
     void releaseMessageData(const QModelIndex &message);
 
+    /** @short The user can see these messages right now
+
+    The pending requests for the metadata of these messages are served before the other ones. This is merely a hint; the
+    indexes can come from any proxy model on top of this one.
+    */
+    void setVisibleMessages(const QModelIndexList &messages);
+
     /** @short Return a list of capabilities which are supported by the server */
     QStringList capabilities() const;
 
@@ -289,6 +298,12 @@ public:
 
     void setNumberRefreshInterval(const int interval);
 
+    /** @short Approximate amount of memory which has been given back by unloadIdleMailboxes() so far, in bytes */
+    quint64 reclaimedMemory() const;
+
+    /** @short Current FETCH limits and link measurements of each connection, indexed by the parser ID */
+    QMap<uint, AdaptiveFetchLimits> fetchLimits() const;
+
 public slots:
     /** @short Ask for an updated list of mailboxes on the server */
     void reloadMailboxList();
@@ -311,6 +326,21 @@ public slots:
     void setSslPolicy(const QList<QSslCertificate> &sslChain, const QList<QSslError> &sslErrors, bool proceed);
 
     void invalidateAllMessageCounts();
+    /** @short Ask the server for up-to-date message counts of all mailboxes whose numbers are known */
+    void refreshAllMessageCounts();
+
+    /** @short Forget the messages of mailboxes which have not been used for a while
+
+    The list of messages of a mailbox stays in memory once it has been loaded, including the envelopes and the downloaded
+    body parts. This function is invoked periodically; it releases the messages of mailboxes which have not been looked
+    at for the number of minutes given by the "trojita-imap-unload-idle-mailboxes-after" property. When there are more
+    messages in memory than the "trojita-imap-resident-messages-limit" property permits, the least recently used mailboxes
+    are released as well. Only the mailboxes which are not being kept in sync and which are fully described by the cache
+    are eligible, so that they can be reloaded quickly when they are needed again. The mailbox which has been switched to
+    most recently and the mailboxes whose messages are still referred to through a QPersistentModelIndex, like the ones
+    shown in a separate message window, are never unloaded.
+    */
+    void unloadIdleMailboxes();
 
     QString imapAuthError() const;
 
@@ -320,10 +350,15 @@ private slots:
 
     /** @short The parser has received a full line */
     void slotParserLineReceived(Imap::Parser *parser, const QByteArray &line);
+    /** @short The parser has received a literal whose payload is not a part of the reported line */
+    void slotParserSpooledLiteralReceived(Imap::Parser *parser, const qint64 size);
 
     /** @short The parser has sent a block of data */
     void slotParserLineSent(Imap::Parser *parser, const QByteArray &line);
 
+    /** @short Remember which task has sent the command with the given @arg tag */
+    void slotParserCommandQueued(Imap::Parser *parser, const Imap::CommandHandle &tag);
+
     /** @short There's been a change in the state of various tasks */
     void slotTasksChanged();
 
@@ -332,6 +367,12 @@ private slots:
 
     void setImapAuthError(const QString &error);
 
+    /** @short Emit the dataChanged() and message count updates which have been collected so far */
+    void flushPendingChanges();
+
+    /** @short Open the spare connections requested through the trojita-imap-spare-connections, if any are missing */
+    void openSpareConnections();
+
 signals:
     /** @short This signal is emitted then the server sent us an ALERT response code */
     void alertReceived(const QString &message);
@@ -385,7 +426,10 @@ signals:
     /** @short Inform the user that it is advised to enable STARTTLS in future connection attempts */
     void requireStartTlsInFuture();
 
-    /** @short The amount of messages in the indicated mailbox might have changed */
+    /** @short The amount of messages in the indicated mailbox might have changed
+
+    An invalid index means that the numbers of many mailboxes were updated at once.
+    */
     void messageCountPossiblyChanged(const QModelIndex &mailbox);
 
     /** @short We've succeeded to create the given mailbox */
@@ -446,6 +490,7 @@ private:
     friend class UpdateFlagsOfAllMessagesTask;
     friend class ListChildMailboxesTask;
     friend class NumberOfMessagesTask;
+    friend class RefreshMessageCountsTask;
     friend class FetchMsgMetadataTask;
     friend class ExpungeMailboxTask;
     friend class ExpungeMessagesTask;
@@ -468,6 +513,7 @@ private:
     friend class SubscribeUnsubscribeTask;
     friend class GenUrlAuthTask;
     friend class UidSubmitTask;
+    friend class TaskSendingCommands;
 
     friend class TestingTaskFactory; // needs access to socketFactory
     friend class DummyNetworkWatcher; // needs access to the network policy manipulation
@@ -490,7 +536,10 @@ private:
     typedef enum {PRELOAD_PER_POLICY, PRELOAD_DISABLED} PreloadingMode;
 
     void askForMsgMetadata(TreeItemMessage *item, PreloadingMode preloadMode);
+    void finalizeAskForMsgMetadata(TreeItemMessage *item, const AbstractCache::MessageDataBundle &data,
+                                   const PreloadingMode preloadMode);
     void askForMsgPart(TreeItemPart *item, bool onlyFromCache=false);
+    void finalizeAskForMsgPart(TreeItemPart *item, const QByteArray &data, const QByteArray &rawData, bool onlyFromCache);
 
     void finalizeList(Parser *parser, TreeItemMailbox *const mailboxPtr);
     void finalizeIncrementalList(Parser *parser, const QString &parentMailboxName);
@@ -502,6 +551,16 @@ private:
     TreeItem *translatePtr(const QModelIndex &index) const;
 
     void emitMessageCountChanged(TreeItemMailbox *const mailbox);
+    void scheduleDataChanged(TreeItem *const item);
+    void scheduleMessageCountChanged(TreeItemMailbox *const mailbox);
+    void scheduleFlushOfPendingChanges();
+    quint64 unloadMessageList(TreeItemMsgList *list);
+    static quint64 approximateMemoryUsage(TreeItem *item);
+
+    /** @short Feed the round-trip time of a command which has just completed into the connection's AdaptiveFetchLimits */
+    void recordCommandCompletion(ParserState &parserState, const CommandHandle &tag);
+    TreeItemMailbox *applyStatus(const Imap::Responses::Status &resp);
+    void applyMessageCounts(const QList<Imap::Responses::Status> &responses);
 
     TreeItemMailbox *findMailboxByName(const QString &name) const;
     TreeItemMailbox *findMailboxByName(const QString &name, const TreeItemMailbox *const root) const;
@@ -516,6 +575,7 @@ private:
     /** @short Return a corresponding KeepMailboxOpenTask for a given mailbox */
     KeepMailboxOpenTask *findTaskResponsibleFor(const QModelIndex &mailbox);
     KeepMailboxOpenTask *findTaskResponsibleFor(TreeItemMailbox *mailboxPtr);
+    void replenishSpareConnection(Parser *adopted);
 
     /** @short Find a mailbox which is expected to be common for all passed items
 
@@ -578,9 +638,49 @@ private:
     QString m_imapAuthError;
 
     QTimer *m_periodicMailboxNumbersRefresh;
+    /** @short The account-wide refresh of message counts which is currently running, if any */
+    QPointer<ImapTask> m_messageCountsRefresh;
+
+    QTimer *m_idleMailboxesUnloader;
+    /** @short Number of times the unloadIdleMailboxes() has run; the lists of messages remember this when they are used */
+    uint m_unloadSweep;
+    quint64 m_reclaimedMemory;
+    /** @short The mailbox which has been passed to switchToMailbox() most recently; its messages are never unloaded */
+    QPersistentModelIndex m_currentMailbox;
+
+    /** @short Time base for the CommandTiming */
+    QElapsedTimer m_commandClock;
 
     QStringList m_capabilitiesBlacklist;
 
+    /** @short Pre-authentication capabilities of an encrypted connection, as seen by the most recent login
+
+    These are used by the OpenConnectionTask for deciding whether the LOGIN can be pipelined
+    without waiting for the server to advertise its capabilities again.
+    */
+    QStringList m_cachedPreAuthCapabilities;
+
+    /** @short The task which sends the commands being queued right now
+
+    This is set only for the lifetime of a TaskSendingCommands guard. Commands which get queued outside of any such
+    scope, like the IDLE or NOOP which are sent from timers, are not attributed to any task.
+    */
+    QPointer<ImapTask> m_taskSendingCommands;
+
+    /** @short Items whose dataChanged() has not been emitted yet
+
+    A burst of FETCH responses would otherwise produce a dataChanged() for each response, and an update of the
+    mailbox' message counts for each of them as well. The items are collected here and each of them is reported once
+    after the whole burst has been processed, see flushPendingChanges().
+    */
+    QVector<TreeItem *> m_pendingDataChanges;
+    /** @short Mailboxes whose message counts have to be announced as changed */
+    QVector<TreeItemMailbox *> m_pendingMessageCountChanges;
+    /** @short Is there a queued call to flushPendingChanges() already? */
+    bool m_pendingChangesFlushScheduled;
+    /** @short Nesting level of responseReceived(); the pending changes get flushed once it drops to zero */
+    int m_responseBatchDepth;
+
 protected slots:
     void responseReceived();
     void responseReceived(Imap::Parser *parser);
@@ -596,6 +696,24 @@ protected slots:
 
 };
 
+/** @short Attribute the commands which get queued during the lifetime of this object to the @arg task
+
+The attribution is used for routing the tagged responses and for measuring the latency of the commands. Nested guards
+restore the previous task when they go out of scope.
+*/
+class TaskSendingCommands
+{
+public:
+    TaskSendingCommands(Model *model, ImapTask *task);
+    ~TaskSendingCommands();
+
+private:
+    Q_DISABLE_COPY(TaskSendingCommands)
+
+    Model *m_model;
+    QPointer<ImapTask> m_previous;
+};
+
 }
 
 }
@@ -26,13 +26,25 @@
 namespace Imap {
 namespace Mailbox {
 
+CommandTiming::CommandTiming(const qint64 queuedAt, const quint64 receivedBytes, const bool isFetch):
+    queuedAt(queuedAt), receivedBytes(receivedBytes), isFetch(isFetch)
+{
+}
+
+CommandTiming::CommandTiming():
+    queuedAt(-1), receivedBytes(0), isFetch(false)
+{
+}
+
 ParserState::ParserState(Parser *_parser):
-    parser(_parser), connState(CONN_STATE_NONE), maintainingTask(0), capabilitiesFresh(false), processingDepth(false)
+    parser(_parser), connState(CONN_STATE_NONE), activeTasksGeneration(0), maintainingTask(0), capabilitiesFresh(false),
+    processingDepth(false), fetchHandlerGeneration(0), routedResponses(0), plugProbes(0), receivedBytes(0), isSpare(false)
 {
 }
 
 ParserState::ParserState():
-    connState(CONN_STATE_NONE), maintainingTask(0), capabilitiesFresh(false), processingDepth(false)
+    connState(CONN_STATE_NONE), activeTasksGeneration(0), maintainingTask(0), capabilitiesFresh(false),
+    processingDepth(false), fetchHandlerGeneration(0), routedResponses(0), plugProbes(0), receivedBytes(0), isSpare(false)
 {
 }
 
@@ -23,7 +23,9 @@
 #ifndef IMAP_MODEL_PARSERSTATE_H
 #define IMAP_MODEL_PARSERSTATE_H
 
+#include <QHash>
 #include <QPointer>
+#include "AdaptiveFetchLimits.h"
 #include "../ConnectionState.h"
 #include "../Parser/Parser.h"
 
@@ -33,6 +35,19 @@ namespace Mailbox {
 class ImapTask;
 class KeepMailboxOpenTask;
 
+/** @short When was a command sent, and how much data had been received by then */
+struct CommandTiming {
+    /** @short Value of the Model's command clock when the command got queued, in milliseconds */
+    qint64 queuedAt;
+    /** @short The ParserState::receivedBytes at that time */
+    quint64 receivedBytes;
+    /** @short Is this a FETCH of message data which shall be used for tuning the AdaptiveFetchLimits? */
+    bool isFetch;
+
+    CommandTiming(const qint64 queuedAt, const quint64 receivedBytes, const bool isFetch);
+    CommandTiming();
+};
+
 /** @short Helper structure for keeping track of each parser's state */
 struct ParserState {
     /** @short Which parser are we talking about here */
@@ -43,6 +58,11 @@ struct ParserState {
     CommandHandle logoutCmd;
     /** @short List of tasks which are active already, and should therefore receive events */
     QList<ImapTask *> activeTasks;
+    /** @short Incremented whenever a task is added to the activeTasks
+
+    Removing a task does not change the order of the remaining ones, so that's not counted.
+    */
+    uint activeTasksGeneration;
     /** @short An active KeepMailboxOpenTask, if one exists */
     QPointer<KeepMailboxOpenTask> maintainingTask;
     /** @short A list of cepabilities, as advertised by the server */
@@ -55,6 +75,37 @@ struct ParserState {
     /** @short Is the connection currently being processed? */
     int processingDepth;
 
+    /** @short Tasks which have sent the commands that are still waiting for their tagged responses
+
+    This is just a hint for routing of the responses. Commands which were not queued within a TaskSendingCommands scope
+    are not listed here, and the responses to them are offered to all active tasks in turn.
+    */
+    QHash<CommandHandle, QPointer<ImapTask> > commandOwners;
+    /** @short The task which has accepted the last untagged FETCH */
+    QPointer<ImapTask> fetchHandler;
+    /** @short The activeTasksGeneration at the time the fetchHandler was determined
+
+    The fetchHandler is only valid while no other task could have been activated in front of it.
+    */
+    uint fetchHandlerGeneration;
+
+    /** @short Number of responses which have been offered to the tasks */
+    quint64 routedResponses;
+    /** @short Number of calls to Responses::AbstractResponse::plug() which were needed for the routedResponses */
+    quint64 plugProbes;
+
+    /** @short Commands sent by the tasks which are still waiting for their tagged responses */
+    QHash<CommandHandle, CommandTiming> commandTimings;
+    /** @short Total size of the response lines received over this connection */
+    quint64 receivedBytes;
+    /** @short Group sizes and parallelism for the FETCHes over this connection, see the trojita-imap-adaptive-fetch-limits */
+    AdaptiveFetchLimits fetchLimits;
+    /** @short Has this connection been opened in advance, without anybody asking for it yet?
+
+    See the trojita-imap-spare-connections property.
+    */
+    bool isSpare;
+
     ParserState(Parser *parser);
     ParserState();
 };
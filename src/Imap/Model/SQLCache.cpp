@@ -21,16 +21,92 @@
 */
 
 #include "SQLCache.h"
+#include <algorithm>
+#include <functional>
+#include <QDateTime>
+#include <QtEndian>
 #include <QSqlError>
 #include <QSqlRecord>
 #include <QTimer>
 #include "Common/SqlTransactionAutoAborter.h"
+#include "Imap/Parser/UidSet.h"
 
 //#define CACHE_DEBUG
 
 namespace
 {
 static int streamVersion = QDataStream::Qt_4_6;
+
+/** @short Number of incremental updates of a mailbox' UID mapping after which they get folded into the full mapping */
+static const int uidMappingJournalLimit = 64;
+
+/** @short Prefix of the UID lists which are stored as a compressed Imap::UidSet */
+const char uidsAsSet = 'S';
+/** @short Prefix of the UID lists which are stored as a plain array of little-endian 32bit integers */
+const char uidsAsArray = 'A';
+
+QByteArray encodeUidArray(const Imap::Uids &uids)
+{
+    QByteArray buf(uids.size() * static_cast<int>(sizeof(quint32)), Qt::Uninitialized);
+    uchar *out = reinterpret_cast<uchar *>(buf.data());
+    for (auto it = uids.constBegin(); it != uids.constEnd(); ++it) {
+        qToLittleEndian<quint32>(*it, out);
+        out += sizeof(quint32);
+    }
+    return buf;
+}
+
+Imap::Uids decodeUidArray(const QByteArray &buf, const int offset)
+{
+    Imap::Uids uids((buf.size() - offset) / sizeof(quint32));
+    const uchar *in = reinterpret_cast<const uchar *>(buf.constData()) + offset;
+    for (auto it = uids.begin(); it != uids.end(); ++it) {
+        *it = qFromLittleEndian<quint32>(in);
+        in += sizeof(quint32);
+    }
+    return uids;
+}
+
+/** @short Store the UIDs as a compressed set when they are sorted, which is always the case for the UID mapping
+
+The other lists, like the UIDs which might have arrived in an arbitrary order, are kept as they are.
+*/
+QByteArray encodeUids(const Imap::Uids &uids)
+{
+    if (std::adjacent_find(uids.constBegin(), uids.constEnd(), std::greater_equal<uint>()) == uids.constEnd())
+        return uidsAsSet + Imap::UidSet::fromVector(uids).toCompactByteArray();
+    return uidsAsArray + encodeUidArray(uids);
+}
+
+/** @short Decode the output of encodeUids(), setting @arg ok to false if the data are corrupted */
+Imap::Uids decodeUids(const QByteArray &buf, bool *ok)
+{
+    *ok = true;
+    if (buf.isEmpty())
+        return Imap::Uids();
+    if (buf[0] == uidsAsSet) {
+        Imap::UidSet set = Imap::UidSet::fromCompactByteArray(buf.mid(1), ok);
+        return *ok ? set.toVector() : Imap::Uids();
+    }
+    if (buf[0] == uidsAsArray && (buf.size() - 1) % static_cast<int>(sizeof(quint32)) == 0)
+        return decodeUidArray(buf, 1);
+    *ok = false;
+    return Imap::Uids();
+}
+
+/** @short Seconds after which another access to a message part is worth recording for the LRU eviction */
+static const qint64 partAccessGranularity = 600;
+
+/** @short Fraction of the budget which is kept free after an eviction so that it doesn't run upon each insertion */
+static const qint64 partEvictionHeadroomPercent = 10;
+
+/** @short Maximal number of message parts to evict at once */
+static const int partEvictionBatchSize = 64;
+
+qint64 partAccessTimestamp()
+{
+    return QDateTime::currentMSecsSinceEpoch() / 1000;
+}
 }
 
 namespace Imap
@@ -62,6 +138,12 @@ QDate SQLCache::accessingThresholdDate = QDate(2012, 11, 1);
 SQLCache::SQLCache()
     : inTransaction(false)
     , m_updateAccessIfOlder(0)
+    , m_blobsMaybeUnreferenced(true)
+    , m_partBytes(-1)
+    , m_partBudget(0)
+    , m_partEvictions(0)
+    , m_partHits(0)
+    , m_partMisses(0)
 {
 }
 
@@ -80,6 +162,12 @@ void SQLCache::init()
     tooMuchTimeWithoutCommit->setObjectName(QStringLiteral("tooMuchTimeWithoutCommit"));
     QObject::connect(tooMuchTimeWithoutCommit.get(), &QTimer::timeout,
                      tooMuchTimeWithoutCommit.get(), [this](){ this->timeToCommit(); });
+    partEviction.reset(new QTimer());
+    partEviction->setSingleShot(true);
+    partEviction->setInterval(0);
+    partEviction->setObjectName(QStringLiteral("partEviction"));
+    QObject::connect(partEviction.get(), &QTimer::timeout,
+                     partEviction.get(), [this](){ this->enforcePartCacheBudget(); });
 }
 
 SQLCache::~SQLCache()
@@ -118,6 +206,44 @@ if ( ! q.exec( QLatin1String("CREATE TABLE mailbox_sync_state ( " \
         return false; \
     }
 
+#define TROJITA_SQL_CACHE_CREATE_UID_MAPPING_JOURNAL \
+    if (! q.exec(QLatin1String("CREATE TABLE uid_mapping_journal (" \
+                               "id INTEGER PRIMARY KEY AUTOINCREMENT, " \
+                               "mailbox STRING NOT NULL, " \
+                               "removed BINARY, " \
+                               "added BINARY" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table uid_mapping_journal"), q); \
+        return false; \
+    } \
+    if (! q.exec(QLatin1String("CREATE INDEX uid_mapping_journal_mailbox ON uid_mapping_journal (mailbox)"))) { \
+        emitError(QObject::tr("Can't create index on uid_mapping_journal"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_CREATE_PART_BLOBS \
+    if (! q.exec(QLatin1String("CREATE TABLE blobs (" \
+                               "hash BINARY NOT NULL PRIMARY KEY, " \
+                               "size INT" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table blobs"), q); \
+        return false; \
+    } \
+    if (! q.exec(QLatin1String("CREATE TABLE part_blobs (" \
+                               "mailbox STRING NOT NULL, " \
+                               "uid INT NOT NULL, " \
+                               "part_id BINARY, " \
+                               "hash BINARY NOT NULL, " \
+                               "PRIMARY KEY (mailbox, uid, part_id)" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table part_blobs"), q); \
+        return false; \
+    } \
+    if (! q.exec(QLatin1String("CREATE INDEX part_blobs_hash ON part_blobs (hash)"))) { \
+        emitError(QObject::tr("Can't create index on part_blobs"), q); \
+        return false; \
+    }
+
 bool SQLCache::open(const QString &name, const QString &fileName)
 {
 #ifdef CACHE_DEBUG
@@ -198,7 +324,126 @@ bool SQLCache::open(const QString &name, const QString &fileName)
         }
     }
 
-    if (version != 7) {
+    if (version == 7) {
+        // V8 stores the UID mapping as a plain array of integers instead of a compressed QDataStream, and keeps the
+        // incremental changes to it in a separate journal so that a single arrival doesn't rewrite the whole mapping
+        TROJITA_SQL_CACHE_CREATE_UID_MAPPING_JOURNAL;
+        QList<QPair<QString, QByteArray> > mappings;
+        if (! q.exec(QStringLiteral("SELECT mailbox, mapping FROM uid_mapping"))) {
+            emitError(QObject::tr("Failed to read the old UID mapping"), q);
+            return false;
+        }
+        while (q.next()) {
+            Imap::Uids uids;
+            QDataStream stream(qUncompress(q.value(1).toByteArray()));
+            stream.setVersion(streamVersion);
+            stream >> uids;
+            mappings << qMakePair(q.value(0).toString(), encodeUidArray(uids));
+        }
+        if (! q.prepare(QStringLiteral("UPDATE uid_mapping SET mapping = ? WHERE mailbox = ?"))) {
+            emitError(QObject::tr("Failed to prepare the UID mapping conversion"), q);
+            return false;
+        }
+        for (auto it = mappings.constBegin(); it != mappings.constEnd(); ++it) {
+            q.bindValue(0, it->second);
+            q.bindValue(1, it->first);
+            if (! q.exec()) {
+                emitError(QObject::tr("Failed to convert the UID mapping"), q);
+                return false;
+            }
+        }
+        version = 8;
+        if (! q.exec(QStringLiteral("UPDATE trojita SET version = 8;"))) {
+            emitError(QObject::tr("Failed to update cache DB scheme from v7 to v8"), q);
+            return false;
+        }
+    }
+
+    if (version == 8) {
+        // V9 keeps track of big message parts which are stored as content-addressed blobs outside of the DB
+        TROJITA_SQL_CACHE_CREATE_PART_BLOBS;
+        version = 9;
+        if (! q.exec(QStringLiteral("UPDATE trojita SET version = 9;"))) {
+            emitError(QObject::tr("Failed to update cache DB scheme from v8 to v9"), q);
+            return false;
+        }
+    }
+
+    if (version == 9) {
+        // V10 tracks the size and the time of the last access of each message part for the LRU eviction
+        if (! q.exec(QStringLiteral("ALTER TABLE parts ADD COLUMN size INT"))
+                || ! q.exec(QStringLiteral("ALTER TABLE parts ADD COLUMN lastAccess INT"))
+                || ! q.exec(QStringLiteral("UPDATE parts SET size = length(data)"))
+                || ! q.exec(QStringLiteral("ALTER TABLE blobs ADD COLUMN lastAccess INT"))) {
+            emitError(QObject::tr("Failed to add the LRU columns"), q);
+            return false;
+        }
+        // The size is included so that the total can be computed from the index alone
+        if (! q.exec(QStringLiteral("CREATE INDEX parts_lastAccess ON parts (lastAccess, size)"))
+                || ! q.exec(QStringLiteral("CREATE INDEX blobs_lastAccess ON blobs (lastAccess, size)"))) {
+            emitError(QObject::tr("Can't create the LRU indexes"), q);
+            return false;
+        }
+        version = 10;
+        if (! q.exec(QStringLiteral("UPDATE trojita SET version = 10;"))) {
+            emitError(QObject::tr("Failed to update cache DB scheme from v9 to v10"), q);
+            return false;
+        }
+    }
+
+    if (version == 10) {
+        // V11 stores the sorted UID lists, i.e. the UID mapping in particular, in a compressed form
+        QList<QPair<QString, QByteArray> > mappings;
+        if (! q.exec(QStringLiteral("SELECT mailbox, mapping FROM uid_mapping"))) {
+            emitError(QObject::tr("Failed to read the old UID mapping"), q);
+            return false;
+        }
+        while (q.next()) {
+            mappings << qMakePair(q.value(0).toString(), encodeUids(decodeUidArray(q.value(1).toByteArray(), 0)));
+        }
+        QList<QPair<qint64, QPair<QByteArray, QByteArray> > > journal;
+        if (! q.exec(QStringLiteral("SELECT id, removed, added FROM uid_mapping_journal"))) {
+            emitError(QObject::tr("Failed to read the old UID mapping journal"), q);
+            return false;
+        }
+        while (q.next()) {
+            journal << qMakePair(q.value(0).toLongLong(),
+                                 qMakePair(encodeUids(decodeUidArray(q.value(1).toByteArray(), 0)),
+                                           encodeUids(decodeUidArray(q.value(2).toByteArray(), 0))));
+        }
+        if (! q.prepare(QStringLiteral("UPDATE uid_mapping SET mapping = ? WHERE mailbox = ?"))) {
+            emitError(QObject::tr("Failed to prepare the UID mapping conversion"), q);
+            return false;
+        }
+        for (auto it = mappings.constBegin(); it != mappings.constEnd(); ++it) {
+            q.bindValue(0, it->second);
+            q.bindValue(1, it->first);
+            if (! q.exec()) {
+                emitError(QObject::tr("Failed to convert the UID mapping"), q);
+                return false;
+            }
+        }
+        if (! q.prepare(QStringLiteral("UPDATE uid_mapping_journal SET removed = ?, added = ? WHERE id = ?"))) {
+            emitError(QObject::tr("Failed to prepare the UID mapping journal conversion"), q);
+            return false;
+        }
+        for (auto it = journal.constBegin(); it != journal.constEnd(); ++it) {
+            q.bindValue(0, it->second.first);
+            q.bindValue(1, it->second.second);
+            q.bindValue(2, it->first);
+            if (! q.exec()) {
+                emitError(QObject::tr("Failed to convert the UID mapping journal"), q);
+                return false;
+            }
+        }
+        version = 11;
+        if (! q.exec(QStringLiteral("UPDATE trojita SET version = 11;"))) {
+            emitError(QObject::tr("Failed to update cache DB scheme from v10 to v11"), q);
+            return false;
+        }
+    }
+
+    if (version != 11) {
         emitError(QObject::tr("Unknown version of sqlite cache"));
         return false;
     }
@@ -332,6 +577,31 @@ bool SQLCache::prepareQueries()
         return false;
     }
 
+    queryUidMappingJournal = QSqlQuery(db);
+    queryUidMappingJournal.setForwardOnly(true);
+    if (! queryUidMappingJournal.prepare(QStringLiteral("SELECT removed, added FROM uid_mapping_journal WHERE mailbox = ? ORDER BY id"))) {
+        emitError(QObject::tr("Failed to prepare queryUidMappingJournal"), queryUidMappingJournal);
+        return false;
+    }
+
+    queryUidMappingJournalSize = QSqlQuery(db);
+    if (! queryUidMappingJournalSize.prepare(QStringLiteral("SELECT COUNT(*) FROM uid_mapping_journal WHERE mailbox = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryUidMappingJournalSize"), queryUidMappingJournalSize);
+        return false;
+    }
+
+    queryAppendUidMappingJournal = QSqlQuery(db);
+    if (! queryAppendUidMappingJournal.prepare(QStringLiteral("INSERT INTO uid_mapping_journal (mailbox, removed, added) VALUES (?, ?, ?)"))) {
+        emitError(QObject::tr("Failed to prepare queryAppendUidMappingJournal"), queryAppendUidMappingJournal);
+        return false;
+    }
+
+    queryClearUidMappingJournal = QSqlQuery(db);
+    if (! queryClearUidMappingJournal.prepare(QStringLiteral("DELETE FROM uid_mapping_journal WHERE mailbox = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryClearUidMappingJournal"), queryClearUidMappingJournal);
+        return false;
+    }
+
     queryMessageMetadata = QSqlQuery(db);
     if (! queryMessageMetadata.prepare(QStringLiteral("SELECT data, lastAccessDate FROM msg_metadata WHERE mailbox = ? AND uid = ?"))) {
         emitError(QObject::tr("Failed to prepare queryMessageMetadata"), queryMessageMetadata);
@@ -356,6 +626,13 @@ bool SQLCache::prepareQueries()
         return false;
     }
 
+    queryMessageFlagsForMailbox = QSqlQuery(db);
+    queryMessageFlagsForMailbox.setForwardOnly(true);
+    if (! queryMessageFlagsForMailbox.prepare(QStringLiteral("SELECT uid, flags FROM flags WHERE mailbox = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryMessageFlagsForMailbox"), queryMessageFlagsForMailbox);
+        return false;
+    }
+
     querySetMessageFlags = QSqlQuery(db);
     if (! querySetMessageFlags.prepare(QStringLiteral("INSERT OR REPLACE INTO flags ( mailbox, uid, flags ) VALUES ( ?, ?, ? )"))) {
         emitError(QObject::tr("Failed to prepare querySetMessageFlags"), querySetMessageFlags);
@@ -386,6 +663,12 @@ bool SQLCache::prepareQueries()
         return false;
     }
 
+    queryClearAllMessages5 = QSqlQuery(db);
+    if (! queryClearAllMessages5.prepare(QStringLiteral("DELETE FROM part_blobs WHERE mailbox = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryClearAllMessages5"), queryClearAllMessages5);
+        return false;
+    }
+
     queryClearMessage1 = QSqlQuery(db);
     if (! queryClearMessage1.prepare(QStringLiteral("DELETE FROM msg_metadata WHERE mailbox = ? AND uid = ?"))) {
         emitError(QObject::tr("Failed to prepare queryClearMessage1"), queryClearMessage1);
@@ -404,14 +687,26 @@ bool SQLCache::prepareQueries()
         return false;
     }
 
+    queryClearMessage4 = QSqlQuery(db);
+    if (! queryClearMessage4.prepare(QStringLiteral("DELETE FROM part_blobs WHERE mailbox = ? AND uid = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryClearMessage4"), queryClearMessage4);
+        return false;
+    }
+
     queryMessagePart = QSqlQuery(db);
-    if (! queryMessagePart.prepare(QStringLiteral("SELECT data FROM parts WHERE mailbox = ? AND uid = ? AND part_id = ?"))) {
+    if (! queryMessagePart.prepare(QStringLiteral("SELECT data, lastAccess FROM parts WHERE mailbox = ? AND uid = ? AND part_id = ?"))) {
         emitError(QObject::tr("Failed to prepare queryMessagePart"), queryMessagePart);
         return false;
     }
 
+    queryAccessMessagePart = QSqlQuery(db);
+    if (! queryAccessMessagePart.prepare(QStringLiteral("UPDATE parts SET lastAccess = ? WHERE mailbox = ? AND uid = ? AND part_id = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryAccessMessagePart"), queryAccessMessagePart);
+        return false;
+    }
+
     querySetMessagePart = QSqlQuery(db);
-    if (! querySetMessagePart.prepare(QStringLiteral("INSERT OR REPLACE INTO parts ( mailbox, uid, part_id, data ) VALUES (?, ?, ?, ?)"))) {
+    if (! querySetMessagePart.prepare(QStringLiteral("INSERT OR REPLACE INTO parts ( mailbox, uid, part_id, data, size, lastAccess ) VALUES (?, ?, ?, ?, ?, ?)"))) {
         emitError(QObject::tr("Failed to prepare querySetMessagePart"), querySetMessagePart);
         return false;
     }
@@ -422,6 +717,97 @@ bool SQLCache::prepareQueries()
         return false;
     }
 
+    queryMessagePartBlob = QSqlQuery(db);
+    if (! queryMessagePartBlob.prepare(QStringLiteral("SELECT part_blobs.hash, blobs.lastAccess FROM part_blobs LEFT JOIN blobs ON part_blobs.hash = blobs.hash "
+                                                      "WHERE mailbox = ? AND uid = ? AND part_id = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryMessagePartBlob"), queryMessagePartBlob);
+        return false;
+    }
+
+    querySetMessagePartBlob = QSqlQuery(db);
+    if (! querySetMessagePartBlob.prepare(QStringLiteral("INSERT OR REPLACE INTO part_blobs (mailbox, uid, part_id, hash) VALUES (?, ?, ?, ?)"))) {
+        emitError(QObject::tr("Failed to prepare querySetMessagePartBlob"), querySetMessagePartBlob);
+        return false;
+    }
+
+    queryForgetMessagePartBlob = QSqlQuery(db);
+    if (! queryForgetMessagePartBlob.prepare(QStringLiteral("DELETE FROM part_blobs WHERE mailbox = ? AND uid = ? AND part_id = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryForgetMessagePartBlob"), queryForgetMessagePartBlob);
+        return false;
+    }
+
+    queryAccessBlob = QSqlQuery(db);
+    if (! queryAccessBlob.prepare(QStringLiteral("UPDATE blobs SET lastAccess = ? WHERE hash = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryAccessBlob"), queryAccessBlob);
+        return false;
+    }
+
+    queryAddBlob = QSqlQuery(db);
+    if (! queryAddBlob.prepare(QStringLiteral("INSERT OR IGNORE INTO blobs (hash, size, lastAccess) VALUES (?, ?, ?)"))) {
+        emitError(QObject::tr("Failed to prepare queryAddBlob"), queryAddBlob);
+        return false;
+    }
+
+    queryUnreferencedBlobs = QSqlQuery(db);
+    queryUnreferencedBlobs.setForwardOnly(true);
+    if (! queryUnreferencedBlobs.prepare(QStringLiteral("SELECT hash FROM blobs WHERE NOT EXISTS "
+                                                        "(SELECT 1 FROM part_blobs WHERE part_blobs.hash = blobs.hash)"))) {
+        emitError(QObject::tr("Failed to prepare queryUnreferencedBlobs"), queryUnreferencedBlobs);
+        return false;
+    }
+
+    queryForgetBlob = QSqlQuery(db);
+    if (! queryForgetBlob.prepare(QStringLiteral("DELETE FROM blobs WHERE hash = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryForgetBlob"), queryForgetBlob);
+        return false;
+    }
+
+    queryForgetBlobReferences = QSqlQuery(db);
+    if (! queryForgetBlobReferences.prepare(QStringLiteral("DELETE FROM part_blobs WHERE hash = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryForgetBlobReferences"), queryForgetBlobReferences);
+        return false;
+    }
+
+    queryPartCacheSize = QSqlQuery(db);
+    if (! queryPartCacheSize.prepare(QStringLiteral("SELECT (SELECT TOTAL(size) FROM parts) + (SELECT TOTAL(size) FROM blobs)"))) {
+        emitError(QObject::tr("Failed to prepare queryPartCacheSize"), queryPartCacheSize);
+        return false;
+    }
+
+    queryMailboxPartsSize = QSqlQuery(db);
+    if (! queryMailboxPartsSize.prepare(QStringLiteral("SELECT TOTAL(size) FROM parts WHERE mailbox = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryMailboxPartsSize"), queryMailboxPartsSize);
+        return false;
+    }
+
+    queryMessagePartsSize = QSqlQuery(db);
+    if (! queryMessagePartsSize.prepare(QStringLiteral("SELECT TOTAL(size) FROM parts WHERE mailbox = ? AND uid = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryMessagePartsSize"), queryMessagePartsSize);
+        return false;
+    }
+
+    queryMessagePartSize = QSqlQuery(db);
+    if (! queryMessagePartSize.prepare(QStringLiteral("SELECT TOTAL(size) FROM parts WHERE mailbox = ? AND uid = ? AND part_id = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryMessagePartSize"), queryMessagePartSize);
+        return false;
+    }
+
+    queryBlobSize = QSqlQuery(db);
+    if (! queryBlobSize.prepare(QStringLiteral("SELECT TOTAL(size) FROM blobs WHERE hash = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryBlobSize"), queryBlobSize);
+        return false;
+    }
+
+    // Inline parts and blobs share a single LRU order; the blobs are identified by their hash, the parts by their key
+    queryLeastRecentlyUsedParts = QSqlQuery(db);
+    queryLeastRecentlyUsedParts.setForwardOnly(true);
+    if (! queryLeastRecentlyUsedParts.prepare(QStringLiteral("SELECT mailbox, uid, part_id, NULL, size, lastAccess FROM parts "
+                                                             "UNION ALL SELECT NULL, NULL, NULL, hash, size, lastAccess FROM blobs "
+                                                             "ORDER BY 6 LIMIT ?"))) {
+        emitError(QObject::tr("Failed to prepare queryLeastRecentlyUsedParts"), queryLeastRecentlyUsedParts);
+        return false;
+    }
+
     queryMessageThreading = QSqlQuery(db);
     if (! queryMessageThreading.prepare(QStringLiteral("SELECT threading FROM msg_threading WHERE mailbox = ?"))) {
         emitError(QObject::tr("Failed to prepare queryMessageThreading"), queryMessageThreading);
@@ -560,18 +946,46 @@ void SQLCache::setMailboxSyncState(const QString &mailbox, const SyncState &stat
 Imap::Uids SQLCache::uidMapping(const QString &mailbox) const
 {
     Imap::Uids res;
+    loadUidMapping(mailbox, res);
+    return res;
+}
+
+bool SQLCache::loadUidMapping(const QString &mailbox, Imap::Uids &res) const
+{
     queryUidMapping.bindValue(0, mailboxName(mailbox));
     if (! queryUidMapping.exec()) {
         emitError(QObject::tr("Query queryUidMapping failed"), queryUidMapping);
-        return res;
+        return false;
     }
+    bool ok = true;
     if (queryUidMapping.first()) {
-        QDataStream stream(qUncompress(queryUidMapping.value(0).toByteArray()));
-        stream.setVersion(streamVersion);
-        stream >> res;
+        res = decodeUids(queryUidMapping.value(0).toByteArray(), &ok);
+        if (!ok) {
+            res.clear();
+            emitError(QObject::tr("Corrupted UID mapping of mailbox %1").arg(mailbox));
+            return false;
+        }
     }
     // "No data present" doesn't necessarily imply a problem -- it simply might not be there yet :)
-    return res;
+
+    queryUidMappingJournal.bindValue(0, mailboxName(mailbox));
+    if (! queryUidMappingJournal.exec()) {
+        emitError(QObject::tr("Query queryUidMappingJournal failed"), queryUidMappingJournal);
+        return false;
+    }
+    // The entries have to be replayed in order; a later entry might expunge a message which an earlier one has added
+    while (queryUidMappingJournal.next()) {
+        bool okRemoved, okAdded;
+        const Imap::Uids removed = decodeUids(queryUidMappingJournal.value(0).toByteArray(), &okRemoved);
+        const Imap::Uids added = decodeUids(queryUidMappingJournal.value(1).toByteArray(), &okAdded);
+        if (!okRemoved || !okAdded) {
+            res.clear();
+            emitError(QObject::tr("Corrupted update of the UID mapping of mailbox %1").arg(mailbox));
+            return false;
+        }
+        applyUidMappingUpdate(res, removed, added);
+    }
+    return true;
 }
 
 void SQLCache::setUidMapping(const QString &mailbox, const Imap::Uids &seqToUid)
@@ -581,13 +995,41 @@ void SQLCache::setUidMapping(const QString &mailbox, const Imap::Uids &seqToUid)
 #endif
     touchingDB();
     querySetUidMapping.bindValue(0, mailboxName(mailbox));
-    QByteArray buf;
-    QDataStream stream(&buf, QIODevice::ReadWrite);
-    stream.setVersion(streamVersion);
-    stream << seqToUid;
-    querySetUidMapping.bindValue(1, qCompress(buf));
+    querySetUidMapping.bindValue(1, encodeUids(seqToUid));
     if (! querySetUidMapping.exec()) {
         emitError(QObject::tr("Query querySetUidMapping failed"), querySetUidMapping);
+        return;
+    }
+    queryClearUidMappingJournal.bindValue(0, mailboxName(mailbox));
+    if (! queryClearUidMappingJournal.exec()) {
+        emitError(QObject::tr("Query queryClearUidMappingJournal failed"), queryClearUidMappingJournal);
+    }
+}
+
+void SQLCache::updateUidMapping(const QString &mailbox, const Imap::Uids &removed, const Imap::Uids &added)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "Updating UID mapping for" << mailbox << "removed" << removed.size() << "added" << added.size();
+#endif
+    touchingDB();
+    queryAppendUidMappingJournal.bindValue(0, mailboxName(mailbox));
+    queryAppendUidMappingJournal.bindValue(1, encodeUids(removed));
+    queryAppendUidMappingJournal.bindValue(2, encodeUids(added));
+    if (! queryAppendUidMappingJournal.exec()) {
+        emitError(QObject::tr("Query queryAppendUidMappingJournal failed"), queryAppendUidMappingJournal);
+        return;
+    }
+
+    queryUidMappingJournalSize.bindValue(0, mailboxName(mailbox));
+    if (! queryUidMappingJournalSize.exec()) {
+        emitError(QObject::tr("Query queryUidMappingJournalSize failed"), queryUidMappingJournalSize);
+        return;
+    }
+    if (queryUidMappingJournalSize.first() && queryUidMappingJournalSize.value(0).toInt() >= uidMappingJournalLimit) {
+        // Fold the journal back into the mapping so that the loading doesn't have to replay a long history
+        Imap::Uids uids;
+        if (loadUidMapping(mailbox, uids))
+            setUidMapping(mailbox, uids);
     }
 }
 
@@ -601,6 +1043,10 @@ void SQLCache::clearUidMapping(const QString &mailbox)
     if (! queryClearUidMapping.exec()) {
         emitError(QObject::tr("Query queryClearUidMapping failed"), queryClearUidMapping);
     }
+    queryClearUidMappingJournal.bindValue(0, mailboxName(mailbox));
+    if (! queryClearUidMappingJournal.exec()) {
+        emitError(QObject::tr("Query queryClearUidMappingJournal failed"), queryClearUidMappingJournal);
+    }
 }
 
 void SQLCache::clearAllMessages(const QString &mailbox)
@@ -613,6 +1059,9 @@ void SQLCache::clearAllMessages(const QString &mailbox)
     queryClearAllMessages2.bindValue(0, mailboxName(mailbox));
     queryClearAllMessages3.bindValue(0, mailboxName(mailbox));
     queryClearAllMessages4.bindValue(0, mailboxName(mailbox));
+    queryClearAllMessages5.bindValue(0, mailboxName(mailbox));
+    queryMailboxPartsSize.bindValue(0, mailboxName(mailbox));
+    const qint64 partsSize = storedSize(queryMailboxPartsSize, QStringLiteral("queryMailboxPartsSize"));
     if (! queryClearAllMessages1.exec()) {
         emitError(QObject::tr("Query queryClearAllMessages1 failed"), queryClearAllMessages1);
     }
@@ -621,10 +1070,17 @@ void SQLCache::clearAllMessages(const QString &mailbox)
     }
     if (! queryClearAllMessages3.exec()) {
         emitError(QObject::tr("Query queryClearAllMessages3 failed"), queryClearAllMessages3);
+    } else {
+        adjustPartCacheSize(-partsSize);
     }
     if (! queryClearAllMessages4.exec()) {
         emitError(QObject::tr("Query queryClearAllMessages4 failed"), queryClearAllMessages4);
     }
+    if (! queryClearAllMessages5.exec()) {
+        emitError(QObject::tr("Query queryClearAllMessages5 failed"), queryClearAllMessages5);
+    } else if (queryClearAllMessages5.numRowsAffected() > 0) {
+        m_blobsMaybeUnreferenced = true;
+    }
     clearUidMapping(mailbox);
 }
 
@@ -640,6 +1096,11 @@ void SQLCache::clearMessage(const QString mailbox, uint uid)
     queryClearMessage2.bindValue(1, uid);
     queryClearMessage3.bindValue(0, mailboxName(mailbox));
     queryClearMessage3.bindValue(1, uid);
+    queryClearMessage4.bindValue(0, mailboxName(mailbox));
+    queryClearMessage4.bindValue(1, uid);
+    queryMessagePartsSize.bindValue(0, mailboxName(mailbox));
+    queryMessagePartsSize.bindValue(1, uid);
+    const qint64 partsSize = storedSize(queryMessagePartsSize, QStringLiteral("queryMessagePartsSize"));
     if (! queryClearMessage1.exec()) {
         emitError(QObject::tr("Query queryClearMessage1 failed"), queryClearMessage1);
     }
@@ -648,6 +1109,13 @@ void SQLCache::clearMessage(const QString mailbox, uint uid)
     }
     if (! queryClearMessage3.exec()) {
         emitError(QObject::tr("Query queryClearMessage3 failed"), queryClearMessage3);
+    } else {
+        adjustPartCacheSize(-partsSize);
+    }
+    if (! queryClearMessage4.exec()) {
+        emitError(QObject::tr("Query queryClearMessage4 failed"), queryClearMessage4);
+    } else if (queryClearMessage4.numRowsAffected() > 0) {
+        m_blobsMaybeUnreferenced = true;
     }
 }
 
@@ -669,6 +1137,33 @@ QStringList SQLCache::msgFlags(const QString &mailbox, const uint uid) const
     return res;
 }
 
+QHash<uint, QStringList> SQLCache::msgFlagsForMailbox(const QString &mailbox) const
+{
+    QHash<uint, QStringList> res;
+    queryMessageFlagsForMailbox.bindValue(0, mailboxName(mailbox));
+    if (! queryMessageFlagsForMailbox.exec()) {
+        emitError(QObject::tr("Query queryMessageFlagsForMailbox failed"), queryMessageFlagsForMailbox);
+        return res;
+    }
+    // The number of distinct combinations of flags is tiny compared to the number of messages, so each blob is only
+    // decoded once and the resulting lists share their data
+    QHash<QByteArray, QStringList> decoded;
+    while (queryMessageFlagsForMailbox.next()) {
+        QByteArray buf = queryMessageFlagsForMailbox.value(1).toByteArray();
+        auto known = decoded.constFind(buf);
+        if (known == decoded.constEnd()) {
+            QStringList flags;
+            QDataStream stream(buf);
+            stream.setVersion(streamVersion);
+            stream >> flags;
+            known = decoded.insert(buf, flags);
+        }
+        res.insert(queryMessageFlagsForMailbox.value(0).toUInt(), *known);
+    }
+    queryMessageFlagsForMailbox.finish();
+    return res;
+}
+
 void SQLCache::setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags)
 {
 #ifdef CACHE_DEBUG
@@ -753,7 +1248,22 @@ QByteArray SQLCache::messagePart(const QString &mailbox, const uint uid, const Q
     }
     if (queryMessagePart.first()) {
         res = qUncompress(queryMessagePart.value(0).toByteArray());
+        qint64 lastAccess = queryMessagePart.value(1).toLongLong();
         queryMessagePart.finish();
+        ++m_partHits;
+
+        qint64 now = partAccessTimestamp();
+        if (lastAccess < now - partAccessGranularity) {
+            queryAccessMessagePart.bindValue(0, now);
+            queryAccessMessagePart.bindValue(1, mailboxName(mailbox));
+            queryAccessMessagePart.bindValue(2, uid);
+            queryAccessMessagePart.bindValue(3, partId);
+            if (! queryAccessMessagePart.exec()) {
+                emitError(QObject::tr("Query queryAccessMessagePart failed"), queryAccessMessagePart);
+            }
+        }
+    } else {
+        ++m_partMisses;
     }
     return res;
 }
@@ -764,13 +1274,24 @@ void SQLCache::setMsgPart(const QString &mailbox, const uint uid, const QByteArr
     qDebug() << "Saving message part" << partId << uid << mailbox;
 #endif
     touchingDB();
+    // The part might be replacing an older version of itself
+    queryMessagePartSize.bindValue(0, mailboxName(mailbox));
+    queryMessagePartSize.bindValue(1, uid);
+    queryMessagePartSize.bindValue(2, partId);
+    const qint64 oldSize = storedSize(queryMessagePartSize, QStringLiteral("queryMessagePartSize"));
     querySetMessagePart.bindValue(0, mailboxName(mailbox));
     querySetMessagePart.bindValue(1, uid);
     querySetMessagePart.bindValue(2, partId);
-    querySetMessagePart.bindValue(3, qCompress(data));
+    QByteArray compressed = qCompress(data);
+    querySetMessagePart.bindValue(3, compressed);
+    querySetMessagePart.bindValue(4, compressed.size());
+    querySetMessagePart.bindValue(5, partAccessTimestamp());
     if (! querySetMessagePart.exec()) {
         emitError(QObject::tr("Query querySetMessagePart failed"), querySetMessagePart);
+        return;
     }
+    adjustPartCacheSize(compressed.size() - oldSize);
+    schedulePartCacheEviction();
 }
 
 void SQLCache::forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
@@ -779,11 +1300,249 @@ void SQLCache::forgetMessagePart(const QString &mailbox, const uint uid, const Q
     qDebug() << "Forgetting message part" << partId << uid << mailbox;
 #endif
     touchingDB();
+    queryMessagePartSize.bindValue(0, mailboxName(mailbox));
+    queryMessagePartSize.bindValue(1, uid);
+    queryMessagePartSize.bindValue(2, partId);
+    const qint64 partSize = storedSize(queryMessagePartSize, QStringLiteral("queryMessagePartSize"));
     queryForgetMessagePart.bindValue(0, mailboxName(mailbox));
     queryForgetMessagePart.bindValue(1, uid);
     queryForgetMessagePart.bindValue(2, partId);
     if (! queryForgetMessagePart.exec()) {
         emitError(QObject::tr("Query queryForgetMessagePart failed"), queryForgetMessagePart);
+    } else {
+        adjustPartCacheSize(-partSize);
+    }
+    queryForgetMessagePartBlob.bindValue(0, mailboxName(mailbox));
+    queryForgetMessagePartBlob.bindValue(1, uid);
+    queryForgetMessagePartBlob.bindValue(2, partId);
+    if (! queryForgetMessagePartBlob.exec()) {
+        emitError(QObject::tr("Query queryForgetMessagePartBlob failed"), queryForgetMessagePartBlob);
+    } else if (queryForgetMessagePartBlob.numRowsAffected() > 0) {
+        m_blobsMaybeUnreferenced = true;
+    }
+}
+
+QByteArray SQLCache::messagePartBlob(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    QByteArray res;
+    queryMessagePartBlob.bindValue(0, mailboxName(mailbox));
+    queryMessagePartBlob.bindValue(1, uid);
+    queryMessagePartBlob.bindValue(2, partId);
+    if (! queryMessagePartBlob.exec()) {
+        emitError(QObject::tr("Query queryMessagePartBlob failed"), queryMessagePartBlob);
+        return res;
+    }
+    if (queryMessagePartBlob.first()) {
+        res = queryMessagePartBlob.value(0).toByteArray();
+        qint64 lastAccess = queryMessagePartBlob.value(1).toLongLong();
+        queryMessagePartBlob.finish();
+
+        qint64 now = partAccessTimestamp();
+        if (lastAccess < now - partAccessGranularity) {
+            queryAccessBlob.bindValue(0, now);
+            queryAccessBlob.bindValue(1, res);
+            if (! queryAccessBlob.exec()) {
+                emitError(QObject::tr("Query queryAccessBlob failed"), queryAccessBlob);
+            }
+        }
+    }
+    return res;
+}
+
+void SQLCache::setMessagePartBlob(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &hash,
+                                  const qint64 size)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "Saving message part" << partId << uid << mailbox << "as blob" << hash;
+#endif
+    touchingDB();
+    queryAddBlob.bindValue(0, hash);
+    queryAddBlob.bindValue(1, size);
+    queryAddBlob.bindValue(2, partAccessTimestamp());
+    if (! queryAddBlob.exec()) {
+        emitError(QObject::tr("Query queryAddBlob failed"), queryAddBlob);
+        return;
+    }
+    // An identical blob might be stored already, in which case it does not take any additional space
+    if (queryAddBlob.numRowsAffected() > 0)
+        adjustPartCacheSize(size);
+    querySetMessagePartBlob.bindValue(0, mailboxName(mailbox));
+    querySetMessagePartBlob.bindValue(1, uid);
+    querySetMessagePartBlob.bindValue(2, partId);
+    querySetMessagePartBlob.bindValue(3, hash);
+    if (! querySetMessagePartBlob.exec()) {
+        emitError(QObject::tr("Query querySetMessagePartBlob failed"), querySetMessagePartBlob);
+        return;
+    }
+    // The part might have referred to another blob previously
+    m_blobsMaybeUnreferenced = true;
+    schedulePartCacheEviction();
+}
+
+QList<QByteArray> SQLCache::unreferencedBlobs()
+{
+    QList<QByteArray> res;
+    if (!m_blobsMaybeUnreferenced)
+        return res;
+    if (! queryUnreferencedBlobs.exec()) {
+        emitError(QObject::tr("Query queryUnreferencedBlobs failed"), queryUnreferencedBlobs);
+        return res;
+    }
+    while (queryUnreferencedBlobs.next()) {
+        res << queryUnreferencedBlobs.value(0).toByteArray();
+    }
+    m_blobsMaybeUnreferenced = false;
+    return res;
+}
+
+void SQLCache::forgetBlob(const QByteArray &hash)
+{
+    touchingDB();
+    queryBlobSize.bindValue(0, hash);
+    const qint64 blobSize = storedSize(queryBlobSize, QStringLiteral("queryBlobSize"));
+    queryForgetBlob.bindValue(0, hash);
+    if (! queryForgetBlob.exec()) {
+        emitError(QObject::tr("Query queryForgetBlob failed"), queryForgetBlob);
+    } else {
+        adjustPartCacheSize(-blobSize);
+    }
+}
+
+bool SQLCache::knownBlobs(QSet<QByteArray> &res)
+{
+    QSqlQuery q(QString(), db);
+    q.setForwardOnly(true);
+    if (! q.exec(QStringLiteral("SELECT hash FROM blobs"))) {
+        emitError(QObject::tr("Failed to list the blobs"), q);
+        return false;
+    }
+    while (q.next()) {
+        res.insert(q.value(0).toByteArray());
+    }
+    return true;
+}
+
+qint64 SQLCache::partCacheSize() const
+{
+    if (m_partBytes >= 0)
+        return m_partBytes;
+    if (! queryPartCacheSize.exec()) {
+        emitError(QObject::tr("Query queryPartCacheSize failed"), queryPartCacheSize);
+        return 0;
+    }
+    if (queryPartCacheSize.first()) {
+        m_partBytes = static_cast<qint64>(queryPartCacheSize.value(0).toDouble());
+        queryPartCacheSize.finish();
+    }
+    return qMax<qint64>(m_partBytes, 0);
+}
+
+qint64 SQLCache::storedSize(QSqlQuery &query, const QString &queryName) const
+{
+    // Nothing has to be tracked until the total is known
+    if (m_partBytes < 0)
+        return 0;
+    if (! query.exec()) {
+        emitError(QObject::tr("Query %1 failed").arg(queryName), query);
+        return 0;
+    }
+    qint64 res = 0;
+    if (query.first())
+        res = static_cast<qint64>(query.value(0).toDouble());
+    query.finish();
+    return res;
+}
+
+void SQLCache::adjustPartCacheSize(const qint64 delta)
+{
+    if (m_partBytes >= 0)
+        m_partBytes = qMax<qint64>(m_partBytes + delta, 0);
+}
+
+/** @short Make room for new data by evicting the message parts which haven't been used for the longest time
+
+Only a limited batch is removed on each call so that a single insertion never stalls for long; if that wasn't enough,
+the next insertion continues where this one has stopped. The blobs are merely detached from their message parts here, the
+actual files are removed by the CombinedCache through unreferencedBlobs().
+*/
+/** @short Make sure that the parts which do not fit into the budget get evicted once the event loop gets a chance to run
+
+The eviction is performed in batches, each of them from a timer of its own, so that it never holds off other requests
+for too long.
+*/
+void SQLCache::schedulePartCacheEviction()
+{
+    if (!partEviction || !m_partBudget || partEviction->isActive() || partCacheSize() <= m_partBudget)
+        return;
+    partEviction->start();
+}
+
+void SQLCache::enforcePartCacheBudget()
+{
+    if (!m_partBudget)
+        return;
+
+    const qint64 target = m_partBudget - m_partBudget * partEvictionHeadroomPercent / 100;
+    if (partCacheSize() <= target)
+        return;
+    touchingDB();
+    queryLeastRecentlyUsedParts.bindValue(0, partEvictionBatchSize);
+    if (! queryLeastRecentlyUsedParts.exec()) {
+        emitError(QObject::tr("Query queryLeastRecentlyUsedParts failed"), queryLeastRecentlyUsedParts);
+        return;
+    }
+
+    struct Victim {
+        QVariant mailbox;
+        QVariant uid;
+        QVariant partId;
+        QByteArray hash;
+        qint64 size;
+    };
+    QList<Victim> victims;
+    qint64 size = m_partBytes;
+    while (size > target && queryLeastRecentlyUsedParts.next()) {
+        Victim victim;
+        victim.mailbox = queryLeastRecentlyUsedParts.value(0);
+        victim.uid = queryLeastRecentlyUsedParts.value(1);
+        victim.partId = queryLeastRecentlyUsedParts.value(2);
+        victim.hash = queryLeastRecentlyUsedParts.value(3).toByteArray();
+        victim.size = queryLeastRecentlyUsedParts.value(4).toLongLong();
+        victims << victim;
+        size -= victim.size;
+    }
+    queryLeastRecentlyUsedParts.finish();
+
+    Q_FOREACH(const Victim &victim, victims) {
+        if (victim.hash.isEmpty()) {
+            // The mailbox name is already in its DB representation
+            queryForgetMessagePart.bindValue(0, victim.mailbox);
+            queryForgetMessagePart.bindValue(1, victim.uid);
+            queryForgetMessagePart.bindValue(2, victim.partId);
+            if (! queryForgetMessagePart.exec()) {
+                emitError(QObject::tr("Query queryForgetMessagePart failed"), queryForgetMessagePart);
+                continue;
+            }
+            adjustPartCacheSize(-victim.size);
+        } else {
+            queryForgetBlobReferences.bindValue(0, victim.hash);
+            if (! queryForgetBlobReferences.exec()) {
+                emitError(QObject::tr("Query queryForgetBlobReferences failed"), queryForgetBlobReferences);
+                continue;
+            }
+            // The blob's size gets subtracted once the blob itself is removed through forgetBlob()
+            m_blobsMaybeUnreferenced = true;
+        }
+        ++m_partEvictions;
+    }
+
+    if (victims.isEmpty())
+        return;
+    if (m_partsEvictedHandler)
+        m_partsEvictedHandler();
+    if (partCacheSize() > target) {
+        // Continue with another batch later on
+        partEviction->start();
     }
 }
 
@@ -841,15 +1600,51 @@ void SQLCache::timeToCommit()
         qDebug() << "Commit";
 #endif
         inTransaction = false;
-        db.commit();
+        bool ok = db.commit();
+        if (!ok)
+            emitError(QObject::tr("Can't commit the transaction"), db);
+        if (m_commitHandler)
+            m_commitHandler(ok);
     }
 }
 
+void SQLCache::commit()
+{
+    timeToCommit();
+}
+
+void SQLCache::setCommitHandler(const std::function<void(const bool)> &handler)
+{
+    m_commitHandler = handler;
+}
+
+void SQLCache::setPartsEvictedHandler(const std::function<void()> &handler)
+{
+    m_partsEvictedHandler = handler;
+}
+
 void SQLCache::setRenewalThreshold(const int days)
 {
     m_updateAccessIfOlder = days;
 }
 
+void SQLCache::setPartCacheBudget(const qint64 bytes)
+{
+    m_partBudget = bytes;
+    schedulePartCacheEviction();
+}
+
+AbstractCache::Statistics SQLCache::statistics() const
+{
+    Statistics res;
+    res.partHits = m_partHits;
+    res.partMisses = m_partMisses;
+    res.partEvictions = m_partEvictions;
+    res.partBytes = partCacheSize();
+    res.partBudget = m_partBudget;
+    return res;
+}
+
 /** @short Return a proper represenation of the mailbox name to be used in the SQL queries
 
 A null QString is represented as NIL, which makes our cache unhappy.
@@ -24,6 +24,7 @@
 #define IMAP_MODEL_SQLCACHE_H
 
 #include <memory>
+#include <QSet>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include "Cache.h"
@@ -85,6 +86,7 @@ public:
     virtual void setMailboxSyncState(const QString &mailbox, const SyncState &state);
 
     virtual void setUidMapping(const QString &mailbox, const Imap::Uids &seqToUid);
+    virtual void updateUidMapping(const QString &mailbox, const Imap::Uids &removed, const Imap::Uids &added);
     virtual void clearUidMapping(const QString &mailbox);
     virtual Imap::Uids uidMapping(const QString &mailbox) const;
 
@@ -96,6 +98,7 @@ public:
 
     virtual QStringList msgFlags(const QString &mailbox, const uint uid) const;
     virtual void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags);
+    virtual QHash<uint, QStringList> msgFlagsForMailbox(const QString &mailbox) const;
 
     virtual QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
     virtual void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data);
@@ -104,11 +107,33 @@ public:
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
+    /** @short Return the hash of the blob which holds the data of a message part, or a null QByteArray if there's none */
+    QByteArray messagePartBlob(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    /** @short Remember that the data of a message part are stored in a blob of the given @arg hash */
+    void setMessagePartBlob(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &hash,
+                            const qint64 size);
+    /** @short Return hashes of all blobs which are no longer used by any message part */
+    QList<QByteArray> unreferencedBlobs();
+    /** @short Stop tracking a blob which is about to be deleted */
+    void forgetBlob(const QByteArray &hash);
+    /** @short Fill in the hashes of all tracked blobs, return false on error */
+    bool knownBlobs(QSet<QByteArray> &res);
+
+    /** @short Commit the pending changes right away instead of waiting for the timer */
+    void commit();
+    /** @short Call the @arg handler after each attempt to commit, passing whether it has succeeded */
+    void setCommitHandler(const std::function<void(const bool)> &handler);
+    /** @short Call the @arg handler after each batch of parts has been evicted in order to stay within the budget */
+    void setPartsEvictedHandler(const std::function<void()> &handler);
+
     /** @short Open a connection to the cache */
     bool open(const QString &name, const QString &fileName);
 
     virtual void setRenewalThreshold(const int days);
 
+    virtual void setPartCacheBudget(const qint64 bytes);
+    virtual Statistics statistics() const;
+
 private:
     /** @short Broadcast an error from the SQL query */
     void emitError(const QString &message, const QSqlQuery &query) const;
@@ -130,6 +155,20 @@ private:
 
     static QString mailboxName(const QString &mailbox);
 
+    /** @short Read the UID mapping including all of its journaled changes, return false on error */
+    bool loadUidMapping(const QString &mailbox, Imap::Uids &res) const;
+
+    /** @short Return the total size of all stored message parts, computing it if it isn't known yet */
+    qint64 partCacheSize() const;
+    /** @short Execute a query which sums up the sizes of some stored parts or blobs */
+    qint64 storedSize(QSqlQuery &query, const QString &queryName) const;
+    /** @short Keep the m_partBytes up-to-date after @arg delta bytes were added or removed */
+    void adjustPartCacheSize(const qint64 delta);
+    /** @short Start the eviction in the background if the parts do not fit into the budget */
+    void schedulePartCacheEviction();
+    /** @short Evict a batch of the least recently used message parts if they do not fit into the budget */
+    void enforcePartCacheBudget();
+
 private slots:
     /** @short We haven't committed for a while */
     void timeToCommit();
@@ -149,26 +188,49 @@ private:
     mutable QSqlQuery queryUidMapping;
     mutable QSqlQuery querySetUidMapping;
     mutable QSqlQuery queryClearUidMapping;
+    mutable QSqlQuery queryUidMappingJournal;
+    mutable QSqlQuery queryUidMappingJournalSize;
+    mutable QSqlQuery queryAppendUidMappingJournal;
+    mutable QSqlQuery queryClearUidMappingJournal;
     mutable QSqlQuery queryMessageMetadata;
     mutable QSqlQuery queryAccessMessageMetadata;
     mutable QSqlQuery querySetMessageMetadata;
     mutable QSqlQuery queryMessageFlags;
+    mutable QSqlQuery queryMessageFlagsForMailbox;
     mutable QSqlQuery querySetMessageFlags;
     mutable QSqlQuery queryClearAllMessages1;
     mutable QSqlQuery queryClearAllMessages2;
     mutable QSqlQuery queryClearAllMessages3;
     mutable QSqlQuery queryClearAllMessages4;
+    mutable QSqlQuery queryClearAllMessages5;
     mutable QSqlQuery queryClearMessage1;
     mutable QSqlQuery queryClearMessage2;
     mutable QSqlQuery queryClearMessage3;
+    mutable QSqlQuery queryClearMessage4;
     mutable QSqlQuery queryMessagePart;
+    mutable QSqlQuery queryAccessMessagePart;
     mutable QSqlQuery querySetMessagePart;
     mutable QSqlQuery queryForgetMessagePart;
+    mutable QSqlQuery queryMessagePartBlob;
+    mutable QSqlQuery querySetMessagePartBlob;
+    mutable QSqlQuery queryForgetMessagePartBlob;
+    mutable QSqlQuery queryAccessBlob;
+    mutable QSqlQuery queryAddBlob;
+    mutable QSqlQuery queryUnreferencedBlobs;
+    mutable QSqlQuery queryForgetBlob;
+    mutable QSqlQuery queryForgetBlobReferences;
+    mutable QSqlQuery queryPartCacheSize;
+    mutable QSqlQuery queryMailboxPartsSize;
+    mutable QSqlQuery queryMessagePartsSize;
+    mutable QSqlQuery queryMessagePartSize;
+    mutable QSqlQuery queryBlobSize;
+    mutable QSqlQuery queryLeastRecentlyUsedParts;
     mutable QSqlQuery queryMessageThreading;
     mutable QSqlQuery querySetMessageThreading;
 
     std::unique_ptr<QTimer> delayedCommit;
     std::unique_ptr<QTimer> tooMuchTimeWithoutCommit;
+    std::unique_ptr<QTimer> partEviction;
     bool inTransaction;
 
     /** @short A point in time against which the "last accessed on" data is computed */
@@ -179,6 +241,23 @@ private:
     To disable updating of the DB accesses, set to zero.
     */
     int m_updateAccessIfOlder;
+
+    /** @short Were there any references to blobs removed since the last call to unreferencedBlobs()? */
+    bool m_blobsMaybeUnreferenced;
+
+    /** @short Total size of the stored message parts, or -1 if it hasn't been computed yet
+
+    Once known, this is updated incrementally as the parts and blobs come and go.
+    */
+    mutable qint64 m_partBytes;
+    /** @short Upper limit on m_partBytes, zero means unlimited */
+    qint64 m_partBudget;
+    quint64 m_partEvictions;
+    mutable quint64 m_partHits;
+    mutable quint64 m_partMisses;
+
+    std::function<void(const bool)> m_commitHandler;
+    std::function<void()> m_partsEvictedHandler;
 };
 
 }
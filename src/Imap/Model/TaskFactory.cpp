@@ -39,6 +39,7 @@
 #include "Imap/Tasks/Fake_ListChildMailboxesTask.h"
 #include "Imap/Tasks/Fake_OpenConnectionTask.h"
 #include "Imap/Tasks/NumberOfMessagesTask.h"
+#include "Imap/Tasks/RefreshMessageCountsTask.h"
 #include "Imap/Tasks/ObtainSynchronizedMailboxTask.h"
 #include "Imap/Tasks/OpenConnectionTask.h"
 #include "Imap/Tasks/UidSubmitTask.h"
@@ -126,6 +127,11 @@ NumberOfMessagesTask *TaskFactory::createNumberOfMessagesTask(Model *model, cons
     return new NumberOfMessagesTask(model, mailbox);
 }
 
+RefreshMessageCountsTask *TaskFactory::createRefreshMessageCountsTask(Model *model, const QStringList &mailboxes)
+{
+    return new RefreshMessageCountsTask(model, mailboxes);
+}
+
 ObtainSynchronizedMailboxTask *TaskFactory::createObtainSynchronizedMailboxTask(Model *model, const QModelIndex &mailboxIndex,
         ImapTask *parentTask, KeepMailboxOpenTask *keepTask)
 {
@@ -220,7 +226,9 @@ Parser *TestingTaskFactory::newParser(Model *model)
                      model, static_cast<void (Model::*)(Parser *)>(&Model::responseReceived), Qt::QueuedConnection);
     QObject::connect(parser, &Parser::connectionStateChanged, model, &Model::handleSocketStateChanged);
     QObject::connect(parser, &Parser::lineReceived, model, &Model::slotParserLineReceived);
+    QObject::connect(parser, &Parser::spooledLiteralReceived, model, &Model::slotParserSpooledLiteralReceived);
     QObject::connect(parser, &Parser::lineSent, model, &Model::slotParserLineSent);
+    QObject::connect(parser, &Parser::commandQueued, model, &Model::slotParserCommandQueued);
     model->m_parsers[ parser ] = parserState;
     model->m_taskModel->slotParserCreated(parser);
     return parser;
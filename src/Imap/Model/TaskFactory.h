@@ -55,6 +55,7 @@ class ListChildMailboxesTask;
 class NumberOfMessagesTask;
 class ObtainSynchronizedMailboxTask;
 class OpenConnectionTask;
+class RefreshMessageCountsTask;
 class UpdateFlagsTask;
 class UpdateFlagsOfAllMessagesTask;
 class ThreadTask;
@@ -90,6 +91,7 @@ public:
     virtual ObtainSynchronizedMailboxTask *createObtainSynchronizedMailboxTask(Model *model, const QModelIndex &mailboxIndex,
             ImapTask *parentTask, KeepMailboxOpenTask *keepTask);
     virtual OpenConnectionTask *createOpenConnectionTask(Model *model);
+    virtual RefreshMessageCountsTask *createRefreshMessageCountsTask(Model *model, const QStringList &mailboxes);
     virtual UpdateFlagsOfAllMessagesTask *createUpdateFlagsOfAllMessagesTask(Model *model, const QModelIndex &mailbox,
             const FlagsOperation flagOperation, const QString &flags);
     virtual UpdateFlagsTask *createUpdateFlagsTask(Model *model, const QModelIndexList &messages, const FlagsOperation flagOperation,
@@ -0,0 +1,330 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QPair>
+#include <QSemaphore>
+#include "ThreadedCache.h"
+#include "Common/PostedEventHandler.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+ThreadedCache::ThreadedCache(std::unique_ptr<AbstractCache> backend)
+    : m_backend(std::move(backend))
+    , m_worker(new Common::PostedEventHandler([this]() { this->runQueuedJobs(); }))
+    , m_notifier(new Common::PostedEventHandler([this]() { this->runOwnerJobs(); }))
+    , m_workerScheduled(false)
+    , m_ownerScheduled(false)
+{
+    // This gets called from the worker thread
+    m_backend->setErrorHandler([this](const QString &e) {
+        QMutexLocker locker(&m_mutex);
+        m_pendingErrors << e;
+        if (!m_ownerScheduled) {
+            m_ownerScheduled = true;
+            m_notifier->schedule();
+        }
+    });
+    m_thread.setObjectName(QStringLiteral("ThreadedCache"));
+    m_worker->moveToThread(&m_thread);
+    m_thread.start();
+}
+
+ThreadedCache::~ThreadedCache()
+{
+    // The backend has to be destroyed from the thread which has been using it; this also makes sure that its pending
+    // transaction gets committed
+    enqueueAndWait([this](AbstractCache *) { m_backend.reset(); });
+    m_thread.quit();
+    m_thread.wait();
+    delete m_worker;
+}
+
+bool ThreadedCache::initialize(const std::function<bool(AbstractCache *)> &initialization)
+{
+    bool res = false;
+    enqueueAndWait([&res, &initialization](AbstractCache *backend) { res = initialization(backend); });
+    return res;
+}
+
+void ThreadedCache::enqueue(const Job &job) const
+{
+    QMutexLocker locker(&m_mutex);
+    m_queue << job;
+    if (!m_workerScheduled) {
+        m_workerScheduled = true;
+        m_worker->schedule();
+    }
+}
+
+void ThreadedCache::enqueueAndWait(const Job &job) const
+{
+    Q_ASSERT(QThread::currentThread() != &m_thread);
+    QSemaphore done;
+    enqueue([&job, &done](AbstractCache *backend) {
+        job(backend);
+        done.release();
+    });
+    done.acquire();
+    // Any errors are delivered from the event loop; the error handler might well decide to replace this very cache
+}
+
+void ThreadedCache::runQueuedJobs()
+{
+    Q_ASSERT(QThread::currentThread() == &m_thread);
+    while (true) {
+        // Whatever has been queued in the meanwhile is processed as a single batch, i.e. within the same transaction
+        QList<Job> batch;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_queue.isEmpty()) {
+                m_workerScheduled = false;
+                return;
+            }
+            batch.swap(m_queue);
+        }
+        Q_FOREACH(const Job &job, batch) {
+            job(m_backend.get());
+        }
+    }
+}
+
+void ThreadedCache::runInOwnerThread(const std::function<void()> &job) const
+{
+    QMutexLocker locker(&m_mutex);
+    m_ownerQueue << job;
+    if (!m_ownerScheduled) {
+        m_ownerScheduled = true;
+        m_notifier->schedule();
+    }
+}
+
+void ThreadedCache::runOwnerJobs()
+{
+    QList<std::function<void()> > jobs;
+    {
+        QMutexLocker locker(&m_mutex);
+        jobs.swap(m_ownerQueue);
+        m_ownerScheduled = false;
+    }
+    deliverErrors();
+    Q_FOREACH(const std::function<void()> &job, jobs) {
+        job();
+    }
+}
+
+void ThreadedCache::deliverErrors()
+{
+    QStringList errors;
+    {
+        QMutexLocker locker(&m_mutex);
+        errors.swap(m_pendingErrors);
+    }
+    if (!m_errorHandler)
+        return;
+    Q_FOREACH(const QString &error, errors) {
+        m_errorHandler(error);
+    }
+}
+
+QList<MailboxMetadata> ThreadedCache::childMailboxes(const QString &mailbox) const
+{
+    QList<MailboxMetadata> res;
+    enqueueAndWait([&res, &mailbox](AbstractCache *backend) { res = backend->childMailboxes(mailbox); });
+    return res;
+}
+
+bool ThreadedCache::childMailboxesFresh(const QString &mailbox) const
+{
+    bool res = false;
+    enqueueAndWait([&res, &mailbox](AbstractCache *backend) { res = backend->childMailboxesFresh(mailbox); });
+    return res;
+}
+
+void ThreadedCache::setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data)
+{
+    enqueue([mailbox, data](AbstractCache *backend) { backend->setChildMailboxes(mailbox, data); });
+}
+
+SyncState ThreadedCache::mailboxSyncState(const QString &mailbox) const
+{
+    SyncState res;
+    enqueueAndWait([&res, &mailbox](AbstractCache *backend) { res = backend->mailboxSyncState(mailbox); });
+    return res;
+}
+
+void ThreadedCache::setMailboxSyncState(const QString &mailbox, const SyncState &state)
+{
+    enqueue([mailbox, state](AbstractCache *backend) { backend->setMailboxSyncState(mailbox, state); });
+}
+
+void ThreadedCache::setUidMapping(const QString &mailbox, const Imap::Uids &seqToUid)
+{
+    enqueue([mailbox, seqToUid](AbstractCache *backend) { backend->setUidMapping(mailbox, seqToUid); });
+}
+
+void ThreadedCache::updateUidMapping(const QString &mailbox, const Imap::Uids &removed, const Imap::Uids &added)
+{
+    enqueue([mailbox, removed, added](AbstractCache *backend) { backend->updateUidMapping(mailbox, removed, added); });
+}
+
+void ThreadedCache::clearUidMapping(const QString &mailbox)
+{
+    enqueue([mailbox](AbstractCache *backend) { backend->clearUidMapping(mailbox); });
+}
+
+Imap::Uids ThreadedCache::uidMapping(const QString &mailbox) const
+{
+    Imap::Uids res;
+    enqueueAndWait([&res, &mailbox](AbstractCache *backend) { res = backend->uidMapping(mailbox); });
+    return res;
+}
+
+void ThreadedCache::clearAllMessages(const QString &mailbox)
+{
+    enqueue([mailbox](AbstractCache *backend) { backend->clearAllMessages(mailbox); });
+}
+
+void ThreadedCache::clearMessage(const QString mailbox, const uint uid)
+{
+    enqueue([mailbox, uid](AbstractCache *backend) { backend->clearMessage(mailbox, uid); });
+}
+
+void ThreadedCache::clearMessages(const QString &mailbox, const Imap::Uids &uids)
+{
+    enqueue([mailbox, uids](AbstractCache *backend) { backend->clearMessages(mailbox, uids); });
+}
+
+AbstractCache::MessageDataBundle ThreadedCache::messageMetadata(const QString &mailbox, const uint uid) const
+{
+    MessageDataBundle res;
+    enqueueAndWait([&res, &mailbox, uid](AbstractCache *backend) { res = backend->messageMetadata(mailbox, uid); });
+    return res;
+}
+
+void ThreadedCache::loadMessageMetadata(const QString &mailbox, const uint uid,
+                                        const std::function<void(const MessageDataBundle &)> &callback) const
+{
+    callAsync<MessageDataBundle>([mailbox, uid](AbstractCache *backend) {
+        MessageDataBundle res;
+        backend->loadMessageMetadata(mailbox, uid, [&res](const MessageDataBundle &data) { res = data; });
+        return res;
+    }, callback);
+}
+
+void ThreadedCache::setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata)
+{
+    enqueue([mailbox, uid, metadata](AbstractCache *backend) { backend->setMessageMetadata(mailbox, uid, metadata); });
+}
+
+QStringList ThreadedCache::msgFlags(const QString &mailbox, const uint uid) const
+{
+    QStringList res;
+    enqueueAndWait([&res, &mailbox, uid](AbstractCache *backend) { res = backend->msgFlags(mailbox, uid); });
+    return res;
+}
+
+void ThreadedCache::setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags)
+{
+    enqueue([mailbox, uid, flags](AbstractCache *backend) { backend->setMsgFlags(mailbox, uid, flags); });
+}
+
+QHash<uint, QStringList> ThreadedCache::msgFlagsForMailbox(const QString &mailbox) const
+{
+    QHash<uint, QStringList> res;
+    enqueueAndWait([&res, &mailbox](AbstractCache *backend) { res = backend->msgFlagsForMailbox(mailbox); });
+    return res;
+}
+
+QByteArray ThreadedCache::messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    QByteArray res;
+    enqueueAndWait([&res, &mailbox, uid, &partId](AbstractCache *backend) { res = backend->messagePart(mailbox, uid, partId); });
+    return res;
+}
+
+void ThreadedCache::loadMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &rawPartId,
+                                    const std::function<void(const QByteArray &, const QByteArray &)> &callback) const
+{
+    typedef QPair<QByteArray, QByteArray> PartData;
+    callAsync<PartData>([mailbox, uid, partId, rawPartId](AbstractCache *backend) {
+        PartData res;
+        backend->loadMessagePart(mailbox, uid, partId, rawPartId, [&res](const QByteArray &data, const QByteArray &rawData) {
+            res = qMakePair(data, rawData);
+        });
+        return res;
+    }, [callback](const PartData &res) {
+        callback(res.first, res.second);
+    });
+}
+
+void ThreadedCache::setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data)
+{
+    enqueue([mailbox, uid, partId, data](AbstractCache *backend) { backend->setMsgPart(mailbox, uid, partId, data); });
+}
+
+void ThreadedCache::setSpooledMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId,
+                                      const QSharedPointer<LiteralSink> &data, const QByteArray &transferEncoding)
+{
+    enqueue([mailbox, uid, partId, data, transferEncoding](AbstractCache *backend) {
+        backend->setSpooledMsgPart(mailbox, uid, partId, data, transferEncoding);
+    });
+}
+
+void ThreadedCache::forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
+{
+    enqueue([mailbox, uid, partId](AbstractCache *backend) { backend->forgetMessagePart(mailbox, uid, partId); });
+}
+
+QVector<Imap::Responses::ThreadingNode> ThreadedCache::messageThreading(const QString &mailbox)
+{
+    QVector<Imap::Responses::ThreadingNode> res;
+    enqueueAndWait([&res, &mailbox](AbstractCache *backend) { res = backend->messageThreading(mailbox); });
+    return res;
+}
+
+void ThreadedCache::setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading)
+{
+    enqueue([mailbox, threading](AbstractCache *backend) { backend->setMessageThreading(mailbox, threading); });
+}
+
+void ThreadedCache::setRenewalThreshold(const int days)
+{
+    enqueue([days](AbstractCache *backend) { backend->setRenewalThreshold(days); });
+}
+
+void ThreadedCache::setPartCacheBudget(const qint64 bytes)
+{
+    enqueue([bytes](AbstractCache *backend) { backend->setPartCacheBudget(bytes); });
+}
+
+AbstractCache::Statistics ThreadedCache::statistics() const
+{
+    Statistics res;
+    enqueueAndWait([&res](AbstractCache *backend) { res = backend->statistics(); });
+    return res;
+}
+
+}
+}
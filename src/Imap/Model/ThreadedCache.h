@@ -0,0 +1,167 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_THREADEDCACHE_H
+#define IMAP_MODEL_THREADEDCACHE_H
+
+#include <memory>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include "Cache.h"
+
+namespace Common {
+class PostedEventHandler;
+}
+
+namespace Imap
+{
+
+namespace Mailbox
+{
+
+/** @short Asynchronous wrapper which moves all I/O of another cache into a dedicated thread
+
+The wrapped cache (typically the CombinedCache) is only ever accessed from a worker thread which is owned by this
+class.  All write operations are queued and return immediately; the worker processes them in batches, and the commits
+of the SQLCache's transactions happen in the worker thread as well, so big transactions no longer stall the GUI.
+
+Operations which return data are forwarded to the worker as well.  The classic AbstractCache API is synchronous, so
+these calls block the calling thread until the worker has processed everything which was queued before them -- which
+means that the reads always observe all preceding writes.  The sync state, the UID mapping and the flags are still read
+this way when a mailbox gets opened because the mailbox synchronization compares the server's state with what it has
+found in the cache.  The reads which happen for each and every message, i.e. the metadata of the messages which scroll
+into view and their parts, go through loadMessageMetadata() and loadMessagePart() which do not block; code which can
+cope with getting its data later shall use callAsync() as well.
+
+Errors reported by the wrapped cache are forwarded to the error handler from the event loop of the thread which owns
+this object.  The handler must not destroy this cache directly; it shall defer any such reaction through a queued
+connection.
+*/
+class ThreadedCache : public AbstractCache
+{
+public:
+    typedef std::function<void(AbstractCache *)> Job;
+
+    explicit ThreadedCache(std::unique_ptr<AbstractCache> backend);
+    virtual ~ThreadedCache();
+
+    /** @short Run @arg initialization with the wrapped cache in the worker thread and return its result
+
+    This is meant for opening of the underlying storage, which has to happen in the worker thread because e.g. the
+    QSqlDatabase may only be used from the thread which created it.
+    */
+    bool initialize(const std::function<bool(AbstractCache *)> &initialization);
+
+    /** @short Run @arg job in the worker thread and pass its result to @arg callback in the thread which owns this cache
+
+    The @arg callback is not invoked when this cache is destroyed before the result gets delivered.
+    */
+    template<typename T> void callAsync(const std::function<T(AbstractCache *)> &job, const std::function<void(const T &)> &callback) const
+    {
+        enqueue([this, job, callback](AbstractCache *backend) {
+            T res = job(backend);
+            runInOwnerThread([callback, res]() { callback(res); });
+        });
+    }
+
+    virtual QList<MailboxMetadata> childMailboxes(const QString &mailbox) const;
+    virtual bool childMailboxesFresh(const QString &mailbox) const;
+    virtual void setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data);
+
+    virtual SyncState mailboxSyncState(const QString &mailbox) const;
+    virtual void setMailboxSyncState(const QString &mailbox, const SyncState &state);
+
+    virtual void setUidMapping(const QString &mailbox, const Imap::Uids &seqToUid);
+    virtual void updateUidMapping(const QString &mailbox, const Imap::Uids &removed, const Imap::Uids &added);
+    virtual void clearUidMapping(const QString &mailbox);
+    virtual Imap::Uids uidMapping(const QString &mailbox) const;
+
+    virtual void clearAllMessages(const QString &mailbox);
+    virtual void clearMessage(const QString mailbox, const uint uid);
+    virtual void clearMessages(const QString &mailbox, const Imap::Uids &uids);
+
+    virtual MessageDataBundle messageMetadata(const QString &mailbox, const uint uid) const;
+    virtual void loadMessageMetadata(const QString &mailbox, const uint uid,
+                                     const std::function<void(const MessageDataBundle &)> &callback) const;
+    virtual void setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata);
+
+    virtual QStringList msgFlags(const QString &mailbox, const uint uid) const;
+    virtual void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags);
+    virtual QHash<uint, QStringList> msgFlagsForMailbox(const QString &mailbox) const;
+
+    virtual QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    virtual void loadMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &rawPartId,
+                                 const std::function<void(const QByteArray &, const QByteArray &)> &callback) const;
+    virtual void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data);
+    virtual void setSpooledMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId,
+                                   const QSharedPointer<LiteralSink> &data, const QByteArray &transferEncoding);
+    virtual void forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId);
+
+    virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
+    virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
+
+    virtual void setRenewalThreshold(const int days);
+
+    virtual void setPartCacheBudget(const qint64 bytes);
+    virtual Statistics statistics() const;
+
+private:
+    /** @short Queue a job for the worker thread */
+    void enqueue(const Job &job) const;
+    /** @short Queue a job for the worker thread and wait till it has been processed */
+    void enqueueAndWait(const Job &job) const;
+    /** @short Process everything which is queued; called in the worker thread */
+    void runQueuedJobs();
+
+    /** @short Schedule @arg job to be run in the thread which owns this cache */
+    void runInOwnerThread(const std::function<void()> &job) const;
+    /** @short Deliver the results of asynchronous calls and the errors; called in the owner thread */
+    void runOwnerJobs();
+    /** @short Pass the errors reported by the backend to the error handler */
+    void deliverErrors();
+
+    Q_DISABLE_COPY(ThreadedCache)
+
+    std::unique_ptr<AbstractCache> m_backend;
+    QThread m_thread;
+    Common::PostedEventHandler *m_worker;
+    std::unique_ptr<Common::PostedEventHandler> m_notifier;
+
+    mutable QMutex m_mutex;
+    /** @short Jobs waiting for the worker thread */
+    mutable QList<Job> m_queue;
+    /** @short Has the worker been notified about the m_queue already? */
+    mutable bool m_workerScheduled;
+    /** @short Jobs waiting for the owner thread */
+    mutable QList<std::function<void()> > m_ownerQueue;
+    /** @short Errors which haven't been delivered yet */
+    mutable QStringList m_pendingErrors;
+    /** @short Has the owner thread been notified about the m_ownerQueue or the m_pendingErrors already? */
+    mutable bool m_ownerScheduled;
+};
+
+}
+
+}
+
+#endif /* IMAP_MODEL_THREADEDCACHE_H */
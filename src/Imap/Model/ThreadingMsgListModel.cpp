@@ -76,12 +76,18 @@ namespace Mailbox
 ThreadingMsgListModel::ThreadingMsgListModel(QObject *parent):
     QAbstractProxyModel(parent), threadingHelperLastId(0), modelResetInProgress(false), threadingInFlight(false),
     m_shallBeThreading(false), m_filteredBySearch(false), m_sortTask(0), m_sortReverse(false), m_currentSortingCriteria(SORT_NONE),
-    m_searchValidity(RESULT_INVALIDATED)
+    m_searchValidity(RESULT_INVALIDATED), m_localThreading(0)
 {
     m_delayedPrune = new QTimer(this);
     m_delayedPrune->setSingleShot(true);
     m_delayedPrune->setInterval(0);
     connect(m_delayedPrune, &QTimer::timeout, this, &ThreadingMsgListModel::delayedPrune);
+
+    // The headers usually arrive in batches, so there's no point in threading after each of them
+    m_delayedLocalThreading = new QTimer(this);
+    m_delayedLocalThreading->setSingleShot(true);
+    m_delayedLocalThreading->setInterval(200);
+    connect(m_delayedLocalThreading, &QTimer::timeout, this, &ThreadingMsgListModel::delayedLocalThreading);
 }
 
 void ThreadingMsgListModel::setSourceModel(QAbstractItemModel *sourceModel)
@@ -167,6 +173,14 @@ void ThreadingMsgListModel::handleDataChanged(const QModelIndex &topLeft, const
             wantThreading();
         }
     }
+
+    if (m_localThreading && m_shallBeThreading && message->m_data && message->m_data->gotEnvelope()) {
+        auto known = m_locallyThreadedUids.constFind(message->uid());
+        if (known != m_locallyThreadedUids.constEnd() && !*known && !m_delayedLocalThreading->isActive()) {
+            // The local threading was done without the headers of this message
+            m_delayedLocalThreading->start();
+        }
+    }
 }
 
 QModelIndex ThreadingMsgListModel::index(int row, int column, const QModelIndex &parent) const
@@ -446,6 +460,14 @@ void ThreadingMsgListModel::resetMe()
     threadedRootIds.clear();
     m_currentSortResult.clear();
     m_searchValidity = RESULT_INVALIDATED;
+    if (m_localThreading) {
+        // Whatever the local threading is working on, it's for the old content
+        delete m_localThreading;
+        m_localThreading = 0;
+        m_locallyThreadedUids.clear();
+        m_delayedLocalThreading->stop();
+        threadingInFlight = false;
+    }
     endResetModel();
     updateNoThreading();
     modelResetInProgress = false;
@@ -600,6 +622,11 @@ void ThreadingMsgListModel::wantThreading(const SkipSortSearch skipSortSearch)
     if (highestUidInThreadingLowerBound >= highestUidInMailbox) {
         // There's no point asking for data at this point, we shall just apply threading
         applyThreading(mapping);
+        if (!m_localThreading && !serverSupportsThreading(realModel)) {
+            // The cached threading might have been computed before all headers were known, so let's refresh it
+            // in the background
+            threadLocally();
+        }
     } else {
         // There's apparently at least one known UID whose threading info we do not know; that means that we have to ask the
         // server here.
@@ -671,6 +698,10 @@ void ThreadingMsgListModel::askForThreading(const uint firstUnknownUid)
         requestedAlgorithm = "REFERENCES";
     } else if (realModel->capabilities().contains(QStringLiteral("THREAD=ORDEREDSUBJECT"))) {
         requestedAlgorithm = "ORDEREDSUBJECT";
+    } else {
+        // The server cannot help us here
+        threadLocally();
+        return;
     }
 
     if (! requestedAlgorithm.isEmpty()) {
@@ -693,6 +724,93 @@ void ThreadingMsgListModel::askForThreading(const uint firstUnknownUid)
     }
 }
 
+/** @short Pass the messages which were not threaded yet to the LocalThreadingRunner
+
+Only the messages whose ENVELOPE is already known can be placed into their threads. The rest of them are submitted without
+any headers at first, and once their data arrive, they are submitted once again.
+*/
+void ThreadingMsgListModel::threadLocally()
+{
+    Q_ASSERT(sourceModel());
+    Q_ASSERT(sourceModel()->rowCount());
+
+    QModelIndex realIndex;
+    Imap::Mailbox::Model::realTreeItem(sourceModel()->index(0, 0), 0, &realIndex);
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
+    Q_ASSERT(list);
+
+    if (!m_localThreading) {
+        m_localThreading = new LocalThreadingRunner(this);
+        connect(m_localThreading, &LocalThreadingRunner::threadingComputed, this, &ThreadingMsgListModel::slotLocalThreadingAvailable);
+    }
+
+    QVector<LocalThreading::Message> added;
+    QSet<uint> present;
+    present.reserve(list->m_children.size());
+    Q_FOREACH(TreeItem *item, list->m_children) {
+        const TreeItemMessage *message = static_cast<const TreeItemMessage *>(item);
+        const uint uid = message->uid();
+        if (!uid)
+            continue;
+        present.insert(uid);
+
+        // Don't use data() here, it would allocate the payload
+        const MessageDataPayload *payload = message->m_data;
+        const bool gotHeaders = payload && payload->gotEnvelope();
+        auto known = m_locallyThreadedUids.find(uid);
+        if (known != m_locallyThreadedUids.end() && (*known || !gotHeaders))
+            continue;
+
+        LocalThreading::Message threadingData;
+        threadingData.uid = uid;
+        if (gotHeaders) {
+            threadingData.messageId = payload->envelope().messageId;
+            threadingData.date = payload->envelope().date;
+            if (payload->gotHdrReferences())
+                threadingData.references = payload->hdrReferences();
+            if (threadingData.references.isEmpty() && !payload->envelope().inReplyTo.isEmpty())
+                threadingData.references << payload->envelope().inReplyTo.front();
+        }
+        added << threadingData;
+        m_locallyThreadedUids[uid] = gotHeaders;
+    }
+
+    Imap::Uids removed;
+    for (auto it = m_locallyThreadedUids.begin(); it != m_locallyThreadedUids.end(); /* nothing */) {
+        if (present.contains(it.key())) {
+            ++it;
+        } else {
+            removed << it.key();
+            it = m_locallyThreadedUids.erase(it);
+        }
+    }
+
+    threadingInFlight = true;
+    m_localThreading->update(added, removed);
+}
+
+void ThreadingMsgListModel::delayedLocalThreading()
+{
+    if (m_localThreading && m_shallBeThreading && sourceModel() && sourceModel()->rowCount())
+        threadLocally();
+}
+
+void ThreadingMsgListModel::slotLocalThreadingAvailable(const QVector<Responses::ThreadingNode> &mapping)
+{
+    threadingInFlight = false;
+    if (!m_shallBeThreading || !sourceModel() || !sourceModel()->rowCount())
+        return;
+
+    const Model *realModel = 0;
+    QModelIndex realIndex;
+    Imap::Mailbox::Model::realTreeItem(sourceModel()->index(0, 0), &realModel, &realIndex);
+    Q_ASSERT(realModel);
+    realModel->cache()->setMessageThreading(realIndex.parent().parent().data(RoleMailboxName).toString(), mapping);
+
+    // Just like with the THREAD response, some new arrivals might be missing, so let's check that at first
+    wantThreading();
+}
+
 /** @short Gather all UIDs present in the mapping and push them into the "uids" vector */
 static void gatherAllUidsFromThreadNode(Imap::Uids &uids, const QVector<Responses::ThreadingNode> &list)
 {
@@ -1211,6 +1329,15 @@ QStringList ThreadingMsgListModel::supportedCapabilities()
     return QStringList() << QStringLiteral("THREAD=REFS") << QStringLiteral("THREAD=REFERENCES") << QStringLiteral("THREAD=ORDEREDSUBJECT");
 }
 
+bool ThreadingMsgListModel::serverSupportsThreading(const Model *realModel)
+{
+    Q_FOREACH(const QString &capability, supportedCapabilities()) {
+        if (realModel->capabilities().contains(capability))
+            return true;
+    }
+    return false;
+}
+
 QStringList ThreadingMsgListModel::mimeTypes() const
 {
     return sourceModel() ? sourceModel()->mimeTypes() : QStringList();
@@ -1277,12 +1404,19 @@ bool ThreadingMsgListModel::threadContainsUnreadMessages(const uint root) const
 QStringList ThreadingMsgListModel::threadAggregatedFlags(const uint root) const
 {
     // FIXME: cache the value somewhere...
-    QStringList aggregatedFlags;
-    threadForeach<void>(root, [&aggregatedFlags](const TreeItemMessage &message) {
-        aggregatedFlags += message.m_flags;
+    // All messages in a thread come from the same mailbox, so their interned flags can be simply merged together
+    FlagsDictionary::Bits bits = 0;
+    QStringList overflow;
+    const FlagsDictionary *dictionary = nullptr;
+    threadForeach<void>(root, [&bits, &overflow, &dictionary](const TreeItemMessage &message) {
+        bits |= message.m_flagBits;
+        overflow += message.m_flagOverflow;
+        dictionary = &message.flagsDictionary();
     });
-    aggregatedFlags.removeDuplicates();
-    return aggregatedFlags;
+    if (!dictionary)
+        return QStringList();
+    overflow.removeDuplicates();
+    return dictionary->decode(bits, overflow);
 }
 
 /** @short Pass a debugging message to the real Model, if possible
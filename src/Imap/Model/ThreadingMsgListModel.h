@@ -27,6 +27,7 @@
 #include <QAbstractProxyModel>
 #include <QPointer>
 #include <QSet>
+#include "LocalThreading.h"
 #include "MailboxTree.h"
 #include "Imap/Parser/Response.h"
 
@@ -149,6 +150,9 @@ public:
     */
     static QStringList supportedCapabilities();
 
+    /** @short Can the server do the threading, or do we have to do that on our own? */
+    static bool serverSupportsThreading(const Model *realModel);
+
     QStringList currentSearchCondition() const;
     SortCriterium currentSortCriterium() const;
     Q_INVOKABLE Qt::SortOrder currentSortOrder() const;
@@ -189,6 +193,10 @@ public slots:
 
     void delayedPrune();
 
+    /** @short Threading which has been computed locally is available */
+    void slotLocalThreadingAvailable(const QVector<Imap::Responses::ThreadingNode> &mapping);
+    void delayedLocalThreading();
+
 signals:
     void sortingFailed();
 
@@ -202,6 +210,9 @@ private:
     */
     void askForThreading(const uint firstUnknownUid = 0);
 
+    /** @short Thread the messages on our own because the server cannot do that */
+    void threadLocally();
+
     void updatePersistentIndexesPhase1();
     void updatePersistentIndexesPhase2();
 
@@ -320,6 +331,13 @@ private:
 
     QTimer *m_delayedPrune;
 
+    /** @short Client-side threading, used when the server does not support the THREAD extension */
+    LocalThreadingRunner *m_localThreading;
+    /** @short UIDs which have been passed to the m_localThreading, and whether their headers were known at that time */
+    QHash<uint, bool> m_locallyThreadedUids;
+    /** @short Redo the local threading once the headers of some messages arrive */
+    QTimer *m_delayedLocalThreading;
+
     friend class ::ImapModelThreadingTest; // needs access to wantThreading();
 };
 
@@ -96,6 +96,9 @@ void MsgPartNetworkReply::slotMyDataChanged()
     if (!part.data(Mailbox::RoleIsFetched).toBool())
         return;
 
+    // A spooled payload only gets loaded into the buffer when the buffer is asked for
+    part.data(Mailbox::RolePartBufferPtr);
+
     MsgPartNetAccessManager *netAccess = qobject_cast<MsgPartNetAccessManager*>(manager());
     Q_ASSERT(netAccess);
     QString mimeType = netAccess->translateToSupportedMimeType(part.data(Mailbox::RolePartMimeType).toString());
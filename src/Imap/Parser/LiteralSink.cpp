@@ -0,0 +1,108 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QFile>
+#include <QTemporaryFile>
+#include "LiteralSink.h"
+
+namespace Imap
+{
+
+LiteralSink::~LiteralSink()
+{
+}
+
+SpooledLiteralSink::SpooledLiteralSink(const qint64 expectedSize)
+    : m_file(new QTemporaryFile())
+    , m_expectedSize(expectedSize)
+    , m_size(0)
+    , m_finished(false)
+{
+    if (!m_file->open()) {
+        // Well, there's nothing much we can do about it, so let's keep the data in memory
+        m_file.reset();
+    }
+}
+
+SpooledLiteralSink::~SpooledLiteralSink()
+{
+}
+
+void SpooledLiteralSink::append(const QByteArray &chunk)
+{
+    Q_ASSERT(!m_finished);
+    if (chunk.isEmpty())
+        return;
+
+    if (m_file) {
+        if (m_file->write(chunk) != chunk.size()) {
+            // Writing to the disk failed (disk full?), so get the data back into the memory and continue from there
+            m_file->flush();
+            m_file->seek(0);
+            m_chunks << m_file->read(m_size);
+            m_file.reset();
+            m_chunks << chunk;
+        }
+    } else {
+        m_chunks << chunk;
+    }
+    m_size += chunk.size();
+}
+
+void SpooledLiteralSink::finish()
+{
+    Q_ASSERT(m_size == m_expectedSize);
+    m_finished = true;
+    if (m_file) {
+        m_fileName = m_file->fileName();
+        m_file->close();
+    }
+}
+
+qint64 SpooledLiteralSink::size() const
+{
+    return m_size;
+}
+
+QByteArray SpooledLiteralSink::readAll()
+{
+    Q_ASSERT(m_finished);
+    if (m_file) {
+        // A QFile of our own, so that concurrent readers do not interfere with each other
+        QFile buf(m_fileName);
+        if (!buf.open(QIODevice::ReadOnly))
+            return QByteArray();
+        return buf.read(m_size);
+    }
+
+    if (m_chunks.size() == 1)
+        return m_chunks.first();
+
+    QByteArray res;
+    res.reserve(m_size);
+    Q_FOREACH(const QByteArray &chunk, m_chunks) {
+        res.append(chunk);
+    }
+    return res;
+}
+
+}
@@ -0,0 +1,101 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_PARSER_LITERALSINK_H
+#define IMAP_PARSER_LITERALSINK_H
+
+#include <QByteArray>
+#include <QList>
+#include <QScopedPointer>
+#include <QString>
+
+class QTemporaryFile;
+
+/** @short Namespace for IMAP interaction */
+namespace Imap
+{
+
+/** @short Destination for the payload of a huge literal which is being received from the server
+
+The Parser usually accumulates the whole response line including all of its literals in memory before it gets
+parsed. That is a waste for multi-megabyte BODY[] and BINARY[] items -- the buffer has to be grown repeatedly and
+the payload gets copied once again by the LowLevelParser. When a literal is big enough, the Parser streams its
+payload chunk-by-chunk into a LiteralSink instead and the resulting Responses::Fetch carries just a handle to it.
+*/
+class LiteralSink
+{
+public:
+    virtual ~LiteralSink();
+
+    /** @short Accept another chunk of the literal's payload */
+    virtual void append(const QByteArray &chunk) = 0;
+
+    /** @short The whole literal has been received */
+    virtual void finish() = 0;
+
+    /** @short Number of bytes which have been passed to this sink so far */
+    virtual qint64 size() const = 0;
+
+    /** @short Return the complete payload as a single buffer
+
+    This is allowed only after finish() has been called. From then on, the sink is shared by the Responses::Fetch, the
+    message part which keeps it until somebody asks for the data, and the cache which might read it from another thread,
+    so this has to be thread-safe.
+    */
+    virtual QByteArray readAll() = 0;
+};
+
+/** @short LiteralSink which spools the data into a temporary file
+
+If the temporary file cannot be created, the chunks are kept in memory and only joined together upon readAll(),
+which still saves the repeated reallocation of the parser's line buffer.
+
+The file gets closed once the literal is complete, so that the sinks which are waiting until somebody asks for their
+data do not occupy a file descriptor each. Each readAll() opens the file on its own.
+*/
+class SpooledLiteralSink : public LiteralSink
+{
+public:
+    explicit SpooledLiteralSink(const qint64 expectedSize);
+    virtual ~SpooledLiteralSink();
+
+    virtual void append(const QByteArray &chunk);
+    virtual void finish();
+    virtual qint64 size() const;
+    virtual QByteArray readAll();
+
+private:
+    Q_DISABLE_COPY(SpooledLiteralSink)
+
+    /** @short The spool file; this is kept around after finish() just so that the file gets removed at the end */
+    QScopedPointer<QTemporaryFile> m_file;
+    /** @short Name of the m_file, remembered by finish() */
+    QString m_fileName;
+    QList<QByteArray> m_chunks;
+    qint64 m_expectedSize;
+    qint64 m_size;
+    bool m_finished;
+};
+
+}
+
+#endif /* IMAP_PARSER_LITERALSINK_H */
@@ -163,6 +163,20 @@ QPair<QByteArray,ParsedAs> getString(const QByteArray &line, int &start)
     if (line[start] == '"') {
         // quoted string
         ++start;
+
+        // Most strings contain no escapes at all, so they can be copied in one go
+        const char *c_str = line.constData() + start;
+        const char * const old_str = c_str;
+        const char * const end = line.constData() + line.size();
+        while (c_str != end && *c_str != '"' && *c_str != '\\' && *c_str != '\r' && *c_str != '\n')
+            ++c_str;
+        if (c_str != end && *c_str == '"') {
+            auto size = c_str - old_str;
+            start += size + 1;
+            // An empty quoted string has always been returned as a null QByteArray
+            return qMakePair(size ? QByteArray(old_str, size) : QByteArray(), QUOTED);
+        }
+
         bool escaping = false;
         QByteArray res;
         bool terminated = false;
@@ -417,6 +431,38 @@ Imap::Uids getSequence(const QByteArray &line, int &start)
     }
 }
 
+Imap::UidSet getUidSet(const QByteArray &line, int &start)
+{
+    Imap::UidSet res;
+    uint previous = LowLevelParser::getUInt(line, start);
+    bool previousIsRangeEnd = false;
+    res.insert(previous);
+
+    while (start < line.size() - 2 && (line[start] == ':' || line[start] == ',')) {
+        const bool isRange = line[start] == ':';
+        if (isRange && previousIsRangeEnd) {
+            throw UnexpectedHere("Sequence set: range cannot me defined by three numbers", line, start);
+        }
+
+        ++start;
+        if (start >= line.size() - 2) throw NoData("Truncated sequence set", line, start);
+
+        uint num = LowLevelParser::getUInt(line, start);
+        if (isRange) {
+            if (previous >= num)
+                throw UnexpectedHere("Sequence set contains an invalid range. "
+                                     "First item of a range must always be smaller than the second item.", line, start);
+            // Unlike getSequence(), this doesn't cost anything even for the huge ranges in a VANISHED (EARLIER)
+            res.insertRange(previous, num);
+        } else {
+            res.insert(num);
+        }
+        previous = num;
+        previousIsRangeEnd = isRange;
+    }
+    return res;
+}
+
 QDateTime parseRFC2822DateTime(const QByteArray &input)
 {
     static const QMap<QString, uint> monthnumbers({ // default value is 0
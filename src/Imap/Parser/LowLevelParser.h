@@ -25,6 +25,7 @@
 #include <QList>
 #include <QPair>
 #include <QVariant>
+#include "Imap/Parser/UidSet.h"
 #include "Imap/Parser/Uids.h"
 
 namespace Imap
@@ -62,6 +63,9 @@ uint getUInt(const QByteArray &line, int &start);
 /** @short Read a 64bit unsigned integer from input */
 quint64 getUInt64(const QByteArray &line, int &start);
 
+/** @short Check whether the input continues with a NIL which is not a prefix of some longer atom */
+bool startsWithNil(const QByteArray &line, int start);
+
 /** @short Read an ATOM */
 QByteArray getAtom(const QByteArray &line, int &start);
 QByteArray getPossiblyBackslashedAtom(const QByteArray &line, int &start);
@@ -98,6 +102,12 @@ QVariant getAnything(const QByteArray &line, int &start);
 /** @short Parse a sequence set from the input */
 Imap::Uids getSequence(const QByteArray &line, int &start);
 
+/** @short Parse a sequence set from the input without expanding its ranges
+
+The syntax is the same as for getSequence(), but the order of the numbers and any duplicates are not preserved.
+*/
+Imap::UidSet getUidSet(const QByteArray &line, int &start);
+
 /** @short Parse RFC2822-like formatted date
  *
  * Code for this class was lobotomized from KDE's KDateTime.
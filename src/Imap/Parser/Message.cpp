@@ -22,6 +22,7 @@
 
 #include <typeinfo>
 
+#include <QDataStream>
 #include <QTextDocument>
 #include <QUrl>
 #include <QTextCodec>
@@ -37,6 +38,298 @@ namespace Imap
 namespace Message
 {
 
+namespace {
+
+/** @short Sequential access to the items of a parenthesized list, straight from the response line
+
+The LowLevelParser::parseList() builds a nested QVariantList which is subsequently walked by the fromList() functions.
+This class allows parsing the ENVELOPE and BODYSTRUCTURE directly, item by item, without all these temporaries.
+Nested lists are handled by creating another ListCursor while the parent one is positioned at the nested list.
+*/
+class ListCursor
+{
+public:
+    ListCursor(const QByteArray &line, int &start): m_line(line), m_start(start), m_count(0)
+    {
+        if (m_start >= m_line.size())
+            throw NoData("Could not parse list: no more data", m_line, m_start);
+        if (m_line[m_start] != '(')
+            throw UnexpectedHere("Could not parse list: expected a list enclosed in (), but got something else instead", m_line, m_start);
+        ++m_start;
+    }
+
+    /** @short Is the next item the end of this list? */
+    bool atEnd()
+    {
+        LowLevelParser::eatSpaces(m_line, m_start);
+        if (m_start >= m_line.size())
+            throw NoData("Could not parse list: truncated data", m_line, m_start);
+        return m_line[m_start] == ')';
+    }
+
+    /** @short Is the next item a nested list? */
+    bool nextIsList()
+    {
+        return !atEnd() && m_line[m_start] == '(';
+    }
+
+    /** @short Is the next item a NIL or an empty string? */
+    bool nextIsEmptyString()
+    {
+        if (nextIsList())
+            return false;
+        int pos = m_start;
+        return LowLevelParser::getAnything(m_line, pos).toByteArray().isEmpty();
+    }
+
+    /** @short Position the cursor at the next item, which shall be a nested list to be parsed by the caller */
+    void enterNested()
+    {
+        Q_ASSERT(nextIsList());
+        ++m_count;
+    }
+
+    /** @short Read a string, an atom or a NIL; throw an exception when this is not possible */
+    QByteArray string(const char *errorMessage)
+    {
+        if (atEnd())
+            throw ParseError(errorMessage, m_line, m_start);
+        if (m_line[m_start] == '(' || m_line[m_start] == '[')
+            throw UnexpectedHere(errorMessage, m_line, m_start);
+        ++m_count;
+        if (m_line[m_start] == '"' || m_line[m_start] == '{' || m_line[m_start] == '~')
+            return LowLevelParser::getString(m_line, m_start).first;
+        if (LowLevelParser::startsWithNil(m_line, m_start)) {
+            m_start += 3;
+            return QByteArray();
+        }
+        return LowLevelParser::getAnything(m_line, m_start).toByteArray();
+    }
+
+    /** @short Read a string, or skip over a list and return an empty string in its place */
+    QByteArray lenientString(const char *errorMessage)
+    {
+        if (nextIsList()) {
+            skip();
+            return QByteArray();
+        }
+        return string(errorMessage);
+    }
+
+    /** @short Read anything at all, in the same form as the LowLevelParser::parseList() would provide it */
+    QVariant anything()
+    {
+        if (atEnd())
+            throw NoData("Could not parse list: unexpected end of list", m_line, m_start);
+        ++m_count;
+        return LowLevelParser::getAnything(m_line, m_start);
+    }
+
+    void skip()
+    {
+        anything();
+    }
+
+    /** @short Read all remaining items and return them the way the body-extension is stored */
+    QVariant remainingAsExtension()
+    {
+        QVariantList list;
+        while (!atEnd())
+            list << anything();
+        if (list.size() == 1)
+            return list.front();
+        if (list.isEmpty())
+            return QVariant();
+        return list;
+    }
+
+    /** @short Discard the rest of the list including the closing parenthesis */
+    void skipRest()
+    {
+        while (!atEnd())
+            skip();
+        ++m_start;
+    }
+
+    /** @short Consume the closing parenthesis, complaining about any extra items before it */
+    void finish(const char *errorMessage)
+    {
+        if (!atEnd())
+            throw ParseError(errorMessage, m_line, m_start);
+        ++m_start;
+    }
+
+    /** @short How many items have been consumed so far */
+    int count() const
+    {
+        return m_count;
+    }
+
+    const QByteArray &line() const { return m_line; }
+    int &start() { return m_start; }
+
+private:
+    const QByteArray &m_line;
+    int &m_start;
+    int m_count;
+};
+
+template<typename T> T numberFromToken(const QByteArray &token, const QByteArray &line, const int start)
+{
+    bool ok = false;
+    qint64 number = token.toLongLong(&ok);
+    if (ok) {
+        if (number >= 0) {
+            return number;
+        } else {
+            qDebug() << "Parser warning:" << number << "is not an unsigned number";
+            return 0;
+        }
+    } else if (token.isEmpty()) {
+        qDebug() << "Parser warning: expected an unsigned number, but got NIL or an empty string instead, yuck";
+        return 0;
+    } else {
+        throw UnexpectedHere("numberFromToken: not a number", line, start);
+    }
+}
+
+template<typename T> T readNumber(ListCursor &items)
+{
+    if (items.nextIsList())
+        throw UnexpectedHere("readNumber: weird data type", items.line(), items.start());
+    return numberFromToken<T>(items.string("readNumber: no data"), items.line(), items.start());
+}
+
+QList<MailAddress> readListOfAddresses(ListCursor &items)
+{
+    QList<MailAddress> res;
+    if (!items.nextIsList()) {
+        if (!items.string("getListOfAddresses: no data").isNull())
+            throw UnexpectedHere("getListOfAddresses: byte array not null", items.line(), items.start());
+        return res;
+    }
+
+    items.enterNested();
+    ListCursor list(items.line(), items.start());
+    while (!list.atEnd()) {
+        if (!list.nextIsList())
+            throw UnexpectedHere("getListOfAddresses: split item not a list", items.line(), items.start());
+        list.enterNested();
+        ListCursor address(items.line(), items.start());
+        QByteArray name = address.string("MailAddress: item#1 not a QByteArray");
+        QByteArray adl = address.string("MailAddress: item#2 not a QByteArray");
+        QByteArray mailbox = address.string("MailAddress: item#3 not a QByteArray");
+        QByteArray host = address.string("MailAddress: item#4 not a QByteArray");
+        address.finish("MailAddress: not four items");
+        res.append(MailAddress(Imap::decodeRFC2047String(name), Imap::decodeRFC2047String(adl),
+                               Imap::decodeRFC2047String(mailbox), Imap::decodeRFC2047String(host)));
+    }
+    list.finish("getListOfAddresses: unterminated list");
+    return res;
+}
+
+AbstractMessage::bodyFldParam_t readBodyFldParam(ListCursor &items)
+{
+    AbstractMessage::bodyFldParam_t map;
+    if (!items.nextIsList()) {
+        if (items.string("body-fld-param: no data").isNull())
+            return map;
+        throw UnexpectedHere("body-fld-param: not a list / nil", items.line(), items.start());
+    }
+    items.enterNested();
+    ListCursor list(items.line(), items.start());
+    while (!list.atEnd()) {
+        QByteArray key = list.string("body-fld-param: string not found");
+        if (list.atEnd())
+            throw UnexpectedHere("body-fld-param: wrong number of entries", items.line(), items.start());
+        map[key.toUpper()] = list.string("body-fld-param: string not found");
+    }
+    list.finish("body-fld-param: unterminated list");
+    return map;
+}
+
+AbstractMessage::bodyFldDsp_t readBodyFldDsp(ListCursor &items)
+{
+    AbstractMessage::bodyFldDsp_t res;
+    if (!items.nextIsList()) {
+        QByteArray buf = items.string("body-fld-dsp: no data");
+        if (!buf.isNull())
+            qDebug() << "IMAP Parser warning: body-fld-dsp not a list or nil, got this instead: " << buf;
+        return res;
+    }
+
+    items.enterNested();
+    ListCursor list(items.line(), items.start());
+    if (list.atEnd())
+        throw ParseError("body-fld-dsp: empty list is not allowed", items.line(), items.start());
+    res.first = list.string("body-fld-dsp: first item is not a string");
+    if (list.atEnd()) {
+        qDebug() << "IMAP Parser warning: body-fld-dsp: second item not present, ignoring";
+    } else {
+        res.second = readBodyFldParam(list);
+    }
+    list.finish("body-fld-dsp: too many items in the list");
+    return res;
+}
+
+QList<QByteArray> readBodyFldLang(ListCursor &items)
+{
+    QList<QByteArray> res;
+    if (!items.nextIsList()) {
+        QByteArray buf = items.string("body-fld-lang not found");
+        if (!buf.isNull())
+            res << buf;
+        return res;
+    }
+    items.enterNested();
+    ListCursor list(items.line(), items.start());
+    while (!list.atEnd())
+        res << list.string("body-fld-lang has wrong structure");
+    list.finish("body-fld-lang has wrong structure");
+    return res;
+}
+
+/** @short Sanitize the Message-Id and In-Reply-To and construct the Envelope */
+Envelope envelopeFromParts(const QDateTime &date, const QString &subject, const QList<MailAddress> &from,
+                           const QList<MailAddress> &sender, const QList<MailAddress> &replyTo,
+                           const QList<MailAddress> &to, const QList<MailAddress> &cc, const QList<MailAddress> &bcc,
+                           const QByteArray &inReplyTo, QByteArray messageId)
+{
+    LowLevelParser::Rfc5322HeaderParser headerParser;
+
+    QByteArray buf;
+    if (!messageId.isEmpty())
+        buf += "Message-Id: " + messageId + "\r\n";
+    if (!inReplyTo.isEmpty())
+        buf += "In-Reply-To: " + inReplyTo + "\r\n";
+    if (!buf.isEmpty()) {
+        bool ok = headerParser.parse(buf);
+        if (!ok) {
+            qDebug() << "Envelope::fromList: malformed headers";
+        }
+    }
+    // If the Message-Id fails to parse, well, bad luck. This enforced sanitizaion is hopefully better than
+    // generating garbage in outgoing e-mails.
+    messageId = headerParser.messageId.size() == 1 ? headerParser.messageId.front() : QByteArray();
+
+    return Envelope(date, subject, from, sender, replyTo, to, cc, bcc, headerParser.inReplyTo, messageId);
+}
+
+QDateTime envelopeDate(const QByteArray &dateStr)
+{
+    QDateTime date;
+    if (!dateStr.isEmpty()) {
+        try {
+            date = LowLevelParser::parseRFC2822DateTime(dateStr);
+        } catch (ParseError &) {
+            // FIXME: log this
+        }
+    }
+    return date;
+}
+
+}
+
 QList<MailAddress> Envelope::getListOfAddresses(const QVariant &in, const QByteArray &line, const int start)
 {
     if (in.type() == QVariant::ByteArray) {
@@ -64,15 +357,7 @@ Envelope Envelope::fromList(const QVariantList &items, const QByteArray &line, c
     // date
     QDateTime date;
     if (items[0].type() == QVariant::ByteArray) {
-        QByteArray dateStr = items[0].toByteArray();
-        if (! dateStr.isEmpty()) {
-            try {
-                date = LowLevelParser::parseRFC2822DateTime(dateStr);
-            } catch (ParseError &) {
-                // FIXME: log this
-                //throw ParseError( e.what(), line, start );
-            }
-        }
+        date = envelopeDate(items[0].toByteArray());
     }
     // Otherwise it's "invalid", null.
 
@@ -86,8 +371,6 @@ Envelope Envelope::fromList(const QVariantList &items, const QByteArray &line, c
     cc = Envelope::getListOfAddresses(items[6], line, start);
     bcc = Envelope::getListOfAddresses(items[7], line, start);
 
-    LowLevelParser::Rfc5322HeaderParser headerParser;
-
     if (items[8].type() != QVariant::ByteArray)
         throw UnexpectedHere("Envelope::fromList: inReplyTo not a QByteArray", line, start);
     QByteArray inReplyTo = items[8].toByteArray();
@@ -96,22 +379,35 @@ Envelope Envelope::fromList(const QVariantList &items, const QByteArray &line, c
         throw UnexpectedHere("Envelope::fromList: messageId not a QByteArray", line, start);
     QByteArray messageId = items[9].toByteArray();
 
-    QByteArray buf;
-    if (!messageId.isEmpty())
-        buf += "Message-Id: " + messageId + "\r\n";
-    if (!inReplyTo.isEmpty())
-        buf += "In-Reply-To: " + inReplyTo + "\r\n";
-    if (!buf.isEmpty()) {
-        bool ok = headerParser.parse(buf);
-        if (!ok) {
-            qDebug() << "Envelope::fromList: malformed headers";
-        }
+    return envelopeFromParts(date, subject, from, sender, replyTo, to, cc, bcc, inReplyTo, messageId);
+}
+
+Envelope Envelope::fromLine(const QByteArray &line, int &start)
+{
+    ListCursor items(line, start);
+
+    QDateTime date;
+    if (items.nextIsList()) {
+        items.skip();
+    } else {
+        date = envelopeDate(items.string("Envelope::fromLine: size != 10"));
     }
-    // If the Message-Id fails to parse, well, bad luck. This enforced sanitizaion is hopefully better than
-    // generating garbage in outgoing e-mails.
-    messageId = headerParser.messageId.size() == 1 ? headerParser.messageId.front() : QByteArray();
 
-    return Envelope(date, subject, from, sender, replyTo, to, cc, bcc, headerParser.inReplyTo, messageId);
+    QString subject = Imap::decodeRFC2047String(items.lenientString("Envelope::fromLine: size != 10"));
+
+    QList<MailAddress> from, sender, replyTo, to, cc, bcc;
+    from = readListOfAddresses(items);
+    sender = readListOfAddresses(items);
+    replyTo = readListOfAddresses(items);
+    to = readListOfAddresses(items);
+    cc = readListOfAddresses(items);
+    bcc = readListOfAddresses(items);
+
+    QByteArray inReplyTo = items.string("Envelope::fromLine: inReplyTo not a QByteArray");
+    QByteArray messageId = items.string("Envelope::fromLine: messageId not a QByteArray");
+    items.finish("Envelope::fromLine: size != 10");
+
+    return envelopeFromParts(date, subject, from, sender, replyTo, to, cc, bcc, inReplyTo, messageId);
 }
 
 void Envelope::clear()
@@ -686,6 +982,598 @@ QSharedPointer<AbstractMessage> AbstractMessage::fromList(const QVariantList &it
     }
 }
 
+QSharedPointer<AbstractMessage> AbstractMessage::fromLine(const QByteArray &line, int &start)
+{
+    ListCursor items(line, start);
+
+    if (items.atEnd())
+        throw NoData("AbstractMessage::fromLine: no data", line, start);
+
+    if (!items.nextIsList()) {
+        // it's a single-part message, hurray
+
+        QByteArray mediaType = items.string("AbstractMessage::fromLine: no data").toLower();
+        if (items.atEnd())
+            throw NoData("AbstractMessage::fromLine: no data", line, start);
+        QByteArray mediaSubType = items.lenientString("AbstractMessage::fromLine: no data").toLower();
+
+        bodyFldParam_t bodyFldParam;
+        if (!items.atEnd())
+            bodyFldParam = readBodyFldParam(items);
+
+        QByteArray bodyFldId;
+        if (!items.atEnd())
+            bodyFldId = items.string("body-fld-id not recognized as a ByteArray");
+
+        QByteArray bodyFldDesc;
+        if (!items.atEnd())
+            bodyFldDesc = items.string("body-fld-desc not recognized as a ByteArray");
+
+        QByteArray bodyFldEnc;
+        if (!items.atEnd())
+            bodyFldEnc = items.string("body-fld-enc not recognized as a ByteArray");
+
+        quint64 bodyFldOctets = 0;
+        if (!items.atEnd())
+            bodyFldOctets = readNumber<quint64>(items);
+
+        if (items.count() < 7) {
+            qDebug() << "AbstractMessage::fromLine(): body-type-basic(?): yuck, too few items, using what we've got";
+        }
+
+        uint bodyFldLines = 0;
+        Envelope envelope;
+        QSharedPointer<AbstractMessage> body;
+
+        // See AbstractMessage::fromList() for details; the rest of this list has to be consumed, though
+#define RETURN_ERROR_BINARY_PART_FROM_LINE \
+    items.skipRest(); \
+    qDebug() << "will return a fake raw part instead of a damaged" << QByteArray(mediaType + '/' + mediaSubType).data() << "part"; \
+    bodyFldParam["x-trojita-original-mime-type"] = mediaType + '/' + mediaSubType; \
+    return QSharedPointer<AbstractMessage>(new BasicMessage("application", "x-trojita-malformed-part-from-imap-response", \
+        bodyFldParam, bodyFldId, bodyFldDesc, bodyFldEnc, bodyFldOctets, \
+        QByteArray(), bodyFldDsp_t(), QList<QByteArray>(), QByteArray(), QVariant()))
+
+        enum { MESSAGE, TEXT, BASIC} kind;
+
+        if (mediaType == "message" && mediaSubType == "rfc822") {
+            // extract envelope, body, body-fld-lines
+
+            if (items.count() < 7 || items.atEnd())
+                throw NoData("too few fields for a Message-message", line, start);
+
+            kind = MESSAGE;
+            if (items.nextIsEmptyString()) {
+                // ENVELOPE is NIL -- a server bug, but there's a chance that perhaps the body might still be readable...
+                qDebug() << "message/rfc822: yuck, got NIL for envelope";
+                items.skip();
+            } else if (!items.nextIsList()) {
+                qDebug() << "message/rfc822: yuck, ENVELOPE is not a list";
+                RETURN_ERROR_BINARY_PART_FROM_LINE;
+            } else {
+                items.enterNested();
+                envelope = Envelope::fromLine(line, start);
+            }
+
+            if (items.atEnd())
+                throw NoData("too few fields for a Message-message", line, start);
+            if (!items.nextIsList()) {
+                // we're screwed, let's fall back to a binary part rendering
+                qDebug() << "message/rfc822: yuck, got garbage for BODY";
+                RETURN_ERROR_BINARY_PART_FROM_LINE;
+            } else {
+                items.enterNested();
+                body = AbstractMessage::fromLine(line, start);
+            }
+
+            if (items.atEnd())
+                throw NoData("too few fields for a Message-message", line, start);
+            try {
+                bodyFldLines = readNumber<uint>(items);
+            } catch (const UnexpectedHere &) {
+                qDebug() << "message/rfc822: yuck, invalid body-fld-lines";
+            }
+
+        } else if (mediaType == "text") {
+            kind = TEXT;
+            if (!items.atEnd()) {
+                // extract body-fld-lines
+                bodyFldLines = readNumber<uint>(items);
+            }
+        } else {
+            // don't extract anything as we're done here
+            kind = BASIC;
+        }
+#undef RETURN_ERROR_BINARY_PART_FROM_LINE
+
+        // extract body-ext-1part
+
+        // body-fld-md5
+        QByteArray bodyFldMd5;
+        if (!items.atEnd())
+            bodyFldMd5 = items.string("body-fld-md5 not a ByteArray");
+
+        // body-fld-dsp
+        bodyFldDsp_t bodyFldDsp;
+        if (!items.atEnd())
+            bodyFldDsp = readBodyFldDsp(items);
+
+        // body-fld-lang
+        QList<QByteArray> bodyFldLang;
+        if (!items.atEnd())
+            bodyFldLang = readBodyFldLang(items);
+
+        // body-fld-loc
+        QByteArray bodyFldLoc;
+        if (!items.atEnd())
+            bodyFldLoc = items.string("body-fld-loc not found");
+
+        // body-extension
+        QVariant bodyExtension = items.remainingAsExtension();
+        items.finish("AbstractMessage::fromLine: unterminated list");
+
+        switch (kind) {
+        case MESSAGE:
+            return QSharedPointer<AbstractMessage>(
+                       new MsgMessage(mediaType, mediaSubType, bodyFldParam,
+                                      bodyFldId, bodyFldDesc, bodyFldEnc, bodyFldOctets,
+                                      bodyFldMd5, bodyFldDsp, bodyFldLang, bodyFldLoc,
+                                      bodyExtension, envelope, body, bodyFldLines)
+                   );
+        case TEXT:
+            return QSharedPointer<AbstractMessage>(
+                       new TextMessage(mediaType, mediaSubType, bodyFldParam,
+                                       bodyFldId, bodyFldDesc, bodyFldEnc, bodyFldOctets,
+                                       bodyFldMd5, bodyFldDsp, bodyFldLang, bodyFldLoc,
+                                       bodyExtension, bodyFldLines)
+                   );
+        case BASIC:
+        default:
+            return QSharedPointer<AbstractMessage>(
+                       new BasicMessage(mediaType, mediaSubType, bodyFldParam,
+                                        bodyFldId, bodyFldDesc, bodyFldEnc, bodyFldOctets,
+                                        bodyFldMd5, bodyFldDsp, bodyFldLang, bodyFldLoc,
+                                        bodyExtension)
+                   );
+        }
+
+    } else {
+
+        QList<QSharedPointer<AbstractMessage> > bodies;
+        while (items.nextIsList()) {
+            items.enterNested();
+            bodies << fromLine(line, start);
+        }
+
+        if (items.atEnd())
+            throw UnexpectedHere("body-type-mpart: media-subtype not recognized", line, start);
+        QByteArray mediaSubType = items.string("body-type-mpart: media-subtype not recognized").toLower();
+
+        // body-ext-mpart
+
+        // body-fld-param
+        bodyFldParam_t bodyFldParam;
+        if (!items.atEnd())
+            bodyFldParam = readBodyFldParam(items);
+
+        // body-fld-dsp
+        bodyFldDsp_t bodyFldDsp;
+        if (!items.atEnd())
+            bodyFldDsp = readBodyFldDsp(items);
+
+        // body-fld-lang
+        QList<QByteArray> bodyFldLang;
+        if (!items.atEnd())
+            bodyFldLang = readBodyFldLang(items);
+
+        // body-fld-loc
+        QByteArray bodyFldLoc;
+        if (!items.atEnd())
+            bodyFldLoc = items.string("body-fld-loc not found");
+
+        // body-extension
+        QVariant bodyExtension = items.remainingAsExtension();
+        items.finish("AbstractMessage::fromLine: unterminated list");
+
+        return QSharedPointer<AbstractMessage>(
+                   new MultiMessage(bodies, mediaSubType, bodyFldParam,
+                                    bodyFldDsp, bodyFldLang, bodyFldLoc, bodyExtension));
+    }
+}
+
+namespace {
+
+/** @short Tag of the compact serialization format
+
+The legacy format produced by QDataStream starts with a big-endian 32bit item count which is never big enough to make
+the first byte non-zero, so the presence of this tag is enough to tell these formats apart.
+*/
+const char bodyStructureFormatTag = 'B';
+
+enum BodyStructureNodeKind {
+    NODE_BASIC = 0,
+    NODE_TEXT = 1,
+    NODE_MSG = 2,
+    NODE_MULTI = 3,
+};
+
+/** @short Writer of the compact binary form of the BODYSTRUCTURE
+
+All numbers are stored as variable-length integers and byte arrays are prefixed by their length, which makes a typical
+message a few times smaller than the QDataStream archive of the original QVariantList.
+*/
+class BodyStructureWriter
+{
+public:
+    explicit BodyStructureWriter(QByteArray &out): m_out(out) {}
+
+    void number(quint64 value)
+    {
+        while (value >= 0x80) {
+            m_out.append(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        m_out.append(static_cast<char>(value));
+    }
+
+    /** @short Store a byte array; the null and empty ones are distinguished from each other */
+    void bytes(const QByteArray &data)
+    {
+        if (data.isNull()) {
+            number(0);
+        } else {
+            number(static_cast<quint64>(data.size()) + 1);
+            m_out.append(data);
+        }
+    }
+
+    void string(const QString &data)
+    {
+        bytes(data.isNull() ? QByteArray() : data.toUtf8());
+    }
+
+    void byteArrayList(const QList<QByteArray> &list)
+    {
+        number(list.size());
+        Q_FOREACH(const QByteArray &item, list) {
+            bytes(item);
+        }
+    }
+
+    void params(const AbstractMessage::bodyFldParam_t &map)
+    {
+        number(map.size());
+        for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
+            bytes(it.key());
+            bytes(it.value());
+        }
+    }
+
+    void variant(const QVariant &data)
+    {
+        if (!data.isValid()) {
+            bytes(QByteArray());
+            return;
+        }
+        // The body-extension is extremely rare and arbitrarily complex, so there's no point in a custom format
+        QByteArray buf;
+        QDataStream stream(&buf, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_4_6);
+        stream << data;
+        bytes(buf);
+    }
+
+    void addresses(const QList<MailAddress> &list)
+    {
+        number(list.size());
+        Q_FOREACH(const MailAddress &address, list) {
+            string(address.name);
+            string(address.adl);
+            string(address.mailbox);
+            string(address.host);
+        }
+    }
+
+    void envelope(const Envelope &e)
+    {
+        if (e.date.isValid()) {
+            number(1);
+            // zig-zag encoding for the signed values
+            qint64 msecs = e.date.toMSecsSinceEpoch();
+            number((static_cast<quint64>(msecs) << 1) ^ static_cast<quint64>(msecs >> 63));
+            qint64 offset = e.date.offsetFromUtc();
+            number((static_cast<quint64>(offset) << 1) ^ static_cast<quint64>(offset >> 63));
+        } else {
+            number(0);
+        }
+        string(e.subject);
+        addresses(e.from);
+        addresses(e.sender);
+        addresses(e.replyTo);
+        addresses(e.to);
+        addresses(e.cc);
+        addresses(e.bcc);
+        byteArrayList(e.inReplyTo);
+        bytes(e.messageId);
+    }
+
+    void message(const AbstractMessage &msg)
+    {
+        const MultiMessage *multi = dynamic_cast<const MultiMessage *>(&msg);
+        const OneMessage *one = dynamic_cast<const OneMessage *>(&msg);
+        const TextMessage *text = dynamic_cast<const TextMessage *>(&msg);
+        const MsgMessage *msgMessage = dynamic_cast<const MsgMessage *>(&msg);
+
+        if (multi) {
+            number(NODE_MULTI);
+        } else if (text) {
+            number(NODE_TEXT);
+        } else if (msgMessage) {
+            number(NODE_MSG);
+        } else {
+            Q_ASSERT(one);
+            number(NODE_BASIC);
+        }
+
+        if (!multi)
+            bytes(msg.mediaType);
+        bytes(msg.mediaSubType);
+        params(msg.bodyFldParam);
+        bytes(msg.bodyFldDsp.first);
+        params(msg.bodyFldDsp.second);
+        byteArrayList(msg.bodyFldLang);
+        bytes(msg.bodyFldLoc);
+        variant(msg.bodyExtension);
+
+        if (multi) {
+            number(multi->bodies.size());
+            Q_FOREACH(const QSharedPointer<AbstractMessage> &child, multi->bodies) {
+                message(*child);
+            }
+            return;
+        }
+
+        bytes(one->bodyFldId);
+        bytes(one->bodyFldDesc);
+        bytes(one->bodyFldEnc);
+        number(one->bodyFldOctets);
+        bytes(one->bodyFldMd5);
+
+        if (text) {
+            number(text->bodyFldLines);
+        } else if (msgMessage) {
+            number(msgMessage->bodyFldLines);
+            envelope(msgMessage->envelope);
+            if (msgMessage->body) {
+                number(1);
+                message(*msgMessage->body);
+            } else {
+                number(0);
+            }
+        }
+    }
+
+private:
+    QByteArray &m_out;
+};
+
+/** @short Counterpart to the BodyStructureWriter */
+class BodyStructureReader
+{
+public:
+    BodyStructureReader(const QByteArray &data, int start): m_data(data), m_pos(start) {}
+
+    quint64 number()
+    {
+        quint64 res = 0;
+        int shift = 0;
+        while (true) {
+            if (m_pos >= m_data.size())
+                throw NoData("BodyStructureReader: truncated number", m_data, m_pos);
+            if (shift > 63)
+                throw ParseError("BodyStructureReader: number out of range", m_data, m_pos);
+            quint8 byte = static_cast<quint8>(m_data[m_pos++]);
+            res |= static_cast<quint64>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return res;
+            shift += 7;
+        }
+    }
+
+    qint64 signedNumber()
+    {
+        quint64 raw = number();
+        return static_cast<qint64>(raw >> 1) ^ -static_cast<qint64>(raw & 1);
+    }
+
+    int count()
+    {
+        quint64 res = number();
+        // Each item needs at least one byte, so this is a cheap sanity check against corrupted input
+        if (res > static_cast<quint64>(m_data.size() - m_pos))
+            throw ParseError("BodyStructureReader: bogus item count", m_data, m_pos);
+        return static_cast<int>(res);
+    }
+
+    QByteArray bytes()
+    {
+        quint64 size = number();
+        if (size == 0)
+            return QByteArray();
+        --size;
+        if (size > static_cast<quint64>(m_data.size() - m_pos))
+            throw NoData("BodyStructureReader: truncated data", m_data, m_pos);
+        QByteArray res = m_data.mid(m_pos, static_cast<int>(size));
+        m_pos += static_cast<int>(size);
+        return res;
+    }
+
+    QString string()
+    {
+        QByteArray buf = bytes();
+        return buf.isNull() ? QString() : QString::fromUtf8(buf);
+    }
+
+    QList<QByteArray> byteArrayList()
+    {
+        QList<QByteArray> res;
+        for (int i = count(); i > 0; --i)
+            res << bytes();
+        return res;
+    }
+
+    AbstractMessage::bodyFldParam_t params()
+    {
+        AbstractMessage::bodyFldParam_t res;
+        for (int i = count(); i > 0; --i) {
+            QByteArray key = bytes();
+            res[key] = bytes();
+        }
+        return res;
+    }
+
+    QVariant variant()
+    {
+        QByteArray buf = bytes();
+        if (buf.isNull())
+            return QVariant();
+        QDataStream stream(&buf, QIODevice::ReadOnly);
+        stream.setVersion(QDataStream::Qt_4_6);
+        QVariant res;
+        stream >> res;
+        return res;
+    }
+
+    QList<MailAddress> addresses()
+    {
+        QList<MailAddress> res;
+        for (int i = count(); i > 0; --i) {
+            QString name = string();
+            QString adl = string();
+            QString mailbox = string();
+            QString host = string();
+            res << MailAddress(name, adl, mailbox, host);
+        }
+        return res;
+    }
+
+    Envelope envelope()
+    {
+        Envelope e;
+        if (number()) {
+            qint64 msecs = signedNumber();
+            qint64 offset = signedNumber();
+            e.date = QDateTime::fromMSecsSinceEpoch(msecs, Qt::OffsetFromUTC, static_cast<int>(offset));
+        }
+        e.subject = string();
+        e.from = addresses();
+        e.sender = addresses();
+        e.replyTo = addresses();
+        e.to = addresses();
+        e.cc = addresses();
+        e.bcc = addresses();
+        e.inReplyTo = byteArrayList();
+        e.messageId = bytes();
+        return e;
+    }
+
+    QSharedPointer<AbstractMessage> message()
+    {
+        quint64 kind = number();
+        if (kind > NODE_MULTI)
+            throw ParseError("BodyStructureReader: unknown node", m_data, m_pos);
+
+        QByteArray mediaType = kind == NODE_MULTI ? QByteArray("multipart") : bytes();
+        QByteArray mediaSubType = bytes();
+        AbstractMessage::bodyFldParam_t bodyFldParam = params();
+        AbstractMessage::bodyFldDsp_t bodyFldDsp;
+        bodyFldDsp.first = bytes();
+        bodyFldDsp.second = params();
+        QList<QByteArray> bodyFldLang = byteArrayList();
+        QByteArray bodyFldLoc = bytes();
+        QVariant bodyExtension = variant();
+
+        if (kind == NODE_MULTI) {
+            QList<QSharedPointer<AbstractMessage> > bodies;
+            for (int i = count(); i > 0; --i)
+                bodies << message();
+            return QSharedPointer<AbstractMessage>(
+                        new MultiMessage(bodies, mediaSubType, bodyFldParam, bodyFldDsp, bodyFldLang, bodyFldLoc, bodyExtension));
+        }
+
+        QByteArray bodyFldId = bytes();
+        QByteArray bodyFldDesc = bytes();
+        QByteArray bodyFldEnc = bytes();
+        quint64 bodyFldOctets = number();
+        QByteArray bodyFldMd5 = bytes();
+
+        switch (kind) {
+        case NODE_TEXT:
+        {
+            uint bodyFldLines = number();
+            return QSharedPointer<AbstractMessage>(
+                        new TextMessage(mediaType, mediaSubType, bodyFldParam, bodyFldId, bodyFldDesc, bodyFldEnc,
+                                        bodyFldOctets, bodyFldMd5, bodyFldDsp, bodyFldLang, bodyFldLoc, bodyExtension,
+                                        bodyFldLines));
+        }
+        case NODE_MSG:
+        {
+            uint bodyFldLines = number();
+            Envelope e = envelope();
+            QSharedPointer<AbstractMessage> body;
+            if (number())
+                body = message();
+            return QSharedPointer<AbstractMessage>(
+                        new MsgMessage(mediaType, mediaSubType, bodyFldParam, bodyFldId, bodyFldDesc, bodyFldEnc,
+                                       bodyFldOctets, bodyFldMd5, bodyFldDsp, bodyFldLang, bodyFldLoc, bodyExtension,
+                                       e, body, bodyFldLines));
+        }
+        default:
+            return QSharedPointer<AbstractMessage>(
+                        new BasicMessage(mediaType, mediaSubType, bodyFldParam, bodyFldId, bodyFldDesc, bodyFldEnc,
+                                         bodyFldOctets, bodyFldMd5, bodyFldDsp, bodyFldLang, bodyFldLoc, bodyExtension));
+        }
+    }
+
+    bool atEnd() const
+    {
+        return m_pos == m_data.size();
+    }
+
+private:
+    const QByteArray &m_data;
+    int m_pos;
+};
+
+}
+
+QByteArray AbstractMessage::serialize() const
+{
+    QByteArray res;
+    res.append(bodyStructureFormatTag);
+    BodyStructureWriter writer(res);
+    writer.message(*this);
+    return res;
+}
+
+QSharedPointer<AbstractMessage> AbstractMessage::fromSerialized(const QByteArray &data)
+{
+    if (!data.isEmpty() && data[0] == bodyStructureFormatTag) {
+        BodyStructureReader reader(data, 1);
+        QSharedPointer<AbstractMessage> res = reader.message();
+        if (!reader.atEnd())
+            throw TooMuchData("AbstractMessage::fromSerialized: trailing garbage", data, 0);
+        return res;
+    }
+
+    // The legacy format, a QVariantList as archived by QDataStream
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_4_6);
+    QVariantList unserialized;
+    stream >> unserialized;
+    return fromList(unserialized, QByteArray(), 0);
+}
+
 void dumpListOfAddresses(QTextStream &stream, const QList<MailAddress> &list, const int indent)
 {
     QByteArray lf("\n");
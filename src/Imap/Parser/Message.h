@@ -72,6 +72,12 @@ public:
         date(date), subject(subject), from(from), sender(sender), replyTo(replyTo),
         to(to), cc(cc), bcc(bcc), inReplyTo(inReplyTo), messageId(messageId) {}
     static Envelope fromList(const QVariantList &items, const QByteArray &line, const int start);
+    /** @short Parse the ENVELOPE directly from the response line
+
+    This is equivalent to calling fromList() on the result of LowLevelParser::parseList(), but without building the
+    intermediate nested QVariantList.
+    */
+    static Envelope fromLine(const QByteArray &line, int &start);
     QTextStream &dump(QTextStream &s, const int indent) const;
 
     void clear();
@@ -104,6 +110,17 @@ public:
 
     virtual ~AbstractMessage() {}
     static QSharedPointer<AbstractMessage> fromList(const QVariantList &items, const QByteArray &line, const int start);
+    /** @short Parse the BODY or BODYSTRUCTURE directly from the response line, see Envelope::fromLine() */
+    static QSharedPointer<AbstractMessage> fromLine(const QByteArray &line, int &start);
+
+    /** @short Compact binary representation of the whole MIME tree, suitable for storing in the cache */
+    QByteArray serialize() const;
+    /** @short Restore the MIME tree from the output of serialize()
+
+    The legacy format, i.e. the QVariantList from LowLevelParser::parseList() as archived by QDataStream, is supported
+    as well so that the existing cache entries remain usable.
+    */
+    static QSharedPointer<AbstractMessage> fromSerialized(const QByteArray &data);
 
     static bodyFldParam_t makeBodyFldParam(const QVariant &list, const QByteArray &line, const int start);
     static bodyFldDsp_t makeBodyFldDsp(const QVariant &list, const QByteArray &line, const int start);
@@ -20,18 +20,22 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <algorithm>
+#include <functional>
 #include <QDebug>
 #include <QStringList>
 #include <QMutexLocker>
 #include <QProcess>
 #include <QSslError>
+#include <QThread>
 #include <QTime>
 #include <QTimer>
 #include "Parser.h"
 #include "Imap/Encoders.h"
+#include "LiteralSink.h"
 #include "LowLevelParser.h"
 #include "../../Streams/IODeviceSocket.h"
 #include "../Model/Utils.h"
+#include "Common/PostedEventHandler.h"
 
 //#define PRINT_TRAFFIC 100
 //#define PRINT_TRAFFIC_TX 500
@@ -90,7 +94,10 @@ Parser::Parser(QObject *parent, Streams::Socket *socket, const uint myId):
     QObject(parent), socket(socket), m_lastTagUsed(0), idling(false), waitForInitialIdle(false),
     m_literalPlus(LiteralPlus::Unsupported), waitingForContinuation(false), startTlsInProgress(false), compressDeflateInProgress(false),
     waitingForConnection(true), waitingForEncryption(socket->isConnectingEncryptedSinceStart()), waitingForSslPolicy(false),
-    m_expectsInitialGreeting(true), readingMode(ReadingLine), oldLiteralPosition(0), m_parserId(myId)
+    m_expectsInitialGreeting(true), readingMode(ReadingLine), oldLiteralPosition(0), readingBytes(0),
+    m_literalSpoolThreshold(1024 * 1024), m_parserId(myId),
+    m_parsingThread(0), m_parsingWorker(0), m_parsingNotifier(0), m_parsingWorkerScheduled(false),
+    m_parsingNotifierScheduled(false), m_linesInWorker(0), m_executeCommandsScheduled(false)
 {
     socket->setParent(this);
     connect(socket, &Streams::Socket::disconnected, this, &Parser::handleDisconnected);
@@ -520,7 +527,7 @@ void Parser::idleDone()
     Commands::Command cmd;
     cmd << Commands::PartOfCommand(Commands::IDLE_DONE, "DONE");
     cmdQueue.append(cmd);
-    QTimer::singleShot(0, this, SLOT(executeCommands()));
+    scheduleExecuteCommands();
 }
 
 void Parser::idleContinuationWontCome()
@@ -528,7 +535,7 @@ void Parser::idleContinuationWontCome()
     Q_ASSERT(waitForInitialIdle);
     waitForInitialIdle = false;
     idling = false;
-    QTimer::singleShot(0, this, SLOT(executeCommands()));
+    scheduleExecuteCommands();
 }
 
 void Parser::idleMagicallyTerminatedByServer()
@@ -612,7 +619,8 @@ CommandHandle Parser::queueCommand(Commands::Command command)
     CommandHandle tag = generateTag();
     command.addTag(tag);
     cmdQueue.append(command);
-    QTimer::singleShot(0, this, SLOT(executeCommands()));
+    scheduleExecuteCommands();
+    emit commandQueued(this, tag);
     return tag;
 }
 
@@ -632,7 +640,7 @@ void Parser::queueResponse(const QSharedPointer<Responses::AbstractResponse> &re
             literalCommandTag.clear();
             waitingForContinuation = false;
             cmdQueue.pop_front();
-            QTimer::singleShot(0, this, SLOT(executeCommands()));
+            scheduleExecuteCommands();
             if (stateResponse->kind != Responses::NO && stateResponse->kind != Responses::BAD) {
                 // FIXME: use parserWarning when it's adapted throughout the code
                 qDebug() << "Synchronized literal rejected but response is neither NO nor BAD";
@@ -686,6 +694,25 @@ void Parser::handleReadyRead()
             }
         }
         break;
+        case ReadingSpooledLiteral:
+        {
+            // Don't let the socket return a buffer of the literal's full size, that's what we're trying to avoid
+            const uint wanted = qMin<uint>(readingBytes, 64 * 1024);
+            QByteArray buf = socket->read(wanted);
+            if (buf.isEmpty())
+                return;
+            readingBytes -= buf.size();
+            Q_ASSERT(!m_spooledLiterals.isEmpty());
+            m_spooledLiterals.last()->append(buf);
+            if (readingBytes == 0) {
+                m_spooledLiterals.last()->finish();
+                emit spooledLiteralReceived(this, m_spooledLiterals.last()->size());
+                readingMode = ReadingLine;
+            } else if (static_cast<uint>(buf.size()) < wanted) {
+                return;
+            }
+        }
+        break;
         }
     }
 }
@@ -704,8 +731,20 @@ void Parser::reallyReadLine()
                 throw ParseError("Can't parse numeric literal size", currentLine, offset);
             if (number < 0)
                 throw ParseError("Negative literal size", currentLine, offset);
-            oldLiteralPosition = offset;
-            readingMode = ReadingNumberOfBytes;
+            int literalStart = offset;
+            if (literalStart > 0 && currentLine[literalStart - 1] == '~')
+                --literalStart;
+            if (shouldSpoolLiteral(literalStart, number)) {
+                // Replace the literal's size specification by a placeholder, the payload goes to the sink
+                currentLine.truncate(literalStart);
+                currentLine += Responses::Fetch::spooledLiteralPlaceholder(m_spooledLiterals.size());
+                m_spooledLiterals << QSharedPointer<LiteralSink>(new SpooledLiteralSink(number));
+                oldLiteralPosition = literalStart;
+                readingMode = ReadingSpooledLiteral;
+            } else {
+                oldLiteralPosition = offset;
+                readingMode = ReadingNumberOfBytes;
+            }
             readingBytes = number;
         } else if (currentLine.endsWith("\r\n")) {
             // it's complete
@@ -720,20 +759,62 @@ void Parser::reallyReadLine()
             processLine(currentLine);
             currentLine.clear();
             oldLiteralPosition = 0;
+            m_spooledLiterals.clear();
         } else {
             throw ParseError("Received line doesn't end with any of \"}\\r\\n\" and \"\\r\\n\"", currentLine, 0);
         }
     } catch (ParserException &e) {
-        queueResponse(QSharedPointer<Responses::AbstractResponse>(new Responses::ParseErrorResponse(e)));
+        m_spooledLiterals.clear();
+        queueResponseAfterPendingLines(QSharedPointer<Responses::AbstractResponse>(new Responses::ParseErrorResponse(e)));
     }
 }
 
+/** @short Find out whether the literal which starts at @arg literalStart is a big BODY[] or BINARY[] item of a FETCH
+
+Only these are worth streaming into a LiteralSink; everything else is small enough to be parsed from memory,
+and the rest of the code doesn't expect to find a spooled literal anywhere else, anyway.
+*/
+bool Parser::shouldSpoolLiteral(const int literalStart, const qint64 size) const
+{
+    if (m_literalSpoolThreshold <= 0 || size < m_literalSpoolThreshold)
+        return false;
+    if (!currentLine.startsWith("* ") || currentLine.indexOf(" FETCH (") == -1)
+        return false;
+    // The literal has to immediately follow the "BODY[...] " or "BINARY[...] " identifier
+    if (literalStart < 2 || currentLine[literalStart - 1] != ' ' || currentLine[literalStart - 2] != ']')
+        return false;
+    int bracket = currentLine.lastIndexOf('[', literalStart - 2);
+    if (bracket == -1)
+        return false;
+    const QByteArray prefix = currentLine.mid(0, bracket).toUpper();
+    return prefix.endsWith(" BODY") || prefix.endsWith("(BODY") || prefix.endsWith(" BINARY") || prefix.endsWith("(BINARY");
+}
+
+void Parser::scheduleExecuteCommands()
+{
+    if (m_executeCommandsScheduled)
+        return;
+    m_executeCommandsScheduled = true;
+    QTimer::singleShot(0, this, SLOT(executeCommands()));
+}
+
+/** @short Send everything which can be sent right now
+
+All commands which are not blocked by a synchronizing literal, IDLE, STARTTLS or COMPRESS are serialized into a single
+buffer and passed to the socket through a single write, so that a burst of commands doesn't end up as a sequence of
+tiny TLS records or DEFLATE sync points.
+*/
 void Parser::executeCommands()
 {
+    m_executeCommandsScheduled = false;
     while (! waitingForContinuation && ! waitForInitialIdle &&
            ! waitingForConnection && ! waitingForEncryption && ! waitingForSslPolicy &&
            ! cmdQueue.isEmpty() && ! startTlsInProgress && !compressDeflateInProgress)
         executeACommand();
+    if (!m_corkedOutput.isEmpty()) {
+        socket->write(m_corkedOutput);
+        m_corkedOutput.clear();
+    }
 }
 
 void Parser::finishStartTls()
@@ -765,7 +846,7 @@ void Parser::handleSocketEncrypted()
 #endif
     emit lineReceived(this, buf);
     handleReadyRead();
-    queueResponse(resp);
+    queueResponseAfterPendingLines(resp);
     executeCommands();
 }
 
@@ -809,7 +890,7 @@ void Parser::executeACommand()
 #ifdef PRINT_TRAFFIC_TX
         qDebug() << m_parserId << ">>>" << buf.left(PRINT_TRAFFIC_TX).trimmed();
 #endif
-        socket->write(buf);
+        m_corkedOutput.append(buf);
         idling = false;
         cmdQueue.pop_front();
         emit lineSent(this, buf);
@@ -853,7 +934,7 @@ void Parser::executeACommand()
                 else
                     qDebug() << m_parserId << ">>> [sensitive command] -- added literal";
 #endif
-                socket->write(buf);
+                m_corkedOutput.append(buf);
                 part.numberSent = true;
                 waitingForContinuation = true;
                 Q_ASSERT(literalCommandTag.isEmpty());
@@ -871,7 +952,7 @@ void Parser::executeACommand()
 #ifdef PRINT_TRAFFIC_TX
             qDebug() << m_parserId << ">>>" << buf.left(PRINT_TRAFFIC_TX).trimmed();
 #endif
-            socket->write(buf);
+            m_corkedOutput.append(buf);
             idling = true;
             waitForInitialIdle = true;
             cmdQueue.pop_front();
@@ -884,7 +965,7 @@ void Parser::executeACommand()
 #ifdef PRINT_TRAFFIC_TX
             qDebug() << m_parserId << ">>>" << buf.left(PRINT_TRAFFIC_TX).trimmed();
 #endif
-            socket->write(buf);
+            m_corkedOutput.append(buf);
             startTlsInProgress = true;
             emit lineSent(this, buf);
             return;
@@ -895,7 +976,7 @@ void Parser::executeACommand()
 #ifdef PRINT_TRAFFIC_TX
             qDebug() << m_parserId << ">>>" << buf.left(PRINT_TRAFFIC_TX).trimmed();
 #endif
-            socket->write(buf);
+            m_corkedOutput.append(buf);
             compressDeflateInProgress = true;
             cmdQueue.pop_front();
             emit lineSent(this, buf);
@@ -911,7 +992,7 @@ void Parser::executeACommand()
             else
                 qDebug() << m_parserId << ">>> [sensitive command]";
 #endif
-            socket->write(buf);
+            m_corkedOutput.append(buf);
             cmdQueue.pop_front();
             emit lineSent(this, sensitiveCommand ? privateMessage : buf);
             break;
@@ -939,26 +1020,114 @@ void Parser::processLine(QByteArray line)
     emit lineReceived(this, line);
     if (m_expectsInitialGreeting && !line.startsWith("* ")) {
         throw NotAnImapServerError(std::string(), line, -1);
-    } else if (line.startsWith("* ")) {
-        m_expectsInitialGreeting = false;
-        queueResponse(parseUntagged(line));
     } else if (line.startsWith("+ ")) {
         if (waitingForContinuation) {
             waitingForContinuation = false;
             literalCommandTag.clear();
-            QTimer::singleShot(0, this, SLOT(executeCommands()));
+            scheduleExecuteCommands();
         } else if (waitForInitialIdle) {
             waitForInitialIdle = false;
-            QTimer::singleShot(0, this, SLOT(executeCommands()));
+            scheduleExecuteCommands();
         } else {
             throw ContinuationRequest(line.constData());
         }
+        return;
+    }
+
+    if (line.startsWith("* ")) {
+        m_expectsInitialGreeting = false;
+    } else {
+        // The rest of the data might be compressed already, so this cannot wait for the worker thread
+        handleCompressDeflateReply(line);
+    }
+
+    if (m_parsingThread) {
+        PendingLine item;
+        item.line = line;
+        item.spooledLiterals = m_spooledLiterals;
+        sendToWorker(item);
+    } else {
+        queueResponse(parseLine(line, m_spooledLiterals));
+    }
+}
+
+QSharedPointer<Responses::AbstractResponse> Parser::parseLine(const QByteArray &line,
+                                                              const QList<QSharedPointer<LiteralSink> > &spooledLiterals)
+{
+    if (line.startsWith("* "))
+        return parseUntagged(line, spooledLiterals);
+    else
+        return parseTagged(line);
+}
+
+void Parser::enableParsingInThread()
+{
+    if (m_parsingThread)
+        return;
+
+    m_parsingThread = new QThread(this);
+    m_parsingThread->setObjectName(QStringLiteral("Parser-%1").arg(m_parserId));
+    m_parsingWorker = new Common::PostedEventHandler([this]() { this->parsePendingLines(); });
+    m_parsingWorker->moveToThread(m_parsingThread);
+    m_parsingNotifier = new Common::PostedEventHandler([this]() { this->takeParsedResponses(); });
+    m_parsingNotifier->setParent(this);
+    m_parsingThread->start();
+}
+
+void Parser::sendToWorker(const PendingLine &item)
+{
+    Q_ASSERT(m_parsingThread);
+    ++m_linesInWorker;
+    m_linesToParse.push(item);
+    if (!m_parsingWorkerScheduled.exchange(true))
+        m_parsingWorker->schedule();
+}
+
+void Parser::parsePendingLines()
+{
+    // Reset the flag before looking at the queue so that no item can get stuck there without a wakeup
+    m_parsingWorkerScheduled = false;
+    PendingLine item;
+    while (m_linesToParse.pop(item)) {
+        QSharedPointer<Responses::AbstractResponse> resp = item.response;
+        if (!resp) {
+            try {
+                resp = parseLine(item.line, item.spooledLiterals);
+            } catch (ImapException &e) {
+                resp = QSharedPointer<Responses::AbstractResponse>(new Responses::ParseErrorResponse(e));
+            }
+        }
+        item = PendingLine();
+        m_parsedResponses.push(resp);
+        if (!m_parsingNotifierScheduled.exchange(true))
+            m_parsingNotifier->schedule();
+    }
+}
+
+void Parser::takeParsedResponses()
+{
+    m_parsingNotifierScheduled = false;
+    QSharedPointer<Responses::AbstractResponse> resp;
+    while (m_parsedResponses.pop(resp)) {
+        Q_ASSERT(m_linesInWorker > 0);
+        --m_linesInWorker;
+        queueResponse(resp);
+    }
+}
+
+void Parser::queueResponseAfterPendingLines(const QSharedPointer<Responses::AbstractResponse> &resp)
+{
+    if (m_linesInWorker) {
+        PendingLine item;
+        item.response = resp;
+        sendToWorker(item);
     } else {
-        queueResponse(parseTagged(line));
+        queueResponse(resp);
     }
 }
 
-QSharedPointer<Responses::AbstractResponse> Parser::parseUntagged(const QByteArray &line)
+QSharedPointer<Responses::AbstractResponse> Parser::parseUntagged(const QByteArray &line,
+                                                                  const QList<QSharedPointer<LiteralSink> > &spooledLiterals)
 {
     int pos = 2;
     LowLevelParser::eatSpaces(line, pos);
@@ -969,11 +1138,11 @@ QSharedPointer<Responses::AbstractResponse> Parser::parseUntagged(const QByteArr
     } catch (ParseError &) {
         return parseUntaggedText(line, pos);
     }
-    return parseUntaggedNumber(line, pos, number);
+    return parseUntaggedNumber(line, pos, number, spooledLiterals);
 }
 
 QSharedPointer<Responses::AbstractResponse> Parser::parseUntaggedNumber(
-    const QByteArray &line, int &start, const uint number)
+    const QByteArray &line, int &start, const uint number, const QList<QSharedPointer<LiteralSink> > &spooledLiterals)
 {
     if (start == line.size())
         // number and nothing else
@@ -1007,7 +1176,7 @@ QSharedPointer<Responses::AbstractResponse> Parser::parseUntaggedNumber(
 
     case Responses::FETCH:
         return QSharedPointer<Responses::AbstractResponse>(
-                   new Responses::Fetch(number, line, start));
+                   new Responses::Fetch(number, line, start, spooledLiterals));
         break;
 
     default:
@@ -1108,38 +1277,42 @@ QSharedPointer<Responses::AbstractResponse> Parser::parseTagged(const QByteArray
     const Responses::Kind kind = Responses::kindFromString(LowLevelParser::getAtom(line, pos));
     ++pos;
 
-    if (compressDeflateInProgress && compressDeflateCommand == tag + ' ') {
-        switch (kind) {
-        case Responses::OK:
-            socket->startDeflate();
-            compressDeflateInProgress = false;
-            compressDeflateCommand.clear();
-            break;
-        default:
-            // do nothing
-            break;
-        }
-        compressDeflateInProgress = false;
-        compressDeflateCommand.clear();
-        QTimer::singleShot(0, this, SLOT(handleCompressionPossibleActivated()));
-    }
-
     return QSharedPointer<Responses::AbstractResponse>(
                new Responses::State(tag, kind, line, pos));
 }
 
+void Parser::handleCompressDeflateReply(const QByteArray &line)
+{
+    if (!compressDeflateInProgress || !line.startsWith(compressDeflateCommand))
+        return;
+
+    int pos = compressDeflateCommand.size();
+    const Responses::Kind kind = Responses::kindFromString(LowLevelParser::getAtom(line, pos));
+    if (kind == Responses::OK) {
+        socket->startDeflate();
+    }
+    compressDeflateInProgress = false;
+    compressDeflateCommand.clear();
+    QTimer::singleShot(0, this, SLOT(handleCompressionPossibleActivated()));
+}
+
 void Parser::enableLiteralPlus(const LiteralPlus mode)
 {
     m_literalPlus = mode;
 }
 
+void Parser::setLiteralSpoolThreshold(const qint64 bytes)
+{
+    m_literalSpoolThreshold = bytes;
+}
+
 void Parser::handleDisconnected(const QString &reason)
 {
     emit lineReceived(this, "*** Socket disconnected: " + reason.toUtf8());
 #ifdef PRINT_TRAFFIC_TX
     qDebug() << m_parserId << "*** Socket disconnected";
 #endif
-    queueResponse(QSharedPointer<Responses::AbstractResponse>(new Responses::SocketDisconnectedResponse(reason)));
+    queueResponseAfterPendingLines(QSharedPointer<Responses::AbstractResponse>(new Responses::SocketDisconnectedResponse(reason)));
 }
 
 Parser::~Parser()
@@ -1149,6 +1322,13 @@ Parser::~Parser()
     // been already destroyed!
     socket->disconnect(this);
     socket->close();
+
+    if (m_parsingThread) {
+        // The worker calls our member functions, so it has to be gone before anything else gets destroyed
+        m_parsingThread->quit();
+        m_parsingThread->wait();
+        delete m_parsingWorker;
+    }
 }
 
 uint Parser::parserId() const
@@ -1164,7 +1344,7 @@ void Parser::slotSocketStateChanged(const Imap::ConnectionState connState, const
 #endif
         emit lineReceived(this, "*** Connection established");
         waitingForConnection = false;
-        QTimer::singleShot(0, this, SLOT(executeCommands()));
+        scheduleExecuteCommands();
     } else if (connState == CONN_STATE_AUTHENTICATED) {
         // unit tests: don't wait for the initial untagged response greetings
         m_expectsInitialGreeting = false;
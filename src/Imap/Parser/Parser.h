@@ -21,6 +21,7 @@
 */
 #ifndef IMAP_PARSER_H
 #define IMAP_PARSER_H
+#include <atomic>
 #include <QLinkedList>
 #include <QSharedPointer>
 #include "Command.h"
@@ -28,6 +29,7 @@
 #include "Sequence.h"
 #include "../ConnectionState.h"
 #include "../Exceptions.h"
+#include "Common/SpscQueue.h"
 #include "Imap/Model/CatenateData.h"
 #include "Imap/Model/UidSubmitData.h"
 
@@ -38,8 +40,15 @@
  * @author Jan Kundrát <jkt@flaska.net>
  */
 
+class QThread;
+
+class ImapParserBenchmark;
 class ImapParserParseTest;
 
+namespace Common {
+class PostedEventHandler;
+}
+
 namespace Streams {
 class Socket;
 }
@@ -48,6 +57,8 @@ class Socket;
 namespace Imap
 {
 
+class LiteralSink;
+
 /** @short A handle identifying a command sent to the server */
 typedef QByteArray CommandHandle;
 
@@ -59,6 +70,7 @@ class Parser : public QObject
 {
     Q_OBJECT
 
+    friend class ::ImapParserBenchmark;
     friend class ::ImapParserParseTest;
 
 public:
@@ -85,6 +97,23 @@ public:
     /** @short Enable/Disable sending literals using the LITERAL+ extension */
     void enableLiteralPlus(const LiteralPlus mode);
 
+    /** @short Stream BODY[] and BINARY[] literals of at least @arg bytes into a LiteralSink
+
+    Literals which are smaller than this threshold are kept in memory as usual. Zero disables the spooling.
+    */
+    void setLiteralSpoolThreshold(const qint64 bytes);
+
+    /** @short Parse the received lines in a dedicated thread
+
+    The socket is still read in the thread which owns this Parser because the commands are written from there, too, but
+    turning the received lines into Responses::AbstractResponse instances happens in a worker thread. The parsed responses
+    are delivered back in their original order and become available through getResponse() and the responseReceived()
+    signal as usual, just a bit later. Huge FETCH responses therefore no longer block the GUI while they are being parsed.
+
+    This cannot be turned off again.
+    */
+    void enableParsingInThread();
+
     uint parserId() const;
 
 public slots:
@@ -298,6 +327,12 @@ signals:
     */
     void lineReceived(Imap::Parser *parser, const QByteArray &line);
 
+    /** @short A literal of @arg size bytes was received into a LiteralSink
+
+    The payload of such a literal is not a part of the line which gets reported through lineReceived().
+    */
+    void spooledLiteralReceived(Imap::Parser *parser, const qint64 size);
+
     /** @short A full line has been sent to the remote IMAP server */
     void lineSent(Imap::Parser *parser, const QByteArray &line);
 
@@ -308,7 +343,8 @@ signals:
     */
     void parserWarning(Imap::Parser *parser, const QString &message, const QByteArray *line, uint position);
 
-    void commandQueued();
+    /** @short A command identified by @arg tag has been queued for sending */
+    void commandQueued(Imap::Parser *parser, const Imap::CommandHandle &tag);
 
     /** @short The socket's state has changed */
     void connectionStateChanged(Imap::Parser *parser, Imap::ConnectionState);
@@ -336,9 +372,15 @@ private:
         return queueCommand(Commands::Command() << Commands::PartOfCommand(kind, text));
     };
 
+    /** @short Make sure that executeCommands() gets called once the control returns to the event loop */
+    void scheduleExecuteCommands();
+
     /** @short Helper for handleReadyRead() -- actually read & parse the data */
     void reallyReadLine();
 
+    /** @short Check whether the literal starting at @arg literalStart shall be streamed into a LiteralSink */
+    bool shouldSpoolLiteral(const int literalStart, const qint64 size) const;
+
     /** @short Helper for search() and uidSearch() */
     CommandHandle searchHelper(const QByteArray &command, const QStringList &criteria,
                                const QByteArray &charset = QByteArray());
@@ -351,15 +393,25 @@ private:
 
     void processLine(QByteArray line);
 
+    /** @short Parse a complete tagged or untagged line along with its @arg spooledLiterals */
+    QSharedPointer<Responses::AbstractResponse> parseLine(const QByteArray &line,
+                                                           const QList<QSharedPointer<LiteralSink> > &spooledLiterals);
+
+    /** @short Enable the compression if @arg line is the server's reply to the COMPRESS DEFLATE command */
+    void handleCompressDeflateReply(const QByteArray &line);
+
     /** @short Parse line for untagged reply */
-    QSharedPointer<Responses::AbstractResponse> parseUntagged(const QByteArray &line);
+    QSharedPointer<Responses::AbstractResponse> parseUntagged(
+        const QByteArray &line,
+        const QList<QSharedPointer<LiteralSink> > &spooledLiterals = QList<QSharedPointer<LiteralSink> >());
 
     /** @short Parse line for tagged reply */
     QSharedPointer<Responses::AbstractResponse> parseTagged(const QByteArray &line);
 
     /** @short helper for parseUntagged() */
     QSharedPointer<Responses::AbstractResponse> parseUntaggedNumber(
-        const QByteArray &line, int &start, const uint number);
+        const QByteArray &line, int &start, const uint number,
+        const QList<QSharedPointer<LiteralSink> > &spooledLiterals);
 
     /** @short helper for parseUntagged() */
     QSharedPointer<Responses::AbstractResponse> parseUntaggedText(
@@ -368,6 +420,25 @@ private:
     /** @short Add parsed response to the internal queue, emit notification signal */
     void queueResponse(const QSharedPointer<Responses::AbstractResponse> &resp);
 
+    /** @short Like queueResponse(), but make sure that @arg resp doesn't overtake the lines being parsed in the worker */
+    void queueResponseAfterPendingLines(const QSharedPointer<Responses::AbstractResponse> &resp);
+
+    /** @short A line waiting for the worker thread, or an already finished response which has to keep its place */
+    struct PendingLine {
+        QByteArray line;
+        QList<QSharedPointer<LiteralSink> > spooledLiterals;
+        QSharedPointer<Responses::AbstractResponse> response;
+    };
+
+    /** @short Pass @arg item to the worker thread */
+    void sendToWorker(const PendingLine &item);
+
+    /** @short Parse everything which has been sent to the worker; called from the worker thread */
+    void parsePendingLines();
+
+    /** @short Queue the responses which were parsed by the worker */
+    void takeParsedResponses();
+
     /** @short Connection to the IMAP server */
     Streams::Socket *socket;
 
@@ -392,10 +463,14 @@ private:
     bool waitingForSslPolicy;
     bool m_expectsInitialGreeting;
 
-    enum { ReadingLine, ReadingNumberOfBytes } readingMode;
+    enum { ReadingLine, ReadingNumberOfBytes, ReadingSpooledLiteral } readingMode;
     QByteArray currentLine;
     int oldLiteralPosition;
     uint readingBytes;
+    /** @short Minimal size of a BODY[]/BINARY[] literal which gets streamed into a LiteralSink */
+    qint64 m_literalSpoolThreshold;
+    /** @short Literals of the currentLine which were streamed into sinks instead of the line itself */
+    QList<QSharedPointer<LiteralSink> > m_spooledLiterals;
     QByteArray startTlsCommand;
     QByteArray startTlsReply;
     QByteArray compressDeflateCommand;
@@ -403,6 +478,26 @@ private:
 
     /** @short Unique-id for debugging purposes */
     uint m_parserId;
+
+    /** @short The worker thread for parsing, if enabled */
+    QThread *m_parsingThread;
+    /** @short Helper living in the m_parsingThread which runs parsePendingLines() */
+    Common::PostedEventHandler *m_parsingWorker;
+    /** @short Helper living in our own thread which runs takeParsedResponses() */
+    Common::PostedEventHandler *m_parsingNotifier;
+    /** @short Lines on their way to the worker thread */
+    Common::SpscQueue<PendingLine> m_linesToParse;
+    /** @short Responses on their way back from the worker thread */
+    Common::SpscQueue<QSharedPointer<Responses::AbstractResponse> > m_parsedResponses;
+    std::atomic<bool> m_parsingWorkerScheduled;
+    std::atomic<bool> m_parsingNotifierScheduled;
+    /** @short Number of items which were sent to the worker and haven't been taken back yet */
+    int m_linesInWorker;
+
+    /** @short Is there a pending call to executeCommands()? */
+    bool m_executeCommandsScheduled;
+    /** @short Data produced by executeACommand() which will be written to the socket at the end of executeCommands() */
+    QByteArray m_corkedOutput;
 };
 
 QTextStream &operator<<(QTextStream &stream, const Sequence &s);
@@ -22,6 +22,7 @@
 #include <typeinfo>
 #include <QSslError>
 #include "Response.h"
+#include "LiteralSink.h"
 #include "Message.h"
 #include "LowLevelParser.h"
 #include "../Model/Model.h"
@@ -859,7 +860,36 @@ QDateTime Fetch::dateify(QByteArray str, const QByteArray &line, const int start
     return date;
 }
 
-Fetch::Fetch(const uint number, const QByteArray &line, int &start): number(number)
+namespace {
+const char spooledLiteralPrefix[] = "~[spooled-literal ";
+const int spooledLiteralPrefixLength = sizeof(spooledLiteralPrefix) - 1;
+}
+
+QByteArray Fetch::spooledLiteralPlaceholder(const int index)
+{
+    return spooledLiteralPrefix + QByteArray::number(index) + ']';
+}
+
+QByteArray Fetch::payload(const AbstractData &item)
+{
+    if (const RespData<QSharedPointer<LiteralSink> > *spooled = dynamic_cast<const RespData<QSharedPointer<LiteralSink> > *>(&item)) {
+        return spooled->data->readAll();
+    } else {
+        return static_cast<const RespData<QByteArray>&>(item).data;
+    }
+}
+
+QSharedPointer<LiteralSink> Fetch::spooledPayload(const AbstractData &item)
+{
+    if (const RespData<QSharedPointer<LiteralSink> > *spooled = dynamic_cast<const RespData<QSharedPointer<LiteralSink> > *>(&item)) {
+        return spooled->data;
+    } else {
+        return QSharedPointer<LiteralSink>();
+    }
+}
+
+Fetch::Fetch(const uint number, const QByteArray &line, int &start, const QList<QSharedPointer<LiteralSink> > &spooledLiterals):
+    number(number)
 {
     ++start;
 
@@ -915,21 +945,27 @@ Fetch::Fetch(const uint number, const QByteArray &line, int &start): number(numb
         } else if (identifier == "RFC822.SIZE") {
             data[identifier] = QSharedPointer<AbstractData>(new RespData<quint64>(LowLevelParser::getUInt64(line, start)));
         } else if (identifier.startsWith("BODY[") || identifier.startsWith("BINARY[") || identifier.startsWith("RFC822")) {
-            data[identifier] = QSharedPointer<AbstractData>(new RespData<QByteArray>(LowLevelParser::getNString(line, start).first));
+            if (!spooledLiterals.isEmpty() && line.size() > start + spooledLiteralPrefixLength
+                    && qstrncmp(line.constData() + start, spooledLiteralPrefix, spooledLiteralPrefixLength) == 0) {
+                // The payload has been streamed into a LiteralSink by the Parser
+                start += spooledLiteralPrefixLength;
+                uint index = LowLevelParser::getUInt(line, start);
+                if (start >= line.size() || line[start] != ']' || index >= static_cast<uint>(spooledLiterals.size()))
+                    throw UnexpectedHere("FETCH: malformed reference to a spooled literal", line, start);
+                ++start;
+                data[identifier] = QSharedPointer<AbstractData>(new RespData<QSharedPointer<LiteralSink> >(spooledLiterals[index]));
+            } else {
+                data[identifier] = QSharedPointer<AbstractData>(new RespData<QByteArray>(LowLevelParser::getNString(line, start).first));
+            }
         } else if (identifier == "ENVELOPE") {
-            QVariantList list = LowLevelParser::parseList('(', ')', line, start);
-            data[identifier] = QSharedPointer<AbstractData>(new RespData<Message::Envelope>(Message::Envelope::fromList(list, line, start)));
+            data[identifier] = QSharedPointer<AbstractData>(new RespData<Message::Envelope>(Message::Envelope::fromLine(line, start)));
         } else if (identifier == "INTERNALDATE") {
             QByteArray buf = LowLevelParser::getNString(line, start).first;
             data[identifier] = QSharedPointer<AbstractData>(new RespData<QDateTime>(dateify(buf, line, start)));
         } else if (identifier == "BODY" || identifier == "BODYSTRUCTURE") {
-            QVariantList list = LowLevelParser::parseList('(', ')', line, start);
-            data[identifier] = Message::AbstractMessage::fromList(list, line, start);
-            QByteArray buffer;
-            QDataStream stream(&buffer, QIODevice::WriteOnly);
-            stream.setVersion(QDataStream::Qt_4_6);
-            stream << list;
-            data["x-trojita-bodystructure"] = QSharedPointer<AbstractData>(new RespData<QByteArray>(buffer));
+            QSharedPointer<Message::AbstractMessage> body = Message::AbstractMessage::fromLine(line, start);
+            data[identifier] = body;
+            data["x-trojita-bodystructure"] = QSharedPointer<AbstractData>(new RespData<QByteArray>(body->serialize()));
         } else {
             // Unrecognized identifier, let's treat it as QByteArray so that we don't break needlessly
             data[identifier] = QSharedPointer<AbstractData>(new RespData<QByteArray>(LowLevelParser::getNString(line, start).first));
@@ -1090,7 +1126,7 @@ Vanished::Vanished(const QByteArray &line, int &start): earlier(NOT_EARLIER)
         start += prefixLength + 1; // one for the required space
     }
 
-    uids = LowLevelParser::getSequence(line, start);
+    uids = LowLevelParser::getUidSet(line, start);
 
     if (start != line.size() - 2)
         throw TooMuchData(line, start);
@@ -1288,9 +1324,8 @@ QTextStream &Vanished::dump(QTextStream &s) const
     if (earlier == EARLIER)
         s << "(EARLIER) ";
     s << "(";
-    Q_FOREACH(const uint &uid, uids) {
-        s << " " << uid;
-    }
+    if (!uids.isEmpty())
+        s << uids.toSequenceSet();
     return s << ")";
 }
 
@@ -1354,6 +1389,11 @@ template<> QTextStream &RespData<QPair<uint,QPair<Sequence, Sequence> > >::dump(
     return stream << "UIDVALIDITY " << data.first << " UIDs-1" << data.second.first << " UIDs-2" << data.second.second;
 }
 
+template<> QTextStream &RespData<QSharedPointer<LiteralSink> >::dump(QTextStream &stream) const
+{
+    return stream << "[spooled literal, " << data->size() << " bytes]";
+}
+
 bool RespData<void>::eq(const AbstractData &other) const
 {
     try {
@@ -1365,6 +1405,18 @@ bool RespData<void>::eq(const AbstractData &other) const
     }
 }
 
+/** @short Spooled literals are compared by their contents, and they are equal to a non-spooled literal with the same data */
+template<> bool RespData<QSharedPointer<LiteralSink> >::eq(const AbstractData &other) const
+{
+    if (const RespData<QByteArray> *r = dynamic_cast<const RespData<QByteArray>*>(&other)) {
+        return data->readAll() == r->data;
+    } else if (const RespData<QSharedPointer<LiteralSink> > *r = dynamic_cast<const RespData<QSharedPointer<LiteralSink> >*>(&other)) {
+        return data == r->data || data->readAll() == r->data->readAll();
+    } else {
+        return false;
+    }
+}
+
 template<class T> bool RespData<T>::eq(const AbstractData &other) const
 {
     try {
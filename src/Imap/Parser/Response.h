@@ -33,6 +33,7 @@
 #include "../Exceptions.h"
 #include "Data.h"
 #include "ThreadingNode.h"
+#include "UidSet.h"
 #include "Uids.h"
 
 class QSslCertificate;
@@ -55,6 +56,7 @@ class Model;
 class ImapTask;
 }
 
+class LiteralSink;
 class Parser;
 
 /** @short IMAP server responses
@@ -558,12 +560,26 @@ public:
     /** @short Fetched items */
     dataType data;
 
-    Fetch(const uint number, const QByteArray &line, int &start);
+    Fetch(const uint number, const QByteArray &line, int &start,
+          const QList<QSharedPointer<LiteralSink> > &spooledLiterals = QList<QSharedPointer<LiteralSink> >());
     Fetch(const uint number, const dataType &data);
     virtual QTextStream &dump(QTextStream &s) const;
     virtual bool eq(const AbstractResponse &other) const;
     virtual void plug(Imap::Parser *parser, Imap::Mailbox::Model *model) const;
     virtual bool plug(Imap::Mailbox::ImapTask *task) const;
+
+    /** @short Text which the Parser puts into the line in place of a literal which got streamed into a LiteralSink
+
+    The @arg index refers to the list of spooled literals which is passed to the constructor. The BODY[] and BINARY[]
+    items which refer to a spooled literal are stored as a RespData<QSharedPointer<LiteralSink> > instead of the usual
+    RespData<QByteArray>.
+    */
+    static QByteArray spooledLiteralPlaceholder(const int index);
+
+    /** @short Return the payload of a BODY[] or BINARY[] item, no matter whether it has been spooled or not */
+    static QByteArray payload(const AbstractData &item);
+    /** @short Return the LiteralSink of a spooled BODY[] or BINARY[] item, or a null pointer if it has not been spooled */
+    static QSharedPointer<LiteralSink> spooledPayload(const AbstractData &item);
 private:
     static QDateTime dateify(QByteArray str, const QByteArray &line, const int start);
 };
@@ -629,9 +645,11 @@ class Vanished: public AbstractResponse
 public:
     typedef enum {EARLIER, NOT_EARLIER} EarlierOrNow;
     EarlierOrNow earlier;
-    Uids uids;
+    /** @short The removed UIDs; a VANISHED (EARLIER) might easily cover millions of them */
+    UidSet uids;
     Vanished(const QByteArray &line, int &start);
-    Vanished(EarlierOrNow earlier, const Uids &uids): earlier(earlier), uids(uids) {}
+    Vanished(EarlierOrNow earlier, const UidSet &uids): earlier(earlier), uids(uids) {}
+    Vanished(EarlierOrNow earlier, const Uids &uids): earlier(earlier), uids(UidSet::fromVector(uids)) {}
     virtual QTextStream &dump(QTextStream &s) const;
     virtual bool eq(const AbstractResponse &other) const;
     virtual void plug(Imap::Parser *parser, Imap::Mailbox::Model *model) const;
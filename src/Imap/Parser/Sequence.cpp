@@ -21,7 +21,6 @@
 */
 
 #include "Sequence.h"
-#include <QStringList>
 #include <QTextStream>
 
 namespace Imap
@@ -29,7 +28,7 @@ namespace Imap
 
 Sequence::Sequence(const uint num): kind(DISTINCT)
 {
-    numbers << num;
+    numbers.insert(num);
 }
 
 Sequence Sequence::startingAt(const uint lo)
@@ -44,26 +43,8 @@ QByteArray Sequence::toByteArray() const
 {
     switch (kind) {
     case DISTINCT:
-    {
         Q_ASSERT(! numbers.isEmpty());
-
-        QStringList res;
-        int i = 0;
-        while (i < numbers.size()) {
-            int old = i;
-            while (i < numbers.size() - 1 &&
-                   numbers[i] == numbers[ i + 1 ] - 1)
-                ++i;
-            if (old != i) {
-                // we've found a sequence
-                res << QString::number(numbers[old]) + QLatin1Char(':') + QString::number(numbers[i]);
-            } else {
-                res << QString::number(numbers[i]);
-            }
-            ++i;
-        }
-        return res.join(QStringLiteral(",")).toLocal8Bit();
-    }
+        return numbers.toSequenceSet();
     case RANGE:
         Q_ASSERT(lo <= hi);
         if (lo == hi)
@@ -83,7 +64,7 @@ Imap::Uids Sequence::toVector() const
     switch (kind) {
     case DISTINCT:
         Q_ASSERT(!numbers.isEmpty());
-        return numbers;
+        return numbers.toVector();
     case RANGE:
         Q_ASSERT(lo <= hi);
         if (lo == hi) {
@@ -105,20 +86,21 @@ Imap::Uids Sequence::toVector() const
 Sequence &Sequence::add(uint num)
 {
     Q_ASSERT(kind == DISTINCT);
-    auto it = qLowerBound(numbers.begin(), numbers.end(), num);
-    if (it == numbers.end() || *it != num)
-        numbers.insert(it, num);
+    numbers.insert(num);
     return *this;
 }
 
-Sequence Sequence::fromVector(Imap::Uids numbers)
+Sequence Sequence::fromVector(const Imap::Uids &numbers)
 {
     Q_ASSERT(!numbers.isEmpty());
-    qSort(numbers);
-    Sequence seq(numbers.first());
-    for (int i = 1; i < numbers.size(); ++i) {
-        seq.add(numbers[i]);
-    }
+    return fromUidSet(Imap::UidSet::fromVector(numbers));
+}
+
+Sequence Sequence::fromUidSet(const Imap::UidSet &numbers)
+{
+    Q_ASSERT(!numbers.isEmpty());
+    Sequence seq;
+    seq.numbers = numbers;
     return seq;
 }
 
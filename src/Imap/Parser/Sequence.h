@@ -24,6 +24,7 @@
 #define IMAP_PARSER_SEQUENCE_H
 
 #include <QString>
+#include "Imap/Parser/UidSet.h"
 #include "Imap/Parser/Uids.h"
 
 /** @short Namespace for IMAP interaction */
@@ -39,7 +40,7 @@ namespace Imap
 class Sequence
 {
     uint lo, hi;
-    Imap::Uids numbers;
+    Imap::UidSet numbers;
     enum { DISTINCT, RANGE, UNLIMITED } kind;
 public:
     /** @short Construct an invalid sequence */
@@ -82,7 +83,10 @@ public:
     Imap::Uids toVector() const;
 
     /** @short Create a sequence from a list of numbers */
-    static Sequence fromVector(Imap::Uids numbers);
+    static Sequence fromVector(const Imap::Uids &numbers);
+
+    /** @short Create a sequence from a set of numbers which is not empty */
+    static Sequence fromUidSet(const Imap::UidSet &numbers);
 
     /** @short Return true if the sequence contains at least some items */
     bool isValid() const;
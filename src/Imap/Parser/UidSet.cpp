@@ -0,0 +1,665 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <bitset>
+#include "UidSet.h"
+
+namespace {
+
+const int bitmapWords = 65536 / 64;
+/** @short A chunk with more ranges than this is smaller when stored as a bitmap */
+const int maxRuns = bitmapWords * sizeof(quint64) / (2 * sizeof(quint16));
+
+int popCount(const quint64 word)
+{
+#if defined(Q_CC_GNU)
+    return __builtin_popcountll(word);
+#else
+    return static_cast<int>(std::bitset<64>(word).count());
+#endif
+}
+
+int countTrailingZeros(quint64 word)
+{
+    Q_ASSERT(word);
+#if defined(Q_CC_GNU)
+    return __builtin_ctzll(word);
+#else
+    int res = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        ++res;
+    }
+    return res;
+#endif
+}
+
+void appendVarint(QByteArray &out, quint32 value)
+{
+    while (value >= 0x80) {
+        out.append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+bool readVarint(const QByteArray &in, int &pos, quint32 &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (pos >= in.size())
+            return false;
+        const quint32 byte = static_cast<uchar>(in[pos++]);
+        if (shift == 28 && (byte & 0x70))
+            return false;
+        value |= (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool parseNumber(const QByteArray &data, int &pos, uint &number)
+{
+    const int start = pos;
+    quint64 value = 0;
+    while (pos < data.size() && data[pos] >= '0' && data[pos] <= '9') {
+        value = value * 10 + (data[pos] - '0');
+        if (value > 0xffffffffULL)
+            return false;
+        ++pos;
+    }
+    number = static_cast<uint>(value);
+    return pos != start;
+}
+
+}
+
+namespace Imap {
+
+UidSet::Container::Container(const quint16 key): key(key), cardinality(0)
+{
+}
+
+bool UidSet::Container::contains(const quint16 low) const
+{
+    if (isBitmap())
+        return bitmap[low >> 6] & (quint64(1) << (low & 63));
+    auto it = std::upper_bound(runs.begin(), runs.end(), low, [](const quint16 value, const Run &run) {
+        return value < run.start;
+    });
+    return it != runs.begin() && (it - 1)->last >= low;
+}
+
+void UidSet::Container::insertRange(const quint16 lo, const quint16 hi)
+{
+    Q_ASSERT(lo <= hi);
+    if (isBitmap()) {
+        for (int i = lo; i <= hi; ++i) {
+            quint64 &word = bitmap[i >> 6];
+            const quint64 bit = quint64(1) << (i & 63);
+            if (!(word & bit)) {
+                word |= bit;
+                ++cardinality;
+            }
+        }
+        return;
+    }
+
+    // The first range which overlaps or touches the new one, or which follows it
+    auto first = std::lower_bound(runs.begin(), runs.end(), lo, [](const Run &run, const quint16 value) {
+        return run.last + 1 < value;
+    });
+    int start = lo;
+    int last = hi;
+    int absorbed = 0;
+    auto end = first;
+    while (end != runs.end() && end->start <= last + 1) {
+        start = std::min<int>(start, end->start);
+        last = std::max<int>(last, end->last);
+        absorbed += end->last - end->start + 1;
+        ++end;
+    }
+    const Run merged = {static_cast<quint16>(start), static_cast<quint16>(last)};
+    if (first == end) {
+        runs.insert(first, merged);
+    } else {
+        *first = merged;
+        runs.erase(first + 1, end);
+    }
+    cardinality += last - start + 1 - absorbed;
+    if (static_cast<int>(runs.size()) > maxRuns)
+        switchToBitmap();
+}
+
+void UidSet::Container::unite(const Container &other)
+{
+    if (isBitmap() || other.isBitmap()) {
+        switchToBitmap();
+        if (other.isBitmap()) {
+            for (int i = 0; i < bitmapWords; ++i)
+                bitmap[i] |= other.bitmap[i];
+            cardinality = 0;
+            for (int i = 0; i < bitmapWords; ++i)
+                cardinality += popCount(bitmap[i]);
+        } else {
+            for (const Run &run : other.runs)
+                insertRange(run.start, run.last);
+        }
+        optimize();
+        return;
+    }
+
+    std::vector<Run> merged;
+    merged.reserve(runs.size() + other.runs.size());
+    auto a = runs.cbegin();
+    auto b = other.runs.cbegin();
+    while (a != runs.cend() || b != other.runs.cend()) {
+        const Run next = (b == other.runs.cend() || (a != runs.cend() && a->start < b->start)) ? *a++ : *b++;
+        if (!merged.empty() && merged.back().last + 1 >= next.start) {
+            merged.back().last = std::max(merged.back().last, next.last);
+        } else {
+            merged.push_back(next);
+        }
+    }
+    runs.swap(merged);
+    cardinality = 0;
+    for (const Run &run : runs)
+        cardinality += run.last - run.start + 1;
+    optimize();
+}
+
+void UidSet::Container::subtract(const Container &other)
+{
+    if (isBitmap() || other.isBitmap()) {
+        switchToBitmap();
+        if (other.isBitmap()) {
+            for (int i = 0; i < bitmapWords; ++i)
+                bitmap[i] &= ~other.bitmap[i];
+        } else {
+            for (const Run &run : other.runs) {
+                for (int i = run.start; i <= run.last; ++i)
+                    bitmap[i >> 6] &= ~(quint64(1) << (i & 63));
+            }
+        }
+        cardinality = 0;
+        for (int i = 0; i < bitmapWords; ++i)
+            cardinality += popCount(bitmap[i]);
+        optimize();
+        return;
+    }
+
+    std::vector<Run> remaining;
+    auto b = other.runs.cbegin();
+    for (Run run : runs) {
+        while (b != other.runs.cend() && b->last < run.start)
+            ++b;
+        int start = run.start;
+        auto hole = b;
+        while (hole != other.runs.cend() && hole->start <= run.last) {
+            if (hole->start > start) {
+                const Run piece = {static_cast<quint16>(start), static_cast<quint16>(hole->start - 1)};
+                remaining.push_back(piece);
+            }
+            start = hole->last + 1;
+            if (hole->last >= run.last)
+                break;
+            ++hole;
+        }
+        if (start <= run.last) {
+            const Run piece = {static_cast<quint16>(start), run.last};
+            remaining.push_back(piece);
+        }
+    }
+    runs.swap(remaining);
+    cardinality = 0;
+    for (const Run &run : runs)
+        cardinality += run.last - run.start + 1;
+    // Punching holes into the ranges might have made the bitmap smaller
+    optimize();
+}
+
+int UidSet::Container::runCount() const
+{
+    if (!isBitmap())
+        return static_cast<int>(runs.size());
+    int res = 0;
+    quint64 carry = 0;
+    for (int i = 0; i < bitmapWords; ++i) {
+        // A range starts at each set bit whose lower neighbor is not set
+        res += popCount(bitmap[i] & ~((bitmap[i] << 1) | carry));
+        carry = bitmap[i] >> 63;
+    }
+    return res;
+}
+
+void UidSet::Container::switchToBitmap()
+{
+    if (isBitmap())
+        return;
+    bitmap.assign(bitmapWords, 0);
+    for (const Run &run : runs) {
+        for (int i = run.start; i <= run.last; ++i)
+            bitmap[i >> 6] |= quint64(1) << (i & 63);
+    }
+    std::vector<Run>().swap(runs);
+}
+
+void UidSet::Container::switchToRuns()
+{
+    if (!isBitmap())
+        return;
+    std::vector<Run> res;
+    int i = nextMember(0);
+    while (i != -1) {
+        int last = i;
+        while (last < 65535 && (bitmap[(last + 1) >> 6] & (quint64(1) << ((last + 1) & 63))))
+            ++last;
+        const Run run = {static_cast<quint16>(i), static_cast<quint16>(last)};
+        res.push_back(run);
+        i = last < 65535 ? nextMember(last + 1) : -1;
+    }
+    std::vector<quint64>().swap(bitmap);
+    runs.swap(res);
+}
+
+void UidSet::Container::optimize()
+{
+    // Switching back to the ranges happens a bit later than the other way round so that the representation doesn't
+    // flip back and forth on each change
+    const int runs = runCount();
+    if (isBitmap() && runs <= maxRuns / 2) {
+        switchToRuns();
+    } else if (!isBitmap() && runs > maxRuns) {
+        switchToBitmap();
+    }
+}
+
+int UidSet::Container::nextMember(const int from) const
+{
+    if (from > 65535)
+        return -1;
+    if (!isBitmap()) {
+        auto it = std::lower_bound(runs.begin(), runs.end(), from, [](const Run &run, const int value) {
+            return run.last < value;
+        });
+        if (it == runs.end())
+            return -1;
+        return std::max<int>(from, it->start);
+    }
+    int index = from >> 6;
+    quint64 word = bitmap[index] & (~quint64(0) << (from & 63));
+    while (!word) {
+        if (++index == bitmapWords)
+            return -1;
+        word = bitmap[index];
+    }
+    return index * 64 + countTrailingZeros(word);
+}
+
+template<typename F>
+void UidSet::forEachRange(F f) const
+{
+    bool haveRange = false;
+    uint lo = 0, hi = 0;
+    auto add = [&](const uint start, const uint last) {
+        if (haveRange && hi + 1 == start) {
+            hi = last;
+            return;
+        }
+        if (haveRange)
+            f(lo, hi);
+        lo = start;
+        hi = last;
+        haveRange = true;
+    };
+    for (const Container &c : m_containers) {
+        const uint base = uint(c.key) << 16;
+        if (c.isBitmap()) {
+            int i = c.nextMember(0);
+            while (i != -1) {
+                int last = i;
+                while (last < 65535 && c.contains(last + 1))
+                    ++last;
+                add(base | uint(i), base | uint(last));
+                i = last < 65535 ? c.nextMember(last + 1) : -1;
+            }
+        } else {
+            for (const Run &run : c.runs)
+                add(base | run.start, base | run.last);
+        }
+    }
+    if (haveRange)
+        f(lo, hi);
+}
+
+UidSet::const_iterator::const_iterator(const UidSet *set, const int container):
+    m_set(set), m_container(container), m_value(0)
+{
+    enterContainer();
+}
+
+void UidSet::const_iterator::enterContainer()
+{
+    if (m_container < static_cast<int>(m_set->m_containers.size())) {
+        const Container &c = m_set->m_containers[m_container];
+        m_value = (uint(c.key) << 16) | uint(c.nextMember(0));
+    } else {
+        m_value = 0;
+    }
+}
+
+UidSet::const_iterator &UidSet::const_iterator::operator++()
+{
+    const Container &c = m_set->m_containers[m_container];
+    const int next = c.nextMember((m_value & 0xffff) + 1);
+    if (next == -1) {
+        ++m_container;
+        enterContainer();
+    } else {
+        m_value = (uint(c.key) << 16) | uint(next);
+    }
+    return *this;
+}
+
+UidSet::const_iterator UidSet::const_iterator::operator++(int)
+{
+    const_iterator res = *this;
+    ++*this;
+    return res;
+}
+
+bool UidSet::const_iterator::operator==(const const_iterator &other) const
+{
+    return m_set == other.m_set && m_container == other.m_container && m_value == other.m_value;
+}
+
+UidSet::UidSet()
+{
+}
+
+UidSet UidSet::fromVector(const Imap::Uids &uids)
+{
+    UidSet res;
+    if (std::is_sorted(uids.constBegin(), uids.constEnd())) {
+        for (const uint uid : uids)
+            res.insert(uid);
+    } else {
+        Imap::Uids sorted = uids;
+        std::sort(sorted.begin(), sorted.end());
+        for (const uint uid : sorted)
+            res.insert(uid);
+    }
+    return res;
+}
+
+UidSet UidSet::fromSequenceSet(const QByteArray &sequenceSet, bool *ok)
+{
+    UidSet res;
+    int pos = 0;
+    while (true) {
+        uint lo, hi;
+        if (!parseNumber(sequenceSet, pos, lo))
+            break;
+        hi = lo;
+        if (pos < sequenceSet.size() && sequenceSet[pos] == ':') {
+            ++pos;
+            if (!parseNumber(sequenceSet, pos, hi))
+                break;
+        }
+        // RFC 3501 allows the range to be specified in the reverse order, too
+        res.insertRange(std::min(lo, hi), std::max(lo, hi));
+        if (pos == sequenceSet.size()) {
+            if (ok)
+                *ok = true;
+            return res;
+        }
+        if (sequenceSet[pos] != ',')
+            break;
+        ++pos;
+    }
+    if (ok)
+        *ok = false;
+    return UidSet();
+}
+
+UidSet UidSet::fromCompactByteArray(const QByteArray &data, bool *ok)
+{
+    UidSet res;
+    int pos = 0;
+    quint64 previous = 0;
+    bool first = true;
+    while (pos < data.size()) {
+        quint32 gap, length;
+        if (!readVarint(data, pos, gap) || !readVarint(data, pos, length)) {
+            if (ok)
+                *ok = false;
+            return UidSet();
+        }
+        const quint64 lo = first ? gap : previous + gap;
+        const quint64 hi = lo + length;
+        if (hi > 0xffffffffULL || (!first && gap < 2)) {
+            if (ok)
+                *ok = false;
+            return UidSet();
+        }
+        res.insertRange(static_cast<uint>(lo), static_cast<uint>(hi));
+        previous = hi;
+        first = false;
+    }
+    if (ok)
+        *ok = true;
+    return res;
+}
+
+void UidSet::insert(const uint uid)
+{
+    insertRange(uid, uid);
+}
+
+void UidSet::insertRange(const uint lo, const uint hi)
+{
+    Q_ASSERT(lo <= hi);
+    for (uint key = lo >> 16; key <= hi >> 16; ++key) {
+        const quint16 from = key == lo >> 16 ? lo & 0xffff : 0;
+        const quint16 to = key == hi >> 16 ? hi & 0xffff : 0xffff;
+        findOrCreate(key)->insertRange(from, to);
+        if (key == 0xffff)
+            break;
+    }
+}
+
+bool UidSet::contains(const uint uid) const
+{
+    const quint16 key = uid >> 16;
+    auto it = std::lower_bound(m_containers.begin(), m_containers.end(), key, [](const Container &c, const quint16 key) {
+        return c.key < key;
+    });
+    return it != m_containers.end() && it->key == key && it->contains(uid & 0xffff);
+}
+
+UidSet &UidSet::unite(const UidSet &other)
+{
+    for (const Container &c : other.m_containers) {
+        auto it = findOrCreate(c.key);
+        if (it->cardinality == 0) {
+            *it = c;
+        } else {
+            it->unite(c);
+        }
+    }
+    return *this;
+}
+
+UidSet &UidSet::subtract(const UidSet &other)
+{
+    auto b = other.m_containers.cbegin();
+    for (auto a = m_containers.begin(); a != m_containers.end(); ++a) {
+        while (b != other.m_containers.cend() && b->key < a->key)
+            ++b;
+        if (b == other.m_containers.cend())
+            break;
+        if (b->key == a->key)
+            a->subtract(*b);
+    }
+    m_containers.erase(std::remove_if(m_containers.begin(), m_containers.end(), [](const Container &c) {
+        return c.cardinality == 0;
+    }), m_containers.end());
+    return *this;
+}
+
+bool UidSet::isEmpty() const
+{
+    return m_containers.empty();
+}
+
+quint64 UidSet::size() const
+{
+    quint64 res = 0;
+    for (const Container &c : m_containers)
+        res += c.cardinality;
+    return res;
+}
+
+uint UidSet::first() const
+{
+    Q_ASSERT(!isEmpty());
+    return *begin();
+}
+
+uint UidSet::last() const
+{
+    Q_ASSERT(!isEmpty());
+    const Container &c = m_containers.back();
+    if (!c.isBitmap())
+        return (uint(c.key) << 16) | c.runs.back().last;
+    int index = bitmapWords - 1;
+    while (!c.bitmap[index])
+        --index;
+    int bit = 63;
+    while (!(c.bitmap[index] & (quint64(1) << bit)))
+        --bit;
+    return (uint(c.key) << 16) | uint(index * 64 + bit);
+}
+
+UidSet::const_iterator UidSet::begin() const
+{
+    return const_iterator(this, 0);
+}
+
+UidSet::const_iterator UidSet::end() const
+{
+    return const_iterator(this, static_cast<int>(m_containers.size()));
+}
+
+Imap::Uids UidSet::toVector() const
+{
+    Imap::Uids res;
+    res.reserve(static_cast<int>(size()));
+    forEachRange([&res](const uint lo, const uint hi) {
+        for (quint64 uid = lo; uid <= hi; ++uid)
+            res << static_cast<uint>(uid);
+    });
+    return res;
+}
+
+QByteArray UidSet::toSequenceSet() const
+{
+    Q_ASSERT(!isEmpty());
+    QByteArray res;
+    forEachRange([&res](const uint lo, const uint hi) {
+        if (!res.isEmpty())
+            res += ',';
+        res += QByteArray::number(lo);
+        if (hi != lo)
+            res += ':' + QByteArray::number(hi);
+    });
+    return res;
+}
+
+QByteArray UidSet::toCompactByteArray() const
+{
+    // Each range is stored as its distance from the previous one and its length, both as variable-length integers
+    QByteArray res;
+    quint64 previous = 0;
+    forEachRange([&res, &previous](const uint lo, const uint hi) {
+        appendVarint(res, lo - previous);
+        appendVarint(res, hi - lo);
+        previous = hi;
+    });
+    return res;
+}
+
+int UidSet::memoryUsage() const
+{
+    int res = sizeof(*this);
+    for (const Container &c : m_containers)
+        res += sizeof(Container) + c.runs.capacity() * sizeof(Run) + c.bitmap.capacity() * sizeof(quint64);
+    return res;
+}
+
+bool UidSet::operator==(const UidSet &other) const
+{
+    if (m_containers.size() != other.m_containers.size())
+        return false;
+    for (std::size_t i = 0; i < m_containers.size(); ++i) {
+        const Container &a = m_containers[i];
+        const Container &b = other.m_containers[i];
+        if (a.key != b.key || a.cardinality != b.cardinality)
+            return false;
+        if (a.isBitmap() && b.isBitmap()) {
+            if (a.bitmap != b.bitmap)
+                return false;
+        } else if (!a.isBitmap() && !b.isBitmap()) {
+            if (a.runs.size() != b.runs.size())
+                return false;
+            for (std::size_t j = 0; j < a.runs.size(); ++j) {
+                if (a.runs[j].start != b.runs[j].start || a.runs[j].last != b.runs[j].last)
+                    return false;
+            }
+        } else {
+            // Same cardinality, so one inclusion is enough
+            const Container &runs = a.isBitmap() ? b : a;
+            const Container &bitmap = a.isBitmap() ? a : b;
+            for (const Run &run : runs.runs) {
+                for (int i = run.start; i <= run.last; ++i) {
+                    if (!bitmap.contains(i))
+                        return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+std::vector<UidSet::Container>::iterator UidSet::findOrCreate(const quint16 key)
+{
+    auto it = std::lower_bound(m_containers.begin(), m_containers.end(), key, [](const Container &c, const quint16 key) {
+        return c.key < key;
+    });
+    if (it == m_containers.end() || it->key != key)
+        it = m_containers.insert(it, Container(key));
+    return it;
+}
+
+}
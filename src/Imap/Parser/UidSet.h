@@ -0,0 +1,162 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef IMAP_UIDSET_H
+#define IMAP_UIDSET_H
+
+#include <iterator>
+#include <vector>
+#include <QByteArray>
+#include "Imap/Parser/Uids.h"
+
+namespace Imap {
+
+/** @short A compressed set of UIDs
+
+The UIDs in a mailbox are usually allocated in long contiguous runs, which makes a plain vector of integers a rather
+wasteful representation. This set splits the 32bit UID space into chunks of 65536 numbers, and each chunk is stored
+either as a sorted list of ranges or as a bitmap, whichever is smaller (the same idea as the "roaring bitmaps"). A
+mailbox with a million of consecutive UIDs therefore takes a few bytes instead of four megabytes.
+
+The set is always sorted and contains no duplicates, which makes it a good fit for the UID mapping of a mailbox (where
+the UIDs grow with the sequence numbers), for the results of a SEARCH and for the VANISHED responses, but not for the
+results of a SORT.
+*/
+class UidSet
+{
+    struct Run {
+        quint16 start;
+        quint16 last;
+    };
+
+    /** @short UIDs which share the upper 16 bits */
+    struct Container {
+        quint16 key;
+        int cardinality;
+        /** @short Sorted, disjoint and non-adjacent ranges; used unless the bitmap is active */
+        std::vector<Run> runs;
+        /** @short Either empty, or one bit for each of the 65536 numbers */
+        std::vector<quint64> bitmap;
+
+        explicit Container(const quint16 key);
+        bool isBitmap() const { return !bitmap.empty(); }
+        bool contains(const quint16 low) const;
+        void insertRange(const quint16 lo, const quint16 hi);
+        void unite(const Container &other);
+        void subtract(const Container &other);
+        int runCount() const;
+        void switchToBitmap();
+        void switchToRuns();
+        /** @short Pick the smaller representation */
+        void optimize();
+        /** @short The lowest member which is not below @arg from, or -1 */
+        int nextMember(const int from) const;
+    };
+
+public:
+    /** @short Iterate over the UIDs in the ascending order */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef uint value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const uint *pointer;
+        typedef const uint &reference;
+
+        uint operator*() const { return m_value; }
+        const_iterator &operator++();
+        const_iterator operator++(int);
+        bool operator==(const const_iterator &other) const;
+        bool operator!=(const const_iterator &other) const { return !(*this == other); }
+
+    private:
+        friend class UidSet;
+        const_iterator(const UidSet *set, const int container);
+        void enterContainer();
+
+        const UidSet *m_set;
+        int m_container;
+        uint m_value;
+    };
+
+    UidSet();
+
+    /** @short Create a set with the given UIDs which may come in an arbitrary order and can be repeated */
+    static UidSet fromVector(const Imap::Uids &uids);
+
+    /** @short Parse an IMAP sequence-set such as "1:10,15"; the "*" is not accepted
+
+    Returns an empty set and sets the @arg ok to false when the data cannot be parsed.
+    */
+    static UidSet fromSequenceSet(const QByteArray &sequenceSet, bool *ok = 0);
+
+    /** @short Decode the output of toCompactByteArray() */
+    static UidSet fromCompactByteArray(const QByteArray &data, bool *ok = 0);
+
+    void insert(const uint uid);
+    /** @short Insert all numbers from @arg lo up to and including @arg hi */
+    void insertRange(const uint lo, const uint hi);
+    bool contains(const uint uid) const;
+
+    /** @short Add all UIDs from the @arg other set */
+    UidSet &unite(const UidSet &other);
+    /** @short Remove all UIDs which are present in the @arg other set */
+    UidSet &subtract(const UidSet &other);
+
+    bool isEmpty() const;
+    quint64 size() const;
+    /** @short The lowest UID; the set must not be empty */
+    uint first() const;
+    /** @short The highest UID; the set must not be empty */
+    uint last() const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    /** @short The UIDs as a sorted vector */
+    Imap::Uids toVector() const;
+
+    /** @short Format the UIDs as an IMAP sequence-set, such as "1:10,15"; the set must not be empty */
+    QByteArray toSequenceSet() const;
+
+    /** @short Serialize into a portable binary form which is small for both long runs and scattered UIDs */
+    QByteArray toCompactByteArray() const;
+
+    /** @short Approximate number of bytes occupied by the set */
+    int memoryUsage() const;
+
+    bool operator==(const UidSet &other) const;
+    bool operator!=(const UidSet &other) const { return !(*this == other); }
+
+private:
+    /** @short Call @arg f with the lowest and the highest UID of each maximal range of consecutive UIDs */
+    template<typename F> void forEachRange(F f) const;
+
+    std::vector<Container>::iterator findOrCreate(const quint16 key);
+
+    /** @short Chunks sorted by their key; empty chunks are removed */
+    std::vector<Container> m_containers;
+};
+
+}
+
+#endif // IMAP_UIDSET_H
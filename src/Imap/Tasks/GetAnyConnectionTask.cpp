@@ -36,16 +36,27 @@ GetAnyConnectionTask::GetAnyConnectionTask(Model *model) :
     ImapTask(model), newConn(0)
 {
     QMap<Parser *,ParserState>::iterator it = model->m_parsers.begin();
+    QMap<Parser *,ParserState>::iterator spare = model->m_parsers.end();
     while (it != model->m_parsers.end()) {
         if (it->connState == CONN_STATE_LOGOUT) {
             // We cannot possibly use this connection
             ++it;
+        } else if (it->isSpare) {
+            // Keep the spare connections for opening mailboxes, unless there's nothing else
+            if (spare == model->m_parsers.end())
+                spare = it;
+            ++it;
         } else {
             // we've found it
             break;
         }
     }
 
+    if (it == model->m_parsers.end() && spare != model->m_parsers.end()) {
+        it = spare;
+        it->isSpare = false;
+    }
+
     if (it == model->m_parsers.end()) {
         // We're creating a completely new connection
         if (model->networkPolicy() == NETWORK_OFFLINE) {
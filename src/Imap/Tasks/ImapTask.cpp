@@ -85,6 +85,7 @@ void ImapTask::markAsActiveTask(const TaskActivatingPosition place)
         model->accessParser(parser).activeTasks.prepend(this);
         break;
     }
+    ++model->accessParser(parser).activeTasksGeneration;
     if (parentTask) {
         parentTask->dependentTasks.removeAll(this);
     }
@@ -226,8 +227,10 @@ void ImapTask::_completed()
     _finished = true;
     log(QStringLiteral("Completed"));
     Q_FOREACH(ImapTask* task, dependentTasks) {
-        if (!task->isFinished())
+        if (!task->isFinished()) {
+            TaskSendingCommands sender(model, task);
             task->perform();
+        }
     }
     emit completed(this);
 }
@@ -20,6 +20,7 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <sstream>
 #include "KeepMailboxOpenTask.h"
 #include "Common/InvokeMethod.h"
@@ -151,6 +152,8 @@ KeepMailboxOpenTask::KeepMailboxOpenTask(Model *model, const QModelIndex &mailbo
     if (! ok)
         limitActiveTasks = 100;
 
+    adaptiveFetchLimits = model->property("trojita-imap-adaptive-fetch-limits").toBool();
+
     CHECK_TASK_TREE
     emit model->mailboxSyncingProgress(mailboxIndex, STATE_WAIT_FOR_CONN);
 
@@ -179,6 +182,7 @@ void KeepMailboxOpenTask::slotPerformConnection()
     }
 
     connect(synchronizeConn, &QObject::destroyed, this, &KeepMailboxOpenTask::slotTaskDeleted);
+    TaskSendingCommands sender(model, synchronizeConn);
     synchronizeConn->perform();
 }
 
@@ -280,6 +284,11 @@ void KeepMailboxOpenTask::slotTaskDeleted(QObject *object)
         abortableTasks.removeOne(reinterpret_cast<FetchMsgMetadataTask *>(object));
     }
 
+    if (fetchMetadataTasks.size() < limitParallelFetchTasks && !requestedEnvelopes.isEmpty() && !fetchEnvelopeTimer->isActive()) {
+        // The envelopes which were held back by slotFetchRequestedEnvelopes() can go now
+        fetchEnvelopeTimer->start();
+    }
+
     if (isReadyToTerminate()) {
         terminate();
     } else if (shouldRunNoop) {
@@ -439,9 +448,10 @@ bool KeepMailboxOpenTask::handleNumberResponse(const Imap::Responses::NumberResp
     Q_ASSERT(list);
     // FIXME: tests!
     if (resp->kind == Imap::Responses::EXPUNGE) {
-        mailbox->handleExpunge(model, *resp);
-        mailbox->syncState.setExists(mailbox->syncState.exists() - 1);
-        saveSyncStateNowOrLater(mailbox);
+        // A burst of EXPUNGEs is applied at once, see applyPendingExpunges()
+        if (!m_pendingVanished.isEmpty())
+            applyPendingExpunges();
+        m_pendingExpunges << resp->number;
         return true;
     } else if (resp->kind == Imap::Responses::EXISTS) {
 
@@ -500,12 +510,39 @@ bool KeepMailboxOpenTask::handleVanished(const Responses::Vanished *const resp)
     if (resp->earlier != Responses::Vanished::NOT_EARLIER)
         return false;
 
+    // Just like the EXPUNGEs, a series of VANISHED responses is applied at once
+    if (!m_pendingExpunges.isEmpty())
+        applyPendingExpunges();
+    m_pendingVanished.unite(resp->uids);
+    return true;
+}
+
+void KeepMailboxOpenTask::applyPendingExpunges()
+{
+    if (m_pendingExpunges.isEmpty() && m_pendingVanished.isEmpty())
+        return;
+
+    QVector<uint> expunges;
+    Imap::UidSet vanished;
+    expunges.swap(m_pendingExpunges);
+    std::swap(vanished, m_pendingVanished);
+
+    if (!mailboxIndex.isValid()) {
+        // The mailbox is gone, so there's nothing to update anymore
+        return;
+    }
+
     TreeItemMailbox *mailbox = Model::mailboxForSomeItem(mailboxIndex);
     Q_ASSERT(mailbox);
 
-    mailbox->handleVanished(model, *resp);
+    if (!expunges.isEmpty()) {
+        mailbox->handleExpunges(model, expunges);
+        mailbox->syncState.setExists(mailbox->syncState.exists() - expunges.size());
+    }
+    if (!vanished.isEmpty()) {
+        mailbox->handleVanished(model, Responses::Vanished(Responses::Vanished::NOT_EARLIER, vanished));
+    }
     saveSyncStateNowOrLater(mailbox);
-    return true;
 }
 
 bool KeepMailboxOpenTask::handleFetch(const Imap::Responses::Fetch *const resp)
@@ -606,6 +643,7 @@ bool KeepMailboxOpenTask::handleStateHelper(const Imap::Responses::State *const
         tagClose.clear();
         model->changeConnectionState(parser, CONN_STATE_AUTHENTICATED);
         if (m_deleteCurrentMailboxTask) {
+            TaskSendingCommands sender(model, m_deleteCurrentMailboxTask);
             m_deleteCurrentMailboxTask->perform();
         }
         if (resp->kind != Responses::OK) {
@@ -758,12 +796,14 @@ void KeepMailboxOpenTask::activateTasks()
         ImapTask *task = dependingTasksForThisMailbox.takeFirst();
         runningTasksForThisMailbox.append(task);
         dependentTasks.removeOne(task);
+        TaskSendingCommands sender(model, task);
         task->perform();
     }
     while (!dependingTasksNoMailbox.isEmpty() && model->accessParser(parser).activeTasks.size() < limitActiveTasks) {
         breakOrCancelPossibleIdle();
         ImapTask *task = dependingTasksNoMailbox.takeFirst();
         dependentTasks.removeOne(task);
+        TaskSendingCommands sender(model, task);
         task->perform();
     }
 
@@ -796,6 +836,7 @@ void KeepMailboxOpenTask::slotFetchRequestedParts()
         return;
 
     breakOrCancelPossibleIdle();
+    refreshFetchLimits();
 
     auto it = requestedParts.begin();
     auto parts = *it;
@@ -827,17 +868,72 @@ void KeepMailboxOpenTask::slotFetchRequestedEnvelopes()
         return;
 
     breakOrCancelPossibleIdle();
+    refreshFetchLimits();
 
-    Imap::Uids fetchNow;
     if (shouldExit) {
-        fetchNow = requestedEnvelopes;
+        fetchMetadataTasks << model->m_taskFactory->createFetchMsgMetadataTask(model, mailboxIndex, requestedEnvelopes);
         requestedEnvelopes.clear();
-    } else {
+        return;
+    }
+
+    if (!prioritizeRequestedEnvelopes()) {
         const int amount = qMin(requestedEnvelopes.size(), limitMessagesAtOnce); // FIXME: add an extra limit?
-        fetchNow = requestedEnvelopes.mid(0, amount);
+        Imap::Uids fetchNow = requestedEnvelopes.mid(0, amount);
+        requestedEnvelopes.erase(requestedEnvelopes.begin(), requestedEnvelopes.begin() + amount);
+        fetchMetadataTasks << model->m_taskFactory->createFetchMsgMetadataTask(model, mailboxIndex, fetchNow);
+        return;
+    }
+
+    // The rest stays queued so that it can be reordered when the user scrolls; a FETCH which has been sent already
+    // cannot be cancelled
+    while (!requestedEnvelopes.isEmpty() && fetchMetadataTasks.size() < limitParallelFetchTasks) {
+        const int amount = qMin(requestedEnvelopes.size(), limitMessagesAtOnce);
+        Imap::Uids fetchNow = requestedEnvelopes.mid(0, amount);
         requestedEnvelopes.erase(requestedEnvelopes.begin(), requestedEnvelopes.begin() + amount);
+        fetchMetadataTasks << model->m_taskFactory->createFetchMsgMetadataTask(model, mailboxIndex, fetchNow);
     }
-    fetchMetadataTasks << model->m_taskFactory->createFetchMsgMetadataTask(model, mailboxIndex, fetchNow);
+}
+
+/** @short Move the requests for the messages which the user can see to the front of the queue
+
+Returns false if it isn't known which messages are visible; the requests are served in the order of their arrival then.
+No request is ever dropped, somebody else than the message list might be waiting for the data.
+*/
+bool KeepMailboxOpenTask::prioritizeRequestedEnvelopes()
+{
+    TreeItemMailbox *mailbox = Model::mailboxForSomeItem(mailboxIndex);
+    if (!mailbox)
+        return false;
+    const TreeItemMsgList *list = static_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    if (list->m_visibleUids.isEmpty())
+        return false;
+
+    std::stable_partition(requestedEnvelopes.begin(), requestedEnvelopes.end(), [list](const uint uid) {
+        return list->m_visibleUids.contains(uid);
+    });
+    return true;
+}
+
+/** @short Take the FETCH limits from the connection's measurements if the adaptive limits are enabled
+
+The values which were configured through the model's properties are only used as a starting point in that case.
+*/
+void KeepMailboxOpenTask::refreshFetchLimits()
+{
+    if (!adaptiveFetchLimits || !parser)
+        return;
+
+    AdaptiveFetchLimits &limits = model->accessParser(parser).fetchLimits;
+    if (!limits.isSeeded()) {
+        limits.seed(limitBytesAtOnce, limitMessagesAtOnce, limitParallelFetchTasks);
+        bool ok;
+        int targetLatency = model->property("trojita-imap-fetch-target-latency").toInt(&ok);
+        if (ok)
+            limits.setTargetLatency(targetLatency);
+    }
+    limitBytesAtOnce = limits.bytesPerGroup();
+    limitMessagesAtOnce = limits.messagesPerGroup();
+    limitParallelFetchTasks = limits.parallelTasks();
 }
 
 void KeepMailboxOpenTask::breakOrCancelPossibleIdle()
@@ -962,12 +1058,30 @@ bool KeepMailboxOpenTask::dieIfInvalidMailbox()
     if (!unSelectTask && isRunning == Running::RUNNING) {
         unSelectTask = model->m_taskFactory->createUnSelectTask(model, this);
         connect(unSelectTask, &ImapTask::completed, this, &KeepMailboxOpenTask::slotUnselected);
+        TaskSendingCommands sender(model, unSelectTask);
         unSelectTask->perform();
     }
 
     return true;
 }
 
+bool KeepMailboxOpenTask::releaseConnection()
+{
+    if (isRunning != Running::RUNNING || shouldExit || unSelectTask || m_deleteCurrentMailboxTask
+            || !waitingObtainTasks.isEmpty() || hasPendingInternalActions() || !mailboxIndex.isValid())
+        return false;
+
+    // Make sure that the sync state which is still pending gets saved before we leave the mailbox
+    m_syncingTimer->stop();
+    syncingTimeout();
+
+    unSelectTask = model->m_taskFactory->createUnSelectTask(model, this);
+    connect(unSelectTask, &ImapTask::completed, this, &KeepMailboxOpenTask::slotUnselected);
+    TaskSendingCommands sender(model, unSelectTask);
+    unSelectTask->perform();
+    return true;
+}
+
 bool KeepMailboxOpenTask::hasPendingInternalActions() const
 {
     bool hasToWaitForIdleTermination = idleLauncher ? idleLauncher->waitingForIdleTaggedTermination() : false;
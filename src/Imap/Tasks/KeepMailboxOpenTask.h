@@ -159,6 +159,21 @@ public:
 
     bool hasItsOwnActivity() const;
 
+    /** @short Apply the EXPUNGE and VANISHED responses which have been collected so far
+
+    Consecutive EXPUNGEs and VANISHEDs are not applied one by one, they are only queued. The Model calls this before
+    it passes any other response from this connection anywhere, as well as when it is done with the responses which
+    have arrived so far.
+    */
+    void applyPendingExpunges();
+
+    /** @short Close this mailbox so that the connection can serve as a spare one
+
+    Nothing happens and false is returned when there is still some work to do in this mailbox. Otherwise, the mailbox
+    gets UNSELECTed and this task finishes once that is done.
+    */
+    bool releaseConnection();
+
 private slots:
     void slotTaskDeleted(QObject *object);
 
@@ -204,6 +219,11 @@ private:
     /** @short If there's an IDLE running, be sure to stop it. If it's queued, delay it. */
     void breakOrCancelPossibleIdle();
 
+    /** @short Serve the pending envelope requests for the visible messages first */
+    bool prioritizeRequestedEnvelopes();
+
+    void refreshFetchLimits();
+
     /** @short Check current mailbox for validity, and take an evasive action if it disappeared
 
     This is an equivalent of ObtainSynchronizedMailboxTask::dieIfInvalidMailbox. It will check whether
@@ -297,10 +317,17 @@ protected:
     */
     Imap::Uids requestedEnvelopes;
 
+    /** @short Sequence numbers of the EXPUNGE responses which have not been applied yet */
+    QVector<uint> m_pendingExpunges;
+    /** @short UIDs from the VANISHED responses which have not been applied yet */
+    Imap::UidSet m_pendingVanished;
+
     uint limitBytesAtOnce;
     int limitMessagesAtOnce;
     int limitParallelFetchTasks;
     int limitActiveTasks;
+    /** @short Are the limits above tuned at runtime through the AdaptiveFetchLimits? */
+    bool adaptiveFetchLimits;
 
     /** @short An UNSELECT task, if active */
     UnSelectTask *unSelectTask;
@@ -39,7 +39,8 @@ namespace Mailbox
 ObtainSynchronizedMailboxTask::ObtainSynchronizedMailboxTask(Model *model, const QModelIndex &mailboxIndex, ImapTask *parentTask,
         KeepMailboxOpenTask *keepTask):
     ImapTask(model), conn(parentTask), mailboxIndex(mailboxIndex), status(STATE_WAIT_FOR_CONN), uidSyncingMode(UID_SYNC_ALL),
-    firstUnknownUidOffset(0), m_usingQresync(false), unSelectTask(0), keepTaskChild(keepTask)
+    firstUnknownUidOffset(0), m_usingQresync(false), m_speculativeSearchFrom(0), m_speculativeModSeq(0),
+    m_finishDeferred(false), m_failureDeferred(false), unSelectTask(0), keepTaskChild(keepTask)
 {
     // The Parser* is not provided by our parent task, but instead through the keepTaskChild.  The reason is simple, the parent
     // task might not even exist, but there's always an KeepMailboxOpenTask in the game.
@@ -117,6 +118,9 @@ void ObtainSynchronizedMailboxTask::perform()
     } else {
         selectCmd = parser->select(mailbox->mailbox());
     }
+    if (!m_usingQresync && model->property("trojita-imap-pipelined-select").toBool()) {
+        sendSpeculativeSyncCommands(mailbox);
+    }
     if (hasQresync && model->accessParser(parser).connState > CONN_STATE_AUTHENTICATED) {
         // The CLOSED response code is defined in RFC 5162. It should be sent out even if the client does not actually use
         // the QRESYNC extension (such as when syncing a mailbox for the first time).
@@ -142,6 +146,24 @@ bool ObtainSynchronizedMailboxTask::handleStateHelper(const Imap::Responses::Sta
     if (resp->tag.isEmpty())
         return false;
 
+    if (resp->tag == m_speculativeSearchCmd || resp->tag == m_speculativeFlagsCmd) {
+        // These were sent along with the SELECT, but it turned out that they are of no use
+        if (resp->tag == m_speculativeSearchCmd) {
+            m_speculativeSearchCmd.clear();
+        } else {
+            m_speculativeFlagsCmd.clear();
+        }
+        log(QStringLiteral("Ignored the result of a speculative command"), Common::LOG_MAILBOX_SYNC);
+        if (m_finishDeferred && !hasSpeculativeCommands()) {
+            if (m_failureDeferred) {
+                _failed(m_deferredFailureMessage);
+            } else {
+                _completed();
+            }
+        }
+        return true;
+    }
+
     if (_dead) {
         _failed(tr("Asked to die"));
         return true;
@@ -164,7 +186,7 @@ bool ObtainSynchronizedMailboxTask::handleStateHelper(const Imap::Responses::Sta
             }
             finalizeSelect();
         } else {
-            _failed(QLatin1String("SELECT failed: ") + resp->message);
+            failSync(QLatin1String("SELECT failed: ") + resp->message);
             model->changeConnectionState(parser, CONN_STATE_AUTHENTICATED);
         }
         return true;
@@ -180,7 +202,7 @@ bool ObtainSynchronizedMailboxTask::handleStateHelper(const Imap::Responses::Sta
             Q_ASSERT(mailbox);
             syncFlags(mailbox);
         } else {
-            _failed(QLatin1String("UID syncing failed: ") + resp->message);
+            failSync(QLatin1String("UID syncing failed: ") + resp->message);
             // FIXME: UNSELECT?
         }
         return true;
@@ -200,13 +222,13 @@ bool ObtainSynchronizedMailboxTask::handleStateHelper(const Imap::Responses::Sta
             if (newArrivalsFetch.isEmpty()) {
                 mailbox->saveSyncStateAndUids(model);
                 model->changeConnectionState(parser, CONN_STATE_SELECTED);
-                _completed();
+                completeSync();
             } else {
                 log(QStringLiteral("Pending new arrival fetching, not terminating yet"), Common::LOG_MAILBOX_SYNC);
             }
         } else {
             status = STATE_DONE;
-            _failed(QLatin1String("Flags synchronization failed: ") + resp->message);
+            failSync(QLatin1String("Flags synchronization failed: ") + resp->message);
             // FIXME: UNSELECT?
         }
         emit model->mailboxSyncingProgress(mailboxIndex, status);
@@ -222,10 +244,10 @@ bool ObtainSynchronizedMailboxTask::handleStateHelper(const Imap::Responses::Sta
                 Q_ASSERT(mailbox);
                 mailbox->saveSyncStateAndUids(model);
                 model->changeConnectionState(parser, CONN_STATE_SELECTED);
-                _completed();
+                completeSync();
             }
         } else {
-            _failed(QLatin1String("UID discovery of new arrivals after initial UID sync has failed: ") + resp->message);
+            failSync(QLatin1String("UID discovery of new arrivals after initial UID sync has failed: ") + resp->message);
             // FIXME: UNSELECT?
         }
         return true;
@@ -303,7 +325,7 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
                             notifyInterestingMessages(mailbox);
                             mailbox->saveSyncStateAndUids(model);
                             model->changeConnectionState(parser, CONN_STATE_SELECTED);
-                            _completed();
+                            completeSync();
                         }
                         return;
                     }
@@ -340,7 +362,7 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
                             notifyInterestingMessages(mailbox);
                             mailbox->saveSyncStateAndUids(model);
                             model->changeConnectionState(parser, CONN_STATE_SELECTED);
-                            _completed();
+                            completeSync();
                         }
                     } else {
                         // This should be enough, the server should've sent the data already
@@ -348,7 +370,7 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
                         notifyInterestingMessages(mailbox);
                         mailbox->saveSyncStateAndUids(model);
                         model->changeConnectionState(parser, CONN_STATE_SELECTED);
-                        _completed();
+                        completeSync();
                     }
                 }
                 return;
@@ -408,6 +430,7 @@ void ObtainSynchronizedMailboxTask::fullMboxSync(TreeItemMailbox *mailbox, TreeI
 {
     log(QStringLiteral("Full synchronization"), Common::LOG_MAILBOX_SYNC);
 
+    list->invalidateSavedUids();
     QModelIndex parent = list->toIndex(model);
     if (! list->m_children.isEmpty()) {
         model->beginRemoveRows(parent, 0, list->m_children.size() - 1);
@@ -444,7 +467,7 @@ void ObtainSynchronizedMailboxTask::fullMboxSync(TreeItemMailbox *mailbox, TreeI
         mailbox->saveSyncStateAndUids(model);
         model->changeConnectionState(parser, CONN_STATE_SELECTED);
         // Take care here: this call could invalidate our index (see test coverage)
-        _completed();
+        completeSync();
     }
     // Our mailbox might have actually been invalidated by various callbacks activated above
     if (mailboxIndex.isValid()) {
@@ -481,6 +504,7 @@ void ObtainSynchronizedMailboxTask::syncNoNewNoDeletions(TreeItemMailbox *mailbo
             messages << msg;
         }
         list->setChildren(messages);
+        list->setSavedUids(uidMap);
 
     } else {
         if (mailbox->syncState.exists() != static_cast<uint>(list->m_children.size())) {
@@ -502,7 +526,7 @@ void ObtainSynchronizedMailboxTask::syncNoNewNoDeletions(TreeItemMailbox *mailbo
         if (newArrivalsFetch.isEmpty()) {
             mailbox->saveSyncStateAndUids(model);
             model->changeConnectionState(parser, CONN_STATE_SELECTED);
-            _completed();
+            completeSync();
         }
     }
 }
@@ -535,19 +559,31 @@ void ObtainSynchronizedMailboxTask::syncUids(TreeItemMailbox *mailbox, const uin
 {
     status = STATE_SYNCING_UIDS;
     log(QStringLiteral("Syncing UIDs"), Common::LOG_MAILBOX_SYNC);
+    uidMap.clear();
+    if (!m_speculativeSearchCmd.isEmpty() && lowestUidToQuery && lowestUidToQuery == m_speculativeSearchFrom) {
+        log(QStringLiteral("The UID SEARCH has been already sent along with the SELECT"), Common::LOG_MAILBOX_SYNC);
+        uidSyncingCmd = m_speculativeSearchCmd;
+        m_speculativeSearchCmd.clear();
+    } else {
+        uidSyncingCmd = sendUidSearch(lowestUidToQuery);
+    }
+    emit model->mailboxSyncingProgress(mailboxIndex, status);
+}
+
+/** @short Ask for UIDs of all messages, or just of those whose UID is at least @arg lowestUidToQuery */
+CommandHandle ObtainSynchronizedMailboxTask::sendUidSearch(const uint lowestUidToQuery)
+{
     QByteArray uidSpecification;
     if (lowestUidToQuery == 0) {
         uidSpecification = "ALL";
     } else {
         uidSpecification = QStringLiteral("UID %1:*").arg(QString::number(lowestUidToQuery)).toUtf8();
     }
-    uidMap.clear();
     if (model->accessParser(parser).capabilities.contains(QStringLiteral("ESEARCH"))) {
-        uidSyncingCmd = parser->uidESearchUid(uidSpecification);
+        return parser->uidESearchUid(uidSpecification);
     } else {
-        uidSyncingCmd = parser->uidSearchUid(uidSpecification);
+        return parser->uidSearchUid(uidSpecification);
     }
-    emit model->mailboxSyncingProgress(mailboxIndex, status);
 }
 
 void ObtainSynchronizedMailboxTask::syncFlags(TreeItemMailbox *mailbox)
@@ -583,7 +619,7 @@ void ObtainSynchronizedMailboxTask::syncFlags(TreeItemMailbox *mailbox)
                     status = STATE_DONE;
                     mailbox->saveSyncStateAndUids(model);
                     model->changeConnectionState(parser, CONN_STATE_SELECTED);
-                    _completed();
+                    completeSync();
                     return;
                 } else {
                     // ...but there's still some pending activity; let's wait for its termination
@@ -599,7 +635,12 @@ void ObtainSynchronizedMailboxTask::syncFlags(TreeItemMailbox *mailbox)
             useModSeq = oldSyncState.highestModSeq();
         }
     }
-    if (useModSeq > 0) {
+    if (!m_speculativeFlagsCmd.isEmpty() && (m_speculativeModSeq == 0 || m_speculativeModSeq == useModSeq)) {
+        // The FETCH which went out along with the SELECT asks for the same data (or even more of them)
+        log(QStringLiteral("The FETCH FLAGS has been already sent along with the SELECT"), Common::LOG_MAILBOX_SYNC);
+        flagsCmd = m_speculativeFlagsCmd;
+        m_speculativeFlagsCmd.clear();
+    } else if (useModSeq > 0) {
         QMap<QByteArray, quint64> fetchModifier;
         fetchModifier["CHANGEDSINCE"] = oldSyncState.highestModSeq();
         flagsCmd = parser->fetch(Sequence(1, mailbox->syncState.exists()), QStringList() << QStringLiteral("FLAGS"), fetchModifier);
@@ -870,6 +911,11 @@ bool ObtainSynchronizedMailboxTask::handleSearch(const Imap::Responses::Search *
     if (dieIfInvalidMailbox())
         return true;
 
+    if (!m_speculativeSearchCmd.isEmpty() && status != STATE_SELECTING) {
+        // The untagged SEARCH which precedes the OK of an unused speculative UID SEARCH
+        return true;
+    }
+
     if (uidSyncingCmd.isEmpty())
         return false;
 
@@ -886,6 +932,9 @@ bool ObtainSynchronizedMailboxTask::handleESearch(const Imap::Responses::ESearch
     if (dieIfInvalidMailbox())
         return true;
 
+    if (!resp->tag.isEmpty() && resp->tag == m_speculativeSearchCmd)
+        return true;
+
     if (resp->tag.isEmpty() || resp->tag != uidSyncingCmd)
         return false;
 
@@ -989,14 +1038,19 @@ bool ObtainSynchronizedMailboxTask::handleFetch(const Imap::Responses::Fetch *co
     if (dieIfInvalidMailbox())
         return true;
 
+    if (!m_speculativeFlagsCmd.isEmpty() && status != STATE_SELECTING) {
+        // The sequence numbers might not match our idea of the mailbox yet, and whatever has changed will be fetched
+        // once again by the real flag synchronization.
+        return true;
+    }
+
     TreeItemMailbox *mailbox = Model::mailboxForSomeItem(mailboxIndex);
     Q_ASSERT(mailbox);
     QList<TreeItemPart *> changedParts;
     TreeItemMessage *changedMessage = 0;
     mailbox->handleFetchResponse(model, *resp, changedParts, changedMessage, m_usingQresync);
     if (changedMessage) {
-        QModelIndex index = changedMessage->toIndex(model);
-        emit model->dataChanged(index, index);
+        model->scheduleDataChanged(changedMessage);
         if (mailbox->syncState.uidNext() <= changedMessage->uid()) {
             mailbox->syncState.setUidNext(changedMessage->uid() + 1);
         }
@@ -1021,6 +1075,10 @@ void ObtainSynchronizedMailboxTask::applyUids(TreeItemMailbox *mailbox)
     Q_ASSERT(list);
     QModelIndex parent = list->toIndex(model);
     list->m_children.reserve(mailbox->syncState.exists());
+    if (uidSyncingMode == UID_SYNC_ALL) {
+        // The whole mapping is going to be rebuilt anyway, so there's no point in saving it incrementally
+        list->invalidateSavedUids();
+    }
 
     int i = firstUnknownUidOffset;
     while (i < uidMap.size() + static_cast<int>(firstUnknownUidOffset)) {
@@ -1078,6 +1136,7 @@ void ObtainSynchronizedMailboxTask::applyUids(TreeItemMailbox *mailbox)
                 // messages due to that one out-of-place arrival -- but we'd still remain correct and not crash.
                 TreeItemMessage *otherMessage = static_cast<TreeItemMessage*>(list->m_children[pos]);
                 if (otherMessage->m_uid != 0 && otherMessage->m_uid != uidMap[uidOffset]) {
+                    list->forgetSavedUid(otherMessage->uid());
                     model->cache()->clearMessage(mailbox->mailbox(), otherMessage->uid());
                     ++pos;
                 } else {
@@ -1108,6 +1167,9 @@ void ObtainSynchronizedMailboxTask::applyUids(TreeItemMailbox *mailbox)
         TreeItemChildrenList removedItems = list->m_children.mid(i);
         list->m_children.erase(list->m_children.begin() + i, list->m_children.end());
         model->endRemoveRows();
+        for (auto it = removedItems.constBegin(); it != removedItems.constEnd(); ++it) {
+            list->forgetSavedUid(static_cast<TreeItemMessage *>(*it)->uid());
+        }
         qDeleteAll(removedItems);
     }
 
@@ -1120,6 +1182,66 @@ void ObtainSynchronizedMailboxTask::applyUids(TreeItemMailbox *mailbox)
     model->changeConnectionState(parser, CONN_STATE_SELECTED);
 }
 
+/** @short Pipeline the UID SEARCH and FETCH FLAGS which will most likely follow the SELECT
+
+The commands are the same ones which finalizeSelect() would issue if there were just a few new arrivals, or no changes
+at all. When the SELECT is done, syncUids() and syncFlags() take them over instead of sending their own. If the mailbox
+has changed in a different way, their results are ignored and the sync proceeds as usual.
+*/
+void ObtainSynchronizedMailboxTask::sendSpeculativeSyncCommands(TreeItemMailbox *mailbox)
+{
+    if (!oldSyncState.isUsableForSyncing() || !oldSyncState.exists() || !oldSyncState.uidNext())
+        return;
+
+    if (static_cast<uint>(model->cache()->uidMapping(mailbox->mailbox()).size()) != oldSyncState.exists()) {
+        // This is going to be a full sync anyway
+        return;
+    }
+
+    m_speculativeSearchFrom = oldSyncState.uidNext();
+    m_speculativeSearchCmd = sendUidSearch(m_speculativeSearchFrom);
+
+    const QStringList &capabilities = model->accessParser(parser).capabilities;
+    if (capabilities.contains(QStringLiteral("CONDSTORE")) || capabilities.contains(QStringLiteral("QRESYNC"))) {
+        m_speculativeModSeq = oldSyncState.highestModSeq();
+    }
+    if (m_speculativeModSeq > 0) {
+        QMap<QByteArray, quint64> fetchModifier;
+        fetchModifier["CHANGEDSINCE"] = m_speculativeModSeq;
+        m_speculativeFlagsCmd = parser->fetch(Sequence::startingAt(1), QStringList() << QStringLiteral("FLAGS"), fetchModifier);
+    } else {
+        m_speculativeFlagsCmd = parser->fetch(Sequence::startingAt(1), QStringList() << QStringLiteral("FLAGS"));
+    }
+    log(QStringLiteral("Pipelining UID SEARCH and FETCH FLAGS along with the SELECT"), Common::LOG_MAILBOX_SYNC);
+}
+
+bool ObtainSynchronizedMailboxTask::hasSpeculativeCommands() const
+{
+    return !m_speculativeSearchCmd.isEmpty() || !m_speculativeFlagsCmd.isEmpty();
+}
+
+/** @short Finish the task, but not before all of the speculative commands are answered */
+void ObtainSynchronizedMailboxTask::completeSync()
+{
+    if (hasSpeculativeCommands()) {
+        m_finishDeferred = true;
+        return;
+    }
+    _completed();
+}
+
+/** @short Fail the task, but not before all of the speculative commands are answered */
+void ObtainSynchronizedMailboxTask::failSync(const QString &message)
+{
+    if (hasSpeculativeCommands()) {
+        m_finishDeferred = true;
+        m_failureDeferred = true;
+        m_deferredFailureMessage = message;
+        return;
+    }
+    _failed(message);
+}
+
 QString ObtainSynchronizedMailboxTask::debugIdentification() const
 {
     if (! mailboxIndex.isValid())
@@ -1190,6 +1312,7 @@ bool ObtainSynchronizedMailboxTask::dieIfInvalidMailbox()
     if (!unSelectTask) {
         unSelectTask = model->m_taskFactory->createUnSelectTask(model, this);
         connect(unSelectTask, &ImapTask::completed, this, &ObtainSynchronizedMailboxTask::slotUnSelectCompleted);
+        TaskSendingCommands sender(model, unSelectTask);
         unSelectTask->perform();
     }
 
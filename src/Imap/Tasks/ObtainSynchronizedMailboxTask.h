@@ -75,7 +75,13 @@ private:
     void finalizeSearch();
 
     void syncUids(TreeItemMailbox *mailbox, const uint lowestUidToQuery=0);
+    CommandHandle sendUidSearch(const uint lowestUidToQuery);
     void syncFlags(TreeItemMailbox *mailbox);
+
+    void sendSpeculativeSyncCommands(TreeItemMailbox *mailbox);
+    bool hasSpeculativeCommands() const;
+    void completeSync();
+    void failSync(const QString &message);
     void updateHighestKnownUid(TreeItemMailbox *mailbox, const TreeItemMsgList *list) const;
 
     void notifyInterestingMessages(TreeItemMailbox *mailbox);
@@ -114,6 +120,19 @@ private:
     SyncState oldSyncState;
     bool m_usingQresync;
 
+    /** @short UID SEARCH which was sent along with the SELECT and which hasn't been put to use (yet) */
+    CommandHandle m_speculativeSearchCmd;
+    /** @short FETCH FLAGS which was sent along with the SELECT and which hasn't been put to use (yet) */
+    CommandHandle m_speculativeFlagsCmd;
+    /** @short The lowest UID which the m_speculativeSearchCmd asks for */
+    uint m_speculativeSearchFrom;
+    /** @short The CHANGEDSINCE of the m_speculativeFlagsCmd, or 0 if it asks for flags of all messages */
+    quint64 m_speculativeModSeq;
+    /** @short The sync has finished, but the replies to the speculative commands are still on their way */
+    bool m_finishDeferred;
+    bool m_failureDeferred;
+    QString m_deferredFailureMessage;
+
     /** @short An UNSELECT task, if active */
     UnSelectTask *unSelectTask;
 
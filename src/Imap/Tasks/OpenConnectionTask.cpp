@@ -37,23 +37,27 @@ namespace Mailbox
 {
 
 OpenConnectionTask::OpenConnectionTask(Model *model) :
-    ImapTask(model)
+    ImapTask(model), m_encrypted(false), m_loginPipelined(false)
 {
     // Offline mode shall be checked by the caller who decides to create the connection
     Q_ASSERT(model->networkPolicy() != NETWORK_OFFLINE);
     parser = new Parser(model, model->m_socketFactory->create(), Common::ConnectionId::next());
+    if (model->property("trojita-imap-parse-in-thread").toBool())
+        parser->enableParsingInThread();
     ParserState parserState(parser);
     connect(parser, &Parser::responseReceived, model, static_cast<void (Model::*)(Parser*)>(&Model::responseReceived), Qt::QueuedConnection);
     connect(parser, &Parser::connectionStateChanged, model, &Model::handleSocketStateChanged);
     connect(parser, &Parser::lineReceived, model, &Model::slotParserLineReceived);
+    connect(parser, &Parser::spooledLiteralReceived, model, &Model::slotParserSpooledLiteralReceived);
     connect(parser, &Parser::lineSent, model, &Model::slotParserLineSent);
+    connect(parser, &Parser::commandQueued, model, &Model::slotParserCommandQueued);
     model->m_parsers[ parser ] = parserState;
     model->m_taskModel->slotParserCreated(parser);
     markAsActiveTask();
 }
 
 OpenConnectionTask::OpenConnectionTask(Model *model, void *dummy):
-    ImapTask(model)
+    ImapTask(model), m_encrypted(false), m_loginPipelined(false)
 {
     Q_UNUSED(dummy);
 }
@@ -168,14 +172,7 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
             // Cool, we're already authenticated. Now, let's see if we have to issue CAPABILITY or if we already know that
             if (model->accessParser(parser).capabilitiesFresh) {
                 // We're alsmost done here, apart from compression
-                if (TROJITA_COMPRESS_DEFLATE && model->accessParser(parser).capabilities.contains(QStringLiteral("COMPRESS=DEFLATE"))) {
-                    compressCmd = parser->compressDeflate();
-                    model->changeConnectionState(parser, CONN_STATE_COMPRESS_DEFLATE);
-                } else {
-                    // really done
-                    model->changeConnectionState(parser, CONN_STATE_AUTHENTICATED);
-                    onComplete();
-                }
+                compressOrComplete();
             } else {
                 model->changeConnectionState(parser, CONN_STATE_POSTAUTH_PRECAPS);
                 capabilityCmd = parser->capability();
@@ -184,8 +181,18 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
 
         case OK:
             if (!model->accessParser(parser).capabilitiesFresh) {
-                model->changeConnectionState(parser, CONN_STATE_CONNECTED_PRETLS);
-                capabilityCmd = parser->capability();
+                if (canPipelineLogin()) {
+                    pipelineLogin();
+                } else if (model->m_startTls && !model->m_cachedPreAuthCapabilities.isEmpty() &&
+                           model->property("trojita-imap-pipelined-login").toBool()) {
+                    // STARTTLS worked last time, so there's no point in asking for capabilities which are going to be
+                    // discarded anyway. Should the server no longer support it, the command will simply fail.
+                    startTlsCmd = parser->startTls();
+                    model->changeConnectionState(parser, CONN_STATE_STARTTLS_ISSUED);
+                } else {
+                    model->changeConnectionState(parser, CONN_STATE_CONNECTED_PRETLS);
+                    capabilityCmd = parser->capability();
+                }
             } else {
                 startTlsOrLoginNow();
             }
@@ -264,6 +271,7 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
             if (model->accessParser(parser).capabilities.contains(QStringLiteral("LOGINDISABLED"))) {
                 abortConnection(tr("Server error: Capabilities contain LOGINDISABLED even after STARTTLS"));
             } else {
+                model->m_cachedPreAuthCapabilities = model->accessParser(parser).capabilities;
                 model->changeConnectionState(parser, CONN_STATE_LOGIN);
                 askForAuth();
             }
@@ -274,25 +282,47 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
     case CONN_STATE_LOGIN:
         // Check the result of the LOGIN command
     {
+        if (m_loginPipelined && resp->tag == capabilityCmd) {
+            // This is the CAPABILITY which went out right before the LOGIN
+            if (resp->kind != OK || !model->accessParser(parser).capabilitiesFresh) {
+                model->m_cachedPreAuthCapabilities.clear();
+            } else if (model->accessParser(parser).capabilities.contains(QStringLiteral("LOGINDISABLED"))) {
+                model->m_cachedPreAuthCapabilities.clear();
+                abortConnection(tr("Server error: Capabilities contain LOGINDISABLED on an encrypted connection"));
+                return true;
+            } else {
+                model->m_cachedPreAuthCapabilities = model->accessParser(parser).capabilities;
+            }
+            // The LOGIN is still in flight, and it will likely change them
+            model->accessParser(parser).capabilitiesFresh = false;
+            return true;
+        }
+        if (resp->tag == postAuthCapabilityCmd) {
+            // The pipelined LOGIN has failed, so this has only repeated the pre-authentication capabilities
+            postAuthCapabilityCmd.clear();
+            return true;
+        }
         if (resp->tag == loginCmd) {
             loginCmd.clear();
             // The LOGIN command is finished
             if (resp->kind == OK) {
                 model->setImapAuthError(QString());
-                if (resp->respCode == CAPABILITIES || model->accessParser(parser).capabilitiesFresh) {
+                if (!postAuthCapabilityCmd.isEmpty()) {
+                    // The CAPABILITY is already queued behind the LOGIN, so let's just wait for its result
+                    capabilityCmd = postAuthCapabilityCmd;
+                    postAuthCapabilityCmd.clear();
+                    model->changeConnectionState(parser, CONN_STATE_POSTAUTH_PRECAPS);
+                } else if (resp->respCode == CAPABILITIES || model->accessParser(parser).capabilitiesFresh) {
                     // Capabilities are already known
-                    if (TROJITA_COMPRESS_DEFLATE && model->accessParser(parser).capabilities.contains(QStringLiteral("COMPRESS=DEFLATE"))) {
-                        compressCmd = parser->compressDeflate();
-                        model->changeConnectionState(parser, CONN_STATE_COMPRESS_DEFLATE);
-                    } else {
-                        model->changeConnectionState(parser, CONN_STATE_AUTHENTICATED);
-                        onComplete();
-                    }
+                    compressOrComplete();
                 } else {
                     // Got to ask for the capabilities
                     model->changeConnectionState(parser, CONN_STATE_POSTAUTH_PRECAPS);
                     capabilityCmd = parser->capability();
                 }
+            } else if (model->accessParser(parser).isSpare) {
+                // The credentials have worked for another connection; don't throw them away because of this one
+                abortConnection(tr("Login failed: %1").arg(resp->message));
             } else {
                 // Login failed
                 QString message;
@@ -334,6 +364,7 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
 
                 model->m_imapPassword.clear();
                 model->m_hasImapPassword = Model::PasswordAvailability::NOT_REQUESTED;
+                m_loginPipelined = false;
                 if (model->accessParser(parser).connState == CONN_STATE_LOGOUT) {
                     // The server has closed the conenction
                     _failed(QStringLiteral("Connection closed after a failed login"));
@@ -350,8 +381,12 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
     {
         bool wasCaps = checkCapabilitiesResult(resp);
         if (wasCaps && !_finished) {
-            model->changeConnectionState(parser, CONN_STATE_AUTHENTICATED);
-            onComplete();
+            if (m_loginPipelined) {
+                compressOrComplete();
+            } else {
+                model->changeConnectionState(parser, CONN_STATE_AUTHENTICATED);
+                onComplete();
+            }
         }
         return wasCaps;
     }
@@ -388,6 +423,9 @@ void OpenConnectionTask::startTlsOrLoginNow()
     } else {
         // We're requested to authenticate even without STARTTLS
         Q_ASSERT(!model->accessParser(parser).capabilities.contains(QLatin1String("LOGINDISABLED")));
+        if (m_encrypted) {
+            model->m_cachedPreAuthCapabilities = model->accessParser(parser).capabilities;
+        }
         model->changeConnectionState(parser, CONN_STATE_LOGIN);
         askForAuth();
     }
@@ -412,11 +450,48 @@ bool OpenConnectionTask::checkCapabilitiesResult(const Responses::State *const r
     return false;
 }
 
+/** @short Is it safe to send LOGIN right away, relying on the capabilities which the server has advertised last time?
+
+This is only ever done over an encrypted connection, so that a server which has suddenly started to announce
+LOGINDISABLED does not get to see the password in the clear.
+*/
+bool OpenConnectionTask::canPipelineLogin() const
+{
+    return m_encrypted && model->property("trojita-imap-pipelined-login").toBool() &&
+            !model->m_cachedPreAuthCapabilities.isEmpty() &&
+            !model->m_cachedPreAuthCapabilities.contains(QStringLiteral("LOGINDISABLED")) &&
+            model->m_hasImapPassword == Model::PasswordAvailability::AVAILABLE;
+}
+
+/** @short Send CAPABILITY, LOGIN and another CAPABILITY at once instead of waiting for each of them in turn */
+void OpenConnectionTask::pipelineLogin()
+{
+    m_loginPipelined = true;
+    model->changeConnectionState(parser, CONN_STATE_LOGIN);
+    model->accessParser(parser).capabilitiesFresh = false;
+    capabilityCmd = parser->capability();
+    loginCmd = parser->login(model->m_imapUser, model->m_imapPassword);
+    postAuthCapabilityCmd = parser->capability();
+}
+
+/** @short We're authenticated and the capabilities are known; enable compression if possible, or finish right now */
+void OpenConnectionTask::compressOrComplete()
+{
+    if (TROJITA_COMPRESS_DEFLATE && model->accessParser(parser).capabilities.contains(QStringLiteral("COMPRESS=DEFLATE"))) {
+        compressCmd = parser->compressDeflate();
+        model->changeConnectionState(parser, CONN_STATE_COMPRESS_DEFLATE);
+    } else {
+        model->changeConnectionState(parser, CONN_STATE_AUTHENTICATED);
+        onComplete();
+    }
+}
+
 void OpenConnectionTask::onComplete()
 {
     // Optionally issue the ID command
     if (model->accessParser(parser).capabilities.contains(QStringLiteral("ID"))) {
         Imap::Mailbox::ImapTask *task = model->m_taskFactory->createIdTask(model, this);
+        TaskSendingCommands sender(model, task);
         task->perform();
     }
     // Optionally enable extensions which need enabling
@@ -428,7 +503,9 @@ void OpenConnectionTask::onComplete()
         }
 
         if (!extensions.isEmpty()) {
-            model->m_taskFactory->createEnableTask(model, this, extensions)->perform();
+            Imap::Mailbox::ImapTask *task = model->m_taskFactory->createEnableTask(model, this, extensions);
+            TaskSendingCommands sender(model, task);
+            task->perform();
         }
     }
 
@@ -439,6 +516,16 @@ void OpenConnectionTask::onComplete()
 void OpenConnectionTask::abortConnection(const QString &message)
 {
     _failed(message);
+    if (model->accessParser(parser).isSpare) {
+        // Nobody is waiting for this connection, so there's no point in bothering the user or in going offline
+        model->logTrace(parser->parserId(), Common::LOG_OTHER, QStringLiteral("OpenConnectionTask"),
+                        QStringLiteral("Giving up on a spare connection: %1").arg(message));
+        if (model->accessParser(parser).connState != CONN_STATE_LOGOUT) {
+            model->accessParser(parser).logoutCmd = parser->logout();
+            model->changeConnectionState(parser, CONN_STATE_LOGOUT);
+        }
+        return;
+    }
     EMIT_LATER(model, authAttemptFailed, Q_ARG(QString, message));
     model->setNetworkPolicy(NETWORK_OFFLINE);
 }
@@ -499,6 +586,7 @@ void OpenConnectionTask::sslConnectionPolicyDecided(bool ok)
     switch (model->accessParser(parser).connState) {
     case CONN_STATE_SSL_VERIFYING:
         if (ok) {
+            m_encrypted = true;
             model->changeConnectionState(parser, CONN_STATE_CONNECTED_PRETLS_PRECAPS);
         } else {
             abortConnection(tr("The security state of the SSL connection got rejected"));
@@ -506,9 +594,14 @@ void OpenConnectionTask::sslConnectionPolicyDecided(bool ok)
         break;
     case CONN_STATE_STARTTLS_VERIFYING:
         if (ok) {
-            model->changeConnectionState(parser, CONN_STATE_ESTABLISHED_PRECAPS);
-            model->accessParser(parser).capabilitiesFresh = false;
-            capabilityCmd = parser->capability();
+            m_encrypted = true;
+            if (canPipelineLogin()) {
+                pipelineLogin();
+            } else {
+                model->changeConnectionState(parser, CONN_STATE_ESTABLISHED_PRECAPS);
+                model->accessParser(parser).capabilitiesFresh = false;
+                capabilityCmd = parser->capability();
+            }
         } else {
             abortConnection(tr("The security state of the connection after a STARTTLS operation got rejected"));
         }
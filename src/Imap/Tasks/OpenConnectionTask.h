@@ -85,11 +85,21 @@ private:
 
     void askForAuth();
 
+    bool canPipelineLogin() const;
+    void pipelineLogin();
+    void compressOrComplete();
+
 private:
     CommandHandle startTlsCmd;
     CommandHandle capabilityCmd;
     CommandHandle loginCmd;
     CommandHandle compressCmd;
+    /** @short CAPABILITY which was queued right behind a pipelined LOGIN */
+    CommandHandle postAuthCapabilityCmd;
+    /** @short Is the underlying connection encrypted already, either via an implicit TLS or via STARTTLS? */
+    bool m_encrypted;
+    /** @short Has the LOGIN been sent without waiting for the fresh capabilities? */
+    bool m_loginPipelined;
     QList<QSslCertificate> m_sslChain;
     QList<QSslError> m_sslErrors;
 };
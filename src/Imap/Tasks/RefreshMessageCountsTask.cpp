@@ -0,0 +1,157 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "RefreshMessageCountsTask.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/Model.h"
+#include "GetAnyConnectionTask.h"
+#include "ListChildMailboxesTask.h"
+#include "NumberOfMessagesTask.h"
+
+namespace
+{
+/** @short How many STATUS commands can be waiting for their replies at the same time */
+const int maxStatusCommandsInFlight = 20;
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+RefreshMessageCountsTask::RefreshMessageCountsTask(Model *model, const QStringList &mailboxes):
+    ImapTask(model), m_mailboxes(mailboxes.toSet()), m_queue(mailboxes)
+{
+    conn = model->m_taskFactory->createGetAnyConnectionTask(model);
+    conn->addDependentTask(this);
+}
+
+void RefreshMessageCountsTask::perform()
+{
+    parser = conn->parser;
+    markAsActiveTask();
+
+    IMAP_TASK_CHECK_ABORT_DIE;
+
+    if (model->accessParser(parser).capabilitiesFresh
+            && model->accessParser(parser).capabilities.contains(QStringLiteral("LIST-STATUS"))
+            && !isListingInProgress()) {
+        m_queue.clear();
+        // empty string, not a null string
+        m_listTag = parser->list(QLatin1String(""), QStringLiteral("*"), QStringList()
+                                 << QStringLiteral("STATUS (%1)").arg(NumberOfMessagesTask::requestedStatusOptions().join(QStringLiteral(" "))));
+    } else {
+        sendMoreStatusCommands();
+    }
+}
+
+/** @short Keep the pipeline of STATUS commands filled */
+void RefreshMessageCountsTask::sendMoreStatusCommands()
+{
+    while (m_statusTags.size() < maxStatusCommandsInFlight && !m_queue.isEmpty()) {
+        m_statusTags << parser->status(m_queue.takeFirst(), NumberOfMessagesTask::requestedStatusOptions());
+    }
+    if (m_statusTags.isEmpty()) {
+        finish();
+    }
+}
+
+bool RefreshMessageCountsTask::handleStateHelper(const Imap::Responses::State *const resp)
+{
+    if (resp->tag.isEmpty())
+        return false;
+
+    if (resp->tag == m_listTag) {
+        if (resp->kind != Responses::OK) {
+            log(QStringLiteral("LIST-STATUS has failed"));
+        }
+        m_listTag.clear();
+        finish();
+        return true;
+    } else if (m_statusTags.removeOne(resp->tag)) {
+        if (resp->kind != Responses::OK) {
+            // The mailbox might have been deleted in the meanwhile; that's not a reason to throw away the other results
+            log(QStringLiteral("STATUS has failed: %1").arg(resp->message));
+        }
+        sendMoreStatusCommands();
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool RefreshMessageCountsTask::handleStatus(const Imap::Responses::Status *const resp)
+{
+    // The LIST-STATUS reports all mailboxes, and there's no reason to throw away the numbers of the other ones
+    if (m_listTag.isEmpty() && !m_mailboxes.contains(resp->mailbox))
+        return false;
+
+    m_results << *resp;
+    return true;
+}
+
+/** @short Keep the mailbox listing which comes along the LIST-STATUS away from the mailbox tree
+
+The mailbox tree is managed by the ListChildMailboxesTask, and the Model hands all LIST responses on a connection to
+whichever listing finishes first. The replies to this LIST "*" cover the nested mailboxes as well, so they would end up
+at wrong places in the tree. No listing is running on this connection when the LIST-STATUS is sent, and the server
+replies to the pipelined commands in order, so everything which arrives before its tagged reply belongs to it.
+*/
+bool RefreshMessageCountsTask::handleList(const Imap::Responses::List *const resp)
+{
+    Q_UNUSED(resp);
+    return !m_listTag.isEmpty();
+}
+
+/** @short Is there a ListChildMailboxesTask whose replies cannot be told apart from those to the LIST-STATUS? */
+bool RefreshMessageCountsTask::isListingInProgress() const
+{
+    Q_FOREACH(ImapTask *task, model->accessParser(parser).activeTasks) {
+        if (qobject_cast<ListChildMailboxesTask *>(task))
+            return true;
+    }
+    return false;
+}
+
+void RefreshMessageCountsTask::finish()
+{
+    if (isFinished())
+        return;
+
+    model->applyMessageCounts(m_results);
+    m_results.clear();
+    _completed();
+}
+
+QString RefreshMessageCountsTask::debugIdentification() const
+{
+    return QStringLiteral("%1 mailboxes, %2 STATUS in flight, %3 queued")
+            .arg(QString::number(m_mailboxes.size()), QString::number(m_statusTags.size()), QString::number(m_queue.size()));
+}
+
+QVariant RefreshMessageCountsTask::taskData(const int role) const
+{
+    return role == RoleTaskCompactName ? QVariant(tr("Updating message counts")) : QVariant();
+}
+
+}
+}
@@ -0,0 +1,79 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_REFRESHMESSAGECOUNTS_TASK_H
+#define IMAP_REFRESHMESSAGECOUNTS_TASK_H
+
+#include <QSet>
+#include <QStringList>
+#include "ImapTask.h"
+#include "Imap/Parser/Response.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short Refresh the number of messages in many mailboxes at once
+
+When the server supports LIST-STATUS, a single LIST "*" RETURN (STATUS ...) is used. Otherwise, the STATUS commands are
+pipelined on a single connection while making sure that only a bounded number of them is in flight at any time.
+
+All of the results are applied to the Model in one go once the last reply arrives, so that the views which compute some
+aggregate over the whole mailbox tree only have to do it once.
+*/
+class RefreshMessageCountsTask : public ImapTask
+{
+    Q_OBJECT
+public:
+    RefreshMessageCountsTask(Model *model, const QStringList &mailboxes);
+    virtual void perform();
+
+    virtual bool handleStateHelper(const Imap::Responses::State *const resp);
+    virtual bool handleStatus(const Imap::Responses::Status *const resp);
+    virtual bool handleList(const Imap::Responses::List *const resp);
+
+    virtual QString debugIdentification() const;
+    virtual QVariant taskData(const int role) const;
+    virtual bool needsMailbox() const {return false;}
+
+private:
+    void sendMoreStatusCommands();
+    void finish();
+    bool isListingInProgress() const;
+
+    ImapTask *conn;
+    /** @short Mailboxes whose numbers are requested */
+    QSet<QString> m_mailboxes;
+    /** @short Mailboxes for which no STATUS has been sent yet */
+    QStringList m_queue;
+    /** @short STATUS commands which haven't been answered yet */
+    QList<CommandHandle> m_statusTags;
+    /** @short The LIST-STATUS command, if used */
+    CommandHandle m_listTag;
+    QList<Imap::Responses::Status> m_results;
+};
+
+}
+}
+
+#endif // IMAP_REFRESHMESSAGECOUNTS_TASK_H
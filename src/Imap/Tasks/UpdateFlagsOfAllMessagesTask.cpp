@@ -82,7 +82,7 @@ bool UpdateFlagsOfAllMessagesTask::handleStateHelper(const Imap::Responses::Stat
                 }
 
                 Q_ASSERT(flagOperation == Imap::Mailbox::FLAG_ADD || flagOperation == Imap::Mailbox::FLAG_ADD_SILENT);
-                QStringList newFlags = message->m_flags;
+                QStringList newFlags = message->flags();
                 if (!newFlags.contains(flags)) {
                     newFlags << flags;
                     message->setFlags(list, model->normalizeFlags(newFlags));
@@ -92,11 +92,10 @@ void UpdateFlagsTask::perform()
             {
                 TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(message->parent());
                 Q_ASSERT(list);
-                QStringList newFlags = message->m_flags;
+                QStringList newFlags = message->flags();
                 newFlags.removeOne(flags);
                 message->setFlags(list, newFlags);
-                // we don't have to either re-sort or call Model::normalizeFlags again from this context;
-                // this will change when the model starts de-duplicating whole lists
+                // we don't have to either re-sort or call Model::normalizeFlags again from this context
                 model->cache()->setMsgFlags(static_cast<TreeItemMailbox*>(list->parent())->mailbox(), message->uid(), newFlags);
                 break;
             }
@@ -104,7 +103,7 @@ void UpdateFlagsTask::perform()
             {
                 TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(message->parent());
                 Q_ASSERT(list);
-                QStringList newFlags = message->m_flags;
+                QStringList newFlags = message->flags();
                 if (!newFlags.contains(flags)) {
                     newFlags << flags;
                     message->setFlags(list, model->normalizeFlags(newFlags));
@@ -43,6 +43,7 @@ These modifications are released into public domain.
 **
 ****************************************************************************/
 
+#include <cstring>
 #include "rfc1951.h"
 
 namespace Streams {
@@ -72,31 +73,44 @@ Rfc1951Compressor::~Rfc1951Compressor()
     deflateEnd(&_zStream);
 }
 
-bool Rfc1951Compressor::write(QIODevice *out, QByteArray *in)
+bool Rfc1951Compressor::write(QIODevice *out, QByteArray *in, bool flush)
 {
     _zStream.next_in = reinterpret_cast<Bytef*>(in->data());
     _zStream.avail_in = in->size();
-    
+    // Without a flush, deflate() keeps the tail of the data in its internal state; it only gets sent with the next
+    // call which asks for a flush. That makes a burst of small writes end up in a single sync point.
+    return deflateInto(out, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+}
+
+bool Rfc1951Compressor::flush(QIODevice *out)
+{
+    _zStream.next_in = Z_NULL;
+    _zStream.avail_in = 0;
+    return deflateInto(out, Z_SYNC_FLUSH);
+}
+
+bool Rfc1951Compressor::deflateInto(QIODevice *out, int flushMode)
+{
     do {
         _zStream.next_out = reinterpret_cast<Bytef*>(_buffer);
         _zStream.avail_out = _chunkSize;
-        int result = deflate(&_zStream, Z_SYNC_FLUSH);
+        int result = deflate(&_zStream, flushMode);
         if (result != Z_OK &&
             result != Z_STREAM_END &&
             result != Z_BUF_ERROR) {
             return false;
         }
-        out->write(_buffer, _chunkSize - _zStream.avail_out);
+        if (_zStream.avail_out != static_cast<uInt>(_chunkSize))
+            out->write(_buffer, _chunkSize - _zStream.avail_out);
     } while (!_zStream.avail_out);
     return true;
 }
 
 
-Rfc1951Decompressor::Rfc1951Decompressor(int chunkSize)
+Rfc1951Decompressor::Rfc1951Decompressor(int chunkSize, int maxBuffered):
+    _chunkSize(chunkSize), _maxBuffered(maxBuffered), _pendingOutput(false), _headOffset(0), _available(0),
+    _scannedForNewline(0)
 {
-    _chunkSize = chunkSize;
-    _stagingBuffer = new char[_chunkSize];
-
     /* allocate inflate state */
     _zStream.zalloc = Z_NULL;
     _zStream.zfree = Z_NULL;
@@ -110,51 +124,162 @@ Rfc1951Decompressor::Rfc1951Decompressor(int chunkSize)
 Rfc1951Decompressor::~Rfc1951Decompressor()
 {
     inflateEnd(&_zStream);
-    delete[] _stagingBuffer;
+}
+
+/** @short Is there any compressed data which haven't been inflated yet? */
+bool Rfc1951Decompressor::hasPendingInput() const
+{
+    return _zStream.avail_in || _pendingOutput;
+}
+
+/** @short Inflate at most one chunk's worth of data to the end of the queue */
+bool Rfc1951Decompressor::inflateChunk()
+{
+    Q_ASSERT(hasPendingInput());
+    if (_chunks.isEmpty() || _chunks.last().size() >= _chunkSize) {
+        _chunks.append(QByteArray());
+        // Prevent the resize() below from giving the memory back after each partial inflate
+        _chunks.last().reserve(_chunkSize);
+    }
+    QByteArray &tail = _chunks.last();
+    const int used = tail.size();
+    tail.resize(_chunkSize);
+    const uInt inputBefore = _zStream.avail_in;
+    _zStream.next_out = reinterpret_cast<Bytef *>(tail.data() + used);
+    _zStream.avail_out = _chunkSize - used;
+    int result = inflate(&_zStream, Z_SYNC_FLUSH);
+    const int produced = _chunkSize - used - _zStream.avail_out;
+    tail.resize(used + produced);
+    if (tail.isEmpty())
+        _chunks.removeLast();
+    _available += produced;
+    // A full output buffer means that inflate() might still have more data to give even without any further input
+    _pendingOutput = _zStream.avail_out == 0;
+    if (!_zStream.avail_in)
+        _inBuffer.clear();
+
+    if (result != Z_OK &&
+        result != Z_STREAM_END &&
+        result != Z_BUF_ERROR) {
+        _zStream.avail_in = 0;
+        _pendingOutput = false;
+        _inBuffer.clear();
+        return false;
+    }
+    if (!produced && _zStream.avail_in == inputBefore) {
+        // No progress at all, which means that there is nothing else to get from this stream
+        _zStream.avail_in = 0;
+        _pendingOutput = false;
+        _inBuffer.clear();
+    }
+    return true;
 }
 
 bool Rfc1951Decompressor::consume(QIODevice *in)
 {
-    while (in->bytesAvailable()) {
-        _inBuffer = in->read(_chunkSize);
+    if (in->bytesAvailable()) {
+        if (_zStream.avail_in) {
+            // Some data from the previous round are still waiting to be inflated
+            _inBuffer = QByteArray(reinterpret_cast<const char *>(_zStream.next_in), _zStream.avail_in) + in->readAll();
+        } else {
+            _inBuffer = in->readAll();
+        }
         _zStream.next_in = reinterpret_cast<Bytef*>(_inBuffer.data());
         _zStream.avail_in = _inBuffer.size();
-        do {
-            _zStream.next_out = reinterpret_cast<Bytef *>(_stagingBuffer);
-            _zStream.avail_out = _chunkSize;
-            int result = inflate(&_zStream, Z_SYNC_FLUSH);
-            if (result != Z_OK &&
-                result != Z_STREAM_END &&
-                result != Z_BUF_ERROR) {
-                return false;
-            }
-            _output.append(_stagingBuffer, _chunkSize - _zStream.avail_out);
-        } while (_zStream.avail_out == 0);
+    }
+    while (_available < _maxBuffered && hasPendingInput()) {
+        if (!inflateChunk())
+            return false;
     }
     return true;
 }
 
-bool Rfc1951Decompressor::canReadLine() const
+qint64 Rfc1951Decompressor::bytesAvailable() const
+{
+    return _available;
+}
+
+/** @short Return the offset of the first LF from the start of the buffered data, or -1
+
+Only the data which have not been scanned by a previous call are looked at. More data get inflated as needed.
+*/
+qint64 Rfc1951Decompressor::findNewline()
+{
+    while (true) {
+        qint64 chunkStart = 0;
+        for (int i = 0; i < _chunks.size(); ++i) {
+            const QByteArray &chunk = _chunks[i];
+            const int begin = i == 0 ? _headOffset : 0;
+            const qint64 chunkEnd = chunkStart + chunk.size() - begin;
+            if (chunkEnd > _scannedForNewline) {
+                const int from = begin + (_scannedForNewline - chunkStart);
+                const char *eol = static_cast<const char *>(memchr(chunk.constData() + from, '\n', chunk.size() - from));
+                if (eol) {
+                    _scannedForNewline = chunkStart + (eol - chunk.constData() - begin);
+                    return _scannedForNewline;
+                }
+                _scannedForNewline = chunkEnd;
+            }
+            chunkStart = chunkEnd;
+        }
+        if (!hasPendingInput() || !inflateChunk())
+            return -1;
+    }
+}
+
+/** @short Move @arg size bytes from the front of the buffered data to the end of @arg out */
+void Rfc1951Decompressor::take(QByteArray &out, qint64 size)
 {
-    return _output.contains('\n');
+    Q_ASSERT(size <= _available);
+    _available -= size;
+    _scannedForNewline = qMax<qint64>(0, _scannedForNewline - size);
+    while (size) {
+        QByteArray &head = _chunks.first();
+        const int n = qMin<qint64>(size, head.size() - _headOffset);
+        if (out.isEmpty() && _headOffset == 0 && n == head.size()) {
+            // Reuse the whole chunk without copying
+            out = head;
+        } else {
+            out.append(head.constData() + _headOffset, n);
+        }
+        size -= n;
+        _headOffset += n;
+        if (_headOffset == head.size()) {
+            _chunks.removeFirst();
+            _headOffset = 0;
+        }
+    }
+}
+
+bool Rfc1951Decompressor::canReadLine()
+{
+    return findNewline() != -1;
 }
 
 QByteArray Rfc1951Decompressor::readLine()
 {
-    int eolPos = _output.indexOf('\n');
+    qint64 eolPos = findNewline();
     if (eolPos == -1) {
         return QByteArray();
     }
-    
-    QByteArray result = _output.left(eolPos + 1);
-    _output = _output.mid(eolPos + 1);
+
+    QByteArray result;
+    take(result, eolPos + 1);
     return result;
 }
 
 QByteArray Rfc1951Decompressor::read(qint64 maxSize)
 {
-    QByteArray res = _output.left(maxSize);
-    _output = _output.mid(maxSize);
+    QByteArray res;
+    while (res.size() < maxSize) {
+        while (!_available && hasPendingInput()) {
+            if (!inflateChunk())
+                break;
+        }
+        if (!_available)
+            break;
+        take(res, qMin<qint64>(maxSize - res.size(), _available));
+    }
     return res;
 }
 
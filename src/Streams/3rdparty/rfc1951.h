@@ -43,6 +43,7 @@
 #define STREAMS_RFC1951_H
 
 #include <QIODevice>
+#include <QList>
 
 #include <zlib.h>
 
@@ -67,31 +68,49 @@ public:
     explicit Rfc1951Compressor(int chunkSize = 8192);
     ~Rfc1951Compressor();
 
-    bool write(QIODevice *out, QByteArray *in);
+    bool write(QIODevice *out, QByteArray *in, bool flush = true);
+    bool flush(QIODevice *out);
 
 private:
+    bool deflateInto(QIODevice *out, int flushMode);
+
+
     int _chunkSize;
     z_stream _zStream;
     char *_buffer;
 };
 
+/* The decompressed data are kept in a queue of chunks of at most _chunkSize bytes each. Consuming data from the front
+   only advances an offset into the first chunk or drops it altogether, so reading a huge literal piece-by-piece does
+   not shift the rest of the buffer around. At most _maxBuffered bytes are inflated in advance upon consume(); the rest
+   of the compressed data is only inflated when the reader asks for more. */
 class Rfc1951Decompressor
 {
 public:
-    explicit Rfc1951Decompressor(int chunkSize = 8192);
+    explicit Rfc1951Decompressor(int chunkSize = 8192, int maxBuffered = 256 * 1024);
     ~Rfc1951Decompressor();
 
     bool consume(QIODevice *in);
-    bool canReadLine() const;
+    bool canReadLine();
     QByteArray readLine();
     QByteArray read(qint64 maxSize);
+    qint64 bytesAvailable() const;
 
 private:
+    bool hasPendingInput() const;
+    bool inflateChunk();
+    qint64 findNewline();
+    void take(QByteArray &out, qint64 size);
+
     int _chunkSize;
+    int _maxBuffered;
     z_stream _zStream;
     QByteArray _inBuffer;
-    char *_stagingBuffer;
-    QByteArray _output;
+    bool _pendingOutput;
+    QList<QByteArray> _chunks;
+    int _headOffset;
+    qint64 _available;
+    qint64 _scannedForNewline;
 };
 
 }
@@ -26,7 +26,7 @@
 
 namespace Streams {
 
-FakeSocket::FakeSocket(const Imap::ConnectionState initialState): m_initialState(initialState)
+FakeSocket::FakeSocket(const Imap::ConnectionState initialState): m_initialState(initialState), m_writeCount(0)
 {
     readChannel = new QBuffer(&r, this);
     readChannel->open(QIODevice::ReadWrite);
@@ -105,9 +105,15 @@ QByteArray FakeSocket::readLine(qint64 maxSize)
 
 qint64 FakeSocket::write(const QByteArray &byteArray)
 {
+    ++m_writeCount;
     return writeChannel->write(byteArray);
 }
 
+int FakeSocket::writeCount() const
+{
+    return m_writeCount;
+}
+
 void FakeSocket::startTls()
 {
     // fake it
@@ -53,6 +53,9 @@ public:
     /** @short Return data written since the last call to this function */
     QByteArray writtenStuff();
 
+    /** @short Number of calls to write() so far */
+    int writeCount() const;
+
 private slots:
     /** @short Delayed informing about being connected */
     void slotEmitConnected();
@@ -77,6 +80,7 @@ private:
     QByteArray r, w;
 
     Imap::ConnectionState m_initialState;
+    int m_writeCount;
 
     FakeSocket(const FakeSocket &); // don't implement
     FakeSocket &operator=(const FakeSocket &); // don't implement
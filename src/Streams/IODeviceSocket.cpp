@@ -36,7 +36,8 @@
 
 namespace Streams {
 
-IODeviceSocket::IODeviceSocket(QIODevice *device): d(device), m_compressor(0), m_decompressor(0)
+IODeviceSocket::IODeviceSocket(QIODevice *device): d(device), m_compressor(0), m_decompressor(0),
+    m_deflateFlushPending(false)
 {
     connect(d, &QIODevice::readyRead, this, &IODeviceSocket::handleReadyRead);
     connect(d, &QIODevice::readChannelFinished, this, &IODeviceSocket::handleStateChanged);
@@ -90,7 +91,12 @@ qint64 IODeviceSocket::write(const QByteArray &byteArray)
 {
 #if TROJITA_COMPRESS_DEFLATE
     if (m_compressor) {
-        m_compressor->write(d, &const_cast<QByteArray&>(byteArray));
+        // Commands which are written during the same event loop iteration share a single sync flush
+        m_compressor->write(d, &const_cast<QByteArray&>(byteArray), false);
+        if (!m_deflateFlushPending) {
+            m_deflateFlushPending = true;
+            EMIT_LATER_NOARG(this, flushDeflate);
+        }
         return byteArray.size();
     }
 #endif
@@ -137,6 +143,16 @@ void IODeviceSocket::emitError()
     emit disconnected(disconnectedMessage);
 }
 
+void IODeviceSocket::flushDeflate()
+{
+#if TROJITA_COMPRESS_DEFLATE
+    if (m_compressor && m_deflateFlushPending) {
+        m_compressor->flush(d);
+    }
+#endif
+    m_deflateFlushPending = false;
+}
+
 ProcessSocket::ProcessSocket(QProcess *proc, const QString &executable, const QStringList &args):
     IODeviceSocket(proc), executable(executable), args(args)
 {
@@ -237,8 +253,13 @@ SslTlsSocket::SslTlsSocket(QSslSocket *sock, const QString &host, const quint16
     // but there is no way of enabling compression back again.
     QSslConfiguration sslConf = sock->sslConfiguration();
     sslConf.setSslOption(QSsl::SslOptionDisableCompression, false);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    // Make the session ticket available, so that the next connection to the same server can skip the full handshake
+    sslConf.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+#endif
     sock->setSslConfiguration(sslConf);
 
+    connect(sock, &QSslSocket::encrypted, this, &SslTlsSocket::rememberTlsSession);
     connect(sock, &QSslSocket::encrypted, this, &Socket::encrypted);
     connect(sock, &QAbstractSocket::stateChanged, this, &SslTlsSocket::handleStateChanged);
     connect(sock, static_cast<void (QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
@@ -251,6 +272,32 @@ void SslTlsSocket::setProxySettings(const ProxySettings proxySettings, const QSt
     m_protocolTag = protocolTag;
 }
 
+void SslTlsSocket::setTlsSessionCache(const std::shared_ptr<TlsSession> &session)
+{
+    m_tlsSession = session;
+}
+
+void SslTlsSocket::rememberTlsSession()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    QSslSocket *sock = qobject_cast<QSslSocket *>(d);
+    Q_ASSERT(sock);
+    if (m_tlsSession) {
+        QList<QSslCertificate> chain = sock->peerCertificateChain();
+        if (!chain.isEmpty()) {
+            m_tlsSession->peerChain = chain;
+        } else if (m_tlsSession->peerChain.isEmpty() || m_tlsSession->peerChain.first() != sock->peerCertificate()) {
+            // There's no chain to check the SSL policy against, so the next connection shall go through a full handshake
+            *m_tlsSession = TlsSession();
+            return;
+        }
+        QByteArray ticket = sock->sslConfiguration().sessionTicket();
+        if (!ticket.isEmpty())
+            m_tlsSession->ticket = ticket;
+    }
+#endif
+}
+
 void SslTlsSocket::close()
 {
     QSslSocket *sock = qobject_cast<QSslSocket*>(d);
@@ -388,6 +435,15 @@ void SslTlsSocket::delayedStart()
         break;
     }
 
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    if (m_tlsSession && !m_tlsSession->ticket.isEmpty()) {
+        // This also covers a STARTTLS which comes later on, the configuration is kept until then
+        QSslConfiguration sslConf = sock->sslConfiguration();
+        sslConf.setSessionTicket(m_tlsSession->ticket);
+        sock->setSslConfiguration(sslConf);
+    }
+#endif
+
     if (startEncrypted)
         sock->connectToHostEncrypted(host, port);
     else
@@ -398,7 +454,13 @@ QList<QSslCertificate> SslTlsSocket::sslChain() const
 {
     QSslSocket *sock = qobject_cast<QSslSocket *>(d);
     Q_ASSERT(sock);
-    return sock->peerCertificateChain();
+    QList<QSslCertificate> chain = sock->peerCertificateChain();
+    if (chain.isEmpty() && m_tlsSession && !m_tlsSession->peerChain.isEmpty()
+            && m_tlsSession->peerChain.first() == sock->peerCertificate()) {
+        // A resumed session might not carry the whole chain; the SSL policy shall not see an empty one, though
+        chain = m_tlsSession->peerChain;
+    }
+    return chain;
 }
 
 QList<QSslError> SslTlsSocket::sslErrors() const
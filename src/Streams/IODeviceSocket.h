@@ -55,10 +55,12 @@ private slots:
     virtual void delayedStart() = 0;
     virtual void handleReadyRead();
     void emitError();
+    void flushDeflate();
 protected:
     QIODevice *d;
     Rfc1951Compressor *m_compressor;
     Rfc1951Decompressor *m_decompressor;
+    bool m_deflateFlushPending;
     QTimer *delayedDisconnect;
     QString disconnectedMessage;
 };
@@ -97,16 +99,20 @@ public:
     virtual QList<QSslError> sslErrors() const;
     bool isConnectingEncryptedSinceStart() const;
     virtual void close();
+    /** @short Try to resume the TLS session stored in @arg session, and store the one which this socket negotiates there */
+    void setTlsSessionCache(const std::shared_ptr<TlsSession> &session);
 private slots:
     void handleStateChanged();
     void handleSocketError(QAbstractSocket::SocketError);
     void delayedStart();
+    void rememberTlsSession();
 private:
     bool startEncrypted;
     QString host;
     quint16 port;
     QString m_protocolTag;
     ProxySettings m_proxySettings;
+    std::shared_ptr<TlsSession> m_tlsSession;
 };
 
 };
@@ -62,7 +62,7 @@ void ProcessSocketFactory::setProxySettings(const ProxySettings proxySettings, c
 }
 
 SslSocketFactory::SslSocketFactory(const QString &host, const quint16 port):
-    host(host), port(port)
+    host(host), port(port), m_tlsSession(std::make_shared<TlsSession>())
 {
 }
 
@@ -77,12 +77,13 @@ Socket *SslSocketFactory::create()
     QSslSocket *sslSock = new QSslSocket();
     SslTlsSocket *sock = new SslTlsSocket(sslSock, host, port, true);
     sock->setProxySettings(m_proxySettings, m_protocolTag);
+    sock->setTlsSessionCache(m_tlsSession);
     return sock;
 }
 
 
 TlsAbleSocketFactory::TlsAbleSocketFactory(const QString &host, const quint16 port):
-    host(host), port(port)
+    host(host), port(port), m_tlsSession(std::make_shared<TlsSession>())
 {
 }
 
@@ -97,6 +98,7 @@ Socket *TlsAbleSocketFactory::create()
     QSslSocket *sslSock = new QSslSocket();
     SslTlsSocket *sock = new SslTlsSocket(sslSock, host, port);
     sock->setProxySettings(m_proxySettings, m_protocolTag);
+    sock->setTlsSessionCache(m_tlsSession);
     return sock;
 }
 
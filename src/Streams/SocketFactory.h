@@ -23,7 +23,9 @@
 #ifndef STREAMS_SOCKETFACTORY_H
 #define STREAMS_SOCKETFACTORY_H
 
+#include <memory>
 #include <QPointer>
+#include <QSslCertificate>
 #include <QStringList>
 #include "Socket.h"
 
@@ -36,6 +38,18 @@ enum class ProxySettings
     DirectConnect,      /**< @short Connect without using any Proxy Settings */
 };
 
+/** @short A TLS session which all sockets manufactured by the same factory try to resume */
+struct TlsSession
+{
+    /** @short Session ticket as negotiated by the last connection */
+    QByteArray ticket;
+    /** @short The server's certificate chain as presented during the last full handshake
+
+    A resumed session doesn't necessarily get to see the whole chain again, but the SSL policy is still checked against it.
+    */
+    QList<QSslCertificate> peerChain;
+};
+
 /** @short Abstract interface for creating new socket that is somehow connected
  * to the IMAP server */
 class SocketFactory: public QObject
@@ -80,6 +94,8 @@ class SslSocketFactory: public SocketFactory
     ProxySettings m_proxySettings;
     /** @short Protocol for the requested connection */
     QString m_protocolTag;
+    /** @short TLS session shared by all sockets manufactured by this factory */
+    std::shared_ptr<TlsSession> m_tlsSession;
 public:
     SslSocketFactory(const QString &host, const quint16 port);
     virtual void setProxySettings(const Streams::ProxySettings proxySettings, const QString &protocolTag);
@@ -98,6 +114,8 @@ class TlsAbleSocketFactory: public SocketFactory
     ProxySettings m_proxySettings;
     /** @short Protocol for the requested connection */
     QString m_protocolTag;
+    /** @short TLS session shared by all sockets manufactured by this factory */
+    std::shared_ptr<TlsSession> m_tlsSession;
 public:
     TlsAbleSocketFactory(const QString &host, const quint16 port);
     virtual void setProxySettings(const Streams::ProxySettings proxySettings, const QString &protocolTag);
@@ -83,6 +83,11 @@ void XtCache::setUidMapping( const QString& mailbox, const QList<uint>& seqToUid
     _sqlCache->setUidMapping( mailbox, seqToUid );
 }
 
+void XtCache::updateUidMapping( const QString& mailbox, const Imap::Uids& removed, const Imap::Uids& added )
+{
+    _sqlCache->updateUidMapping( mailbox, removed, added );
+}
+
 void XtCache::clearUidMapping( const QString& mailbox )
 {
     _sqlCache->clearUidMapping( mailbox );
@@ -112,6 +117,12 @@ void XtCache::setMsgFlags( const QString& mailbox, uint uid, const QStringList&
     Q_UNUSED(flags);
 }
 
+QHash<uint, QStringList> XtCache::msgFlagsForMailbox( const QString& mailbox ) const
+{
+    Q_UNUSED(mailbox);
+    return QHash<uint, QStringList>();
+}
+
 XtCache::MessageDataBundle XtCache::messageMetadata( const QString& mailbox, uint uid ) const
 {
     Q_UNUSED(mailbox);
@@ -187,4 +198,14 @@ void XtCache::setRenewalThreshold(const int days)
     Q_UNUSED(days);
 }
 
+void XtCache::setPartCacheBudget(const qint64 bytes)
+{
+    Q_UNUSED(bytes);
+}
+
+Imap::Mailbox::AbstractCache::Statistics XtCache::statistics() const
+{
+    return Statistics();
+}
+
 }
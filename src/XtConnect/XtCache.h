@@ -69,6 +69,7 @@ public:
     virtual void setMailboxSyncState( const QString& mailbox, const Imap::Mailbox::SyncState& state );
 
     virtual void setUidMapping( const QString& mailbox, const QList<uint>& seqToUid );
+    virtual void updateUidMapping( const QString& mailbox, const Imap::Uids& removed, const Imap::Uids& added );
     virtual void clearUidMapping( const QString& mailbox );
     virtual QList<uint> uidMapping( const QString& mailbox ) const;
 
@@ -82,6 +83,8 @@ public:
     virtual QStringList msgFlags( const QString& mailbox, uint uid ) const;
     /** @short Returns no data */
     virtual void setMsgFlags( const QString& mailbox, uint uid, const QStringList& flags );
+    /** @short Returns no data */
+    virtual QHash<uint, QStringList> msgFlagsForMailbox( const QString& mailbox ) const;
 
     /** @short ALways returns an empty QByteArray */
     virtual QByteArray messagePart( const QString& mailbox, uint uid, const QString& partId ) const;
@@ -98,6 +101,9 @@ public:
 
     void setRenewalThreshold(const int days);
 
+    virtual void setPartCacheBudget(const qint64 bytes);
+    virtual Statistics statistics() const;
+
     /** @short Saving status of a message */
     typedef enum {
         STATE_SAVED, /**< Message has been already saved into the DB */
@@ -0,0 +1,199 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QElapsedTimer>
+#include <QTest>
+#include "Imap/Parser/Parser.h"
+#include "Streams/FakeSocket.h"
+
+#include "bench_Imap_Parser.h"
+
+void ImapParserBenchmark::init()
+{
+    socket = new Streams::FakeSocket(Imap::CONN_STATE_AUTHENTICATED);
+    parser = new Imap::Parser(this, socket, 666);
+}
+
+void ImapParserBenchmark::cleanup()
+{
+    // The parser owns the socket
+    delete parser;
+    parser = 0;
+    socket = 0;
+    QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+}
+
+/** @short Push the whole transcript through the parser, drain all responses and report the throughput */
+void ImapParserBenchmark::feed(const QByteArray &transcript, const int expectedResponses)
+{
+    QElapsedTimer timer;
+    qint64 nsecs = 0;
+    qint64 bytes = 0;
+    qint64 responses = 0;
+
+    QBENCHMARK {
+        timer.start();
+        socket->fakeReading(transcript);
+        parser->handleReadyRead();
+        int count = 0;
+        while (parser->hasResponse()) {
+            parser->getResponse();
+            ++count;
+        }
+        nsecs += timer.nsecsElapsed();
+        QCOMPARE(count, expectedResponses);
+        bytes += transcript.size();
+        responses += count;
+    }
+
+    if (nsecs > 0) {
+        const double secs = nsecs / 1e9;
+        qDebug("%.1f MB/s, %.0f responses/s", bytes / secs / (1024 * 1024), responses / secs);
+    }
+}
+
+void ImapParserBenchmark::benchmarkFetchFlagsStorm()
+{
+    const int numMessages = 100000;
+    QByteArray transcript;
+    transcript.reserve(numMessages * 64);
+    for (int i = 1; i <= numMessages; ++i) {
+        transcript += "* " + QByteArray::number(i) + " FETCH (UID " + QByteArray::number(i * 3) + " FLAGS (";
+        switch (i % 4) {
+        case 0:
+            transcript += "\\Seen";
+            break;
+        case 1:
+            transcript += "\\Seen \\Answered $Forwarded";
+            break;
+        case 2:
+            transcript += "\\Flagged $NotJunk keyword" + QByteArray::number(i % 7);
+            break;
+        default:
+            break;
+        }
+        transcript += "))\r\n";
+    }
+    feed(transcript, numMessages);
+}
+
+void ImapParserBenchmark::benchmarkEnvelopeBodyStructure()
+{
+    const int numMessages = 5000;
+    QByteArray transcript;
+    for (int i = 1; i <= numMessages; ++i) {
+        transcript += "* " + QByteArray::number(i) + " FETCH (UID " + QByteArray::number(i + 1000) +
+            " RFC822.SIZE " + QByteArray::number(1200 + i) + " INTERNALDATE \"6-Apr-1981 12:03:32 -0630\" ENVELOPE ("
+            "\"Wed, 17 Jul 1996 02:23:25 -0700 (PDT)\" "
+            "\"IMAP4rev1 WG mtg summary and minutes #" + QByteArray::number(i) + "\" "
+            "((\"Terry Gray\" NIL \"gray\" \"cac.washington.edu\")) "
+            "((\"Terry Gray\" NIL \"gray\" \"cac.washington.edu\")) "
+            "((\"Terry Gray\" NIL \"gray\" \"cac.washington.edu\")) "
+            "((NIL NIL \"imap\" \"cac.washington.edu\")) "
+            "((NIL NIL \"minutes\" \"CNRI.Reston.VA.US\") "
+            "(\"John Klensin\" NIL \"KLENSIN\" \"MIT.EDU\")) NIL NIL "
+            "\"<B27397-" + QByteArray::number(i) + "@cac.washington.edu>\") "
+            "BODYSTRUCTURE ((\"text\" \"plain\" "
+            "(\"charset\" \"US-ASCII\" \"delsp\" \"yes\" \"format\" \"flowed\") "
+            "NIL NIL \"7bit\" 990 27 NIL NIL NIL)"
+            "(\"application\" \"pgp-signature\" (\"x-mac-type\" \"70674453\" \"name\" \"PGP.sig\") NIL "
+            "\"This is a digitally signed message part\" \"7bit\" 193 NIL (\"inline\" "
+            "(\"filename\" \"PGP.sig\")) NIL) \"signed\" (\"protocol\" "
+            "\"application/pgp-signature\" \"micalg\" \"pgp-sha1\" \"boundary\" "
+            "\"Apple-Mail-10--856231115\") NIL NIL))\r\n";
+    }
+    feed(transcript, numMessages);
+}
+
+void ImapParserBenchmark::benchmarkLargeLiterals()
+{
+    QFETCH(qint64, spoolThreshold);
+
+    parser->setLiteralSpoolThreshold(spoolThreshold);
+
+    const int numMessages = 8;
+    const int size = 4 * 1024 * 1024;
+    QByteArray payload;
+    payload.reserve(size);
+    while (payload.size() < size)
+        payload += "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt.\r\n";
+    payload.truncate(size);
+
+    QByteArray transcript;
+    transcript.reserve(numMessages * (size + 64));
+    for (int i = 1; i <= numMessages; ++i) {
+        transcript += "* " + QByteArray::number(i) + " FETCH (UID " + QByteArray::number(i) + " BODY[] {" +
+            QByteArray::number(size) + "}\r\n" + payload + ")\r\n";
+    }
+    feed(transcript, numMessages);
+}
+
+void ImapParserBenchmark::benchmarkLargeLiterals_data()
+{
+    QTest::addColumn<qint64>("spoolThreshold");
+    QTest::newRow("in-memory") << qint64(0);
+    QTest::newRow("spooled") << qint64(1024 * 1024);
+}
+
+void ImapParserBenchmark::benchmarkThreadEsearch()
+{
+    const int numThreads = 20000;
+    QByteArray thread = "* THREAD ";
+    for (int i = 0; i < numThreads; ++i) {
+        const QByteArray base = QByteArray::number(i * 5 + 1);
+        switch (i % 3) {
+        case 0:
+            thread += "(" + base + ")";
+            break;
+        case 1:
+            thread += "(" + base + " " + QByteArray::number(i * 5 + 2) + " " + QByteArray::number(i * 5 + 3) + ")";
+            break;
+        default:
+            thread += "(" + base + " (" + QByteArray::number(i * 5 + 2) + ")(" + QByteArray::number(i * 5 + 3) +
+                " " + QByteArray::number(i * 5 + 4) + "))";
+            break;
+        }
+    }
+    thread += "\r\n";
+
+    QByteArray esearch = "* ESEARCH (TAG \"y01\") UID COUNT 60000 ALL ";
+    for (int i = 0; i < 20000; ++i) {
+        if (i)
+            esearch += ',';
+        if (i % 2) {
+            esearch += QByteArray::number(i * 7);
+        } else {
+            esearch += QByteArray::number(i * 7) + ':' + QByteArray::number(i * 7 + 4);
+        }
+    }
+    esearch += "\r\n";
+
+    const int repeat = 10;
+    QByteArray transcript;
+    for (int i = 0; i < repeat; ++i) {
+        transcript += thread;
+        transcript += esearch;
+    }
+    feed(transcript, 2 * repeat);
+}
+
+QTEST_GUILESS_MAIN(ImapParserBenchmark)
@@ -0,0 +1,66 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BENCH_IMAP_PARSER
+#define BENCH_IMAP_PARSER
+
+#include <QObject>
+
+namespace Imap {
+class Parser;
+}
+
+namespace Streams {
+class FakeSocket;
+}
+
+/** @short Throughput benchmarks of the Imap::Parser and the Imap::Responses
+
+The server transcripts are fed through a Streams::FakeSocket, so the whole pipeline from reading the lines and literals
+up to the construction of the Responses::* objects is measured.  Apart from the usual QBENCHMARK output, each benchmark
+reports its throughput in MB/s and responses/s.
+*/
+class ImapParserBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void init();
+    void cleanup();
+
+    /** @short Lots of small FETCH FLAGS responses, such as after a SELECT of a big mailbox */
+    void benchmarkFetchFlagsStorm();
+    /** @short Metadata of messages as fetched during the mailbox sync */
+    void benchmarkEnvelopeBodyStructure();
+    /** @short Downloads of big message bodies */
+    void benchmarkLargeLiterals();
+    void benchmarkLargeLiterals_data();
+    /** @short THREAD and ESEARCH responses with many UIDs */
+    void benchmarkThreadEsearch();
+
+private:
+    void feed(const QByteArray &transcript, const int expectedResponses);
+
+    Streams::FakeSocket *socket;
+    Imap::Parser *parser;
+};
+
+#endif
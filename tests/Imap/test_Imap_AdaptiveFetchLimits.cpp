@@ -0,0 +1,95 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTest>
+#include "test_Imap_AdaptiveFetchLimits.h"
+#include "Imap/Model/AdaptiveFetchLimits.h"
+
+using namespace Imap::Mailbox;
+
+/** @short The limits grow step by step while the FETCHes finish in time */
+void ImapAdaptiveFetchLimitsTest::testAdditiveIncrease()
+{
+    AdaptiveFetchLimits limits;
+    limits.seed(1024 * 1024, 300, 10);
+    limits.setTargetLatency(1000);
+    QVERIFY(limits.isSeeded());
+    QCOMPARE(limits.smoothedRtt(), -1);
+
+    // Something else than a FETCH is only measured
+    QVERIFY(!limits.addSample(20, 100, false));
+    QCOMPARE(limits.messagesPerGroup(), 300);
+    QCOMPARE(limits.smoothedRtt(), 20);
+
+    for (int i = 0; i < 4; ++i) {
+        QVERIFY(limits.addSample(100, 8 * 1024, true));
+    }
+    QCOMPARE(limits.messagesPerGroup(), 400);
+    QCOMPARE(limits.bytesPerGroup(), uint(1024 * 1024 + 4 * 128 * 1024));
+    QCOMPARE(limits.parallelTasks(), 11);
+    QCOMPARE(limits.minimalRtt(), 20);
+    QCOMPARE(limits.samples(), 5);
+    // The responses were too small for estimating the throughput
+    QCOMPARE(limits.throughput(), quint64(0));
+
+    // Seeding once again does not throw the history away
+    limits.seed(1, 1, 1);
+    QCOMPARE(limits.messagesPerGroup(), 400);
+}
+
+/** @short A slow FETCH cuts the limits in half, down to a sane minimum */
+void ImapAdaptiveFetchLimitsTest::testMultiplicativeDecrease()
+{
+    AdaptiveFetchLimits limits;
+    limits.seed(1024 * 1024, 300, 10);
+    limits.setTargetLatency(1000);
+
+    QVERIFY(limits.addSample(1500, 1000, true));
+    QCOMPARE(limits.messagesPerGroup(), 150);
+    QCOMPARE(limits.bytesPerGroup(), uint(512 * 1024));
+    QCOMPARE(limits.parallelTasks(), 5);
+
+    for (int i = 0; i < 10; ++i) {
+        limits.addSample(1500, 1000, true);
+    }
+    QCOMPARE(limits.messagesPerGroup(), 10);
+    QCOMPARE(limits.bytesPerGroup(), uint(64 * 1024));
+    QCOMPARE(limits.parallelTasks(), 1);
+    QVERIFY(!limits.addSample(1500, 1000, true));
+}
+
+/** @short A group is never bigger than what the link can deliver within the target latency */
+void ImapAdaptiveFetchLimitsTest::testThroughputCap()
+{
+    AdaptiveFetchLimits limits;
+    limits.seed(1024 * 1024, 300, 10);
+    limits.setTargetLatency(1000);
+
+    QVERIFY(limits.addSample(500, 50 * 1024, true));
+    QCOMPARE(limits.throughput(), quint64(100 * 1024));
+    QCOMPARE(limits.bytesPerGroup(), uint(100 * 1024));
+    // The number of messages is not limited by the throughput
+    QCOMPARE(limits.messagesPerGroup(), 325);
+    QCOMPARE(limits.smoothedRtt(), 500);
+}
+
+QTEST_GUILESS_MAIN(ImapAdaptiveFetchLimitsTest)
@@ -553,4 +553,78 @@ void BodyPartsTest::testBinaryFallback()
     }
 }
 
+/** @short Check that the responses are routed to the tasks which wait for them without probing all other tasks */
+void BodyPartsTest::testResponseRouting()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    helperSyncBNoMessages();
+    cServer("* 1 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 1:* (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 333 FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    QModelIndex msg = msgListB.child(0, 0);
+    QVERIFY(msg.isValid());
+    QCOMPARE(model->rowCount(msg), 0);
+    cClient(t.mk("UID FETCH 333 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 333 BODYSTRUCTURE (" + bsManyPlaintexts + "))\r\n" + t.last("OK fetched\r\n"));
+    QModelIndex rootMultipart = msg.child(0, 0);
+    QVERIFY(rootMultipart.isValid());
+    QCOMPARE(model->rowCount(rootMultipart), 5);
+
+    // Each part is requested separately, so there's a FetchMsgPartTask for each of them
+    QList<QByteArray> tags;
+    for (int n = 0; n < 5; ++n) {
+        QCOMPARE(rootMultipart.child(n, 0).data(RolePartData).toByteArray(), QByteArray());
+        cClient(t.mk(QStringLiteral("UID FETCH 333 (BODY.PEEK[%1])\r\n").arg(n + 1).toUtf8().constData()));
+        tags << t.last();
+    }
+
+    const Imap::Mailbox::ParserState &state = singleParserState();
+    cServer("* 1 FETCH (UID 333 BODY[1] \"" + QByteArray("one").toBase64() + "\")\r\n");
+    for (int n = 1; n < 5; ++n) {
+        // Once a task has accepted a FETCH, the following ones go straight to it
+        const quint64 probes = state.plugProbes;
+        cServer(QStringLiteral("* 1 FETCH (UID 333 BODY[%1] \"%2\")\r\n").arg(QString::number(n + 1),
+                                                                           QString::fromUtf8(QByteArray("part").toBase64())).toUtf8());
+        QCOMPARE(state.plugProbes, probes + 1);
+    }
+    for (int n = 4; n >= 0; --n) {
+        // The tagged responses go directly to the task which has sent the command, no matter where it's in the queue
+        const quint64 probes = state.plugProbes;
+        cServer(tags[n] + " OK fetched\r\n");
+        QCOMPARE(state.plugProbes, probes + 1);
+    }
+    QCOMPARE(rootMultipart.child(0, 0).data(RolePartData).toByteArray(), QByteArray("one"));
+    QCOMPARE(rootMultipart.child(4, 0).data(RolePartData).toByteArray(), QByteArray("part"));
+    justKeepTask();
+    cEmpty();
+}
+
+/** @short Check that a part whose payload got spooled by the Parser is decoded upon access and cached properly */
+void BodyPartsTest::testSpooledPart()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    helperSyncBNoMessages();
+    singleParserState().parser->setLiteralSpoolThreshold(10);
+    cServer("* 1 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 1:* (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 333 FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    QModelIndex msg = msgListB.child(0, 0);
+    QVERIFY(msg.isValid());
+    QCOMPARE(model->rowCount(msg), 0);
+    cClient(t.mk("UID FETCH 333 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 333 BODYSTRUCTURE (" + bsManyPlaintexts + "))\r\n" + t.last("OK fetched\r\n"));
+    QModelIndex part = msg.child(0, 0).child(0, 0);
+    QVERIFY(part.isValid());
+
+    QCOMPARE(part.data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 333 (BODY.PEEK[1])\r\n"));
+    const QByteArray fakePartData = QByteArray("this is long enough to get spooled").toBase64();
+    cServer("* 1 FETCH (UID 333 BODY[1] {" + QByteArray::number(fakePartData.size()) + "}\r\n" + fakePartData + ")\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(part.data(RolePartData).toByteArray(), QByteArray("this is long enough to get spooled"));
+    QCOMPARE(model->cache()->messagePart("b", 333, "1"), QByteArray("this is long enough to get spooled"));
+    justKeepTask();
+    cEmpty();
+}
+
 QTEST_GUILESS_MAIN(BodyPartsTest)
@@ -43,6 +43,8 @@ private slots:
     void testFilenameExtraction_data();
 
     void testBinaryFallback();
+    void testResponseRouting();
+    void testSpooledPart();
 };
 
 #endif
@@ -166,4 +166,47 @@ void CopyAndFlagTest::testUpdateAllFlags()
     justKeepTask();
 }
 
+/** @short Make sure that the flags survive even when there are more of them than what fits into the FlagsDictionary */
+void CopyAndFlagTest::testManyKeywords()
+{
+    existsA = 2;
+    uidNextA = 3;
+    uidValidityA = 666;
+    for (uint i = 1; i <= existsA; ++i)
+        uidMapA << i;
+
+    QStringList keywords;
+    for (int i = 0; i < 80; ++i)
+        keywords << QStringLiteral("kw%1").arg(i);
+    QStringList seenAndLast = QStringList() << QStringLiteral("\\Seen") << keywords.last();
+
+    QCOMPARE(model->rowCount(msgListA), 0);
+    cClient(t.mk("SELECT a\r\n"));
+    cServer("* 2 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] UIDs valid\r\n"
+            "* OK [UIDNEXT 3] Predicted next UID\r\n"
+            + t.last("OK selected\r\n"));
+    cClient(t.mk("UID SEARCH ALL\r\n"));
+    cServer("* SEARCH 1 2\r\n" + t.last("OK search\r\n"));
+    cClient(t.mk("FETCH 1:2 (FLAGS)\r\n"));
+    cServer("* 1 FETCH (FLAGS (" + keywords.join(QStringLiteral(" ")).toUtf8() + "))\r\n"
+            "* 2 FETCH (FLAGS (\\Seen " + keywords.last().toUtf8() + "))\r\n"
+            + t.last("OK fetched\r\n"));
+    helperCheckCache();
+    helperVerifyUidMapA();
+
+    QStringList sortedKeywords = keywords;
+    sortedKeywords.sort();
+    QCOMPARE(msgListA.child(0, 0).data(RoleMessageFlags).toStringList(), sortedKeywords);
+    QVERIFY(!msgListA.child(0, 0).data(RoleMessageIsMarkedRead).toBool());
+    QCOMPARE(model->cache()->msgFlags(QStringLiteral("a"), 1), sortedKeywords);
+    QCOMPARE(msgListA.child(1, 0).data(RoleMessageFlags).toStringList(), seenAndLast);
+    QVERIFY(msgListA.child(1, 0).data(RoleMessageIsMarkedRead).toBool());
+    QCOMPARE(model->rowCount(msgListA), 2);
+    QCOMPARE(idxA.data(RoleUnreadMessageCount).toInt(), 1);
+
+    cEmpty();
+    justKeepTask();
+}
+
 QTEST_GUILESS_MAIN(CopyAndFlagTest)
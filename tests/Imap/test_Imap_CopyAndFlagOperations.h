@@ -40,6 +40,7 @@ private slots:
     void testMoveRfcMove();
 
     void testUpdateAllFlags();
+    void testManyKeywords();
 };
 
 #endif
@@ -21,8 +21,12 @@
 */
 
 #include <QBuffer>
+#include <QDataStream>
 #include <QFile>
+#include <QSignalSpy>
 #include <QTest>
+#include "Imap/Parser/LiteralSink.h"
+#include "Imap/Parser/LowLevelParser.h"
 #include "Imap/Parser/Message.h"
 #include "Streams/FakeSocket.h"
 
@@ -189,6 +193,17 @@ void ImapParserParseTest::testParseUntagged()
     Q_ASSERT( response );
     QSharedPointer<Imap::Responses::AbstractResponse> r = parser->parseUntagged( line );
     if ( Imap::Responses::Fetch* fetchResult = dynamic_cast<Imap::Responses::Fetch*>( r.data() ) ) {
+        auto serialized = fetchResult->data.constFind("x-trojita-bodystructure");
+        if (serialized != fetchResult->data.constEnd()) {
+            // The cached form has to restore exactly the same structure
+            auto bodyStructure = fetchResult->data.constFind("BODYSTRUCTURE");
+            if (bodyStructure == fetchResult->data.constEnd())
+                bodyStructure = fetchResult->data.constFind("BODY");
+            QVERIFY(bodyStructure != fetchResult->data.constEnd());
+            QByteArray blob = dynamic_cast<const Imap::Responses::RespData<QByteArray>&>(**serialized).data;
+            QCOMPARE(*Imap::Message::AbstractMessage::fromSerialized(blob),
+                     static_cast<const Imap::Responses::AbstractData&>(**bodyStructure));
+        }
         fetchResult->data.remove( "x-trojita-bodystructure" );
     }
 #if 0// qDebug()'s internal buffer is too small to be useful here, that's why QCOMPARE's normal dumping is not enough
@@ -202,6 +217,33 @@ void ImapParserParseTest::testParseUntagged()
     QCOMPARE( *r, *response );
 }
 
+/** @short Make sure that the BODYSTRUCTURE stored in the cache by older versions remains readable */
+void ImapParserParseTest::testLegacyBodyStructureSerialization()
+{
+    QByteArray line = "((\"text\" \"plain\" (\"chaRset\" \"us-ASCII\") NIL \"foo\" \"7bit\" 3 1 NIL NIL NIL)"
+            "(\"message\" \"rfc822\" NIL NIL NIL \"8bit\" 1337 (NIL \"subj\" NIL NIL NIL NIL NIL NIL NIL \"<msg@id>\") "
+            "(\"text\" \"html\" NIL NIL NIL \"base64\" 10 2) 42) \"mixed\" (\"boundary\" \"x\") NIL NIL)";
+    int start = 0;
+    QVariantList list = Imap::LowLevelParser::parseList('(', ')', line, start);
+    QByteArray legacy;
+    QDataStream stream(&legacy, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << list;
+
+    start = 0;
+    auto parsed = Imap::Message::AbstractMessage::fromLine(line, start);
+    QCOMPARE(start, line.size());
+    QCOMPARE(*Imap::Message::AbstractMessage::fromSerialized(legacy), static_cast<const Imap::Responses::AbstractData&>(*parsed));
+    QCOMPARE(*Imap::Message::AbstractMessage::fromSerialized(parsed->serialize()), static_cast<const Imap::Responses::AbstractData&>(*parsed));
+    QVERIFY(parsed->serialize().size() < legacy.size());
+    try {
+        Imap::Message::AbstractMessage::fromSerialized(parsed->serialize().left(10));
+        QFAIL("Truncated data were accepted");
+    } catch (Imap::ParserException &) {
+        // that's expected
+    }
+}
+
 void ImapParserParseTest::testParseUntagged_data()
 {
     using namespace Imap::Responses;
@@ -1102,6 +1144,90 @@ void ImapParserParseTest::testParseFetchGarbageWithoutExceptions_data()
                           "\"ZZZ.XML\" \"BASE64\" NIL NIL) \"MIXED\"))\r\n");
 }
 
+void ImapParserParseTest::testSpooledLiterals()
+{
+    using namespace Imap::Responses;
+
+    Streams::FakeSocket *sock = new Streams::FakeSocket(Imap::CONN_STATE_CONNECTED_PRETLS_PRECAPS);
+    Imap::Parser spoolingParser(0, sock, 667);
+    spoolingParser.setLiteralSpoolThreshold(10);
+    QSignalSpy spooledSpy(&spoolingParser, SIGNAL(spooledLiteralReceived(Imap::Parser*,qint64)));
+
+    // The first literal is big enough to get spooled, the second one is not
+    sock->fakeReading("* 1 FETCH (UID 3 BODY[1] {20}\r\n0123456789abcdefghij BINARY[2] {3}\r\nabc)\r\n");
+    spoolingParser.handleReadyRead();
+    QVERIFY(spoolingParser.hasResponse());
+    QSharedPointer<AbstractResponse> resp = spoolingParser.getResponse();
+    QSharedPointer<Fetch> fetch = resp.dynamicCast<Fetch>();
+    QVERIFY(fetch);
+    QVERIFY(dynamic_cast<const RespData<QSharedPointer<Imap::LiteralSink> >*>(fetch->data["BODY[1]"].data()));
+    QVERIFY(dynamic_cast<const RespData<QByteArray>*>(fetch->data["BINARY[2]"].data()));
+    QCOMPARE(Fetch::payload(*fetch->data["BODY[1]"]), QByteArray("0123456789abcdefghij"));
+    QCOMPARE(spooledSpy.size(), 1);
+    QCOMPARE(spooledSpy[0][1].toLongLong(), 20LL);
+
+    Fetch::dataType fetchData;
+    fetchData["UID"] = QSharedPointer<AbstractData>(new RespData<uint>(3));
+    fetchData["BODY[1]"] = QSharedPointer<AbstractData>(new RespData<QByteArray>("0123456789abcdefghij"));
+    fetchData["BINARY[2]"] = QSharedPointer<AbstractData>(new RespData<QByteArray>("abc"));
+    QCOMPARE(*resp, static_cast<const AbstractResponse &>(Fetch(1, fetchData)));
+
+    // A literal which arrives in pieces, and which is not a part of any BODY[] item
+    sock->fakeReading("* 2 FETCH (BINARY[1] ~{12}\r\nfirst ");
+    spoolingParser.handleReadyRead();
+    QVERIFY(!spoolingParser.hasResponse());
+    sock->fakeReading("second ENVELOPE (NIL {11}\r\nsome-random NIL NIL NIL NIL NIL NIL NIL NIL))\r\n");
+    spoolingParser.handleReadyRead();
+    QVERIFY(spoolingParser.hasResponse());
+    fetch = spoolingParser.getResponse().dynamicCast<Fetch>();
+    QVERIFY(fetch);
+    QCOMPARE(Fetch::payload(*fetch->data["BINARY[1]"]), QByteArray("first second"));
+    QCOMPARE(static_cast<const RespData<Imap::Message::Envelope>&>(*fetch->data["ENVELOPE"]).data.subject,
+             QStringLiteral("some-random"));
+}
+
+void ImapParserParseTest::testParsingInThread()
+{
+    using namespace Imap::Responses;
+
+    Streams::FakeSocket *sock = new Streams::FakeSocket(Imap::CONN_STATE_CONNECTED_PRETLS_PRECAPS);
+    Imap::Parser threadedParser(0, sock, 668);
+    threadedParser.setLiteralSpoolThreshold(10);
+    threadedParser.enableParsingInThread();
+
+    sock->fakeReading("* OK hi there\r\n"
+                      "* 1 FETCH (UID 3 BODY[1] {20}\r\n0123456789abcdefghij)\r\n"
+                      "* 2 FOOBAR\r\n"
+                      "y0 OK done\r\n");
+    threadedParser.handleReadyRead();
+    // The lines were passed to the worker, so nothing can be available before the event loop gets a chance to run
+    QVERIFY(!threadedParser.hasResponse());
+    // Whatever is queued by the parser itself has to wait for the lines which are still being parsed
+    threadedParser.handleDisconnected(QStringLiteral("gone"));
+    QVERIFY(!threadedParser.hasResponse());
+
+    QList<QSharedPointer<AbstractResponse> > responses;
+    for (int i = 0; i < 500 && responses.size() < 5; ++i) {
+        QTest::qWait(10);
+        while (threadedParser.hasResponse())
+            responses << threadedParser.getResponse();
+    }
+    QCOMPARE(responses.size(), 5);
+
+    QSharedPointer<State> state = responses[0].dynamicCast<State>();
+    QVERIFY(state);
+    QCOMPARE(state->kind, OK);
+    QVERIFY(state->tag.isEmpty());
+    QSharedPointer<Fetch> fetch = responses[1].dynamicCast<Fetch>();
+    QVERIFY(fetch);
+    QCOMPARE(Fetch::payload(*fetch->data["BODY[1]"]), QByteArray("0123456789abcdefghij"));
+    QVERIFY(responses[2].dynamicCast<ParseErrorResponse>());
+    state = responses[3].dynamicCast<State>();
+    QVERIFY(state);
+    QCOMPARE(state->tag, QByteArray("y0"));
+    QVERIFY(responses[4].dynamicCast<SocketDisconnectedResponse>());
+}
+
 void ImapParserParseTest::benchmark()
 {
     QByteArray line1 = "* 1 FETCH (BODYSTRUCTURE ((\"text\" \"plain\" "
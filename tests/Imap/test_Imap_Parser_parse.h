@@ -42,9 +42,13 @@ private Q_SLOTS:
     /** @short Test parsing of untagged responses */
     void testParseUntagged();
     void testParseUntagged_data();
+    void testLegacyBodyStructureSerialization();
     /** @short Test that we can parse that garbage without resorting to a fatal error */
     void testParseFetchGarbageWithoutExceptions();
     void testParseFetchGarbageWithoutExceptions_data();
+    /** @short Test that huge BODY[] literals are streamed into a LiteralSink */
+    void testSpooledLiterals();
+    void testParsingInThread();
 
     /** @short Test sequence output */
     void testSequences();
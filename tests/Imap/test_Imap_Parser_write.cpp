@@ -22,6 +22,7 @@
 
 #include "test_Imap_Parser_write.h"
 #include "Utils/FakeCapabilitiesInjector.h"
+#include "Imap/Parser/Parser.h"
 #include "Streams/FakeSocket.h"
 
 #define APPEND_PREFIX "APPEND a \"\\d{2}-[a-zA-Z]{3}-\\d{4} \\d{2}:\\d{2}:\\d{2} [+-]?\\d{4}\" "
@@ -81,4 +82,36 @@ void ImapParserWriteTest::testLiteralMinus()
     cEmpty();
 }
 
+/** @short Commands which are queued at once are sent through a single write */
+void ImapParserWriteTest::testCorkedCommands()
+{
+    Imap::Parser *parser = singleParserState().parser;
+    QVERIFY(parser);
+    const int writesBefore = SOCK->writeCount();
+
+    parser->noop();
+    parser->namespaceCommand();
+    parser->noop();
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK->writeCount(), writesBefore + 1);
+    QByteArray expected = t.mk("NOOP\r\n");
+    expected += t.mk("NAMESPACE\r\n");
+    expected += t.mk("NOOP\r\n");
+    cClient(expected);
+
+    // A synchronizing literal has to wait for the continuation, but the rest is still sent in one go
+    model->appendIntoMailbox(QStringLiteral("a"), plaintext10, QStringList(), QDateTime::currentDateTime());
+    cClientRegExp(t.mk(APPEND_PREFIX) + "\\{" + QByteArray::number(plaintext10.size()) + "\\}");
+    const QByteArray appendTag = t.last();
+    parser->noop();
+    QCoreApplication::processEvents();
+    cEmpty();
+    const int writesBeforeContinuation = SOCK->writeCount();
+    cServer("+ OK send your literal\r\n");
+    QCOMPARE(SOCK->writeCount(), writesBeforeContinuation + 1);
+    cClient(plaintext10 + "\r\n" + t.mk("NOOP\r\n"));
+    cServer(appendTag + " OK stored\r\n");
+    cEmpty();
+}
+
 QTEST_GUILESS_MAIN(ImapParserWriteTest)
@@ -34,6 +34,7 @@ private slots:
     void testNoLiteralPlus();
     void testLiteralPlus();
     void testLiteralMinus();
+    void testCorkedCommands();
 };
 
 #endif
@@ -25,6 +25,7 @@
 #include "test_Imap_SelectedMailboxUpdates.h"
 #include "Imap/Model/DummyNetworkWatcher.h"
 #include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MailboxTree.h"
 #include "Imap/Model/MemoryCache.h"
 #include "Imap/Parser/Uids.h"
 #include "Streams/FakeSocket.h"
@@ -713,6 +714,74 @@ void ImapModelSelectedMailboxUpdatesTest::testVanishedWithNonExisting()
     cEmpty();
 }
 
+/** @short A series of EXPUNGEs is applied at once, with one rowsRemoved() per contiguous range */
+void ImapModelSelectedMailboxUpdatesTest::testExpungeBurst()
+{
+    initialMessages(10);
+    QSignalSpy rowsRemoved(model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    QSignalSpy numbersWatcher(model, SIGNAL(messageCountPossiblyChanged(QModelIndex)));
+
+    cServer("* 2 EXPUNGE\r\n* 2 EXPUNGE\r\n* 5 EXPUNGE\r\n* 7 EXPUNGE\r\n* 6 EXPUNGE\r\n");
+    uidMapA = Imap::Uids() << 1 << 4 << 5 << 6 << 8;
+    existsA = uidMapA.size();
+    helperCheckUidMapFromModel();
+    helperCheckCache();
+
+    // UIDs 2, 3, 7, 9 and 10 were at rows 1, 2, 6, 8 and 9
+    QCOMPARE(rowsRemoved.size(), 3);
+    QCOMPARE(rowsRemoved[0][1].toInt(), 8);
+    QCOMPARE(rowsRemoved[0][2].toInt(), 9);
+    QCOMPARE(rowsRemoved[1][1].toInt(), 6);
+    QCOMPARE(rowsRemoved[1][2].toInt(), 6);
+    QCOMPARE(rowsRemoved[2][1].toInt(), 1);
+    QCOMPARE(rowsRemoved[2][2].toInt(), 2);
+    QCOMPARE(numbersWatcher.size(), 1);
+
+    // The surviving messages have to know their new position
+    for (int i = 0; i < uidMapA.size(); ++i) {
+        QModelIndex message = msgListA.child(i, 0);
+        QCOMPARE(static_cast<Imap::Mailbox::TreeItem *>(message.internalPointer())->row(), i);
+    }
+
+    // An EXPUNGE which is out of bounds is still an error
+    {
+        ExpectSingleErrorHere blocker(this);
+        cServer("* 1 EXPUNGE\r\n* 5 EXPUNGE\r\n");
+    }
+}
+
+/** @short A series of FETCHes reports each changed message once, and the message counts just once as well */
+void ImapModelSelectedMailboxUpdatesTest::testFlagsBurst()
+{
+    initialMessages(10);
+    QSignalSpy dataChanged(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+    QSignalSpy numbersWatcher(model, SIGNAL(messageCountPossiblyChanged(QModelIndex)));
+
+    QByteArray burst;
+    for (int i = 1; i <= 10; ++i) {
+        burst += "* " + QByteArray::number(i) + " FETCH (FLAGS (\\Seen))\r\n";
+    }
+    burst += "* 3 FETCH (FLAGS (\\Seen \\Flagged))\r\n";
+    cServer(burst);
+
+    QCOMPARE(numbersWatcher.size(), 1);
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleUnreadMessageCount).toInt(), 0);
+    QVector<int> seenRows;
+    for (int i = 0; i < dataChanged.size(); ++i) {
+        QModelIndex topLeft = dataChanged[i][0].toModelIndex();
+        QCOMPARE(dataChanged[i][1].toModelIndex(), topLeft);
+        if (topLeft.parent() == msgListA)
+            seenRows << topLeft.row();
+    }
+    QCOMPARE(seenRows.size(), 10);
+    for (int i = 0; i < 10; ++i) {
+        QCOMPARE(seenRows[i], i);
+        QVERIFY(msgListA.child(i, 0).data(Imap::Mailbox::RoleMessageIsMarkedRead).toBool());
+    }
+    QVERIFY(msgListA.child(2, 0).data(Imap::Mailbox::RoleMessageIsMarkedFlagged).toBool());
+    cEmpty();
+}
+
 /** @short Test what happens when the server informs about new message arrivals twice in a row */
 void ImapModelSelectedMailboxUpdatesTest::testMultipleArrivals()
 {
@@ -1085,6 +1154,44 @@ void ImapModelSelectedMailboxUpdatesTest::testFetchMsgMetadataPerPartes()
     justKeepTask();
 }
 
+/** @short Envelopes of the visible messages are fetched first, but nothing which was asked for is forgotten */
+void ImapModelSelectedMailboxUpdatesTest::testEnvelopeViewportPriority()
+{
+    model->setProperty("trojita-imap-limit-fetch-messages-per-group", 3);
+    model->setProperty("trojita-imap-limit-parallel-fetch-tasks", 2);
+    model->setProperty("trojita-imap-preload-msg-metadata", 5);
+    initialMessages(200);
+    cEmpty();
+
+    // The view might be sorted, so the visible messages are not necessarily next to each other
+    QModelIndexList visible;
+    for (int row = 150; row < 155; ++row) {
+        visible << msgListA.child(row, 0);
+    }
+    model->setVisibleMessages(visible);
+
+    // The message at the top of the list has been asked for first, but it is not visible
+    QCOMPARE(model->rowCount(msgListA.child(0, 0)), 0);
+    QCOMPARE(model->rowCount(msgListA.child(152, 0)), 0);
+
+    QByteArray c1 = t.mk("UID FETCH 151:153 (" FETCH_METADATA_ITEMS ")\r\n");
+    QByteArray r1 = t.last("OK fetched\r\n");
+    QByteArray c2 = t.mk("UID FETCH 1,154:155 (" FETCH_METADATA_ITEMS ")\r\n");
+    QByteArray r2 = t.last("OK fetched\r\n");
+    cClient(c1 + c2);
+    cServer(r1);
+    cClient(t.mk("UID FETCH 2:4 (" FETCH_METADATA_ITEMS ")\r\n"));
+    QByteArray r3 = t.last("OK fetched\r\n");
+    cServer(r2);
+    cClient(t.mk("UID FETCH 5,148:149 (" FETCH_METADATA_ITEMS ")\r\n"));
+    QByteArray r4 = t.last("OK fetched\r\n");
+    cServer(r3);
+    cClient(t.mk("UID FETCH 150,156:157 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer(t.last("OK fetched\r\n") + r4);
+    cEmpty();
+    justKeepTask();
+}
+
 class MonitoringCache : public Imap::Mailbox::MemoryCache {
 public:
     virtual void setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata) override
@@ -39,6 +39,8 @@ private slots:
     void testGenericTrafficWithEnvelopes();
     void testVanishedUpdates();
     void testVanishedWithNonExisting();
+    void testExpungeBurst();
+    void testFlagsBurst();
     void testMultipleArrivals();
     void testMultipleArrivalsBlockingFurtherActivity();
     void testInnocentUidValidityChange();
@@ -52,6 +54,7 @@ private slots:
     void testLogoutClosed();
     void testFetchMsgMetadataPerPartes();
     void testFetchMsgDuplicateBodystructure();
+    void testEnvelopeViewportPriority();
 
     void helperDataChangedUidNonZero(const QModelIndex &a, const QModelIndex &b);
 private:
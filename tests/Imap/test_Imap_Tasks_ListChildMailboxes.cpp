@@ -30,6 +30,7 @@
 #include "Imap/Model/MemoryCache.h"
 #include "Imap/Model/Model.h"
 #include "Imap/Tasks/Fake_ListChildMailboxesTask.h"
+#include "Utils/FakeCapabilitiesInjector.h"
 
 void ImapModelListChildMailboxesTest::init()
 {
@@ -230,6 +231,130 @@ void ImapModelListChildMailboxesTest::testNoStatusForCachedItems()
     cEmpty();
 }
 
+/** @short The periodic refresh of the numbers is done in a single batch */
+void ImapModelListChildMailboxesTest::testRefreshMessageCounts()
+{
+    using namespace Imap::Mailbox;
+
+    QCOMPARE(model->rowCount(QModelIndex()), 1);
+    cClient(t.mk("LIST \"\" \"%\"\r\n"));
+    cServer("* LIST (\\HasNoChildren) \".\" a\r\n"
+            "* LIST (\\HasNoChildren) \".\" b\r\n"
+            "* LIST (\\HasNoChildren) \".\" c\r\n"
+            + t.last("OK listed\r\n"));
+    QCOMPARE(model->rowCount(QModelIndex()), 4);
+    idxA = model->index(1, 0, QModelIndex());
+    idxB = model->index(2, 0, QModelIndex());
+    QModelIndex idxC = model->index(3, 0, QModelIndex());
+
+    // Nothing to refresh yet, no numbers were requested
+    model->refreshAllMessageCounts();
+    QCoreApplication::processEvents();
+    cEmpty();
+
+    // The numbers of "c" are never requested, so they shall not be refreshed either
+    QCOMPARE(idxA.data(RoleTotalMessageCount), QVariant());
+    QCOMPARE(idxB.data(RoleTotalMessageCount), QVariant());
+    QByteArray c1 = t.mk("STATUS a (MESSAGES UNSEEN RECENT)\r\n");
+    QByteArray r1 = t.last("OK status\r\n");
+    QByteArray c2 = t.mk("STATUS b (MESSAGES UNSEEN RECENT)\r\n");
+    QByteArray r2 = t.last("OK status\r\n");
+    cClient(c1 + c2);
+    cServer("* STATUS a (MESSAGES 1 RECENT 0 UNSEEN 1)\r\n" + r1 +
+            "* STATUS b (MESSAGES 2 RECENT 0 UNSEEN 2)\r\n" + r2);
+    QCOMPARE(idxA.data(RoleTotalMessageCount).toInt(), 1);
+    QCOMPARE(idxB.data(RoleTotalMessageCount).toInt(), 2);
+    cEmpty();
+
+    // Without LIST-STATUS, the STATUS commands are pipelined and the results are applied once all of them are in
+    model->refreshAllMessageCounts();
+    c1 = t.mk("STATUS a (MESSAGES UNSEEN RECENT)\r\n");
+    r1 = t.last("OK status\r\n");
+    c2 = t.mk("STATUS b (MESSAGES UNSEEN RECENT)\r\n");
+    r2 = t.last("OK status\r\n");
+    cClient(c1 + c2);
+    cServer("* STATUS a (MESSAGES 10 RECENT 0 UNSEEN 3)\r\n" + r1);
+    QCOMPARE(idxA.data(RoleTotalMessageCount).toInt(), 1);
+    QCOMPARE(idxA.data(RoleMailboxNumbersFetched).toBool(), true);
+    cServer("* STATUS b (MESSAGES 20 RECENT 0 UNSEEN 4)\r\n" + r2);
+    QCOMPARE(idxA.data(RoleTotalMessageCount).toInt(), 10);
+    QCOMPARE(idxA.data(RoleUnreadMessageCount).toInt(), 3);
+    QCOMPARE(idxB.data(RoleTotalMessageCount).toInt(), 20);
+    QCOMPARE(idxB.data(RoleUnreadMessageCount).toInt(), 4);
+    QCOMPARE(idxC.data(RoleMailboxNumbersFetched).toBool(), false);
+    cEmpty();
+
+    // With LIST-STATUS, a single command is enough and the mailbox tree is not affected by it
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QStringLiteral("LIST-STATUS"));
+    model->refreshAllMessageCounts();
+    cClient(t.mk("LIST \"\" \"*\" RETURN (STATUS (MESSAGES UNSEEN RECENT))\r\n"));
+    cServer("* LIST (\\HasNoChildren) \".\" a\r\n"
+            "* STATUS a (MESSAGES 11 RECENT 0 UNSEEN 0)\r\n"
+            "* LIST (\\HasNoChildren) \".\" b\r\n"
+            "* STATUS b (MESSAGES 21 RECENT 1 UNSEEN 1)\r\n"
+            "* LIST (\\HasNoChildren) \".\" c\r\n"
+            "* STATUS c (MESSAGES 31 RECENT 0 UNSEEN 0)\r\n"
+            + t.last("OK listed\r\n"));
+    QCOMPARE(model->rowCount(QModelIndex()), 4);
+    QCOMPARE(idxA.data(RoleTotalMessageCount).toInt(), 11);
+    QCOMPARE(idxB.data(RoleTotalMessageCount).toInt(), 21);
+    QCOMPARE(idxB.data(RoleRecentMessageCount).toInt(), 1);
+    // The numbers are applied even to those mailboxes which weren't explicitly asked for
+    QCOMPARE(idxC.data(RoleMailboxNumbersFetched).toBool(), true);
+    QCOMPARE(idxC.data(RoleTotalMessageCount).toInt(), 31);
+    cEmpty();
+
+    // The nested mailboxes reported by the LIST-STATUS must not leak into a listing of the top level
+    model->refreshAllMessageCounts();
+    model->reloadMailboxList();
+    QByteArray c3 = t.mk("LIST \"\" \"*\" RETURN (STATUS (MESSAGES UNSEEN RECENT))\r\n");
+    QByteArray r3 = t.last("OK listed\r\n");
+    QByteArray c4 = t.mk("LIST \"\" \"%\" RETURN (STATUS (MESSAGES UNSEEN RECENT))\r\n");
+    QByteArray r4 = t.last("OK listed\r\n");
+    cClient(c3 + c4);
+    cServer("* LIST (\\HasNoChildren) \".\" a\r\n"
+            "* STATUS a (MESSAGES 12 RECENT 0 UNSEEN 0)\r\n"
+            "* LIST (\\HasNoChildren) \".\" a.x\r\n"
+            "* STATUS a.x (MESSAGES 1 RECENT 0 UNSEEN 0)\r\n"
+            "* LIST (\\HasNoChildren) \".\" b\r\n"
+            "* STATUS b (MESSAGES 22 RECENT 0 UNSEEN 0)\r\n"
+            + r3 +
+            "* LIST (\\HasNoChildren) \".\" a\r\n"
+            "* STATUS a (MESSAGES 12 RECENT 0 UNSEEN 0)\r\n"
+            "* LIST (\\HasNoChildren) \".\" b\r\n"
+            "* STATUS b (MESSAGES 22 RECENT 0 UNSEEN 0)\r\n"
+            + r4);
+    QCOMPARE(model->rowCount(QModelIndex()), 3);
+    QCOMPARE(model->index(1, 0, QModelIndex()).data(RoleMailboxName).toString(), QStringLiteral("a"));
+    QCOMPARE(model->index(2, 0, QModelIndex()).data(RoleMailboxName).toString(), QStringLiteral("b"));
+    QVERIFY(singleParserState().listResponses.isEmpty());
+    cEmpty();
+
+    // The LIST-STATUS is not sent while a listing is running on the same connection
+    model->reloadMailboxList();
+    model->refreshAllMessageCounts();
+    QByteArray c5 = t.mk("LIST \"\" \"%\" RETURN (STATUS (MESSAGES UNSEEN RECENT))\r\n");
+    QByteArray r5 = t.last("OK listed\r\n");
+    c1 = t.mk("STATUS a (MESSAGES UNSEEN RECENT)\r\n");
+    r1 = t.last("OK status\r\n");
+    c2 = t.mk("STATUS b (MESSAGES UNSEEN RECENT)\r\n");
+    r2 = t.last("OK status\r\n");
+    cClient(c5 + c1 + c2);
+    cServer("* LIST (\\HasNoChildren) \".\" a\r\n"
+            "* STATUS a (MESSAGES 13 RECENT 0 UNSEEN 0)\r\n"
+            "* LIST (\\HasNoChildren) \".\" b\r\n"
+            "* STATUS b (MESSAGES 23 RECENT 0 UNSEEN 0)\r\n"
+            + r5 +
+            "* STATUS a (MESSAGES 14 RECENT 0 UNSEEN 0)\r\n" + r1 +
+            "* STATUS b (MESSAGES 24 RECENT 0 UNSEEN 0)\r\n" + r2);
+    QCOMPARE(model->rowCount(QModelIndex()), 3);
+    QCOMPARE(model->index(1, 0, QModelIndex()).data(RoleTotalMessageCount).toInt(), 14);
+    QCOMPARE(model->index(2, 0, QModelIndex()).data(RoleTotalMessageCount).toInt(), 24);
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
 /** @short Concurrent listing at several levels of the nesting
 
 https://bugs.kde.org/show_bug.cgi?id=364314
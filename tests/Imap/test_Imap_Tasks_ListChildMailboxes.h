@@ -45,6 +45,8 @@ private slots:
 
     void testFailingList();
 
+    void testRefreshMessageCounts();
+
     void testAutoExpanding();
 };
 
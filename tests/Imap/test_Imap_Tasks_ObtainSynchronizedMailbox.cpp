@@ -264,6 +264,63 @@ void ImapModelObtainSynchronizedMailboxTest::testResyncNoArrivals()
     helperOneFlagUpdate( idxA.child( 0,0 ).child( 10, 0 ) );
 }
 
+/** @short Messages of a mailbox which has not been used for some time are released and later reloaded from the cache */
+void ImapModelObtainSynchronizedMailboxTest::testUnloadIdleMailbox()
+{
+    existsA = 20;
+    uidValidityA = 1337;
+    for (uint i = 1; i <= existsA; ++i) {
+        uidMapA.append(i * 2);
+    }
+    uidNextA = 666;
+    helperSyncAWithMessagesEmptyState();
+    model->setProperty("trojita-imap-unload-idle-mailboxes-after", 2);
+
+    // The mailbox which is kept in sync is never unloaded
+    model->unloadIdleMailboxes();
+    model->unloadIdleMailboxes();
+    model->unloadIdleMailboxes();
+    QCOMPARE(model->reclaimedMemory(), quint64(0));
+    QVERIFY(msgListA.data(Imap::Mailbox::RoleIsFetched).toBool());
+
+    helperSyncBNoMessages();
+    // Nobody may hold on to the list or its messages, otherwise it would have to stay
+    const QModelIndex list = msgListA;
+    msgListA = QModelIndex();
+    QPersistentModelIndex message = list.child(3, 0);
+    QSignalSpy rowsRemoved(model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    model->unloadIdleMailboxes();
+    model->unloadIdleMailboxes();
+    model->unloadIdleMailboxes();
+    QVERIFY(rowsRemoved.isEmpty());
+    message = QModelIndex();
+
+    // Looking at the messages postpones the unloading
+    QCOMPARE(model->rowCount(list), 20);
+    model->unloadIdleMailboxes();
+    QVERIFY(rowsRemoved.isEmpty());
+    // So does looking up a message by its UID
+    QVERIFY(model->messageIndexByUid(QStringLiteral("a"), 6).isValid());
+    model->unloadIdleMailboxes();
+    QVERIFY(rowsRemoved.isEmpty());
+    model->unloadIdleMailboxes();
+    QCOMPARE(rowsRemoved.size(), 1);
+    msgListA = idxA.child(0, 0);
+    QCOMPARE(rowsRemoved[0][0].toModelIndex(), QModelIndex(msgListA));
+    QCOMPARE(rowsRemoved[0][1].toInt(), 0);
+    QCOMPARE(rowsRemoved[0][2].toInt(), 19);
+    QVERIFY(model->reclaimedMemory() > 0);
+    QVERIFY(!msgListA.data(Imap::Mailbox::RoleIsFetched).toBool());
+    // The message counts are still known
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount).toInt(), 20);
+
+    // Once the mailbox is needed again, its messages are back right away, and the usual sync follows
+    QCOMPARE(model->rowCount(msgListA), 0);
+    QCoreApplication::processEvents();
+    helperSyncAWithMessagesNoArrivals();
+    helperVerifyUidMapA();
+}
+
 /** @short Test new message arrivals happening on each resync */
 void ImapModelObtainSynchronizedMailboxTest::testResyncOneNew()
 {
@@ -733,6 +790,99 @@ void ImapModelObtainSynchronizedMailboxTest::testCacheArrivals()
     justKeepTask();
 }
 
+/** @short The UID SEARCH and FETCH FLAGS for new arrivals are sent together with the SELECT */
+void ImapModelObtainSynchronizedMailboxTest::testPipelinedSelectArrivals()
+{
+    model->setProperty("trojita-imap-pipelined-select", true);
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(3);
+    sync.setUidValidity(666);
+    sync.setUidNext(15);
+    Imap::Uids uidMap;
+    uidMap << 6 << 9 << 10;
+    model->cache()->setMailboxSyncState(QStringLiteral("a"), sync);
+    model->cache()->setUidMapping(QStringLiteral("a"), uidMap);
+    QCOMPARE(model->rowCount(msgListA), 0);
+    QByteArray pipeline = t.mk("SELECT a\r\n");
+    const QByteArray selectTag = t.last();
+    pipeline += t.mk("UID SEARCH UID 15:*\r\n");
+    const QByteArray searchTag = t.last();
+    pipeline += t.mk("FETCH 1:* (FLAGS)\r\n");
+    cClient(pipeline);
+    cServer("* 4 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 16] .\r\n"
+            + selectTag + " OK selected\r\n");
+    cEmpty();
+    cServer("* SEARCH 42\r\n" + searchTag + " OK uids\r\n");
+    cEmpty();
+    cServer("* 1 FETCH (FLAGS (x))\r\n"
+            "* 2 FETCH (FLAGS (y))\r\n"
+            "* 3 FETCH (FLAGS (z))\r\n"
+            "* 4 FETCH (FLAGS (fn))\r\n"
+            + t.last("OK fetch\r\n"));
+    cEmpty();
+    uidMap << 42;
+    sync.setUidNext(43);
+    sync.setExists(4);
+    sync.setUnSeenCount(4);
+    sync.setRecent(0);
+    QCOMPARE(model->cache()->mailboxSyncState("a"), sync);
+    QCOMPARE(model->cache()->uidMapping("a"), uidMap);
+    QCOMPARE(model->cache()->msgFlags("a", 6), QStringList() << "x");
+    QCOMPARE(model->cache()->msgFlags("a", 42), QStringList() << "fn");
+    justKeepTask();
+}
+
+/** @short Speculative commands which don't fit the actual mailbox state are ignored */
+void ImapModelObtainSynchronizedMailboxTest::testPipelinedSelectGeneric()
+{
+    model->setProperty("trojita-imap-pipelined-select", true);
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(3);
+    sync.setUidValidity(666);
+    sync.setUidNext(15);
+    Imap::Uids uidMap;
+    uidMap << 6 << 9 << 10;
+    model->cache()->setMailboxSyncState(QStringLiteral("a"), sync);
+    model->cache()->setUidMapping(QStringLiteral("a"), uidMap);
+    QCOMPARE(model->rowCount(msgListA), 0);
+    QByteArray pipeline = t.mk("SELECT a\r\n");
+    const QByteArray selectTag = t.last();
+    pipeline += t.mk("UID SEARCH UID 15:*\r\n");
+    const QByteArray speculativeSearch = t.last();
+    pipeline += t.mk("FETCH 1:* (FLAGS)\r\n");
+    const QByteArray speculativeFetch = t.last();
+    cClient(pipeline);
+    // One message got deleted and another one arrived, so the only safe way forward is a full UID SEARCH
+    cServer("* 3 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 16] .\r\n"
+            + selectTag + " OK selected\r\n");
+    cClient(t.mk("UID SEARCH ALL\r\n"));
+    cServer("* SEARCH 42\r\n" + speculativeSearch + " OK uids\r\n");
+    // These sequence numbers do not correspond to the messages which we know about yet
+    cServer("* 1 FETCH (FLAGS (bogus))\r\n"
+            "* 2 FETCH (FLAGS (bogus))\r\n"
+            "* 3 FETCH (FLAGS (bogus))\r\n"
+            + speculativeFetch + " OK fetch\r\n");
+    cEmpty();
+    cServer("* SEARCH 6 10 42\r\n" + t.last("OK uids\r\n"));
+    cClient(t.mk("FETCH 1:3 (FLAGS)\r\n"));
+    cServer("* 1 FETCH (FLAGS (x))\r\n"
+            "* 2 FETCH (FLAGS (z))\r\n"
+            "* 3 FETCH (FLAGS (fn))\r\n"
+            + t.last("OK fetch\r\n"));
+    cEmpty();
+    uidMap.clear();
+    uidMap << 6 << 10 << 42;
+    QCOMPARE(model->cache()->uidMapping("a"), uidMap);
+    QCOMPARE(model->cache()->msgFlags("a", 6), QStringList() << "x");
+    QCOMPARE(model->cache()->msgFlags("a", 10), QStringList() << "z");
+    QCOMPARE(model->cache()->msgFlags("a", 42), QStringList() << "fn");
+    justKeepTask();
+}
+
 void ImapModelObtainSynchronizedMailboxTest::testCacheArrivalRaceDuringUid()
 {
     helperCacheArrivalRaceDuringUid(WITHOUT_ESEARCH);
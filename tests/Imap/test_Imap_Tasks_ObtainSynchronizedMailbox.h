@@ -50,6 +50,7 @@ private slots:
     void testSyncTwoInParallel();
     void testSyncNoUidnext();
     void testResyncNoArrivals();
+    void testUnloadIdleMailbox();
     void testResyncOneNew();
     void testResyncUidValidity();
     void testDecreasedUidNext();
@@ -60,6 +61,8 @@ private slots:
     void testCacheNoChange();
     void testCacheUidValidity();
     void testCacheArrivals();
+    void testPipelinedSelectArrivals();
+    void testPipelinedSelectGeneric();
     void testCacheArrivalRaceDuringUid();
     void testCacheArrivalRaceDuringUid_ESearch();
     void testCacheArrivalRaceDuringUid2();
@@ -601,6 +601,118 @@ void ImapModelOpenConnectionTest::testExcessivePasswordPrompts()
     cEmpty();
 }
 
+/** @short Go through the regular STARTTLS and LOGIN sequence, then lose the connection and start reconnecting */
+void ImapModelOpenConnectionTest::loginWithStartTlsAndReconnect()
+{
+    reinit(TlsRequired::Yes);
+    model->setProperty("trojita-imap-pipelined-login", QVariant(true));
+
+    cEmpty();
+    cServer("* OK foo\r\n");
+    cClient(t.mk("CAPABILITY\r\n"));
+    cServer("* CAPABILITY imap4rev1 starttls\r\n"
+            + t.last("ok cap\r\n"));
+    cClient(t.mk("STARTTLS\r\n"));
+    cServer(t.last("OK will establish secure layer immediately\r\n"));
+    cClient("[*** STARTTLS ***]"
+            + t.mk("CAPABILITY\r\n"));
+    cServer("* CAPABILITY IMAP4rev1\r\n"
+            + t.last("OK capability completed\r\n"));
+    cClient(t.mk("LOGIN luzr sikrit\r\n"));
+    cServer(t.last("OK [CAPABILITY IMAP4rev1] logged in\r\n"));
+    cEmpty();
+    QCOMPARE(completedSpy->size(), 1);
+    QCOMPARE(authSpy->size(), 1);
+
+    SOCK->fakeDisconnect(QStringLiteral("Fake network going down"));
+    for (int i = 0; i < 10; ++i) {
+        QCoreApplication::processEvents();
+    }
+    LibMailboxSync::setModelNetworkPolicy(model, Imap::Mailbox::NETWORK_ONLINE);
+    model->rowCount(QModelIndex());
+    QCoreApplication::processEvents();
+    t.reset();
+}
+
+/** @short A reconnect skips the CAPABILITY before STARTTLS and pipelines the LOGIN behind the CAPABILITY */
+void ImapModelOpenConnectionTest::testPipelinedLogin()
+{
+    loginWithStartTlsAndReconnect();
+
+    cServer("* OK foo\r\n");
+    cClient(t.mk("STARTTLS\r\n"));
+    cServer(t.last("OK will establish secure layer immediately\r\n"));
+    QByteArray preAuthCaps = t.mk("CAPABILITY\r\n");
+    QByteArray preAuthCapsTag = t.last();
+    QByteArray login = t.mk("LOGIN luzr sikrit\r\n");
+    QByteArray loginTag = t.last();
+    cClient("[*** STARTTLS ***]" + preAuthCaps + login + t.mk("CAPABILITY\r\n"));
+    cServer("* CAPABILITY IMAP4rev1\r\n" + preAuthCapsTag + " OK capability completed\r\n"
+            + loginTag + " OK logged in\r\n"
+            + "* CAPABILITY IMAP4rev1 ID\r\n" + t.last("OK capability completed\r\n"));
+    cClient(t.mk("ID (\"name\" \"Trojita\")\r\n")
+            + t.mk("LIST \"\" \"%\"\r\n"));
+    cServer("* ID nil\r\n" + t.prev("OK you courious peer\r\n")
+            + t.last("OK listed\r\n"));
+    cEmpty();
+    QCOMPARE(authSpy->size(), 1);
+    QCOMPARE(model->imapAuthError(), QString());
+}
+
+/** @short The pipelined LOGIN gives up when the server suddenly advertises LOGINDISABLED */
+void ImapModelOpenConnectionTest::testPipelinedLoginDisabled()
+{
+    loginWithStartTlsAndReconnect();
+
+    cServer("* OK foo\r\n");
+    cClient(t.mk("STARTTLS\r\n"));
+    cServer(t.last("OK will establish secure layer immediately\r\n"));
+    QByteArray preAuthCaps = t.mk("CAPABILITY\r\n");
+    QByteArray preAuthCapsTag = t.last();
+    QByteArray login = t.mk("LOGIN luzr sikrit\r\n");
+    cClient("[*** STARTTLS ***]" + preAuthCaps + login + t.mk("CAPABILITY\r\n"));
+    cServer("* CAPABILITY IMAP4rev1 LOGINDISABLED\r\n" + preAuthCapsTag + " OK capability completed\r\n");
+    cClient(t.mk("LOGOUT\r\n"));
+    cEmpty();
+    QCOMPARE(model->networkPolicy(), Imap::Mailbox::NETWORK_OFFLINE);
+}
+
+/** @short A spare connection is opened after the login, and losing it does not take the Model offline */
+void ImapModelOpenConnectionTest::testSpareConnection()
+{
+    model->setProperty("trojita-imap-spare-connections", QVariant(1));
+    Streams::FakeSocket *primary = SOCK;
+
+    cEmpty();
+    cServer("* OK [capability imap4rev1] hi there\r\n");
+    cClient(t.mk("LOGIN luzr sikrit\r\n"));
+    cServer(t.last("OK [CAPABILITY IMAP4rev1] logged in\r\n"));
+    cEmpty();
+    QCOMPARE(completedSpy->size(), 1);
+    QCOMPARE(authSpy->size(), 1);
+
+    QCoreApplication::processEvents();
+    QVERIFY(SOCK != primary);
+    t.reset();
+    cServer("* OK [capability imap4rev1] hi there\r\n");
+    cClient(t.mk("LOGIN luzr sikrit\r\n"));
+    cServer(t.last("OK [CAPABILITY IMAP4rev1] logged in\r\n"));
+    cEmpty();
+    // The credentials are reused, and no further spare gets opened
+    QCOMPARE(authSpy->size(), 1);
+    Streams::FakeSocket *spare = SOCK;
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK, spare);
+
+    SOCK->fakeDisconnect(QStringLiteral("Fake network going down"));
+    for (int i = 0; i < 10; ++i) {
+        QCoreApplication::processEvents();
+    }
+    QCOMPARE(model->networkPolicy(), Imap::Mailbox::NETWORK_ONLINE);
+    QVERIFY(netErrorSpy->isEmpty());
+    QVERIFY(failedSpy->isEmpty());
+}
+
 // FIXME: verify how LOGINDISABLED even after STARTLS ends up
 
 void ImapModelOpenConnectionTest::provideAuthDetails()
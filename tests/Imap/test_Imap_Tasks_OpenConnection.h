@@ -70,12 +70,18 @@ private slots:
 
     void testExcessivePasswordPrompts();
 
+    void testPipelinedLogin();
+    void testPipelinedLoginDisabled();
+
+    void testSpareConnection();
+
     void provideAuthDetails();
     void acceptSsl(const QList<QSslCertificate> &certificateChain, const QList<QSslError> &sslErrors);
 
 protected:
     enum class TlsRequired { No, Yes };
     void reinit(const TlsRequired tlsRequired = TlsRequired::No);
+    void loginWithStartTlsAndReconnect();
 
 private:
     QPointer<Imap::Mailbox::OpenConnectionTask> task;
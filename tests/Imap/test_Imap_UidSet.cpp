@@ -0,0 +1,169 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTest>
+#include "test_Imap_UidSet.h"
+#include "Imap/Parser/UidSet.h"
+
+using Imap::UidSet;
+
+/** @short Contiguous UIDs are stored as ranges which take almost no memory */
+void ImapUidSetTest::testRanges()
+{
+    UidSet set;
+    QVERIFY(set.isEmpty());
+    set.insertRange(1, 1000000);
+    set.insert(1000002);
+    set.insert(5);
+    QCOMPARE(set.size(), quint64(1000001));
+    QCOMPARE(set.first(), 1u);
+    QCOMPARE(set.last(), 1000002u);
+    QVERIFY(set.contains(65536));
+    QVERIFY(!set.contains(1000001));
+    QVERIFY(!set.contains(0));
+    QVERIFY(set.memoryUsage() < 4096);
+    QCOMPARE(set.toSequenceSet(), QByteArray("1:1000000,1000002"));
+
+    // Ranges which touch each other are merged, even across the chunk boundaries
+    UidSet touching;
+    touching.insertRange(65530, 65535);
+    touching.insertRange(65536, 65540);
+    touching.insertRange(4294967290u, 4294967295u);
+    QCOMPARE(touching.toSequenceSet(), QByteArray("65530:65540,4294967290:4294967295"));
+
+    Imap::Uids uids;
+    for (uint uid : touching)
+        uids << uid;
+    QCOMPARE(uids, touching.toVector());
+    QCOMPARE(uids.size(), 17);
+    QCOMPARE(uids.last(), 4294967295u);
+}
+
+/** @short Scattered UIDs switch to a bitmap and back */
+void ImapUidSetTest::testBitmap()
+{
+    UidSet set;
+    Imap::Uids expected;
+    for (uint uid = 1; uid < 65536; uid += 2) {
+        set.insert(uid);
+        expected << uid;
+    }
+    QCOMPARE(set.toVector(), expected);
+    // A bitmap of 65536 bits is smaller than 32768 ranges
+    QVERIFY(set.memoryUsage() < 16 * 1024);
+    QVERIFY(set.contains(65535));
+    QVERIFY(!set.contains(65534));
+    QCOMPARE(set.last(), 65535u);
+
+    // Filling the holes leaves a single range which is just as good as a bitmap which is full
+    UidSet holes;
+    holes.insertRange(2, 65534);
+    set.unite(holes);
+    QCOMPARE(set.size(), quint64(65535));
+    QCOMPARE(set.toSequenceSet(), QByteArray("1:65535"));
+
+    set.subtract(holes);
+    QCOMPARE(set.toSequenceSet(), QByteArray("1,65535"));
+    QVERIFY(set.memoryUsage() < 1024);
+}
+
+void ImapUidSetTest::testSetOperations()
+{
+    UidSet a = UidSet::fromVector(Imap::Uids() << 10 << 3 << 4 << 5 << 3 << 200000 << 7);
+    QCOMPARE(a.toVector(), Imap::Uids() << 3 << 4 << 5 << 7 << 10 << 200000);
+
+    UidSet b;
+    b.insertRange(5, 9);
+    b.insert(200000);
+    b.insert(300000);
+
+    UidSet united = a;
+    united.unite(b);
+    QCOMPARE(united.toSequenceSet(), QByteArray("3:10,200000,300000"));
+
+    UidSet difference = a;
+    difference.subtract(b);
+    QCOMPARE(difference.toSequenceSet(), QByteArray("3:4,10"));
+
+    difference.subtract(united);
+    QVERIFY(difference.isEmpty());
+    QVERIFY(difference.begin() == difference.end());
+
+    QVERIFY(a != b);
+    QCOMPARE(UidSet::fromVector(a.toVector()), a);
+}
+
+void ImapUidSetTest::testSequenceSet_data()
+{
+    QTest::addColumn<QByteArray>("input");
+    QTest::addColumn<bool>("valid");
+    QTest::addColumn<QByteArray>("normalized");
+
+    QTest::newRow("single") << QByteArray("1") << true << QByteArray("1");
+    QTest::newRow("ranges") << QByteArray("1:3,5,6,8:9") << true << QByteArray("1:3,5:6,8:9");
+    QTest::newRow("reversed-range") << QByteArray("10:5,1") << true << QByteArray("1,5:10");
+    QTest::newRow("duplicates") << QByteArray("3,1:5,3") << true << QByteArray("1:5");
+    QTest::newRow("empty") << QByteArray() << false << QByteArray();
+    QTest::newRow("star") << QByteArray("1:*") << false << QByteArray();
+    QTest::newRow("double-comma") << QByteArray("1,,2") << false << QByteArray();
+    QTest::newRow("trailing-comma") << QByteArray("1,") << false << QByteArray();
+    QTest::newRow("overflow") << QByteArray("4294967296") << false << QByteArray();
+}
+
+void ImapUidSetTest::testSequenceSet()
+{
+    QFETCH(QByteArray, input);
+    QFETCH(bool, valid);
+    QFETCH(QByteArray, normalized);
+
+    bool ok = !valid;
+    UidSet set = UidSet::fromSequenceSet(input, &ok);
+    QCOMPARE(ok, valid);
+    if (valid) {
+        QCOMPARE(set.toSequenceSet(), normalized);
+    } else {
+        QVERIFY(set.isEmpty());
+    }
+}
+
+void ImapUidSetTest::testCompactByteArray()
+{
+    UidSet set;
+    set.insertRange(1, 100000);
+    set.insert(100005);
+    set.insertRange(4000000000u, 4000000010u);
+    const QByteArray data = set.toCompactByteArray();
+    QVERIFY(data.size() < 20);
+
+    bool ok = false;
+    QCOMPARE(UidSet::fromCompactByteArray(data, &ok), set);
+    QVERIFY(ok);
+
+    QVERIFY(UidSet::fromCompactByteArray(QByteArray(), &ok).isEmpty());
+    QVERIFY(ok);
+
+    // Truncated data
+    UidSet::fromCompactByteArray(data.left(data.size() - 1), &ok);
+    QVERIFY(!ok);
+}
+
+QTEST_GUILESS_MAIN(ImapUidSetTest)
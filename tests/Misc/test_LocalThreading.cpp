@@ -0,0 +1,158 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTest>
+#include "test_LocalThreading.h"
+#include "Imap/Model/LocalThreading.h"
+
+using Imap::Mailbox::LocalThreading;
+using Imap::Responses::ThreadingNode;
+
+namespace {
+
+LocalThreading::Message message(const uint uid, const QByteArray &messageId, const QList<QByteArray> &references = QList<QByteArray>())
+{
+    LocalThreading::Message res;
+    res.uid = uid;
+    res.messageId = messageId;
+    res.references = references;
+    res.date = QDateTime(QDate(2015, 1, 1), QTime(0, 0)).addSecs(uid * 60);
+    return res;
+}
+
+}
+
+/** @short Messages are linked via their References, and sorted by date */
+void LocalThreadingTest::testReferences()
+{
+    LocalThreading threading;
+    QVector<LocalThreading::Message> messages;
+    messages << message(4, "d")
+             << message(3, "c", QList<QByteArray>() << "a" << "b")
+             << message(1, "a")
+             << message(2, "b", QList<QByteArray>() << "a")
+             << message(5, "e", QList<QByteArray>() << "a");
+    threading.addMessages(messages);
+
+    QVector<ThreadingNode> expected;
+    expected << ThreadingNode(1, QVector<ThreadingNode>()
+                              << ThreadingNode(2, QVector<ThreadingNode>() << ThreadingNode(3))
+                              << ThreadingNode(5))
+             << ThreadingNode(4);
+    QCOMPARE(threading.threads(), expected);
+}
+
+/** @short Messages which are not present get pruned, unless they hold a thread together */
+void LocalThreadingTest::testMissingParents()
+{
+    LocalThreading threading;
+    QVector<LocalThreading::Message> messages;
+    messages << message(1, "a", QList<QByteArray>() << "x")
+             << message(2, "b", QList<QByteArray>() << "x")
+             << message(3, "c", QList<QByteArray>() << "y")
+             << message(4, "d", QList<QByteArray>() << "a" << "z");
+    threading.addMessages(messages);
+
+    QVector<ThreadingNode> expected;
+    expected << ThreadingNode(0, QVector<ThreadingNode>()
+                              << ThreadingNode(1, QVector<ThreadingNode>() << ThreadingNode(4))
+                              << ThreadingNode(2))
+             << ThreadingNode(3);
+    QCOMPARE(threading.threads(), expected);
+}
+
+/** @short New arrivals, expunges and late headers */
+void LocalThreadingTest::testIncrementalUpdates()
+{
+    LocalThreading threading;
+    threading.addMessages(QVector<LocalThreading::Message>() << message(1, "a"));
+    QCOMPARE(threading.threads(), QVector<ThreadingNode>() << ThreadingNode(1));
+
+    // A reply whose headers are not known yet
+    threading.addMessages(QVector<LocalThreading::Message>() << message(2, QByteArray()));
+    QCOMPARE(threading.threads(), QVector<ThreadingNode>() << ThreadingNode(1) << ThreadingNode(2));
+
+    // ...and now they are
+    threading.addMessages(QVector<LocalThreading::Message>() << message(2, "b", QList<QByteArray>() << "a"));
+    QCOMPARE(threading.threads(), QVector<ThreadingNode>()
+             << ThreadingNode(1, QVector<ThreadingNode>() << ThreadingNode(2)));
+
+    threading.addMessages(QVector<LocalThreading::Message>() << message(3, "c", QList<QByteArray>() << "a"));
+    QCOMPARE(threading.threads(), QVector<ThreadingNode>()
+             << ThreadingNode(1, QVector<ThreadingNode>() << ThreadingNode(2) << ThreadingNode(3)));
+
+    // The replies remain together when the original message is gone
+    threading.removeMessages(Imap::Uids() << 1);
+    QCOMPARE(threading.threads(), QVector<ThreadingNode>()
+             << ThreadingNode(0, QVector<ThreadingNode>() << ThreadingNode(2) << ThreadingNode(3)));
+
+    threading.removeMessages(Imap::Uids() << 2);
+    QCOMPARE(threading.threads(), QVector<ThreadingNode>() << ThreadingNode(3));
+}
+
+/** @short Broken headers must not break the threading */
+void LocalThreadingTest::testDuplicatesAndLoops()
+{
+    LocalThreading threading;
+    QVector<LocalThreading::Message> messages;
+    messages << message(1, "a", QList<QByteArray>() << "b")
+             << message(2, "b", QList<QByteArray>() << "a")
+             << message(3, "a")
+             << message(4, "d", QList<QByteArray>() << "d");
+    threading.addMessages(messages);
+
+    // The second "a" is treated as if it had no Message-Id at all, and a message cannot be its own parent
+    QVector<ThreadingNode> expected;
+    expected << ThreadingNode(2, QVector<ThreadingNode>() << ThreadingNode(1))
+             << ThreadingNode(3)
+             << ThreadingNode(4);
+    QCOMPARE(threading.threads(), expected);
+}
+
+/** @short The containers of messages which are gone are freed */
+void LocalThreadingTest::testPruning()
+{
+    LocalThreading threading;
+    QVector<LocalThreading::Message> messages;
+    messages << message(1, "a", QList<QByteArray>() << "x")
+             << message(2, "b", QList<QByteArray>() << "x" << "a")
+             << message(3, QByteArray());
+    threading.addMessages(messages);
+    QCOMPARE(threading.containerCount(), 4);
+
+    // Once the headers arrive, the anonymous container is no longer needed
+    threading.addMessages(QVector<LocalThreading::Message>() << message(3, "c", QList<QByteArray>() << "b"));
+    QCOMPARE(threading.containerCount(), 4);
+
+    // The "a" still holds the thread together
+    threading.removeMessages(Imap::Uids() << 1);
+    QCOMPARE(threading.containerCount(), 4);
+    QCOMPARE(threading.threads(), QVector<ThreadingNode>()
+             << ThreadingNode(2, QVector<ThreadingNode>() << ThreadingNode(3)));
+
+    // Removing the leaf frees the whole chain of the empty ancestors
+    threading.removeMessages(Imap::Uids() << 3 << 2);
+    QCOMPARE(threading.containerCount(), 0);
+    QCOMPARE(threading.threads(), QVector<ThreadingNode>());
+}
+
+QTEST_GUILESS_MAIN(LocalThreadingTest)
@@ -0,0 +1,139 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QBuffer>
+#include <QTest>
+#include "test_Rfc1951.h"
+#include "Streams/3rdparty/rfc1951.h"
+
+using namespace Streams;
+
+namespace {
+
+/** @short Compress the data through a sequence of small writes which only get flushed once at the end */
+QByteArray compress(const QByteArray &data, const int writeSize)
+{
+    Rfc1951Compressor compressor;
+    QBuffer wire;
+    wire.open(QIODevice::WriteOnly);
+    for (int i = 0; i < data.size(); i += writeSize) {
+        QByteArray piece = data.mid(i, writeSize);
+        compressor.write(&wire, &piece, false);
+    }
+    compressor.flush(&wire);
+    return wire.data();
+}
+
+/** @short Feed the decompressor with a packet of compressed data as if it came from the network */
+void deliver(Rfc1951Decompressor &decompressor, const QByteArray &packet)
+{
+    QBuffer socket;
+    socket.setData(packet);
+    socket.open(QIODevice::ReadOnly);
+    QVERIFY(decompressor.consume(&socket));
+}
+
+QByteArray sampleData(const int lines, const int literalSize)
+{
+    QByteArray data;
+    for (int i = 0; i < lines; ++i) {
+        data += "* " + QByteArray::number(i) + " FETCH (UID " + QByteArray::number(i * 3) + " FLAGS (\\Seen))\r\n";
+    }
+    data += "* 1 FETCH (BODY[] {" + QByteArray::number(literalSize) + "}\r\n";
+    for (int i = 0; i < literalSize; ++i) {
+        // something which does not compress too well, and which contains line breaks in weird places
+        data += static_cast<char>((i * 31 + i / 251) % 251);
+    }
+    data += ")\r\ny0 OK done\r\n";
+    return data;
+}
+
+}
+
+/** @short Read the data back the same way the IMAP parser does, both lines and literals */
+void Rfc1951Test::testRoundTrip()
+{
+    QFETCH(int, writeSize);
+    QFETCH(int, packetSize);
+
+    const QByteArray data = sampleData(3000, 300000);
+    const QByteArray compressed = compress(data, writeSize);
+    QVERIFY(compressed.size() < data.size());
+
+    Rfc1951Decompressor decompressor;
+    QByteArray output;
+    int literal = 0;
+    for (int i = 0; i < compressed.size(); i += packetSize) {
+        deliver(decompressor, compressed.mid(i, packetSize));
+        while (true) {
+            if (literal) {
+                QByteArray buf = decompressor.read(qMin(literal, 64 * 1024));
+                if (buf.isEmpty())
+                    break;
+                literal -= buf.size();
+                output += buf;
+            } else if (decompressor.canReadLine()) {
+                QByteArray line = decompressor.readLine();
+                QVERIFY(line.endsWith('\n'));
+                output += line;
+                if (line.endsWith("}\r\n"))
+                    literal = line.mid(line.lastIndexOf('{') + 1, line.size() - line.lastIndexOf('{') - 4).toInt();
+            } else {
+                break;
+            }
+        }
+    }
+    QCOMPARE(literal, 0);
+    QCOMPARE(decompressor.bytesAvailable(), qint64(0));
+    QCOMPARE(output.size(), data.size());
+    QVERIFY(output == data);
+}
+
+void Rfc1951Test::testRoundTrip_data()
+{
+    QTest::addColumn<int>("writeSize");
+    QTest::addColumn<int>("packetSize");
+
+    QTest::newRow("tiny-packets") << 100 << 7;
+    QTest::newRow("mtu") << 1000 << 1400;
+    QTest::newRow("everything-at-once") << 1024 * 1024 << 1024 * 1024 * 10;
+}
+
+/** @short A huge chunk of compressed data is not inflated before somebody asks for it */
+void Rfc1951Test::testBoundedOutput()
+{
+    const QByteArray data(4 * 1024 * 1024, 'x');
+    const QByteArray compressed = compress(data, data.size());
+
+    Rfc1951Decompressor decompressor(8192, 64 * 1024);
+    deliver(decompressor, compressed);
+    QVERIFY(decompressor.bytesAvailable() >= 64 * 1024);
+    QVERIFY(decompressor.bytesAvailable() < 128 * 1024);
+    QVERIFY(!decompressor.canReadLine());
+
+    // The rest gets inflated on demand
+    QByteArray output = decompressor.read(data.size() + 1);
+    QCOMPARE(output.size(), data.size());
+    QCOMPARE(decompressor.bytesAvailable(), qint64(0));
+}
+
+QTEST_GUILESS_MAIN(Rfc1951Test)
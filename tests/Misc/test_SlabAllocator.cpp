@@ -0,0 +1,108 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <QSet>
+#include <QTest>
+#include "test_SlabAllocator.h"
+#include "Common/SlabAllocator.h"
+
+using namespace Common;
+
+/** @short The chunks do not overlap, are properly aligned and get reused after a release */
+void SlabAllocatorTest::testChunks()
+{
+    const std::size_t size = 56;
+    SlabAllocator allocator(size);
+    QCOMPARE(allocator.slabCount(), 0);
+
+    QVector<char *> chunks;
+    for (int i = 0; i < 1000; ++i) {
+        char *chunk = static_cast<char *>(allocator.allocate(size));
+        QVERIFY(chunk);
+        QCOMPARE(reinterpret_cast<quintptr>(chunk) % 16, quintptr(0));
+        memset(chunk, i % 256, size);
+        chunks << chunk;
+    }
+    for (int i = 0; i < chunks.size(); ++i) {
+        QCOMPARE(static_cast<unsigned char>(chunks[i][0]), static_cast<unsigned char>(i % 256));
+        QCOMPARE(static_cast<unsigned char>(chunks[i][size - 1]), static_cast<unsigned char>(i % 256));
+    }
+    QCOMPARE(allocator.slabCount(), (1000 + allocator.chunksPerSlab() - 1) / allocator.chunksPerSlab());
+
+    // A released chunk is handed out again without asking for another slab
+    const int slabs = allocator.slabCount();
+    char *released = chunks.takeAt(500);
+    allocator.deallocate(released, size);
+    QCOMPARE(allocator.allocate(size), static_cast<void *>(released));
+    QCOMPARE(allocator.slabCount(), slabs);
+    chunks << released;
+
+    Q_FOREACH(char *chunk, chunks) {
+        allocator.deallocate(chunk, size);
+    }
+}
+
+/** @short Slabs are returned once all of their chunks are gone, except for the very last one */
+void SlabAllocatorTest::testReleasingSlabs()
+{
+    const std::size_t size = 64;
+    SlabAllocator allocator(size);
+    const int count = allocator.chunksPerSlab() * 5;
+    QVector<void *> chunks;
+    for (int i = 0; i < count; ++i) {
+        chunks << allocator.allocate(size);
+    }
+    QCOMPARE(allocator.slabCount(), 5);
+
+    // Releasing every other chunk does not free anything
+    for (int i = 0; i < count; i += 2) {
+        allocator.deallocate(chunks[i], size);
+        chunks[i] = 0;
+    }
+    QCOMPARE(allocator.slabCount(), 5);
+
+    // The holes get filled before a new slab is needed
+    for (int i = 0; i < count; i += 2) {
+        chunks[i] = allocator.allocate(size);
+    }
+    QCOMPARE(allocator.slabCount(), 5);
+
+    Q_FOREACH(void *chunk, chunks) {
+        allocator.deallocate(chunk, size);
+    }
+    QCOMPARE(allocator.slabCount(), 1);
+}
+
+/** @short Sizes other than the configured one go to the usual heap */
+void SlabAllocatorTest::testForeignSize()
+{
+    SlabAllocator allocator(32);
+    void *chunk = allocator.allocate(48);
+    QVERIFY(chunk);
+    QCOMPARE(allocator.slabCount(), 0);
+    allocator.deallocate(chunk, 48);
+    allocator.deallocate(0, 32);
+    QCOMPARE(allocator.slabCount(), 0);
+}
+
+QTEST_GUILESS_MAIN(SlabAllocatorTest)
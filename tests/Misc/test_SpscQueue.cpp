@@ -0,0 +1,110 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QSharedPointer>
+#include <QTest>
+#include <QThread>
+#include "test_SpscQueue.h"
+#include "Common/SpscQueue.h"
+
+using namespace Common;
+
+namespace {
+
+/** @short Push a sequence of numbers into the queue from another thread */
+class Producer : public QThread
+{
+public:
+    Producer(SpscQueue<int> *queue, const int count): m_queue(queue), m_count(count)
+    {
+    }
+
+protected:
+    virtual void run()
+    {
+        for (int i = 0; i < m_count; ++i)
+            m_queue->push(i);
+    }
+
+private:
+    SpscQueue<int> *m_queue;
+    int m_count;
+};
+
+}
+
+void SpscQueueTest::testOrdering()
+{
+    SpscQueue<QSharedPointer<int> > queue;
+    QSharedPointer<int> item;
+    QVERIFY(queue.isEmpty());
+    QVERIFY(!queue.pop(item));
+    QVERIFY(!item);
+
+    QSharedPointer<int> first(new int(1));
+    queue.push(first);
+    queue.push(QSharedPointer<int>(new int(2)));
+    QVERIFY(!queue.isEmpty());
+
+    QVERIFY(queue.pop(item));
+    QCOMPARE(*item, 1);
+    // The queue must not keep a reference to an item which has been popped already
+    QWeakPointer<int> weak = first.toWeakRef();
+    item.clear();
+    first.clear();
+    QVERIFY(!weak.data());
+
+    queue.push(QSharedPointer<int>(new int(3)));
+    QVERIFY(queue.pop(item));
+    QCOMPARE(*item, 2);
+    QVERIFY(queue.pop(item));
+    QCOMPARE(*item, 3);
+    QVERIFY(queue.isEmpty());
+    QVERIFY(!queue.pop(item));
+    QCOMPARE(*item, 3);
+
+    // Whatever is left in the queue gets released upon its destruction
+    queue.push(item);
+}
+
+void SpscQueueTest::testTwoThreads()
+{
+    const int count = 100000;
+    SpscQueue<int> queue;
+    Producer producer(&queue, count);
+    producer.start();
+
+    int expected = 0;
+    while (expected < count) {
+        int item;
+        if (queue.pop(item)) {
+            QCOMPARE(item, expected);
+            ++expected;
+        } else {
+            QThread::yieldCurrentThread();
+        }
+    }
+    QVERIFY(producer.wait());
+    QVERIFY(queue.isEmpty());
+}
+
+QTEST_GUILESS_MAIN(SpscQueueTest)
@@ -20,9 +20,17 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <QDir>
+#include <QFile>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryDir>
 #include <QTest>
 #include "test_SqlCache.h"
+#include "Imap/Model/CombinedCache.h"
+#include "Imap/Model/MemoryCache.h"
 #include "Imap/Model/SQLCache.h"
+#include "Imap/Model/ThreadedCache.h"
 
 Q_DECLARE_METATYPE(QList<Imap::Mailbox::MailboxMetadata>)
 
@@ -88,4 +96,372 @@ void TestSqlCache::testMailboxOperation()
     QVERIFY(errorLog.empty());
 }
 
+void TestSqlCache::testMessageFlags()
+{
+    QStringList seen = QStringList() << QStringLiteral("\\Seen");
+    QStringList seenAnswered = QStringList() << QStringLiteral("\\Seen") << QStringLiteral("\\Answered");
+
+    QVERIFY(cache->msgFlagsForMailbox(QStringLiteral("flags")).isEmpty());
+    CHECK_CACHE_ERRORS;
+
+    cache->setMsgFlags(QStringLiteral("flags"), 1, seen);
+    cache->setMsgFlags(QStringLiteral("flags"), 2, seenAnswered);
+    cache->setMsgFlags(QStringLiteral("flags"), 3, seen);
+    cache->setMsgFlags(QStringLiteral("flags"), 4, QStringList());
+    cache->setMsgFlags(QStringLiteral("other"), 1, seenAnswered);
+    CHECK_CACHE_ERRORS;
+
+    QHash<uint, QStringList> expected;
+    expected[1] = seen;
+    expected[2] = seenAnswered;
+    expected[3] = seen;
+    expected[4] = QStringList();
+    QCOMPARE(cache->msgFlagsForMailbox(QStringLiteral("flags")), expected);
+    CHECK_CACHE_ERRORS;
+    for (auto it = expected.constBegin(); it != expected.constEnd(); ++it) {
+        QCOMPARE(cache->msgFlags(QStringLiteral("flags"), it.key()), it.value());
+    }
+
+    cache->clearMessage(QStringLiteral("flags"), 2);
+    expected.remove(2);
+    QCOMPARE(cache->msgFlagsForMailbox(QStringLiteral("flags")), expected);
+    CHECK_CACHE_ERRORS;
+
+    QVERIFY(errorLog.empty());
+}
+
+/** @short Check that incremental updates of the UID mapping survive the journal compaction */
+void TestSqlCache::testUidMapping()
+{
+    const QString mailbox = QStringLiteral("uids");
+    QVERIFY(cache->uidMapping(mailbox).isEmpty());
+    CHECK_CACHE_ERRORS;
+
+    Imap::Uids expected;
+    for (uint uid = 1; uid <= 1000; ++uid)
+        expected << uid * 2;
+    cache->setUidMapping(mailbox, expected);
+    CHECK_CACHE_ERRORS;
+    QCOMPARE(cache->uidMapping(mailbox), expected);
+
+    uint nextUid = 3000;
+    for (int i = 0; i < 150; ++i) {
+        // drop a message from the middle and add two new arrivals
+        Imap::Uids removed, added;
+        removed << expected[expected.size() / 2];
+        expected.remove(expected.size() / 2);
+        added << nextUid << nextUid + 5;
+        expected << nextUid << nextUid + 5;
+        nextUid += 10;
+        cache->updateUidMapping(mailbox, removed, added);
+        CHECK_CACHE_ERRORS;
+        QCOMPARE(cache->uidMapping(mailbox), expected);
+    }
+
+    // An arrival which gets expunged before the journal is compacted
+    cache->updateUidMapping(mailbox, Imap::Uids(), Imap::Uids() << nextUid);
+    cache->updateUidMapping(mailbox, Imap::Uids() << nextUid, Imap::Uids());
+    CHECK_CACHE_ERRORS;
+    QCOMPARE(cache->uidMapping(mailbox), expected);
+    // ...and which must not come back when the journal gets folded into the mapping
+    for (int i = 0; i < 70; ++i) {
+        cache->updateUidMapping(mailbox, Imap::Uids(), Imap::Uids() << nextUid + 1 + i);
+        expected << nextUid + 1 + i;
+    }
+    CHECK_CACHE_ERRORS;
+    QCOMPARE(cache->uidMapping(mailbox), expected);
+
+    // A full update discards the journal
+    expected.resize(10);
+    cache->setUidMapping(mailbox, expected);
+    QCOMPARE(cache->uidMapping(mailbox), expected);
+
+    // Mappings with UIDs which are not known yet cannot be stored as a compressed set
+    expected = Imap::Uids() << 0 << 0 << 5 << 3;
+    cache->setUidMapping(mailbox, expected);
+    QCOMPARE(cache->uidMapping(mailbox), expected);
+
+    expected.clear();
+    for (uint uid = 1; uid <= 100000; ++uid)
+        expected << uid;
+    cache->setUidMapping(mailbox, expected);
+    QCOMPARE(cache->uidMapping(mailbox), expected);
+
+    cache->clearUidMapping(mailbox);
+    QVERIFY(cache->uidMapping(mailbox).isEmpty());
+    QVERIFY(errorLog.empty());
+
+    // Corrupted data are reported instead of being used for the sync
+    QSqlQuery q(QSqlDatabase::database(QStringLiteral("meh")));
+    QVERIFY(q.prepare(QStringLiteral("INSERT OR REPLACE INTO uid_mapping (mailbox, mapping) VALUES (?, ?)")));
+    q.bindValue(0, mailbox);
+    q.bindValue(1, QByteArray("X12345678"));
+    QVERIFY(q.exec());
+    QVERIFY(cache->uidMapping(mailbox).isEmpty());
+    QCOMPARE(errorLog.size(), size_t(1));
+    q.bindValue(0, mailbox);
+    q.bindValue(1, QByteArray("A123"));
+    QVERIFY(q.exec());
+    QVERIFY(cache->uidMapping(mailbox).isEmpty());
+    QCOMPARE(errorLog.size(), size_t(2));
+    errorLog.clear();
+    cache->clearUidMapping(mailbox);
+}
+
+/** @short Big message parts with the same content are stored just once and removed with the last reference */
+void TestSqlCache::testPartDeduplication()
+{
+    using namespace Imap::Mailbox;
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    std::vector<QString> combinedErrors;
+    CombinedCache combined(QStringLiteral("combined"), dir.path());
+    combined.setErrorHandler([&combinedErrors](const QString &e) { combinedErrors.push_back(e); });
+    QVERIFY(combined.open());
+
+    auto countBlobs = [&dir]() {
+        int count = 0;
+        QDir blobs(dir.path() + QLatin1String("/blobs"));
+        Q_FOREACH(const QString &subdir, blobs.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+            count += QDir(blobs.filePath(subdir)).entryList(QDir::Files).size();
+        }
+        return count;
+    };
+
+    QByteArray attachment(2 * 1024 * 1024, 'x');
+    QByteArray other(2 * 1024 * 1024, 'y');
+    combined.setMsgPart(QStringLiteral("a"), 1, "2", attachment);
+    combined.setMsgPart(QStringLiteral("b"), 10, "3", attachment);
+    combined.setMsgPart(QStringLiteral("b"), 11, "1", other);
+    QCOMPARE(countBlobs(), 2);
+    QCOMPARE(combined.messagePart(QStringLiteral("a"), 1, "2"), attachment);
+    QCOMPARE(combined.messagePart(QStringLiteral("b"), 10, "3"), attachment);
+    QCOMPARE(combined.messagePart(QStringLiteral("b"), 11, "1"), other);
+
+    // Still referenced from the other mailbox
+    combined.clearMessage(QStringLiteral("a"), 1);
+    combined.commit();
+    QVERIFY(combined.messagePart(QStringLiteral("a"), 1, "2").isEmpty());
+    QCOMPARE(countBlobs(), 2);
+    QCOMPARE(combined.messagePart(QStringLiteral("b"), 10, "3"), attachment);
+
+    // The file stays until the transaction which has forgotten it gets committed
+    combined.forgetMessagePart(QStringLiteral("b"), 10, "3");
+    QCOMPARE(countBlobs(), 2);
+    combined.commit();
+    QCOMPARE(countBlobs(), 1);
+
+    // A blob which got forgotten and stored again within the same transaction survives the commit
+    combined.clearAllMessages(QStringLiteral("b"));
+    combined.setMsgPart(QStringLiteral("c"), 1, "1", other);
+    combined.commit();
+    QCOMPARE(countBlobs(), 1);
+    QCOMPARE(combined.messagePart(QStringLiteral("c"), 1, "1"), other);
+
+    combined.clearAllMessages(QStringLiteral("c"));
+    combined.commit();
+    QCOMPARE(countBlobs(), 0);
+    QVERIFY(combinedErrors.empty());
+}
+
+/** @short Blob files which the SQL cache does not know about are removed when the cache is opened */
+void TestSqlCache::testOrphanedBlobs()
+{
+    using namespace Imap::Mailbox;
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    std::vector<QString> combinedErrors;
+    QByteArray attachment(2 * 1024 * 1024, 'x');
+    {
+        CombinedCache combined(QStringLiteral("orphans1"), dir.path());
+        combined.setErrorHandler([&combinedErrors](const QString &e) { combinedErrors.push_back(e); });
+        QVERIFY(combined.open());
+        combined.setMsgPart(QStringLiteral("a"), 1, "2", attachment);
+    }
+
+    // A blob whose row has never been committed, and a leftover of an interrupted write
+    QDir blobs(dir.path() + QLatin1String("/blobs"));
+    QVERIFY(blobs.mkpath(QStringLiteral("ab")));
+    const QString orphan = blobs.filePath(QStringLiteral("ab/abcdef"));
+    const QString partial = blobs.filePath(QStringLiteral("ab/abcdef.XyZ123"));
+    Q_FOREACH(const QString &fileName, QStringList() << orphan << partial) {
+        QFile f(fileName);
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write("meh");
+    }
+
+    CombinedCache combined(QStringLiteral("orphans2"), dir.path());
+    combined.setErrorHandler([&combinedErrors](const QString &e) { combinedErrors.push_back(e); });
+    QVERIFY(combined.open());
+    QVERIFY(!QFile::exists(orphan));
+    QVERIFY(!QFile::exists(partial));
+    QCOMPARE(combined.messagePart(QStringLiteral("a"), 1, "2"), attachment);
+    QVERIFY(combinedErrors.empty());
+}
+
+/** @short Make sure that the message parts are kept within the configured budget */
+void TestSqlCache::testPartCacheBudget()
+{
+    using namespace Imap::Mailbox;
+
+    std::vector<QString> budgetErrors;
+    SQLCache budgeted;
+    budgeted.setErrorHandler([&budgetErrors](const QString &e) { budgetErrors.push_back(e); });
+    QVERIFY(budgeted.open(QStringLiteral("budget"), QStringLiteral(":memory:")));
+
+    // The parts are stored compressed, so their content must not be trivially compressible
+    quint32 seed = 1;
+    auto randomPart = [&seed]() {
+        QByteArray buf(10 * 1024, Qt::Uninitialized);
+        for (int i = 0; i < buf.size(); ++i) {
+            seed = seed * 1103515245 + 12345;
+            buf[i] = static_cast<char>(seed >> 24);
+        }
+        return buf;
+    };
+
+    const qint64 budget = 100 * 1024;
+    budgeted.setPartCacheBudget(budget);
+    QByteArray first = randomPart();
+    budgeted.setMsgPart(QStringLiteral("a"), 1, "1", first);
+    QCOMPARE(budgeted.messagePart(QStringLiteral("a"), 1, "1"), first);
+    QVERIFY(budgeted.messagePart(QStringLiteral("a"), 2, "1").isEmpty());
+
+    for (uint uid = 2; uid <= 50; ++uid) {
+        budgeted.setMsgPart(QStringLiteral("a"), uid, "1", randomPart());
+    }
+
+    // The eviction happens in the background
+    QTRY_VERIFY(budgeted.statistics().partBytes <= budget);
+    AbstractCache::Statistics stats = budgeted.statistics();
+    QCOMPARE(stats.partBudget, budget);
+    QVERIFY(stats.partBytes > 0);
+    QVERIFY(stats.partBytes <= budget);
+    QVERIFY(stats.partEvictions > 0);
+    QCOMPARE(stats.partHits, quint64(1));
+    QCOMPARE(stats.partMisses, quint64(1));
+
+    int stillCached = 0;
+    for (uint uid = 1; uid <= 50; ++uid) {
+        if (!budgeted.messagePart(QStringLiteral("a"), uid, "1").isEmpty())
+            ++stillCached;
+    }
+    QVERIFY(stillCached > 0);
+    QVERIFY(stillCached < 10);
+    QCOMPARE(static_cast<quint64>(stillCached), budgeted.statistics().partHits - 1);
+    QCOMPARE(budgeted.statistics().partEvictions + stillCached, quint64(50));
+
+    // Lifting the limit stops the eviction
+    budgeted.setPartCacheBudget(0);
+    for (uint uid = 51; uid <= 70; ++uid) {
+        budgeted.setMsgPart(QStringLiteral("a"), uid, "1", randomPart());
+    }
+    QCoreApplication::processEvents();
+    QCOMPARE(budgeted.statistics().partEvictions, stats.partEvictions);
+    QVERIFY(budgeted.statistics().partBytes > budget);
+    QVERIFY(budgetErrors.empty());
+}
+
+/** @short The MemoryCache evicts the least recently used parts once it is over budget */
+void TestSqlCache::testMemoryCacheBudget()
+{
+    using namespace Imap::Mailbox;
+
+    MemoryCache cache;
+    cache.setPartCacheBudget(3000);
+    cache.setMsgPart(QStringLiteral("a"), 1, "1", QByteArray(1000, 'a'));
+    cache.setMsgPart(QStringLiteral("a"), 2, "1", QByteArray(1000, 'b'));
+    cache.setMsgPart(QStringLiteral("a"), 3, "1", QByteArray(1000, 'c'));
+    QCOMPARE(cache.statistics().partBytes, qint64(3000));
+
+    // Accessing the oldest part makes the second one the eviction candidate
+    QCOMPARE(cache.messagePart(QStringLiteral("a"), 1, "1"), QByteArray(1000, 'a'));
+    cache.setMsgPart(QStringLiteral("a"), 4, "1", QByteArray(1000, 'd'));
+    QVERIFY(cache.messagePart(QStringLiteral("a"), 2, "1").isEmpty());
+    QCOMPARE(cache.messagePart(QStringLiteral("a"), 1, "1"), QByteArray(1000, 'a'));
+
+    AbstractCache::Statistics stats = cache.statistics();
+    QCOMPARE(stats.partBytes, qint64(3000));
+    QCOMPARE(stats.partEvictions, quint64(1));
+
+    // Replacing a part only accounts for the difference
+    cache.setMsgPart(QStringLiteral("a"), 3, "1", QByteArray(500, 'C'));
+    QCOMPARE(cache.statistics().partBytes, qint64(2500));
+    cache.clearMessage(QStringLiteral("a"), 3);
+    QCOMPARE(cache.statistics().partBytes, qint64(2000));
+    cache.clearAllMessages(QStringLiteral("a"));
+    stats = cache.statistics();
+    QCOMPARE(stats.partBytes, qint64(0));
+    QCOMPARE(stats.partEvictions, quint64(1));
+}
+
+/** @short Check that the ThreadedCache behaves just like the SQLCache which it wraps */
+void TestSqlCache::testThreadedCache()
+{
+    using namespace Imap::Mailbox;
+
+    std::vector<QString> threadedErrors;
+    ThreadedCache threaded{std::unique_ptr<AbstractCache>(new SQLCache())};
+    threaded.setErrorHandler([&threadedErrors](const QString &e) { threadedErrors.push_back(e); });
+    QVERIFY(threaded.initialize([](AbstractCache *backend) {
+        return static_cast<SQLCache *>(backend)->open(QStringLiteral("threaded"), QStringLiteral(":memory:"));
+    }));
+
+    // The writes are asynchronous, but the reads shall always see them
+    QStringList seen = QStringList() << QStringLiteral("\\Seen");
+    Imap::Uids uids;
+    for (uint i = 1; i <= 1000; ++i) {
+        threaded.setMsgFlags(QStringLiteral("threaded"), i, seen);
+        uids << i;
+    }
+    threaded.setUidMapping(QStringLiteral("threaded"), uids);
+    QCOMPARE(threaded.uidMapping(QStringLiteral("threaded")), uids);
+    QCOMPARE(threaded.msgFlagsForMailbox(QStringLiteral("threaded")).size(), 1000);
+    QCOMPARE(threaded.msgFlags(QStringLiteral("threaded"), 666), seen);
+
+    threaded.clearAllMessages(QStringLiteral("threaded"));
+    QVERIFY(threaded.msgFlagsForMailbox(QStringLiteral("threaded")).isEmpty());
+    QVERIFY(threaded.uidMapping(QStringLiteral("threaded")).isEmpty());
+
+    // The asynchronous interface delivers the result through the event loop of the calling thread
+    int callbacks = 0;
+    threaded.setMsgFlags(QStringLiteral("threaded"), 333, seen);
+    threaded.callAsync<QStringList>([](AbstractCache *backend) { return backend->msgFlags(QStringLiteral("threaded"), 333); },
+                                    [&callbacks, &seen](const QStringList &flags) {
+                                        QCOMPARE(flags, seen);
+                                        ++callbacks;
+                                    });
+    QCOMPARE(callbacks, 0);
+    QTRY_COMPARE(callbacks, 1);
+
+    // The message parts are never read in a blocking manner
+    threaded.setMsgPart(QStringLiteral("threaded"), 333, "1.X-RAW", "raw");
+    threaded.loadMessagePart(QStringLiteral("threaded"), 333, "1", "1.X-RAW",
+                             [&callbacks](const QByteArray &data, const QByteArray &rawData) {
+                                 QVERIFY(data.isNull());
+                                 QCOMPARE(rawData, QByteArray("raw"));
+                                 ++callbacks;
+                             });
+    QCOMPARE(callbacks, 1);
+    QTRY_COMPARE(callbacks, 2);
+
+    // ...and neither is the metadata of a message
+    AbstractCache::MessageDataBundle metadata;
+    metadata.uid = 333;
+    metadata.size = 666;
+    threaded.setMessageMetadata(QStringLiteral("threaded"), 333, metadata);
+    threaded.loadMessageMetadata(QStringLiteral("threaded"), 333,
+                                 [&callbacks](const AbstractCache::MessageDataBundle &data) {
+                                     QCOMPARE(data.uid, 333u);
+                                     QCOMPARE(data.size, quint64(666));
+                                     ++callbacks;
+                                 });
+    QCOMPARE(callbacks, 2);
+    QTRY_COMPARE(callbacks, 3);
+
+    QVERIFY(threadedErrors.empty());
+}
+
 QTEST_GUILESS_MAIN(TestSqlCache)
@@ -39,6 +39,13 @@ private Q_SLOTS:
     void initTestCase();
     void cleanupTestCase();
     void testMailboxOperation();
+    void testMessageFlags();
+    void testUidMapping();
+    void testPartDeduplication();
+    void testOrphanedBlobs();
+    void testPartCacheBudget();
+    void testMemoryCacheBudget();
+    void testThreadedCache();
 
 private:
     std::shared_ptr<Imap::Mailbox::SQLCache> cache;
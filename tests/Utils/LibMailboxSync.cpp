@@ -612,6 +612,14 @@ void LibMailboxSync::checkNoTasks()
     QCOMPARE(model->taskModel()->rowCount(parser1), 0);
 }
 
+/** @short Access the Model's bookkeeping of the single parser */
+const Imap::Mailbox::ParserState &LibMailboxSync::singleParserState()
+{
+    Q_ASSERT(model->taskModel()->rowCount() == 1);
+    QModelIndex parser1 = model->taskModel()->index(0, 0);
+    return model->accessParser(static_cast<Imap::Parser*>(parser1.internalPointer()));
+}
+
 /** @short Find an item within a tree identified by a "path"
 
 Based on a textual "path" like "1.2.3" or "6", find an index within the model which corresponds to that location.
@@ -101,6 +101,7 @@ protected:
     void initialMessages(const uint exists);
     void justKeepTask();
     void checkNoTasks();
+    const Imap::Mailbox::ParserState &singleParserState();
 
     Imap::Mailbox::Model* model;
     Imap::Mailbox::MsgListModel *msgListModel;